@@ -1,35 +1,227 @@
 #include "bytearray.h"
 #include "endian.h"
 #include "log.h"
+#include "mutex.h"
 
 #include <memory.h>
+#include <new>
 #include <string>
 #include <stdexcept>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace linko {
 
 static linko::Logger::ptr g_logger = LINKO_LOG_NAME("system");
 
-ByteArray::Node::Node(size_t s) 
-    : ptr(new char[s])
-    , size(s)
-    , next(nullptr) {
+namespace {
+
+/*
+ * ByteArray内存块池
+ * 每个线程按块大小缓存空闲块, 本地缓存超出字节预算时把一部分交给全局池, 本地为空时从全局池批量取
+ * 本地和全局的预算都按所有块大小的总字节数计算, 没有最少保留的块数, 超出的直接释放
+ */
+static const size_t THREAD_CACHE_BYTES = 4 * 1024 * 1024;
+static const size_t GLOBAL_CACHE_BYTES = 64 * 1024 * 1024;
+static const size_t TRANSFER_COUNT = 32;
+
+struct ChunkList {
+    size_t size;
+    std::vector<char*> chunks;
+};
+
+class GlobalChunkPool {
+public:
+    // 进程退出时不析构, 其他静态对象析构时仍可归还内存块
+    static GlobalChunkPool* GetInstance() {
+        static GlobalChunkPool* s_pool = new GlobalChunkPool;
+        return s_pool;
+    }
+
+    // 取最多count个块追加到out, 返回取到的数量
+    size_t take(size_t size, std::vector<char*>& out, size_t count) {
+        Mutex::Lock lock(m_mutex);
+        auto it = m_lists.find(size);
+        if (it == m_lists.end()) {
+            return 0;
+        }
+        std::vector<char*>& list = it->second;
+        size_t n = std::min(count, list.size());
+        out.insert(out.end(), list.end() - n, list.end());
+        list.resize(list.size() - n);
+        m_bytes -= n * size;
+        if (list.empty()) {
+            m_lists.erase(it);
+        }
+        return n;
+    }
+
+    void give(size_t size, char** chunks, size_t count) {
+        size_t i = 0;
+        {
+            Mutex::Lock lock(m_mutex);
+            if (size <= GLOBAL_CACHE_BYTES - m_bytes) {
+                size_t n = std::min(count, (GLOBAL_CACHE_BYTES - m_bytes) / size);
+                if (n > 0) {
+                    std::vector<char*>& list = m_lists[size];
+                    list.insert(list.end(), chunks, chunks + n);
+                    m_bytes += n * size;
+                    i = n;
+                }
+            }
+        }
+        for (; i < count; ++i) {
+            delete[] chunks[i];
+        }
+    }
+private:
+    Mutex m_mutex;
+    // 所有缓存块的总字节数
+    size_t m_bytes = 0;
+    std::unordered_map<size_t, std::vector<char*> > m_lists;
+};
+
+struct ThreadChunkCache {
+    ~ThreadChunkCache();
+
+    std::vector<char*>& get(size_t size) {
+        for (auto& i : lists) {
+            if (i.size == size) {
+                return i.chunks;
+            }
+        }
+        lists.push_back(ChunkList());
+        lists.back().size = size;
+        return lists.back().chunks;
+    }
+
+    // 超出预算时先把刚释放的这种大小交出一半, 仍超出则交出其他大小的全部块
+    void trim(std::vector<char*>& current, size_t size) {
+        if (bytes <= THREAD_CACHE_BYTES) {
+            return;
+        }
+        size_t n = (current.size() + 1) / 2;
+        GlobalChunkPool::GetInstance()->give(size, &current[current.size() - n], n);
+        current.resize(current.size() - n);
+        bytes -= n * size;
+        for (auto& i : lists) {
+            if (bytes <= THREAD_CACHE_BYTES) {
+                break;
+            }
+            if (i.chunks.empty() || &i.chunks == &current) {
+                continue;
+            }
+            GlobalChunkPool::GetInstance()->give(i.size, &i.chunks[0], i.chunks.size());
+            bytes -= i.chunks.size() * i.size;
+            i.chunks.clear();
+        }
+    }
+
+    std::vector<ChunkList> lists;
+    // 本线程缓存块的总字节数
+    size_t bytes = 0;
+};
+
+// 线程局部缓存析构后该线程仍可能释放内存块(如其他thread_local对象析构), 此时直接走全局池
+static thread_local bool t_cache_destroyed = false;
+static thread_local ThreadChunkCache t_chunk_cache;
+
+ThreadChunkCache::~ThreadChunkCache() {
+    t_cache_destroyed = true;
+    for (auto& i : lists) {
+        if (!i.chunks.empty()) {
+            GlobalChunkPool::GetInstance()->give(i.size, &i.chunks[0], i.chunks.size());
+        }
+    }
+}
+
+static char* AllocChunk(size_t size) {
+    if (!t_cache_destroyed) {
+        std::vector<char*>& list = t_chunk_cache.get(size);
+        if (list.empty()) {
+            // 一批不超过本地预算的一半
+            size_t count = std::min(TRANSFER_COUNT, THREAD_CACHE_BYTES / 2 / size);
+            t_chunk_cache.bytes += GlobalChunkPool::GetInstance()->take(size, list, count) * size;
+        }
+        if (!list.empty()) {
+            char* p = list.back();
+            list.pop_back();
+            t_chunk_cache.bytes -= size;
+            return p;
+        }
+    }
+    return new char[size];
+}
+
+static void FreeChunk(char* p, size_t size);
+
+// 堆上的块: 头部存放引用计数, 数据从CHUNK_HEADER_SIZE处开始
+struct HeapChunkOwner : public ChunkOwner {
+    size_t size;
+};
+
+static const size_t CHUNK_HEADER_SIZE = (sizeof(HeapChunkOwner) + 15) & ~(size_t)15;
 
+static void ReleaseHeapChunk(ChunkOwner* owner) {
+    size_t size = static_cast<HeapChunkOwner*>(owner)->size;
+    static_cast<HeapChunkOwner*>(owner)->~HeapChunkOwner();
+    FreeChunk((char*)owner, size);
 }
 
-ByteArray::Node::Node()
-    : ptr(nullptr)
-    , size(0)
-    , next(nullptr) {
-    
+// 分配size字节的块, 计数和数据在同一块池内存中
+static ChunkRef NewChunk(size_t size, char*& data) {
+    size_t block = CHUNK_HEADER_SIZE + size;
+    char* p = AllocChunk(block);
+    HeapChunkOwner* owner = new (p) HeapChunkOwner;
+    owner->ref.store(1, std::memory_order_relaxed);
+    owner->release = &ReleaseHeapChunk;
+    owner->size = block;
+    data = p + CHUNK_HEADER_SIZE;
+    return ChunkRef(owner);
 }
 
-ByteArray::Node::~Node() {
-    if (ptr) {
-        delete[] ptr;
+// mmap的内存, 所有引用释放后才munmap
+struct MapChunkOwner : public ChunkOwner {
+    char* addr;
+    size_t len;
+};
+
+static void ReleaseMapChunk(ChunkOwner* owner) {
+    MapChunkOwner* map = static_cast<MapChunkOwner*>(owner);
+    munmap(map->addr, map->len);
+    delete map;
+}
+
+// appendExternal的外部内存
+struct ExternalChunkOwner : public ChunkOwner {
+    std::function<void()> cb;
+};
+
+static void ReleaseExternalChunk(ChunkOwner* owner) {
+    ExternalChunkOwner* ext = static_cast<ExternalChunkOwner*>(owner);
+    if (ext->cb) {
+        ext->cb();
+    }
+    delete ext;
+}
+
+static void FreeChunk(char* p, size_t size) {
+    if (t_cache_destroyed || size > THREAD_CACHE_BYTES) {
+        GlobalChunkPool::GetInstance()->give(size, &p, 1);
+        return;
     }
+    std::vector<char*>& list = t_chunk_cache.get(size);
+    list.push_back(p);
+    t_chunk_cache.bytes += size;
+    t_chunk_cache.trim(list, size);
+}
+
 }
 
 ByteArray::ByteArray(size_t base_size) 
@@ -37,18 +229,18 @@ ByteArray::ByteArray(size_t base_size)
     , m_position(0)
     , m_capacity(base_size)
     , m_size(0) 
-    , m_endian(LINKO_BIG_ENDIAN)
-    , m_root(new Node(base_size))
-    , m_cur(m_root) {
+    , m_endian(LINKO_BIG_ENDIAN) {
+    char* data = nullptr;
+    ChunkRef owner = NewChunk(m_baseSize, data);
+    m_chunks.push_back({data, m_baseSize, std::move(owner), false});
+}
 
+ByteArray::ByteArray(const std::string& name, MapMode mode, size_t size, size_t base_size)
+    : ByteArray(base_size) {
+    mapFile(name, mode, size);
 }
+
 ByteArray::~ByteArray() {
-    Node* tmp = m_root;
-    while (tmp) {
-        m_cur = tmp;
-        tmp = tmp->next;
-        delete m_cur;
-    }
 }
 
 bool ByteArray::isLittleEndian() const {
@@ -120,7 +312,7 @@ static uint32_t EncodeZigzag32(const int32_t& v) {
 }
 
 static uint64_t EncodeZigzag64(const int64_t& v) {
-    return (v << 1) ^ (v >> 31);
+    return (v << 1) ^ (v >> 63);
 }
 
 static int32_t DecodeZigzag32(const uint32_t& v) {
@@ -189,7 +381,7 @@ void ByteArray::writeStringF64(const std::string& value) {
 }
 
 void ByteArray::writeStringVint(const std::string& value) {
-    writeFint64(value.size());
+    writeUint64(value.size());
     write(value.c_str(), value.size());
 }
 
@@ -280,14 +472,14 @@ uint64_t ByteArray::readUint64() {
 }
 
 float ByteArray::readFloat() {
-    uint32_t v = readUint32();
+    uint32_t v = readFuint32();
     float value;
     memcpy(&value, &v, sizeof(v));
     return value;
 }
 
 double ByteArray::readDouble() {
-    uint64_t v = readUint64();
+    uint64_t v = readFuint64();
     double value;
     memcpy(&value, &v, sizeof(v));
     return value;
@@ -325,17 +517,544 @@ std::string ByteArray::readStringFVint() {
     return buff;
 }
 
+// 以下为批量编解码使用的SWAR内核, 一次处理8字节
+// 把低56位按7位一组展开到8个字节的低7位
+static inline uint64_t Spread7(uint64_t v) {
+    uint64_t x = v & 0x00ffffffffffffffull;
+    x = ((x & 0x00fffffff0000000ull) << 4) | (x & 0x000000000fffffffull);
+    x = ((x & 0x0fffc0000fffc000ull) << 2) | (x & 0x00003fff00003fffull);
+    x = ((x & 0x3f803f803f803f80ull) << 1) | (x & 0x007f007f007f007full);
+    return x;
+}
+
+// Spread7的逆运算, 输入每个字节的最高位须为0
+static inline uint64_t Compact7(uint64_t x) {
+    x = ((x & 0x7f007f007f007f00ull) >> 1) | (x & 0x007f007f007f007full);
+    x = ((x & 0x3fff00003fff0000ull) >> 2) | (x & 0x00003fff00003fffull);
+    x = ((x & 0x0fffffff00000000ull) >> 4) | (x & 0x000000000fffffffull);
+    return x;
+}
+
+static inline size_t VarintLength64(uint64_t v) {
+    return 1 + (63 - __builtin_clzll(v | 1)) / 7;
+}
+
+// 编码一个varint, 返回长度; 会写入max(8, 长度)个字节, 调用方需保证空间
+static inline size_t EncodeVarint64(uint8_t* p, uint64_t v) {
+#if LINKO_BYTE_ORDER == LINKO_LITTLE_ENDIAN
+    size_t len = VarintLength64(v);
+    uint64_t x = Spread7(v);
+    if (len <= 8) {
+        x |= 0x8080808080808080ull & ((1ull << ((len - 1) * 8)) - 1);
+        memcpy(p, &x, 8);
+        return len;
+    }
+    x |= 0x8080808080808080ull;
+    memcpy(p, &x, 8);
+    v >>= 56;
+    if (len == 9) {
+        p[8] = v;
+    } else {
+        p[8] = (v & 0x7f) | 0x80;
+        p[9] = v >> 7;
+    }
+    return len;
+#else
+    size_t i = 0;
+    while (v >= 0x80) {
+        p[i++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[i++] = v;
+    return i;
+#endif
+}
+
+// 解码一个varint, 调用方需保证p之后至少有10个字节可读
+static inline const uint8_t* DecodeVarint64(const uint8_t* p, uint64_t& v) {
+#if LINKO_BYTE_ORDER == LINKO_LITTLE_ENDIAN
+    uint64_t word;
+    memcpy(&word, p, 8);
+    // 每个字节最高位为0的即为结束字节
+    uint64_t stop = ~word & 0x8080808080808080ull;
+    if (stop) {
+        size_t len = (__builtin_ctzll(stop) >> 3) + 1;
+        if (len < 8) {
+            word &= (1ull << (len * 8)) - 1;
+        }
+        v = Compact7(word & 0x7f7f7f7f7f7f7f7full);
+        return p + len;
+    }
+    v = Compact7(word & 0x7f7f7f7f7f7f7f7full) | ((uint64_t)(p[8] & 0x7f) << 56);
+    if (p[8] < 0x80) {
+        return p + 9;
+    }
+    v |= (uint64_t)(p[9] & 0x7f) << 63;
+    return p + 10;
+#else
+    v = 0;
+    for (int i = 0; i < 64; i += 7) {
+        uint8_t b = *p++;
+        v |= ((uint64_t)(b & 0x7f)) << i;
+        if (b < 0x80) {
+            break;
+        }
+    }
+    return p;
+#endif
+}
+
+char* ByteArray::writeSpan(size_t& avail) {
+    if (m_position == m_capacity) {
+        addCapacity(1);
+    }
+    size_t idx, npos;
+    locate(m_position, idx, npos);
+    if (m_shared) {
+        makeWritable(idx, npos);
+    }
+    avail = m_chunks[idx].size - npos;
+    return m_chunks[idx].ptr + npos;
+}
+
+const char* ByteArray::readSpan(size_t& avail) const {
+    if (m_position >= m_size) {
+        avail = 0;
+        return nullptr;
+    }
+    size_t idx, npos;
+    locate(m_position, idx, npos);
+    avail = std::min(m_chunks[idx].size - npos, m_size - m_position);
+    return m_chunks[idx].ptr + npos;
+}
+
+template<class T>
+void ByteArray::writeFixedArray(const T* values, size_t count) {
+    if (m_endian == LINKO_BYTE_ORDER) {
+        write(values, count * sizeof(T));
+        return;
+    }
+    T tmp[256];
+    while (count > 0) {
+        size_t n = std::min<size_t>(count, 256);
+        for (size_t i = 0; i < n; ++i) {
+            tmp[i] = byteswap(values[i]);
+        }
+        write(tmp, n * sizeof(T));
+        values += n;
+        count -= n;
+    }
+}
+
+template<class T>
+void ByteArray::readFixedArray(T* values, size_t count) {
+    read(values, count * sizeof(T));
+    if (m_endian != LINKO_BYTE_ORDER) {
+        for (size_t i = 0; i < count; ++i) {
+            values[i] = byteswap(values[i]);
+        }
+    }
+}
+
+template<class T, class F>
+void ByteArray::writeVarintArray(const T* values, size_t count, F encode) {
+    static const size_t MAX_LEN = 10;
+    static const size_t BATCH = 64;
+    uint8_t tmp[BATCH * MAX_LEN];
+    size_t i = 0;
+    while (i < count) {
+        // 在末尾追加且当前块剩余空间足够时直接编码进块内存,
+        // 内核会多写几个字节, 覆盖写时不能走这条路径
+        if (m_position == m_size) {
+            size_t avail = 0;
+            uint8_t* p = (uint8_t*)writeSpan(avail);
+            if (avail >= MAX_LEN) {
+                uint8_t* start = p;
+                uint8_t* end = p + avail - MAX_LEN;
+                while (i < count && p <= end) {
+                    p += EncodeVarint64(p, encode(values[i++]));
+                }
+                m_position += p - start;
+                m_size = m_position;
+                continue;
+            }
+        }
+        // 跨块时先编码到临时缓冲区再写入
+        size_t n = std::min(count - i, BATCH - 1);
+        uint8_t* p = tmp;
+        for (size_t j = 0; j < n; ++j) {
+            p += EncodeVarint64(p, encode(values[i++]));
+        }
+        write(tmp, p - tmp);
+    }
+}
+
+template<class T, class F>
+void ByteArray::readVarintArray(T* values, size_t count, F decode) {
+    static const size_t MAX_LEN = 10;
+    size_t i = 0;
+    while (i < count) {
+        size_t avail = 0;
+        const uint8_t* p = (const uint8_t*)readSpan(avail);
+        if (avail >= MAX_LEN) {
+            const uint8_t* start = p;
+            const uint8_t* end = p + avail - MAX_LEN;
+            while (i < count && p <= end) {
+                uint64_t v;
+                p = DecodeVarint64(p, v);
+                values[i++] = decode(v);
+            }
+            m_position += p - start;
+        } else {
+            // 块末尾不足MAX_LEN字节, 逐字节读取
+            values[i++] = decode(readUint64());
+        }
+    }
+}
+
+#define XX(type, name) \
+    void ByteArray::write##name##Array(const type* values, size_t count) { \
+        writeFixedArray(values, count); \
+    } \
+    void ByteArray::read##name##Array(type* values, size_t count) { \
+        readFixedArray(values, count); \
+    }
+
+XX(int16_t, Fint16);
+XX(uint16_t, Fuint16);
+XX(int32_t, Fint32);
+XX(uint32_t, Fuint32);
+XX(int64_t, Fint64);
+XX(uint64_t, Fuint64);
+#undef XX
+
+void ByteArray::writeInt32Array(const int32_t* values, size_t count) {
+    writeVarintArray(values, count, [](int32_t v) { return (uint64_t)EncodeZigzag32(v); });
+}
+
+void ByteArray::writeUint32Array(const uint32_t* values, size_t count) {
+    writeVarintArray(values, count, [](uint32_t v) { return (uint64_t)v; });
+}
+
+void ByteArray::writeInt64Array(const int64_t* values, size_t count) {
+    writeVarintArray(values, count, [](int64_t v) { return EncodeZigzag64(v); });
+}
+
+void ByteArray::writeUint64Array(const uint64_t* values, size_t count) {
+    writeVarintArray(values, count, [](uint64_t v) { return v; });
+}
+
+void ByteArray::readInt32Array(int32_t* values, size_t count) {
+    readVarintArray(values, count, [](uint64_t v) { return DecodeZigzag32((uint32_t)v); });
+}
+
+void ByteArray::readUint32Array(uint32_t* values, size_t count) {
+    readVarintArray(values, count, [](uint64_t v) { return (uint32_t)v; });
+}
+
+void ByteArray::readInt64Array(int64_t* values, size_t count) {
+    readVarintArray(values, count, [](uint64_t v) { return DecodeZigzag64(v); });
+}
+
+void ByteArray::readUint64Array(uint64_t* values, size_t count) {
+    readVarintArray(values, count, [](uint64_t v) { return v; });
+}
+
 void ByteArray::clear() {
     m_position = m_size = 0;
     m_capacity = m_baseSize;
-    Node* tmp = m_root->next;
-    while (tmp) {
-        m_cur = tmp;
-        tmp = tmp->next;
-        delete m_cur;
+    m_mapMode = NOT_MAPPED;
+    m_mapBase = nullptr;
+    m_mapLen = 0;
+    if (m_cord) {
+        m_chunks.clear();
+        m_offsets.clear();
+        m_cord = false;
+        char* data = nullptr;
+        ChunkRef owner = NewChunk(m_baseSize, data);
+        m_chunks.push_back({data, m_baseSize, std::move(owner), false});
+    } else {
+        m_chunks.resize(1);
+    }
+}
+
+void ByteArray::locate(size_t pos, size_t& idx, size_t& npos) const {
+    if (!m_cord) {
+        idx = pos / m_baseSize;
+        npos = pos % m_baseSize;
+        return;
+    }
+    // 最后一个起始偏移不大于pos的块
+    idx = std::upper_bound(m_offsets.begin(), m_offsets.end(), pos) - m_offsets.begin();
+    if (idx == 0) {
+        npos = 0;
+        return;
+    }
+    --idx;
+    npos = pos - m_offsets[idx];
+    if (npos == m_chunks[idx].size) {
+        ++idx;
+        npos = 0;
     }
-    m_cur = m_root;
-    m_root->next = NULL;
+}
+
+void ByteArray::makeWritable(size_t& idx, size_t& npos) {
+    if (m_mapMode == READ_WRITE) {
+        // 可写映射始终写回文件, 切片可以看到修改
+        return;
+    }
+    if (!m_chunks[idx].external && m_chunks[idx].owner.unique()) {
+        return;
+    }
+    if (m_chunks[idx].size > m_baseSize) {
+        // 映射或大的外部内存只复制写入位置所在的一段
+        splitChunk(idx, npos);
+    }
+    Chunk& c = m_chunks[idx];
+    // 复制出的块也按m_baseSize分配, 内存池中的块大小保持一致
+    char* data = nullptr;
+    ChunkRef owner = NewChunk(m_baseSize, data);
+    memcpy(data, c.ptr, c.size);
+    c.ptr = data;
+    c.owner = std::move(owner);
+    c.external = false;
+}
+
+void ByteArray::splitChunk(size_t& idx, size_t& npos) {
+    // 大于m_baseSize的块只会出现在cord模式
+    Chunk c = m_chunks[idx];
+    size_t offset = m_offsets[idx];
+    size_t begin = npos / m_baseSize * m_baseSize;
+    size_t end = std::min(begin + m_baseSize, c.size);
+
+    std::vector<Chunk> parts;
+    std::vector<size_t> offsets;
+    if (begin > 0) {
+        parts.push_back({c.ptr, begin, c.owner, c.external});
+        offsets.push_back(offset);
+    }
+    parts.push_back({c.ptr + begin, end - begin, c.owner, c.external});
+    offsets.push_back(offset + begin);
+    if (end < c.size) {
+        parts.push_back({c.ptr + end, c.size - end, c.owner, c.external});
+        offsets.push_back(offset + end);
+    }
+
+    m_chunks.erase(m_chunks.begin() + idx);
+    m_chunks.insert(m_chunks.begin() + idx, parts.begin(), parts.end());
+    m_offsets.erase(m_offsets.begin() + idx);
+    m_offsets.insert(m_offsets.begin() + idx, offsets.begin(), offsets.end());
+    if (begin > 0) {
+        ++idx;
+    }
+    npos -= begin;
+}
+
+void ByteArray::toCord() {
+    if (!m_cord) {
+        m_offsets.resize(m_chunks.size());
+        for (size_t i = 0; i < m_chunks.size(); ++i) {
+            m_offsets[i] = i * m_baseSize;
+        }
+        m_cord = true;
+    }
+    // 切片追加在m_size之后, 之前未使用的容量不再可用
+    size_t idx, npos;
+    locate(m_size, idx, npos);
+    if (npos > 0) {
+        m_chunks[idx].size = npos;
+        ++idx;
+    }
+    m_chunks.resize(idx);
+    m_offsets.resize(idx);
+    m_capacity = m_size;
+}
+
+void ByteArray::appendSlice(const ByteArray& other, size_t len, size_t position) {
+    if (position > other.m_size || len > other.m_size - position) {
+        throw std::out_of_range("slice out of range");
+    }
+    if (m_mapMode == READ_WRITE) {
+        throw std::logic_error("can not append slice to read-write mapping");
+    }
+    if (m_position != m_size) {
+        throw std::logic_error("slice can only be appended at the end");
+    }
+    if (len == 0) {
+        return;
+    }
+
+    // other可能就是自身, 先收集引用再修改m_chunks
+    std::vector<Chunk> slices;
+    size_t idx, npos;
+    other.locate(position, idx, npos);
+    while (len > 0) {
+        const Chunk& c = other.m_chunks[idx];
+        size_t n = std::min(c.size - npos, len);
+        slices.push_back({c.ptr + npos, n, c.owner, c.external});
+        len -= n;
+        ++idx;
+        npos = 0;
+    }
+    other.m_shared = true;
+    m_shared = true;
+
+    toCord();
+    for (auto& i : slices) {
+        m_offsets.push_back(m_capacity);
+        m_chunks.push_back(i);
+        m_capacity += i.size;
+    }
+    m_position = m_size = m_capacity;
+}
+
+void ByteArray::appendSlice(const ByteArray& other, size_t len) {
+    appendSlice(other, len, other.m_position);
+}
+
+void ByteArray::appendExternal(const void* data, size_t len, std::function<void()> release) {
+    if (m_mapMode == READ_WRITE) {
+        throw std::logic_error("can not append slice to read-write mapping");
+    }
+    if (m_position != m_size) {
+        throw std::logic_error("slice can only be appended at the end");
+    }
+    ExternalChunkOwner* ext = new ExternalChunkOwner;
+    ext->ref.store(1, std::memory_order_relaxed);
+    ext->release = &ReleaseExternalChunk;
+    ext->cb = release;
+    ChunkRef owner(ext);
+    if (len == 0) {
+        return;
+    }
+    m_shared = true;
+    toCord();
+    m_offsets.push_back(m_capacity);
+    m_chunks.push_back({(char*)data, len, std::move(owner), true});
+    m_capacity += len;
+    m_position = m_size = m_capacity;
+}
+
+bool ByteArray::mapFile(const std::string& name, MapMode mode, size_t size) {
+    if (mode == NOT_MAPPED) {
+        return false;
+    }
+    int fd = open(name.c_str(), mode == READ_ONLY ? O_RDONLY : (O_RDWR | O_CREAT), 0644);
+    if (fd < 0) {
+        LINKO_LOG_ERROR(g_logger) << "mapFile open name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LINKO_LOG_ERROR(g_logger) << "mapFile fstat name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        close(fd);
+        return false;
+    }
+    size_t len = st.st_size;
+    if (mode == READ_WRITE && size > len) {
+        if (ftruncate(fd, size) != 0) {
+            LINKO_LOG_ERROR(g_logger) << "mapFile ftruncate name=" << name << " size=" << size
+                << " error, errno=" << errno << " errstr=" << strerror(errno);
+            close(fd);
+            return false;
+        }
+        len = size;
+    }
+
+    char* addr = nullptr;
+    if (len > 0) {
+        int prot = mode == READ_ONLY ? PROT_READ : (PROT_READ | PROT_WRITE);
+        void* p = mmap(nullptr, len, prot, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            LINKO_LOG_ERROR(g_logger) << "mapFile mmap name=" << name << " len=" << len
+                << " error, errno=" << errno << " errstr=" << strerror(errno);
+            close(fd);
+            return false;
+        }
+        addr = (char*)p;
+    }
+    // 映射建立后不再需要fd
+    close(fd);
+
+    clear();
+    m_chunks.clear();
+    m_offsets.clear();
+    m_cord = true;
+    m_mapMode = mode;
+    m_mapBase = addr;
+    m_mapLen = len;
+    m_capacity = m_size = len;
+    if (len > 0) {
+        // 切片引用映射时, 所有引用释放后才munmap
+        MapChunkOwner* map = new MapChunkOwner;
+        map->ref.store(1, std::memory_order_relaxed);
+        map->release = &ReleaseMapChunk;
+        map->addr = addr;
+        map->len = len;
+        m_chunks.push_back({addr, len, ChunkRef(map), mode == READ_ONLY});
+        m_offsets.push_back(0);
+        m_shared = m_shared || mode == READ_ONLY;
+    }
+    return true;
+}
+
+bool ByteArray::advise(Advice advice, size_t offset, size_t len) {
+    if (m_mapMode == NOT_MAPPED || offset >= m_mapLen) {
+        return false;
+    }
+    int flag = MADV_NORMAL;
+    switch (advice) {
+        case ADVICE_NORMAL:
+            flag = MADV_NORMAL;
+            break;
+        case ADVICE_SEQUENTIAL:
+            flag = MADV_SEQUENTIAL;
+            break;
+        case ADVICE_RANDOM:
+            flag = MADV_RANDOM;
+            break;
+        case ADVICE_WILLNEED:
+            flag = MADV_WILLNEED;
+            break;
+        case ADVICE_DONTNEED:
+            flag = MADV_DONTNEED;
+            break;
+        case ADVICE_HUGEPAGE:
+#ifdef MADV_HUGEPAGE
+            flag = MADV_HUGEPAGE;
+            break;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+
+    len = std::min(len, m_mapLen - offset);
+    // madvise要求起始地址页对齐
+    static const size_t s_page_size = sysconf(_SC_PAGESIZE);
+    size_t begin = offset / s_page_size * s_page_size;
+    if (madvise(m_mapBase + begin, len + offset - begin, flag) != 0) {
+        LINKO_LOG_ERROR(g_logger) << "madvise advice=" << advice << " offset=" << offset
+            << " len=" << len << " error, errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool ByteArray::sync() {
+    if (m_mapMode != READ_WRITE || m_mapLen == 0) {
+        return false;
+    }
+    if (msync(m_mapBase, m_mapLen, MS_SYNC) != 0) {
+        LINKO_LOG_ERROR(g_logger) << "msync len=" << m_mapLen
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
 }
 
 void ByteArray::write(const void* buf, size_t size) {
@@ -344,31 +1063,22 @@ void ByteArray::write(const void* buf, size_t size) {
     }
     addCapacity(size);
 
-    // 内存块内的位置
-    size_t npos = m_position % m_baseSize;
-    // 当前内存块剩余容量
-    size_t ncap = m_cur->size - npos;
-    // buf中开始读取的位置
-    size_t bpos = 0;
+    size_t idx, npos;
+    locate(m_position, idx, npos);
+    const char* src = (const char*)buf;
 
     while (size > 0) {
-        if (ncap >= size) {
-            memcpy(m_cur->ptr + npos, (char*)buf + bpos, size);
-            if (m_cur->size == (npos + size)) {
-                m_cur = m_cur->next;
-            }
-            m_position += size;
-            bpos += size;
-            size = 0;
-        } else {
-            memcpy(m_cur->ptr + npos, (char*)buf + bpos, ncap);
-            m_position += ncap;
-            bpos += ncap;
-            size -= ncap;
-            m_cur = m_cur->next;
-            ncap = m_cur->size;
-            npos = 0;
+        if (m_shared) {
+            makeWritable(idx, npos);
         }
+        Chunk& c = m_chunks[idx];
+        size_t n = std::min(c.size - npos, size);
+        memcpy(c.ptr + npos, src, n);
+        src += n;
+        size -= n;
+        m_position += n;
+        ++idx;
+        npos = 0;
     }
 
     if (m_position > m_size) {
@@ -381,69 +1091,31 @@ void ByteArray::read(void* buf, size_t size) {
     if (size > getReadSize()) {
         throw std::out_of_range("not enough len");
     }
-
-    // 内存块内的位置
-    size_t npos = m_position % m_baseSize;
-    // 当前内存块剩余容量
-    size_t ncap = m_cur->size - npos;
-    // buf中开始读取的位置
-    size_t bpos = 0;
-
-    while (size > 0) {
-        // 如果当前内存块剩余容量大于需要读取的数据长度
-        if (ncap >= size) {
-            memcpy((char*)buf + bpos, m_cur->ptr + npos, size);
-            if (m_cur->size == (npos + size)) {
-                m_cur = m_cur->next;
-            }
-            m_position += ncap;
-            bpos += size;
-            size = 0;
-        } else {
-            memcpy((char*)buf + bpos, m_cur->ptr + npos, ncap);
-            m_position += ncap;
-            bpos += ncap;
-            size -= ncap;
-            m_cur = m_cur->next;
-            ncap = m_cur->size;
-            npos = 0;
-        }
-    }
+    copyOut(buf, size, m_position);
+    m_position += size;
 }
 
 void ByteArray::read(void* buf, size_t size, size_t position) const {
-    // 如果要读取的数据长度超过当前已有数据大小
-    if (size > getReadSize()) {
+    // 如果要读取的数据长度超过position之后已有数据大小
+    if (position > m_size || size > m_size - position) {
         throw std::out_of_range("not enough len");
     }
+    copyOut(buf, size, position);
+}
 
-    // 内存块内的位置
-    size_t npos = position % m_baseSize;
-    // 当前内存块剩余容量
-    size_t ncap = m_cur->size - npos;
-    // buf中开始读取的位置
-    size_t bpos = 0;
-    Node* cur = m_cur;
+void ByteArray::copyOut(void* buf, size_t size, size_t position) const {
+    size_t idx, npos;
+    locate(position, idx, npos);
+    char* dst = (char*)buf;
 
     while (size > 0) {
-        // 如果当前内存块剩余容量大于需要读取的数据长度
-        if (ncap >= size) {
-            memcpy((char*)buf + bpos, cur->ptr + npos, size);
-            if (cur->size == (npos + size)) {
-                cur = cur->next;
-            }
-            position += ncap;
-            bpos += size;
-            size = 0;
-        } else {
-            memcpy((char*)buf + bpos, cur->ptr + npos, ncap);
-            position += ncap;
-            bpos += ncap;
-            size -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
+        const Chunk& c = m_chunks[idx];
+        size_t n = std::min(c.size - npos, size);
+        memcpy(dst, c.ptr + npos, n);
+        dst += n;
+        size -= n;
+        ++idx;
+        npos = 0;
     }
 }
 
@@ -456,14 +1128,6 @@ void ByteArray::setPosition(size_t v) {
     if (m_position > m_size) {
         m_size = m_position;
     }
-    m_cur = m_root;
-    while (v > m_cur->size) {
-        v -= m_cur->size;
-        m_cur = m_cur->next;
-    }
-    if (v == m_cur->size) {
-        m_cur = m_cur->next;
-    }
 }
 
 bool ByteArray::writeToFile(const std::string& name) const {
@@ -475,21 +1139,10 @@ bool ByteArray::writeToFile(const std::string& name) const {
         return false;
     }
 
-    int64_t read_size = getReadSize();
-    int64_t pos = m_position;
-    Node* cur = m_cur;
-
-    while (read_size > 0) {
-        int diff = pos % m_baseSize;
-        //int64_t len = (read_size > (int64_t)m_baseSize ? m_baseSize : read_size) - diff;
-        int64_t len = ((read_size + diff) > (int64_t)m_baseSize ? (m_baseSize - diff) : read_size);
-
-        ofs.write(cur->ptr + diff, len);
-        if (len + diff == (int64_t)m_baseSize) {
-            cur = cur->next;
-        }
-        pos += len;
-        read_size -= len;
+    std::vector<iovec> iovs;
+    getReadBuffers(iovs);
+    for (auto& i : iovs) {
+        ofs.write((const char*)i.iov_base, i.iov_len);
     }
 
     return true;
@@ -521,27 +1174,21 @@ void ByteArray::addCapacity(size_t size) {
     if (old_cap >= size) {
         return;
     }
+    if (m_mapMode == READ_WRITE) {
+        throw std::out_of_range("write beyond read-write mapping");
+    }
 
     size = size - old_cap;
     size_t count = (size / m_baseSize) + ((size % m_baseSize) > 0 ? 1 : 0);
-    Node* tmp = m_root;
-    while (tmp->next) {
-        tmp = tmp->next;
-    }
-
-    Node* first = nullptr;
     for (size_t i = 0; i < count; ++i) {
-        tmp->next = new Node(m_baseSize);
-        if (first == nullptr) {
-            first = tmp->next;
+        char* data = nullptr;
+        ChunkRef owner = NewChunk(m_baseSize, data);
+        if (m_cord) {
+            m_offsets.push_back(m_capacity);
         }
-        tmp = tmp->next;
+        m_chunks.push_back({data, m_baseSize, std::move(owner), false});
         m_capacity += m_baseSize;
     }
-
-    if (old_cap == 0) {
-        m_cur = first;
-    }
 }
 
 std::string ByteArray::toString() const {
@@ -570,67 +1217,30 @@ std::string ByteArray::toHexString() const {
 }
 
 uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len) const {
-    len = len > getReadSize() ? getReadSize() : len;
-    if (len == 0) {
-        return 0;
-    }
-
-    uint64_t size = len;
-
-    size_t npos = m_position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
-    struct iovec iov;
-    Node* cur = m_cur;
-
-    while (len > 0) {
-        if (ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        } else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-            len -= ncap;
-            ncap = cur->size;
-            npos = 0;
-        }
-        buffers.push_back(iov);
-    }
-    return size;
+    return getReadBuffers(buffers, len, m_position);
 }
 
 uint64_t ByteArray::getReadBuffers(
         std::vector<iovec>& buffers, uint64_t len, uint64_t position) const {
-    len = len > getReadSize() ? getReadSize() : len;
-    if (len == 0) {
+    if (position >= m_size) {
         return 0;
     }
+    len = len > m_size - position ? m_size - position : len;
 
     uint64_t size = len;
-
-    size_t npos = position % m_baseSize;
-    size_t count = position / m_baseSize;
-    Node* cur = m_root;
-    while (count > 0) {
-        cur = cur->next;
-        --count;
-    }
-    size_t ncap = cur->size - npos;
+    size_t idx, npos;
+    locate(position, idx, npos);
     struct iovec iov;
 
     while (len > 0) {
-        if (ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        } else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-            len -= ncap;
-            ncap = cur->size;
-            npos = 0;
-        }
+        const Chunk& c = m_chunks[idx];
+        size_t n = std::min<uint64_t>(c.size - npos, len);
+        iov.iov_base = c.ptr + npos;
+        iov.iov_len = n;
         buffers.push_back(iov);
+        len -= n;
+        ++idx;
+        npos = 0;
     }
     return size;
 }
@@ -642,26 +1252,24 @@ uint64_t ByteArray::getWriteBuffers(std::vector<iovec>& buffers, uint64_t len) {
 
     addCapacity(len);
     uint64_t size = len;
-
-    size_t npos = m_position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
+    size_t idx, npos;
+    locate(m_position, idx, npos);
     struct iovec iov;
-    Node* cur = m_cur;
+
     while (len > 0) {
-        if (ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        } else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-            len -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
+        if (m_shared) {
+            makeWritable(idx, npos);
         }
+        const Chunk& c = m_chunks[idx];
+        size_t n = std::min<uint64_t>(c.size - npos, len);
+        iov.iov_base = c.ptr + npos;
+        iov.iov_len = n;
         buffers.push_back(iov);
+        len -= n;
+        ++idx;
+        npos = 0;
     }
     return size;
 }
+
 }
@@ -1,32 +1,116 @@
 #ifndef __LINKO_BYTEARRAY_H__
 #define __LINKO_BYTEARRAY_H__
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
+#include <functional>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 namespace linko {
 
+/*
+ * ByteArray内存块的侵入式引用计数
+ * 堆上的块把计数放在从内存池取出的内存头部, 映射和外部内存单独分配计数对象
+ */
+struct ChunkOwner {
+    std::atomic<uint32_t> ref;
+    // 计数归零时释放内存块及计数自身
+    void (*release)(ChunkOwner* owner);
+};
+
+class ChunkRef {
+public:
+    ChunkRef() = default;
+    // 接管引用计数为1的owner
+    explicit ChunkRef(ChunkOwner* owner) : m_owner(owner) {}
+    ChunkRef(const ChunkRef& o) : m_owner(o.m_owner) {
+        if (m_owner) {
+            m_owner->ref.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    ChunkRef(ChunkRef&& o) : m_owner(o.m_owner) { o.m_owner = nullptr; }
+    ChunkRef& operator=(ChunkRef o) {
+        std::swap(m_owner, o.m_owner);
+        return *this;
+    }
+    ~ChunkRef() { reset(); }
+
+    void reset() {
+        if (m_owner && m_owner->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_owner->release(m_owner);
+        }
+        m_owner = nullptr;
+    }
+    // 只有自己持有
+    bool unique() const {
+        return m_owner && m_owner->ref.load(std::memory_order_acquire) == 1;
+    }
+private:
+    ChunkOwner* m_owner = nullptr;
+};
+
+/*
+ * 二进制数组
+ * 数据按m_baseSize大小分块存储, 块指针保存在m_chunks中, 位置pos所在块为m_chunks[pos / m_baseSize],
+ * 定位和获取iovec只与涉及的块数有关, 与位置无关
+ * 块内存来自全局内存池, 每个线程有本地缓存, 释放的块优先回到本线程缓存
+ *
+ * cord模式: appendSlice/appendExternal追加的是对其他ByteArray块或外部内存的引用, 不拷贝数据,
+ * 此后块大小不再统一, 定位改为在块起始偏移上二分查找; getReadBuffers直接返回指向共享内存的iovec
+ * 共享的块在任何一方写入前都会先复制一份(写时复制)
+ *
+ * 映射模式: mapFile将文件mmap为一个块, 读写接口与普通模式相同
+ * READ_ONLY下映射作为外部内存, 写入时只把涉及的m_baseSize范围复制到堆上, 不修改文件;
+ * 超出文件大小的写入追加到堆块
+ * READ_WRITE下直接写入映射内存, 大小固定为映射长度, 不能扩容或追加切片
+ */
 class ByteArray {
 public:
     typedef std::shared_ptr<ByteArray> ptr;
 
-    // ByteArray存储节点
-    struct Node {
-        Node(size_t s);
-        Node();
-        ~Node();
+    enum MapMode {
+        NOT_MAPPED = 0,
+        READ_ONLY = 1,
+        READ_WRITE = 2
+    };
 
-        char* ptr;
-        size_t size;
-        Node* next;
+    enum Advice {
+        ADVICE_NORMAL = 0,
+        ADVICE_SEQUENTIAL = 1,
+        ADVICE_RANDOM = 2,
+        ADVICE_WILLNEED = 3,
+        ADVICE_DONTNEED = 4,
+        ADVICE_HUGEPAGE = 5
     };
 
     ByteArray(size_t base_size = 4096);
+    // 映射文件, 失败时为空数组, 可通过getMapMode判断
+    ByteArray(const std::string& name, MapMode mode, size_t size = 0, size_t base_size = 4096);
     ~ByteArray();
 
+    ByteArray(const ByteArray&) = delete;
+    ByteArray& operator=(const ByteArray&) = delete;
+
+    // 在末尾追加other中从position开始len字节的引用, 不拷贝数据, 要求当前位置在末尾
+    void appendSlice(const ByteArray& other, size_t len, size_t position);
+    // 从other的当前位置开始追加len字节, 不改变other的位置
+    void appendSlice(const ByteArray& other, size_t len);
+    // 在末尾追加外部内存的引用, 所有引用释放后调用release
+    void appendExternal(const void* data, size_t len, std::function<void()> release = nullptr);
+    // 是否包含切片或外部内存
+    bool isCord() const { return m_cord; }
+
+    // 映射文件替换当前内容, 位置置0; READ_WRITE下size大于文件大小时扩展文件
+    bool mapFile(const std::string& name, MapMode mode, size_t size = 0);
+    MapMode getMapMode() const { return m_mapMode; }
+    // 对[offset, offset + len)所在的页设置缺页策略
+    bool advise(Advice advice, size_t offset = 0, size_t len = ~0ull);
+    // READ_WRITE下将修改同步到文件
+    bool sync();
+
     // write
     void writeFint8(int8_t value);
     void writeFuint8(uint8_t value);
@@ -46,6 +130,18 @@ public:
     void writeFloat(float value);
     void writeDouble(double value);
 
+    // 批量写入count个值, 编码方式与对应的单值接口相同
+    void writeFint16Array(const int16_t* values, size_t count);
+    void writeFuint16Array(const uint16_t* values, size_t count);
+    void writeFint32Array(const int32_t* values, size_t count);
+    void writeFuint32Array(const uint32_t* values, size_t count);
+    void writeFint64Array(const int64_t* values, size_t count);
+    void writeFuint64Array(const uint64_t* values, size_t count);
+    void writeInt32Array(const int32_t* values, size_t count);
+    void writeUint32Array(const uint32_t* values, size_t count);
+    void writeInt64Array(const int64_t* values, size_t count);
+    void writeUint64Array(const uint64_t* values, size_t count);
+
     void writeStringF16(const std::string& value);
     void writeStringF32(const std::string& value);
     void writeStringF64(const std::string& value);
@@ -70,6 +166,18 @@ public:
     float readFloat();
     double readDouble();
 
+    // 批量读取count个值到values
+    void readFint16Array(int16_t* values, size_t count);
+    void readFuint16Array(uint16_t* values, size_t count);
+    void readFint32Array(int32_t* values, size_t count);
+    void readFuint32Array(uint32_t* values, size_t count);
+    void readFint64Array(int64_t* values, size_t count);
+    void readFuint64Array(uint64_t* values, size_t count);
+    void readInt32Array(int32_t* values, size_t count);
+    void readUint32Array(uint32_t* values, size_t count);
+    void readInt64Array(int64_t* values, size_t count);
+    void readUint64Array(uint64_t* values, size_t count);
+
     std::string readStringF16();
     std::string readStringF32();
     std::string readStringF64();
@@ -81,6 +189,9 @@ public:
     void read(void* buf, size_t size);
     void read(void* buf, size_t size, size_t position) const;
     
+    // 确保从当前位置起至少有size字节可写容量
+    void reserve(size_t size) { addCapacity(size); }
+
     size_t getPosition() const { return m_position; }
     void setPosition(size_t v);
 
@@ -109,6 +220,31 @@ private:
     void addCapacity(size_t size);
     // 获取当前可写入容量
     size_t getCapacity() const { return m_capacity - m_position; }
+    // 从position开始读取size长度到buf, 不改变m_position
+    void copyOut(void* buf, size_t size, size_t position) const;
+    // pos所在的块及块内偏移, pos为容量末尾时idx等于块数
+    void locate(size_t pos, size_t& idx, size_t& npos) const;
+    // 写入前调用, 块被共享时先复制; 大于m_baseSize的块先拆分, 只复制npos所在的范围
+    void makeWritable(size_t& idx, size_t& npos);
+    // 把cord中的块idx拆分为npos所在的m_baseSize范围及其前后两部分, 更新idx和npos
+    void splitChunk(size_t& idx, size_t& npos);
+    // 进入cord模式, 建立块偏移索引并丢弃m_size之后的空闲容量
+    void toCord();
+    // 当前位置所在块的连续可写空间, 没有可用块时先扩容
+    char* writeSpan(size_t& avail);
+    // 当前位置所在块的连续可读数据
+    const char* readSpan(size_t& avail) const;
+
+    template<class T>
+    void writeFixedArray(const T* values, size_t count);
+    template<class T>
+    void readFixedArray(T* values, size_t count);
+    // F将T转换为待编码的uint64_t
+    template<class T, class F>
+    void writeVarintArray(const T* values, size_t count, F encode);
+    // F将解码出的uint64_t转换为T
+    template<class T, class F>
+    void readVarintArray(T* values, size_t count, F decode);
 
 private:
     // 内存块大小
@@ -121,10 +257,25 @@ private:
     size_t m_size;
     // 字节序，默认大端
     int8_t m_endian;
-    // 第一个内存块指针
-    Node* m_root;
-    // 当前操作的内存块指针
-    Node* m_cur;
+    struct Chunk {
+        char* ptr;
+        size_t size;
+        // 持有内存, 被切片共享时引用计数大于1
+        ChunkRef owner;
+        // 外部内存, 不可直接写入
+        bool external;
+    };
+    // 内存块索引
+    std::vector<Chunk> m_chunks;
+    // cord模式下每个块的起始偏移
+    std::vector<size_t> m_offsets;
+    bool m_cord = false;
+    // 是否有块被切片引用过, 为false时写入无需检查写时复制
+    mutable bool m_shared = false;
+    MapMode m_mapMode = NOT_MAPPED;
+    // 映射的起始地址和长度, 内存由对应块的owner持有
+    char* m_mapBase = nullptr;
+    size_t m_mapLen = 0;
 };
 
 }
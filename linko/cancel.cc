@@ -0,0 +1,134 @@
+#include "cancel.h"
+#include "fiber.h"
+#include "util.h"
+
+#include <errno.h>
+#include <algorithm>
+
+namespace linko {
+
+static FiberLocal<CancelToken::ptr>& CurrentToken() {
+    static FiberLocal<CancelToken::ptr> s_token;
+    return s_token;
+}
+
+CancelToken::CancelToken(uint64_t deadline_ms, CancelToken::ptr parent)
+    :m_deadline(deadline_ms)
+    ,m_parent(parent) {
+    if (m_parent) {
+        m_deadline = std::min(m_deadline, m_parent->m_deadline);
+        m_parentWaiter.cb = &CancelToken::OnParentCancel;
+        m_parentWaiter.arg = this;
+        if (!m_parent->addWaiter(&m_parentWaiter)) {
+            m_cancelled = true;
+        }
+    }
+}
+
+CancelToken::~CancelToken() {
+    if (m_parent) {
+        m_parent->delWaiter(&m_parentWaiter);
+    }
+}
+
+void CancelToken::OnParentCancel(void* arg) {
+    ((CancelToken*)arg)->cancel();
+}
+
+void CancelToken::cancel() {
+    //在锁内执行回调, delWaiter返回后回调不会再访问等待记录
+    MutexType::Lock lock(m_mutex);
+    if (m_cancelled.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    while (CancelWaiter* w = m_waiters) {
+        m_waiters = w->next;
+        if (m_waiters) {
+            m_waiters->prev = nullptr;
+        }
+        w->prev = w->next = nullptr;
+        w->linked = false;
+        w->cb(w->arg);
+    }
+}
+
+int CancelToken::check() const {
+    if (isCancelled()) {
+        return ECANCELED;
+    }
+    if (m_deadline != (uint64_t)-1 && GetMonotonicMS() >= m_deadline) {
+        return ETIMEDOUT;
+    }
+    return 0;
+}
+
+uint64_t CancelToken::remaining() const {
+    if (m_deadline == (uint64_t)-1) {
+        return -1;
+    }
+    uint64_t now = GetMonotonicMS();
+    return now >= m_deadline ? 0 : m_deadline - now;
+}
+
+bool CancelToken::addWaiter(CancelWaiter* w) {
+    MutexType::Lock lock(m_mutex);
+    if (isCancelled()) {
+        return false;
+    }
+    w->prev = nullptr;
+    w->next = m_waiters;
+    if (m_waiters) {
+        m_waiters->prev = w;
+    }
+    m_waiters = w;
+    w->linked = true;
+    return true;
+}
+
+void CancelToken::delWaiter(CancelWaiter* w) {
+    MutexType::Lock lock(m_mutex);
+    if (!w->linked) {
+        return;
+    }
+    if (w->prev) {
+        w->prev->next = w->next;
+    } else {
+        m_waiters = w->next;
+    }
+    if (w->next) {
+        w->next->prev = w->prev;
+    }
+    w->prev = w->next = nullptr;
+    w->linked = false;
+}
+
+CancelToken::ptr CancelToken::GetThis() {
+    std::shared_ptr<const CancelToken::ptr> p = CurrentToken().get();
+    return p ? *p : nullptr;
+}
+
+void CancelToken::SetThis(CancelToken::ptr token) {
+    if (token) {
+        CurrentToken().set(token);
+    } else {
+        CurrentToken().reset();
+    }
+}
+
+int CancelToken::Check() {
+    std::shared_ptr<const CancelToken::ptr> p = CurrentToken().get();
+    return p && *p ? (*p)->check() : 0;
+}
+
+CancelScope::CancelScope(uint64_t timeout_ms)
+    :m_prev(CancelToken::GetThis()) {
+    uint64_t deadline = timeout_ms == (uint64_t)-1 ? -1 : GetMonotonicMS() + timeout_ms;
+    m_token = std::make_shared<CancelToken>(deadline, m_prev);
+    CancelToken::SetThis(m_token);
+}
+
+CancelScope::~CancelScope() {
+    CancelToken::SetThis(m_prev);
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef __LINKO_CANCEL_H__
+#define __LINKO_CANCEL_H__
+
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace linko {
+
+/*
+ * 协程截止时间与取消
+ * 令牌保存在协程局部存储中, 当前协程派生的协程共享同一个令牌
+ * hook中的阻塞操作开始前检查令牌, 等待时间不超过截止时间, 令牌取消时唤醒正在等待的操作
+ * 超过截止时间返回ETIMEDOUT, 被取消返回ECANCELED
+ */
+
+//取消等待记录, 位于阻塞操作的栈上; 注册期间令牌被取消时, 在取消方线程中执行cb(arg)
+struct CancelWaiter {
+    void (*cb)(void*) = nullptr;
+    void* arg = nullptr;
+    CancelWaiter* prev = nullptr;
+    CancelWaiter* next = nullptr;
+    bool linked = false;
+};
+
+class CancelToken : Noncopyable {
+public:
+    typedef std::shared_ptr<CancelToken> ptr;
+    typedef SpinLock MutexType;
+
+    /*
+     * deadline_ms: 绝对时间(GetMonotonicMS), -1表示不限
+     * parent: 截止时间不晚于parent, parent取消时本令牌一同取消
+     */
+    CancelToken(uint64_t deadline_ms = -1, CancelToken::ptr parent = nullptr);
+    ~CancelToken();
+
+    void cancel();
+    bool isCancelled() const { return m_cancelled.load(std::memory_order_acquire); }
+    uint64_t getDeadline() const { return m_deadline; }
+
+    //返回0, 已取消返回ECANCELED, 超过截止时间返回ETIMEDOUT
+    int check() const;
+    //距截止时间的毫秒数, 不限返回-1
+    uint64_t remaining() const;
+
+    //注册等待记录, 已经取消时返回false且不注册
+    bool addWaiter(CancelWaiter* w);
+    //注销等待记录, 返回后cb不会再执行
+    void delWaiter(CancelWaiter* w);
+
+    //当前协程的令牌, 没有返回nullptr
+    static CancelToken::ptr GetThis();
+    static void SetThis(CancelToken::ptr token);
+    //检查当前协程的令牌
+    static int Check();
+
+private:
+    static void OnParentCancel(void* arg);
+
+private:
+    uint64_t m_deadline;
+    std::atomic<bool> m_cancelled{false};
+    CancelToken::ptr m_parent;
+    //注册在父令牌上
+    CancelWaiter m_parentWaiter;
+    MutexType m_mutex;
+    CancelWaiter* m_waiters = nullptr;
+};
+
+/*
+ * 在当前协程上设置截止时间, 作用域内的阻塞操作及期间派生的协程都受其限制
+ * 截止时间不晚于外层令牌, 析构时恢复外层令牌
+ */
+class CancelScope : Noncopyable {
+public:
+    //timeout_ms: 从现在起的超时时间, -1表示只继承外层截止时间
+    CancelScope(uint64_t timeout_ms = -1);
+    ~CancelScope();
+
+    const CancelToken::ptr& getToken() const { return m_token; }
+    void cancel() { m_token->cancel(); }
+
+private:
+    CancelToken::ptr m_prev;
+    CancelToken::ptr m_token;
+};
+
+}
+
+#endif
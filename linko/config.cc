@@ -2,6 +2,20 @@
 #include <iostream>
 
 namespace linko {
+
+size_t ConfigVarBase::NextId() {
+    static std::atomic<size_t> s_id{0};
+    return s_id++;
+}
+
+ConfigVarBase::SnapshotSlot& ConfigVarBase::getSnapshotSlot() {
+    static thread_local std::vector<SnapshotSlot> t_slots;
+    if (m_id >= t_slots.size()) {
+        t_slots.resize(m_id + 1);
+    }
+    return t_slots[m_id];
+}
+
 ConfigVarBase::ptr Config::LookupBase(const std::string& name) {
     RWMutexType::ReadLock lock(GetMutex());
     auto it = GetDatas().find(name);
@@ -26,10 +40,12 @@ static void ListAllMember(const std::string& prefix,
     }
 }
 
-void Config::LoadFromYaml(const YAML::Node& root) {
+bool Config::LoadFromYaml(const YAML::Node& root) {
     std::list<std::pair<std::string, const YAML::Node> > all_nodes;
     ListAllMember("", root, all_nodes);
 
+    std::vector<ConfigVarBase::Pending::ptr> pendings;
+    bool ok = true;
     for (auto& i : all_nodes) {
         std::string key = i.first;
         if (key.empty()) {
@@ -40,15 +56,49 @@ void Config::LoadFromYaml(const YAML::Node& root) {
         auto var = LookupBase(key);
 
         if (var) {
+            ConfigVarBase::Pending::ptr pending;
+            bool rt = false;
             if (i.second.IsScalar()) {
-                var->fromString(i.second.Scalar());
+                rt = var->prepare(i.second.Scalar(), pending);
             } else {
                 std::stringstream ss;
                 ss << i.second;
-                var->fromString(ss.str());
+                rt = var->prepare(ss.str(), pending);
+            }
+            if (!rt) {
+                ok = false;
+            } else if (pending) {
+                pendings.push_back(pending);
             }
         }
     }
+    if (!ok) {
+        LINKO_LOG_ERROR(LINKO_LOG_ROOT()) << "Config::LoadFromYaml invalid value, nothing applied";
+        return false;
+    }
+
+    {
+        Mutex::Lock lock(GetApplyMutex());
+        for (auto& i : pendings) {
+            i->commit();
+        }
+    }
+    for (auto& i : pendings) {
+        i->notify();
+    }
+    return true;
+}
+
+bool Config::LoadFromFile(const std::string& path) {
+    YAML::Node root;
+    try {
+        root = YAML::LoadFile(path);
+    } catch (std::exception& e) {
+        LINKO_LOG_ERROR(LINKO_LOG_ROOT()) << "Config::LoadFromFile " << path
+            << " error: " << e.what();
+        return false;
+    }
+    return LoadFromYaml(root);
 }
 
 void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb) {
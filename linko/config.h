@@ -1,6 +1,7 @@
 #ifndef __LINKO_CONFIG_H__
 #define __LINKO_CONFIG_H__
 
+#include <atomic>
 #include <exception>
 #include <memory>
 #include <stdexcept>
@@ -32,12 +33,46 @@ public:
     const std::string getName() { return m_name; }
     const std::string getDescription() { return m_description; }
 
+    /*
+     * 事务中某个配置项解析完成、尚未生效的新值
+     * 所有配置项prepare成功后依次commit, 全部commit之后再notify
+     */
+    class Pending {
+    public:
+        typedef std::shared_ptr<Pending> ptr;
+        virtual ~Pending() {}
+        // 发布新值, 不触发监听者
+        virtual void commit() = 0;
+        // 通知监听者
+        virtual void notify() = 0;
+    };
+
     virtual std::string toString() = 0;
     virtual bool fromString(const std::string& val) = 0;
+    /*
+     * 解析并校验val, 不修改当前值
+     * 解析或校验失败返回false; 值与当前值相同时pending为空
+     */
+    virtual bool prepare(const std::string& val, Pending::ptr& pending) = 0;
     virtual std::string getTypeName() const = 0;
+
+protected:
+    // 线程本地缓存的配置快照, version与配置项不一致时需要刷新
+    struct SnapshotSlot {
+        uint64_t version = 0;
+        std::shared_ptr<const void> value;
+    };
+
+    // 当前线程中该配置项的缓存槽位
+    SnapshotSlot& getSnapshotSlot();
+
 private:
     std::string m_name;
     std::string m_description;
+    // 全局唯一的编号, 作为线程本地缓存的下标
+    size_t m_id = NextId();
+
+    static size_t NextId();
 };
 
 /*
@@ -243,53 +278,99 @@ public:
     typedef RWMutex RWMutexType;
     typedef std::shared_ptr<ConfigVar> ptr;
     typedef std::function<void (const T& old_value, const T& new_value)> on_change_cb;
+    // 返回false时拒绝该值
+    typedef std::function<bool (const T& value)> validator_cb;
 
     ConfigVar(const std::string& name, const T& default_value
             , const std::string& description = "")
         : ConfigVarBase(name, description)
-        , m_val(default_value) {
+        , m_val(std::make_shared<const T>(default_value)) {
     }
 
     std::string toString() override {
         try {
             //return boost::lexical_cast<std::string>(m_val);
-            RWMutexType::ReadLock lock(m_mutex);
-            return ToStr()(m_val);
+            return ToStr()(*getSnapshot());
         } catch (std::exception& e) {
             LINKO_LOG_ERROR(LINKO_LOG_ROOT()) << "ConfigVar::toString exception" 
-                << e.what() << " convert: " << typeid(m_val).name() << "to string";
+                << e.what() << " convert: " << typeid(T).name() << "to string";
         }
         return "";
     }
 
     bool fromString(const std::string& val) override {
+        Pending::ptr pending;
+        if (!prepare(val, pending)) {
+            return false;
+        }
+        if (pending) {
+            pending->commit();
+            pending->notify();
+        }
+        return true;
+    }
+
+    bool prepare(const std::string& val, Pending::ptr& pending) override {
+        pending.reset();
+        std::shared_ptr<const T> v;
         try {
             //m_val =  boost::lexical_cast<T>(val);
-            setValue(FormStr()(val));
+            v = std::make_shared<const T>(FormStr()(val));
         } catch (std::exception& e) {
-            LINKO_LOG_ERROR(LINKO_LOG_ROOT()) << "ConfigVar::toString exception" 
-                << e.what() << " convert: string to " << typeid(m_val).name();
+            LINKO_LOG_ERROR(LINKO_LOG_ROOT()) << "ConfigVar::fromString exception " 
+                << e.what() << " convert: string to " << typeid(T).name()
+                << " name=" << getName();
+            return false;
         }
-        return false;
+
+        validator_cb validator;
+        {
+            RWMutexType::ReadLock lock(m_mutex);
+            validator = m_validator;
+        }
+        if (validator && !validator(*v)) {
+            LINKO_LOG_ERROR(LINKO_LOG_ROOT()) << "ConfigVar validate fail name=" << getName()
+                << " value=" << val;
+            return false;
+        }
+        if (*v == *getSnapshot()) {
+            return true;
+        }
+        pending.reset(new PendingValue(this, v));
+        return true;
+    }
+
+    /*
+     * 当前值的只读快照, 读取线程本地缓存, 配置未变化时不加锁也不拷贝T
+     * 快照不可修改, 可以跨协程切换持有; 容器类型的热路径应使用它代替getValue
+     */
+    std::shared_ptr<const T> getSnapshot() {
+        return std::static_pointer_cast<const T>(refreshSlot().value);
+    }
+
+    /*
+     * 直接引用线程本地缓存中的值, 省去一次引用计数操作
+     * 引用只在当前线程下次读取该配置项之前有效, 不能跨越协程切换使用
+     */
+    const T& getValueRef() {
+        return *static_cast<const T*>(refreshSlot().value.get());
     }
 
     const T getValue() { 
-        RWMutexType::ReadLock lock(m_mutex);
-        return m_val; 
+        return getValueRef();
     }
 
-    void setValue(const T val) {
-        {
-            RWMutexType::ReadLock lock(m_mutex);
-            if (val == m_val) {
-                return;
-            }
-            for (auto& i : m_cbs) {
-                i.second(m_val, val);
-            }
-        }
+    // 发布新的快照后通知监听者, 已经持有旧快照的读者不受影响
+    void setValue(const T& val) {
+        PendingValue pending(this, std::make_shared<const T>(val));
+        pending.commit();
+        pending.notify();
+    }
+
+    // 只对配置文件等字符串来源的值生效, setValue不做校验
+    void setValidator(validator_cb cb) {
         RWMutexType::WriteLock lock(m_mutex);
-        m_val = val;
+        m_validator = cb;
     }
 
     std::string getTypeName() const override { return typeid(T).name(); }
@@ -317,10 +398,59 @@ public:
         RWMutexType::WriteLock lock(m_mutex);
         m_cbs.clear();
     }
+private:
+    class PendingValue : public Pending {
+    public:
+        PendingValue(ConfigVar* var, std::shared_ptr<const T> val)
+            :m_var(var)
+            ,m_newVal(val) {
+        }
+
+        void commit() override {
+            RWMutexType::WriteLock lock(m_var->m_mutex);
+            if (*m_newVal == *m_var->m_val) {
+                return;
+            }
+            m_oldVal = m_var->m_val;
+            m_var->m_val = m_newVal;
+            m_var->m_version.fetch_add(1, std::memory_order_release);
+            m_cbs = m_var->m_cbs;
+        }
+
+        void notify() override {
+            if (!m_oldVal) {
+                return;
+            }
+            for (auto& i : m_cbs) {
+                i.second(*m_oldVal, *m_newVal);
+            }
+        }
+    private:
+        ConfigVar* m_var;
+        std::shared_ptr<const T> m_newVal;
+        // commit时实际发生了变化才有值
+        std::shared_ptr<const T> m_oldVal;
+        std::map<uint64_t, on_change_cb> m_cbs;
+    };
+
+    SnapshotSlot& refreshSlot() {
+        SnapshotSlot& slot = getSnapshotSlot();
+        if (slot.version != m_version.load(std::memory_order_acquire)) {
+            RWMutexType::ReadLock lock(m_mutex);
+            slot.value = m_val;
+            slot.version = m_version.load(std::memory_order_relaxed);
+        }
+        return slot;
+    }
+
 private:
     RWMutexType m_mutex;
-    T m_val;
+    // 当前值的不可变快照, 修改时整体替换
+    std::shared_ptr<const T> m_val;
+    // 每次替换快照加1, 线程本地缓存据此判断是否过期
+    std::atomic<uint64_t> m_version{1};
     std::map<uint64_t, on_change_cb> m_cbs;
+    validator_cb m_validator;
 };
 
 class Config {
@@ -367,7 +497,12 @@ public:
         return std::dynamic_pointer_cast<ConfigVar<T> >(it->second);
     }
 
-    static void LoadFromYaml(const YAML::Node& root);
+    /*
+     * 事务性加载: 先解析校验全部配置项, 任一失败则不修改任何配置项并返回false
+     * 全部成功后依次发布新值, 再统一通知监听者
+     */
+    static bool LoadFromYaml(const YAML::Node& root);
+    static bool LoadFromFile(const std::string& path);
 
     static ConfigVarBase::ptr LookupBase(const std::string& name);
 
@@ -382,6 +517,12 @@ private:
         static RWMutexType s_mutex;
         return s_mutex;
     }
+
+    // 串行化加载事务的提交
+    static Mutex& GetApplyMutex() {
+        static Mutex s_mutex;
+        return s_mutex;
+    }
 };
 }
 
@@ -0,0 +1,233 @@
+#include "config_watcher.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string.h>
+
+namespace linko {
+
+static Logger::ptr g_logger = LINKO_LOG_NAME("system");
+
+static ConfigVar<uint64_t>::ptr g_config_watch_delay =
+    Config::Lookup("config.watch.delay", (uint64_t)100, "config file change merge delay ms");
+
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+static void SplitPath(const std::string& path, std::string& dir, std::string& name) {
+    size_t pos = path.rfind('/');
+    if (pos == std::string::npos) {
+        dir = ".";
+        name = path;
+    } else {
+        dir = pos == 0 ? "/" : path.substr(0, pos);
+        name = path.substr(pos + 1);
+    }
+}
+
+ConfigWatcher::ConfigWatcher(IOManager* iom)
+    :m_iom(iom) {
+    m_reloadLatency = Metrics::AddHistogram("linko_config_reload_latency_seconds"
+            , "config file change to reload done");
+    m_loadTime = Metrics::AddHistogram("linko_config_load_seconds"
+            , "config file parse, validate, commit and notify time");
+    m_failures = Metrics::AddCounter("linko_config_reload_failures_total"
+            , "config file reloads rejected");
+    m_metrics.push_back(m_reloadLatency);
+    m_metrics.push_back(m_loadTime);
+    m_metrics.push_back(m_failures);
+    m_metrics.push_back(Metrics::AddGauge("linko_config_last_reload_latency_seconds"
+            , "latency of the latest config reload", MetricLabels(), [this]() {
+        MutexType::Lock lock(m_mutex);
+        return m_stats.last_latency_us / 1000000.0;
+    }));
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    Metrics::Del(m_metrics);
+    stop();
+}
+
+bool ConfigWatcher::start() {
+    if (!m_iom) {
+        LINKO_LOG_ERROR(g_logger) << "ConfigWatcher::start without IOManager";
+        return false;
+    }
+    MutexType::Lock lock(m_mutex);
+    if (!m_stop) {
+        return true;
+    }
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        LINKO_LOG_ERROR(g_logger) << "inotify_init1 errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    for (auto& i : m_files) {
+        int wd = inotify_add_watch(m_fd, i.first.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            LINKO_LOG_ERROR(g_logger) << "inotify_add_watch " << i.first
+                << " errno=" << errno << " " << strerror(errno);
+            continue;
+        }
+        m_dirs[wd] = i.first;
+    }
+    m_stop = false;
+    lock.unlock();
+
+    //IOManager中注册事件需要在其调度线程中进行
+    std::weak_ptr<ConfigWatcher> weak(shared_from_this());
+    m_iom->schedule([weak]() {
+        ConfigWatcher::ptr self = weak.lock();
+        if (self) {
+            MutexType::Lock lock(self->m_mutex);
+            self->watch();
+        }
+    });
+    return true;
+}
+
+void ConfigWatcher::stop() {
+    MutexType::Lock lock(m_mutex);
+    if (m_stop) {
+        return;
+    }
+    m_stop = true;
+    if (m_timer) {
+        m_timer->cancel();
+        m_timer.reset();
+    }
+    m_iom->delEvent(m_fd, IOManager::READ);
+    close(m_fd);
+    m_fd = -1;
+    m_dirs.clear();
+}
+
+bool ConfigWatcher::addFile(const std::string& path) {
+    std::string dir;
+    std::string name;
+    SplitPath(path, dir, name);
+    {
+        MutexType::Lock lock(m_mutex);
+        bool new_dir = m_files.find(dir) == m_files.end();
+        m_files[dir].insert(name);
+        if (new_dir && !m_stop) {
+            int wd = inotify_add_watch(m_fd, dir.c_str(), WATCH_MASK);
+            if (wd < 0) {
+                LINKO_LOG_ERROR(g_logger) << "inotify_add_watch " << dir
+                    << " errno=" << errno << " " << strerror(errno);
+            } else {
+                m_dirs[wd] = dir;
+            }
+        }
+    }
+    return Config::LoadFromFile(path);
+}
+
+ConfigWatcher::Stats ConfigWatcher::getStats() {
+    MutexType::Lock lock(m_mutex);
+    Stats s = m_stats;
+    s.reloads = m_reloadLatency->count();
+    s.failures = m_failures->value();
+    s.total_latency_us = m_reloadLatency->sum();
+    return s;
+}
+
+// 调用方持有m_mutex
+void ConfigWatcher::watch() {
+    if (m_stop) {
+        return;
+    }
+    std::weak_ptr<ConfigWatcher> weak(shared_from_this());
+    m_iom->addEvent(m_fd, IOManager::READ, [weak]() {
+        ConfigWatcher::ptr self = weak.lock();
+        if (self) {
+            self->onEvent();
+        }
+    });
+}
+
+void ConfigWatcher::onEvent() {
+    MutexType::Lock lock(m_mutex);
+    if (m_stop) {
+        return;
+    }
+
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    while (true) {
+        ssize_t n = read(m_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        for (char* p = buf; p < buf + n;) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (!ev->len) {
+                continue;
+            }
+            auto dit = m_dirs.find(ev->wd);
+            if (dit == m_dirs.end()) {
+                continue;
+            }
+            auto fit = m_files.find(dit->second);
+            if (fit == m_files.end() || !fit->second.count(ev->name)) {
+                continue;
+            }
+            m_dirty.insert(dit->second + "/" + ev->name);
+            changed = true;
+        }
+    }
+
+    if (changed && !m_timer) {
+        m_firstEventUs = GetMonotonicUS();
+        std::weak_ptr<ConfigWatcher> weak(shared_from_this());
+        m_timer = m_iom->addTimer(g_config_watch_delay->getValue(), [weak]() {
+            ConfigWatcher::ptr self = weak.lock();
+            if (self) {
+                self->onTimer();
+            }
+        });
+    }
+    watch();
+}
+
+void ConfigWatcher::onTimer() {
+    std::set<std::string> files;
+    uint64_t first_event = 0;
+    {
+        MutexType::Lock lock(m_mutex);
+        files.swap(m_dirty);
+        first_event = m_firstEventUs;
+        m_timer.reset();
+    }
+
+    for (auto& i : files) {
+        uint64_t start = GetMonotonicUS();
+        bool ok = Config::LoadFromFile(i);
+        uint64_t now = GetMonotonicUS();
+
+        if (!ok) {
+            m_failures->inc();
+            LINKO_LOG_ERROR(g_logger) << "config reload fail file=" << i;
+            continue;
+        }
+        uint64_t latency = now - first_event;
+        m_reloadLatency->observe(latency);
+        m_loadTime->observe(now - start);
+
+        MutexType::Lock lock(m_mutex);
+        m_stats.last_latency_us = latency;
+        m_stats.max_latency_us = std::max(m_stats.max_latency_us, latency);
+        m_stats.last_load_us = now - start;
+        m_stats.last_reload_ms = now / 1000;
+        lock.unlock();
+        LINKO_LOG_INFO(g_logger) << "config reload file=" << i << " latency=" << latency
+            << "us load=" << now - start << "us";
+    }
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef __LINKO_CONFIG_WATCHER_H__
+#define __LINKO_CONFIG_WATCHER_H__
+
+#include <memory>
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "iomanager.h"
+#include "metrics.h"
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace linko {
+
+/*
+ * 配置文件热加载
+ * inotify句柄注册在IOManager上, 文件变化时由IO事件触发, 不需要轮询线程
+ * 监听文件所在目录, 编辑器先写临时文件再rename的方式也能感知
+ * 短时间内的多次变化合并为一次加载, 每个文件通过Config::LoadFromFile整体生效或整体失败
+ */
+class ConfigWatcher : public std::enable_shared_from_this<ConfigWatcher>, Noncopyable {
+public:
+    typedef std::shared_ptr<ConfigWatcher> ptr;
+    typedef Mutex MutexType;
+
+    struct Stats {
+        uint64_t reloads = 0;
+        uint64_t failures = 0;
+        // 从收到文件变化到加载完成的耗时
+        uint64_t last_latency_us = 0;
+        uint64_t max_latency_us = 0;
+        uint64_t total_latency_us = 0;
+        // 解析, 校验, 提交和通知监听者的耗时
+        uint64_t last_load_us = 0;
+        // 最近一次加载完成的时间, 毫秒
+        uint64_t last_reload_ms = 0;
+    };
+
+    ConfigWatcher(IOManager* iom = IOManager::GetThis());
+    ~ConfigWatcher();
+
+    // 创建inotify句柄并在IOManager中开始监听
+    bool start();
+    void stop();
+
+    // 监听path, 立即加载一次; 返回首次加载结果
+    bool addFile(const std::string& path);
+
+    Stats getStats();
+
+private:
+    void watch();
+    void onEvent();
+    void onTimer();
+
+private:
+    IOManager* m_iom;
+    int m_fd = -1;
+    bool m_stop = true;
+    MutexType m_mutex;
+    // inotify watch描述符 -> 目录
+    std::map<int, std::string> m_dirs;
+    // 目录 -> 该目录下监听的文件名
+    std::map<std::string, std::set<std::string> > m_files;
+    // 已变化待加载的文件
+    std::set<std::string> m_dirty;
+    // 合并等待中第一次变化的时间
+    uint64_t m_firstEventUs = 0;
+    Timer::ptr m_timer;
+    // 只保存最近一次和最大值, 次数与累计值由下面的指标给出
+    Stats m_stats;
+    // 从收到文件变化到加载完成的耗时, 次数即成功加载次数
+    Histogram::ptr m_reloadLatency;
+    Histogram::ptr m_loadTime;
+    Counter::ptr m_failures;
+    std::vector<Metric::ptr> m_metrics;
+};
+
+}
+
+#endif
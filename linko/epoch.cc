@@ -0,0 +1,96 @@
+#include "epoch.h"
+#include <atomic>
+
+namespace linko {
+
+/*
+ * 每个线程的epoch记录, 记录只追加到全局链表, 线程退出后标记为空闲供新线程复用
+ * state高位为进入时的epoch, 低16位为嵌套深度, 深度为0表示不在读临界区
+ * 两者放在一个字里用CAS修改, guard在其他线程析构时也不会与本线程的进入交错出错
+ */
+struct EpochRecord {
+    std::atomic<uint64_t> state{0};
+    std::atomic<bool> used{true};
+    EpochRecord* next = nullptr;
+    char pad[64];
+};
+
+namespace {
+
+static const uint64_t DEPTH_BITS = 16;
+static const uint64_t DEPTH_MASK = (1ull << DEPTH_BITS) - 1;
+
+std::atomic<uint64_t> s_epoch{1};
+std::atomic<EpochRecord*> s_records{nullptr};
+
+EpochRecord* AcquireRecord() {
+    for (EpochRecord* i = s_records.load(std::memory_order_acquire); i; i = i->next) {
+        bool expected = false;
+        if (!i->used.load(std::memory_order_relaxed)
+                && i->used.compare_exchange_strong(expected, true)) {
+            return i;
+        }
+    }
+    EpochRecord* rec = new EpochRecord;
+    rec->next = s_records.load(std::memory_order_relaxed);
+    while (!s_records.compare_exchange_weak(rec->next, rec)) {
+    }
+    return rec;
+}
+
+struct ThreadEpoch {
+    EpochRecord* record = nullptr;
+
+    ~ThreadEpoch() {
+        //仍被挂起协程的guard引用时, 复用该记录的线程按嵌套处理, 同样安全
+        if (record) {
+            record->used.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local ThreadEpoch t_epoch;
+
+}
+
+EpochGuard::EpochGuard() {
+    if (!t_epoch.record) {
+        t_epoch.record = AcquireRecord();
+    }
+    m_record = t_epoch.record;
+    uint64_t s = m_record->state.load(std::memory_order_relaxed);
+    uint64_t n = 0;
+    do {
+        n = (s & DEPTH_MASK) ? s + 1
+            : (s_epoch.load(std::memory_order_relaxed) << DEPTH_BITS) | 1;
+    } while (!m_record->state.compare_exchange_weak(s, n, std::memory_order_relaxed));
+    // epoch必须在读取共享对象之前对回收方可见
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+EpochGuard::~EpochGuard() {
+    uint64_t s = m_record->state.load(std::memory_order_relaxed);
+    uint64_t n = 0;
+    do {
+        n = (s & DEPTH_MASK) == 1 ? 0 : s - 1;
+    } while (!m_record->state.compare_exchange_weak(s, n, std::memory_order_release));
+}
+
+uint64_t Epoch::Retire() {
+    return s_epoch.fetch_add(1);
+}
+
+uint64_t Epoch::MinActive() {
+    // 与EpochGuard中的fence配对: 要么这里看到读者的epoch, 要么读者看到摘除后的状态
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t min_epoch = UINT64_MAX;
+    for (EpochRecord* i = s_records.load(std::memory_order_acquire); i; i = i->next) {
+        uint64_t s = i->state.load(std::memory_order_acquire);
+        if ((s & DEPTH_MASK) && (s >> DEPTH_BITS) < min_epoch) {
+            min_epoch = s >> DEPTH_BITS;
+        }
+    }
+    return min_epoch;
+}
+
+}
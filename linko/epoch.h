@@ -0,0 +1,36 @@
+#ifndef __LINKO_EPOCH_H__
+#define __LINKO_EPOCH_H__
+
+#include <stdint.h>
+#include "noncopyable.h"
+
+namespace linko {
+
+struct EpochRecord;
+
+/*
+ * 基于epoch的延迟回收
+ * 读者在EpochGuard内访问无锁发布的对象; 写者摘除对象后用Epoch::Retire记下当前epoch,
+ * 之后Epoch::MinActive大于该值时, 摘除前进入的读者都已退出, 对象可以释放
+ * 每个线程一个记录, guard可以嵌套; 协程在guard内切出后到其他线程恢复也能正确退出,
+ * 只是挂起期间会推迟所有回收
+ */
+class EpochGuard : Noncopyable {
+public:
+    EpochGuard();
+    ~EpochGuard();
+private:
+    EpochRecord* m_record;
+};
+
+class Epoch {
+public:
+    // 推进全局epoch, 返回摘除对象时的epoch
+    static uint64_t Retire();
+    // 所有活跃读者中最小的epoch, 没有读者时为UINT64_MAX
+    static uint64_t MinActive();
+};
+
+}
+
+#endif
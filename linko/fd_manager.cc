@@ -1,12 +1,20 @@
 #include "fd_manager.h"
 #include "hook.h"
+#include "log.h"
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <stdint.h>
 
 namespace linko {
 
+static Logger::ptr g_logger = LINKO_LOG_NAME("system");
+
 FdCtx::FdCtx(int fd) 
     : m_isInit(false)
     , m_isSocket(false) 
+    , m_isPollable(false)
+    , m_isFile(false)
     , m_sysNonblock(false)
     , m_userNonblock(false)
     , m_isClosed(false)
@@ -33,23 +41,32 @@ bool FdCtx::init() {
     if (-1 == fstat(m_fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isPollable = false;
+        m_isFile = false;
     } else {
         m_isInit = true;
         //判断文件是否为socket
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        //eventfd/timerfd/signalfd等匿名inode没有文件类型位
+        m_isPollable = m_isSocket || S_ISFIFO(fd_stat.st_mode)
+            || (fd_stat.st_mode & S_IFMT) == 0;
+        m_isFile = S_ISREG(fd_stat.st_mode) || S_ISBLK(fd_stat.st_mode);
     }
 
-    if (m_isSocket) {
+    m_userNonblock = false;
+    if (m_isPollable) {
         int flags = fcntl_f(m_fd, F_GETFL, 0);
         if (!(flags & O_NONBLOCK)) {
             fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+        } else {
+            //创建时已经指定了非阻塞(SOCK_NONBLOCK/O_NONBLOCK/EFD_NONBLOCK)
+            m_userNonblock = true;
         }
         m_sysNonblock = true;
     } else {
         m_sysNonblock = false;
     }
 
-    m_userNonblock = false;
     m_isClosed = false;
     return m_isInit;
 }
@@ -71,40 +88,97 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
+    struct rlimit rl;
+    m_capacity = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        m_capacity = rl.rlim_max == RLIM_INFINITY ? SIZE_MAX : rl.rlim_max;
+        if (rl.rlim_cur != RLIM_INFINITY) {
+            m_capacity = std::max<size_t>(m_capacity, rl.rlim_cur);
+        }
+    }
+    // 防止rlimit设置得过大, 页目录按上限一次分配
+    m_capacity = std::max<size_t>(std::min<size_t>(m_capacity, 1 << 24), 1024);
+    size_t pages = (m_capacity + PAGE_SLOTS - 1) / PAGE_SLOTS;
+    m_pages = new std::atomic<std::atomic<FdCtx*>*>[pages];
+    for (size_t i = 0; i < pages; ++i) {
+        m_pages[i].store(nullptr, std::memory_order_relaxed);
+    }
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if (fd == -1) {
+std::atomic<FdCtx*>* FdManager::slot(int fd, bool create) {
+    if (fd < 0) {
         return nullptr;
     }
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_datas.size() <= fd) {
-        if (auto_create == false) {
-            return nullptr;
+    if ((size_t)fd >= m_capacity) {
+        if (create && !m_overflowLogged.exchange(true, std::memory_order_relaxed)) {
+            LINKO_LOG_ERROR(g_logger) << "FdManager fd=" << fd << " exceeds capacity="
+                << m_capacity << ", fds beyond it are not hooked and will block the thread";
         }
-    } else {
-        if (m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+        return nullptr;
+    }
+    std::atomic<std::atomic<FdCtx*>*>& page = m_pages[fd / PAGE_SLOTS];
+    std::atomic<FdCtx*>* p = page.load(std::memory_order_acquire);
+    if (!p && create) {
+        std::atomic<FdCtx*>* new_page = new std::atomic<FdCtx*>[PAGE_SLOTS];
+        for (size_t i = 0; i < PAGE_SLOTS; ++i) {
+            new_page[i].store(nullptr, std::memory_order_relaxed);
         }
+        if (page.compare_exchange_strong(p, new_page, std::memory_order_acq_rel)) {
+            p = new_page;
+        } else {
+            // 其他线程已经分配
+            delete[] new_page;
+        }
+    }
+    return p ? &p[fd % PAGE_SLOTS] : nullptr;
+}
+
+FdCtx* FdManager::get(int fd, bool auto_create) {
+    std::atomic<FdCtx*>* s = slot(fd, auto_create);
+    if (!s) {
+        return nullptr;
+    }
+    FdCtx* ctx = s->load(std::memory_order_acquire);
+    if (ctx || !auto_create) {
+        return ctx;
     }
-    lock.unlock();
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if (fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+    FdCtx* new_ctx = new FdCtx(fd);
+    if (s->compare_exchange_strong(ctx, new_ctx, std::memory_order_acq_rel)) {
+        return new_ctx;
     }
-    m_datas[fd] = ctx;
+    // 其他线程已经创建
+    delete new_ctx;
     return ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if ((int)m_datas.size() <= fd) {
+    std::atomic<FdCtx*>* s = slot(fd, false);
+    if (!s) {
+        return;
+    }
+    FdCtx* ctx = s->exchange(nullptr, std::memory_order_seq_cst);
+    if (!ctx) {
         return;
     }
-    m_datas[fd].reset();
+    MutexType::Lock lock(m_mutex);
+    m_retired.push_back(std::make_pair(ctx, Epoch::Retire()));
+    reclaim();
+}
+
+void FdManager::reclaim() {
+    uint64_t min_epoch = Epoch::MinActive();
+
+    // 读者进入时的epoch大于删除时的epoch, 说明进入时槽位已经清空, 不可能再访问到
+    size_t n = 0;
+    for (auto& i : m_retired) {
+        if (i.second < min_epoch) {
+            delete i.first;
+        } else {
+            m_retired[n++] = i;
+        }
+    }
+    m_retired.resize(n);
 }
 
 }
@@ -6,24 +6,28 @@
 
 #include <vector>
 #include <memory>
+#include <atomic>
 #include "thread.h"
 #include "singleton.h"
+#include "epoch.h"
 
 namespace linko {
 
 /*
  * 文件句柄上下文类
- * 管理文件句柄类型(是否socket)
+ * 管理文件句柄类型: socket/管道/eventfd等可以epoll等待的句柄hook后设为非阻塞,
+ * 普通文件和块设备不能epoll等待, hook后放到文件IO线程池中执行
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx>  {
+class FdCtx {
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
     FdCtx(int fd);
     ~FdCtx();
 
     bool init();
     bool isInit() const { return m_isInit; }
     bool isSocket() const { return m_isSocket; }
+    bool isPollable() const { return m_isPollable; }
+    bool isFile() const { return m_isFile; }
     bool isClosed() const { return m_isClosed; }
     bool close();
 
@@ -39,6 +43,8 @@ public:
 private:
     bool m_isInit: 1;       // 是否初始化
     bool m_isSocket: 1;     // 是否socket
+    bool m_isPollable: 1;   // 是否可以epoll等待
+    bool m_isFile: 1;       // 是否普通文件或块设备
     bool m_sysNonblock: 1;  // 是否hook非阻塞
     bool m_userNonblock: 1; // 是否用户主动设置非阻塞
     bool m_isClosed: 1;     // 是否关闭
@@ -50,19 +56,45 @@ private:
 
 /*
  * 文件句柄管理类
+ * 按RLIMIT_NOFILE分配固定大小的数组, 每个槽位原子地发布FdCtx指针, 查找无锁且不修改引用计数
+ * del后的FdCtx基于epoch延迟释放: 读者在ReadGuard内声明当前epoch, 
+ * 只有所有活跃读者的epoch都大于删除时的epoch后才真正释放
  */
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
+
+    // 读临界区, 期间get返回的FdCtx不会被释放, 可以嵌套
+    typedef EpochGuard ReadGuard;
+
     FdManager();
 
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    // 返回借用的指针, 只能在ReadGuard内使用; fd超出容量时返回nullptr并记录一次错误日志
+    FdCtx* get(int fd, bool auto_create = false);
     void del(int fd);
 
+    size_t getCapacity() const { return m_capacity; }
+
+private:
+    // 释放已经没有读者能访问到的FdCtx
+    void reclaim();
+    // fd所在槽位, 页不存在且create为false时返回nullptr
+    std::atomic<FdCtx*>* slot(int fd, bool create);
+
 private:
-    RWMutexType m_mutex;
-    // 文件句柄合集
-    std::vector<FdCtx::ptr> m_datas;
+    // 每页槽位数
+    static const size_t PAGE_SLOTS = 4096;
+    // 按RLIMIT_NOFILE硬限制计算, 运行中调高软限制后新fd仍在容量内
+    size_t m_capacity;
+    /*
+     * 文件句柄合集, 两级表: 页在首次使用时分配, 之后不再移动或释放
+     * 读者无需额外同步, 也不需要预先按上限分配全部槽位
+     */
+    std::atomic<std::atomic<FdCtx*>*>* m_pages;
+    std::atomic<bool> m_overflowLogged{false};
+    MutexType m_mutex;
+    // 已删除待释放的FdCtx及删除时的epoch
+    std::vector<std::pair<FdCtx*, uint64_t> > m_retired;
 };
 
 // 单例模式
@@ -3,7 +3,15 @@
 #include "macro.h"
 #include "log.h"
 #include "scheduler.h"
+#include "numa.h"
+#include "metrics.h"
+#include "iomanager.h"
+#include "hook.h"
 #include <atomic>
+#include <sstream>
+#include <map>
+#include <signal.h>
+#include <string.h>
 
 namespace linko {
 
@@ -14,6 +22,11 @@ static std::atomic<uint64_t> s_fiber_id {0};
 //协程数
 static std::atomic<uint64_t> s_fiber_count {0};
 
+static Gauge::ptr g_fiber_gauge = Metrics::AddGauge("linko_fibers"
+        , "fibers alive", MetricLabels(), []() {
+    return (double)s_fiber_count;
+});
+
 //当前协程
 static thread_local Fiber* t_fiber = nullptr;
 //主协程
@@ -23,10 +36,100 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = 
     Config::Lookup<uint32_t>("fiber.stack_size", 1024 * 1024, "fiber stack size");
 
+//协程栈优先分配在创建协程的线程所在numa节点上, 配合scheduler.affinity使用
+static ConfigVar<bool>::ptr g_fiber_stack_numa_local =
+    Config::Lookup<bool>("fiber.stack_numa_local", false, "allocate fiber stack on local numa node");
+
+//挂起时记录调用栈, 便于在DumpAll中查看协程停在哪里, 每次挂起多一次backtrace
+static ConfigVar<bool>::ptr g_fiber_backtrace_on_hold =
+    Config::Lookup<bool>("fiber.backtrace_on_hold", false, "record fiber stack when it holds");
+
+static ConfigVar<int>::ptr g_fiber_dump_signal =
+    Config::Lookup<int>("fiber.dump_signal", 0, "signal that dumps all fibers to log, 0 disables");
+
+//挂起时最多记录的栈帧数
+static const int HOLD_STACK_SIZE = 32;
+
+/*
+ * 存活子协程的侵入式链表, 每个线程一个, 协程加入创建它的线程的链表
+ * 协程可能在其他线程析构, 增删都要加锁, 但同一链表上几乎没有竞争
+ */
+struct FiberList {
+    typedef SpinLock MutexType;
+    typedef std::shared_ptr<FiberList> ptr;
+
+    MutexType mutex;
+    Fiber* head = nullptr;
+
+    void add(Fiber* f) {
+        MutexType::Lock lock(mutex);
+        f->m_prev = nullptr;
+        f->m_next = head;
+        if (head) {
+            head->m_prev = f;
+        }
+        head = f;
+    }
+
+    void del(Fiber* f) {
+        MutexType::Lock lock(mutex);
+        if (f->m_prev) {
+            f->m_prev->m_next = f->m_next;
+        } else {
+            head = f->m_next;
+        }
+        if (f->m_next) {
+            f->m_next->m_prev = f->m_prev;
+        }
+        f->m_prev = f->m_next = nullptr;
+    }
+
+    //线程退出后其链表仍由未析构的协程持有
+    static std::vector<std::weak_ptr<FiberList> >& GetLists() {
+        static std::vector<std::weak_ptr<FiberList> > s_lists;
+        return s_lists;
+    }
+
+    static Mutex& GetMutex() {
+        static Mutex s_mutex;
+        return s_mutex;
+    }
+
+    static FiberList::ptr GetThis() {
+        static thread_local FiberList::ptr t_list;
+        if (!t_list) {
+            t_list = std::make_shared<FiberList>();
+            Mutex::Lock lock(GetMutex());
+            auto& lists = GetLists();
+            for (auto it = lists.begin(); it != lists.end();) {
+                if (it->expired()) {
+                    it = lists.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            lists.push_back(t_list);
+        }
+        return t_list;
+    }
+};
+
+static pid_t GetCachedThreadId() {
+    static thread_local pid_t t_tid = GetThreadId();
+    return t_tid;
+}
+
 //创建和释放运行栈
 class MallocStackAllocator {
 public:
     static void* Alloc(size_t size) {
+        if (g_fiber_stack_numa_local->getValue()) {
+            //NumaLocalAlloc的内存同样用free释放
+            void* p = NumaLocalAlloc(size);
+            if (p) {
+                return p;
+            }
+        }
         return malloc(size);
     }
 
@@ -44,6 +147,33 @@ uint64_t Fiber::GetFiberId() {
     return 0;
 }
 
+size_t FiberLocalStorage::NextIndex() {
+    static std::atomic<size_t> s_index {0};
+    return s_index++;
+}
+
+FiberLocalStorage::ptr Fiber::GetLocals() {
+    return t_fiber ? t_fiber->m_locals : nullptr;
+}
+
+std::shared_ptr<const void> Fiber::GetLocal(size_t idx) {
+    if (!t_fiber || !t_fiber->m_locals) {
+        return nullptr;
+    }
+    return t_fiber->m_locals->get(idx);
+}
+
+void Fiber::SetLocal(size_t idx, std::shared_ptr<const void> v) {
+    Fiber* cur = t_fiber ? t_fiber : GetThis().get();
+    //只有当前协程持有时才原地修改, 否则复制一份, 不影响共享该存储的其他协程
+    if (!cur->m_locals) {
+        cur->m_locals = std::make_shared<FiberLocalStorage>();
+    } else if (cur->m_locals.use_count() > 1) {
+        cur->m_locals = std::make_shared<FiberLocalStorage>(*cur->m_locals);
+    }
+    cur->m_locals->set(idx, std::move(v));
+}
+
 Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
@@ -59,8 +189,13 @@ Fiber::Fiber() {
 
 Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller) 
     : m_id(++s_fiber_id) 
-    , m_cb(cb) {
+    , m_cb(cb)
+    , m_locals(t_fiber ? t_fiber->m_locals : nullptr) {
     ++s_fiber_count;
+    m_startMs = GetCurrentMS();
+    m_switchTicks = GetCurrentTicks();
+    m_list = FiberList::GetThis();
+    m_list->add(this);
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
 
     m_stack = StackAllocator::Alloc(m_stacksize);
@@ -84,10 +219,14 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 }
 
 Fiber::~Fiber() {
+    //先从链表中删除, DumpAll不会再读取本对象
+    if (m_list) {
+        m_list->del(this);
+    }
     --s_fiber_count;
     //子协程是否存在
     if (m_stack) {
-        LINKO_LOG_INFO(g_logger) << "Fiber id:" << m_id << " m_state:" << m_state;
+        LINKO_LOG_INFO(g_logger) << "Fiber id:" << m_id << " m_state:" << getState();
         LINKO_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
         StackAllocator::Dealloc(m_stack, m_stacksize);
     } else {
@@ -110,6 +249,8 @@ void Fiber::reset(std::function<void()> cb) {
     //当前协程不在准备和运行态
     LINKO_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
     m_cb = cb;
+    m_locals.reset();
+    m_startMs = GetCurrentMS();
     if (getcontext(&m_ctx)) {
         LINKO_ASSERT2(false, "getcontext");
     }
@@ -122,18 +263,29 @@ void Fiber::reset(std::function<void()> cb) {
     m_state = INIT;
 }
 
+void Fiber::onSwitch() {
+    m_switchTicks = GetCurrentTicks();
+    m_threadId = GetCachedThreadId();
+}
+
 void Fiber::call() {
     SetThis(this);
     LINKO_ASSERT(m_state != EXEC);
     m_state = EXEC;
+    onSwitch();
 
     if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
         LINKO_ASSERT2(false, "swapcontext");
     }
+    //协程上下文已经保存, 此时才允许其他线程切入
+    State exec = EXEC;
+    m_state.compare_exchange_strong(exec, HOLD, std::memory_order_release
+            , std::memory_order_relaxed);
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
+    onSwitch();
 
     if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
         LINKO_ASSERT2(false, "swapcontext");
@@ -144,6 +296,7 @@ void Fiber::swapIn() {
     SetThis(this);
     LINKO_ASSERT(m_state != EXEC);
     m_state = EXEC;
+    onSwitch();
     
     if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
         LINKO_ASSERT2(false, "swapcontext");
@@ -152,6 +305,7 @@ void Fiber::swapIn() {
 
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
+    onSwitch();
 
     if (swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
         LINKO_ASSERT2(false, "swapcontext");
@@ -180,12 +334,209 @@ void Fiber::YieldToReady() {
     cur->swapOut();
 }
 
+/*
+ * 切出前保持EXEC状态, 由调度器(或call)在切回后置为HOLD
+ * 其他线程唤醒该协程时, 调度器会跳过EXEC状态的协程, 避免切入仍在运行的栈
+ */
 void Fiber::YieldToHold() {
     Fiber::ptr cur = GetThis();
-    cur->m_state = HOLD;
+    bool captured = false;
+    if (cur->m_list && g_fiber_backtrace_on_hold->getValue()) {
+        void* stack[HOLD_STACK_SIZE];
+        int n = BacktraceRaw(stack, HOLD_STACK_SIZE, 1);
+        FiberList::MutexType::Lock lock(cur->m_list->mutex);
+        cur->m_holdStack.assign(stack, stack + n);
+        captured = true;
+    }
     cur->swapOut();
+
+    cur->m_waitWhat.store(nullptr, std::memory_order_relaxed);
+    cur->m_waitFd.store(-1, std::memory_order_relaxed);
+    cur->m_waitEvent.store(0, std::memory_order_relaxed);
+    if (captured) {
+        FiberList::MutexType::Lock lock(cur->m_list->mutex);
+        cur->m_holdStack.clear();
+    }
 }
 
+void Fiber::SetWait(const char* what, int fd, int event) {
+    if (!t_fiber) {
+        return;
+    }
+    t_fiber->m_waitFd.store(fd, std::memory_order_relaxed);
+    t_fiber->m_waitEvent.store(event, std::memory_order_relaxed);
+    t_fiber->m_waitWhat.store(what, std::memory_order_relaxed);
+}
+
+static const char* StateToString(Fiber::State state) {
+    switch (state) {
+#define XX(name) \
+        case Fiber::name: return #name;
+        XX(INIT);
+        XX(HOLD);
+        XX(EXEC);
+        XX(TERM);
+        XX(READY);
+        XX(EXCEPT);
+#undef XX
+    }
+    return "UNKNOWN";
+}
+
+void Fiber::DumpAll(std::ostream& os) {
+    struct Snapshot {
+        uint64_t id;
+        State state;
+        uint64_t start_ms;
+        uint64_t switch_ticks;
+        pid_t thread;
+        const char* what;
+        int fd;
+        int event;
+        std::vector<void*> stack;
+    };
+
+    std::vector<FiberList::ptr> lists;
+    {
+        Mutex::Lock lock(FiberList::GetMutex());
+        for (auto& i : FiberList::GetLists()) {
+            FiberList::ptr l = i.lock();
+            if (l) {
+                lists.push_back(l);
+            }
+        }
+    }
+
+    //只在锁内复制, 格式化和符号化在锁外进行
+    std::vector<Snapshot> fibers;
+    for (auto& l : lists) {
+        FiberList::MutexType::Lock lock(l->mutex);
+        for (Fiber* f = l->head; f; f = f->m_next) {
+            Snapshot s;
+            s.id = f->m_id;
+            s.state = f->getState();
+            s.start_ms = f->m_startMs;
+            s.switch_ticks = f->m_switchTicks;
+            s.thread = f->m_threadId;
+            s.what = f->m_waitWhat.load(std::memory_order_relaxed);
+            s.fd = f->m_waitFd.load(std::memory_order_relaxed);
+            s.event = f->m_waitEvent.load(std::memory_order_relaxed);
+            s.stack = f->m_holdStack;
+            fibers.push_back(std::move(s));
+        }
+    }
+
+    uint64_t now_ms = GetCurrentMS();
+    uint64_t now_ticks = GetCurrentTicks();
+    std::map<std::string, size_t> states;
+    for (auto& i : fibers) {
+        ++states[StateToString(i.state)];
+    }
+    os << "fibers=" << fibers.size();
+    for (auto& i : states) {
+        os << " " << i.first << "=" << i.second;
+    }
+    os << "\n";
+
+    for (auto& i : fibers) {
+        os << "fiber id=" << i.id
+           << " state=" << StateToString(i.state)
+           << " thread=" << i.thread
+           << " age_ms=" << (now_ms > i.start_ms ? now_ms - i.start_ms : 0)
+           << " state_ms=" << (now_ticks > i.switch_ticks ? TicksToUS(now_ticks - i.switch_ticks) / 1000 : 0);
+        if (i.what) {
+            os << " wait=" << i.what;
+            if (i.fd >= 0) {
+                os << " fd=" << i.fd;
+            }
+            if (i.event & IOManager::READ) {
+                os << " READ";
+            }
+            if (i.event & IOManager::WRITE) {
+                os << " WRITE";
+            }
+        }
+        os << "\n";
+        if (!i.stack.empty()) {
+            os << BacktraceSymbolsToString(i.stack.data(), i.stack.size(), "    ");
+        }
+    }
+}
+
+/*
+ * 信号处理函数只写管道, 由单独的线程输出
+ * 管道两端都绕过hook: 信号可能打断hook线程中的协程, 处理函数里不能进入do_io
+ */
+static int s_dump_pipe[2] = {-1, -1};
+static int s_dump_signo = 0;
+
+static void OnDumpSignal(int) {
+    int err = errno;
+    //写端非阻塞, 管道满时丢弃本次请求
+    ssize_t rt = write_f(s_dump_pipe[1], "D", 1);
+    (void)rt;
+    errno = err;
+}
+
+void Fiber::SetDumpSignal(int signo) {
+    static Mutex s_mutex;
+    static Thread::ptr s_thread;
+    Mutex::Lock lock(s_mutex);
+    if (s_dump_signo) {
+        signal(s_dump_signo, SIG_DFL);
+        s_dump_signo = 0;
+    }
+    if (signo <= 0) {
+        return;
+    }
+    if (!s_thread) {
+        if (pipe2_f(s_dump_pipe, O_CLOEXEC)) {
+            LINKO_LOG_ERROR(g_logger) << "fiber dump pipe errno=" << errno
+                << " errstr=" << strerror(errno);
+            return;
+        }
+        fcntl_f(s_dump_pipe[1], F_SETFL, fcntl_f(s_dump_pipe[1], F_GETFL) | O_NONBLOCK);
+        s_thread.reset(new Thread([]() {
+            char c;
+            while (true) {
+                ssize_t n = read_f(s_dump_pipe[0], &c, 1);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n != 1) {
+                    LINKO_LOG_ERROR(g_logger) << "fiber dump read rt=" << n << " errno=" << errno
+                        << " errstr=" << strerror(errno);
+                    break;
+                }
+                std::stringstream ss;
+                DumpAll(ss);
+                LINKO_LOG_INFO(g_logger) << "fiber dump:\n" << ss.str();
+            }
+        }, "fiber_dump"));
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &OnDumpSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(signo, &sa, nullptr)) {
+        LINKO_LOG_ERROR(g_logger) << "fiber dump sigaction(" << signo << ") errno=" << errno
+            << " errstr=" << strerror(errno);
+        return;
+    }
+    s_dump_signo = signo;
+}
+
+struct _FiberDumpIniter {
+    _FiberDumpIniter() {
+        g_fiber_dump_signal->addListener([](const int& old_value, const int& new_value) {
+            Fiber::SetDumpSignal(new_value);
+        });
+    }
+};
+
+static _FiberDumpIniter s_fiber_dump_initer;
+
 uint64_t Fiber::TotalFibers() {
     return s_fiber_count;
 }
@@ -3,15 +3,48 @@
 
 #include <memory>
 #include <functional>
+#include <vector>
+#include <atomic>
+#include <ostream>
 #include <ucontext.h>
 #include "thread.h"
+#include "noncopyable.h"
 
 namespace linko {
 
 class Scheduler;
+struct FiberList;
+
+/*
+ * 协程局部存储
+ * 每个FiberLocal对象在构造时分配一个固定下标, 访问为一次数组索引
+ * 派生的协程共享父协程的存储, 任一方写入时先复制, 因此派生后双方的修改互不可见
+ */
+class FiberLocalStorage {
+public:
+    typedef std::shared_ptr<FiberLocalStorage> ptr;
+
+    static size_t NextIndex();
+
+    const std::shared_ptr<const void>& get(size_t idx) const {
+        static const std::shared_ptr<const void> s_null;
+        return idx < m_slots.size() ? m_slots[idx] : s_null;
+    }
+
+    void set(size_t idx, std::shared_ptr<const void> v) {
+        if (idx >= m_slots.size()) {
+            m_slots.resize(idx + 1);
+        }
+        m_slots[idx] = std::move(v);
+    }
+
+private:
+    std::vector<std::shared_ptr<const void> > m_slots;
+};
 
 class Fiber : public std::enable_shared_from_this<Fiber> {
 friend class Scheduler;
+friend struct FiberList;
 public:
     typedef std::shared_ptr<Fiber> ptr;
 
@@ -48,7 +81,11 @@ public:
     void swapOut();
 
     uint64_t getId() const { return m_id; }
-    State getState() const { return m_state; }
+    //其他线程的调度器会读取状态判断协程能否切入, 需要acquire
+    State getState() const { return m_state.load(std::memory_order_acquire); }
+
+    const FiberLocalStorage::ptr& getLocals() const { return m_locals; }
+    void setLocals(FiberLocalStorage::ptr locals) { m_locals = std::move(locals); }
 
 public:
     static void SetThis(Fiber* f);
@@ -62,16 +99,82 @@ public:
     static void CallerMainFunc();
     static uint64_t GetFiberId();
 
+    //当前协程的局部存储, 没有时返回nullptr, 不会创建主协程
+    static FiberLocalStorage::ptr GetLocals();
+    static std::shared_ptr<const void> GetLocal(size_t idx);
+    static void SetLocal(size_t idx, std::shared_ptr<const void> v);
+
+    /*
+     * 记录当前协程接下来挂起等待的对象, YieldToHold返回时清除
+     * what需为静态字符串, event为IOManager::Event
+     */
+    static void SetWait(const char* what, int fd = -1, int event = 0);
+    //输出所有存活子协程的状态, 等待对象, 当前状态持续的时间和挂起时的调用栈
+    static void DumpAll(std::ostream& os);
+    //收到signo信号时把DumpAll输出到system日志, 0表示取消
+    static void SetDumpSignal(int signo);
+
 private:
+    //切入或切出时记录时间和线程
+    void onSwitch();
+
     uint64_t m_id = 0;
     uint32_t m_stacksize = 0;
-    State m_state = INIT;
+    //切出后在swapcontext返回之后以release写入HOLD, 保证上下文已保存
+    std::atomic<State> m_state{INIT};
 
     ucontext_t m_ctx;
     //协程运行栈指针
     void* m_stack = nullptr;
 
     std::function<void()> m_cb;
+    //协程局部存储, 创建时继承自当前协程
+    FiberLocalStorage::ptr m_locals;
+
+    //所在的存活协程链表, 按创建线程划分
+    std::shared_ptr<FiberList> m_list;
+    Fiber* m_prev = nullptr;
+    Fiber* m_next = nullptr;
+    //创建或reset的时间
+    uint64_t m_startMs = 0;
+    //最近一次切入或切出的时间(GetCurrentTicks)
+    uint64_t m_switchTicks = 0;
+    //最近运行的线程
+    pid_t m_threadId = 0;
+    //挂起等待的对象, 由DumpAll在其他线程读取
+    std::atomic<const char*> m_waitWhat{nullptr};
+    std::atomic<int> m_waitFd{-1};
+    std::atomic<int> m_waitEvent{0};
+    //挂起时的调用栈(未符号化), 修改时持有m_list的锁
+    std::vector<void*> m_holdStack;
+};
+
+/*
+ * 协程局部变量, 定义为静态或全局对象
+ * 协程在线程间迁移时值跟随协程; 在协程中创建或调度的新任务继承当前值
+ */
+template<class T>
+class FiberLocal : Noncopyable {
+public:
+    FiberLocal()
+        :m_index(FiberLocalStorage::NextIndex()) {
+    }
+
+    //未设置返回nullptr
+    std::shared_ptr<const T> get() const {
+        return std::static_pointer_cast<const T>(Fiber::GetLocal(m_index));
+    }
+
+    void set(const T& v) {
+        Fiber::SetLocal(m_index, std::make_shared<const T>(v));
+    }
+
+    void reset() {
+        Fiber::SetLocal(m_index, nullptr);
+    }
+
+private:
+    size_t m_index;
 };
 
 }
@@ -0,0 +1,302 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "log.h"
+#include "macro.h"
+
+namespace linko {
+
+//挂起前的自旋次数, 持有者在其他线程上且临界区很短时可以避免一次挂起和调度
+static const int SPIN_COUNT = 100;
+
+FiberWaiter::FiberWaiter() {
+    scheduler = Scheduler::GetThis();
+    if (scheduler) {
+        fiber = Fiber::GetThis();
+        if (fiber.get() == Scheduler::GetMainFiber()) {
+            fiber.reset();
+        }
+    }
+    if (!fiber) {
+        sem = new Semaphore(0);
+    }
+}
+
+FiberWaiter::~FiberWaiter() {
+    delete sem;
+}
+
+void FiberWaiter::wait() {
+    //notify可能先于wait执行并取走了fiber, 以sem区分等待方式
+    if (!sem) {
+        Fiber::SetWait("fiber_sync");
+        Fiber::YieldToHold();
+    } else {
+        sem->wait();
+    }
+}
+
+void FiberWaiter::notify() {
+    if (!sem) {
+        //先取出成员, schedule之后等待方可能已经恢复并销毁了本对象
+        Scheduler* s = scheduler;
+        Fiber::ptr f = std::move(fiber);
+        s->schedule(f);
+    } else {
+        sem->notify();
+    }
+}
+
+void FiberWaitQueue::push(FiberWaiter* w) {
+    w->next = nullptr;
+    if (m_tail) {
+        m_tail->next = w;
+    } else {
+        m_head = w;
+    }
+    m_tail = w;
+    ++m_size;
+}
+
+FiberWaiter* FiberWaitQueue::pop() {
+    FiberWaiter* w = m_head;
+    if (w) {
+        m_head = w->next;
+        if (!m_head) {
+            m_tail = nullptr;
+        }
+        w->next = nullptr;
+        --m_size;
+    }
+    return w;
+}
+
+void FiberMutex::lockSlow() {
+    for (int i = 0; i < SPIN_COUNT; ++i) {
+        if (m_state.load(std::memory_order_relaxed) == 0 && tryLock()) {
+            return;
+        }
+    }
+    while (true) {
+        SpinLock::Lock lock(m_waitLock);
+        //标记有等待者; 如果交换前未加锁, 则已经拿到锁
+        if (m_state.exchange(2, std::memory_order_acquire) == 0) {
+            return;
+        }
+        FiberWaiter waiter;
+        m_waiters.push(&waiter);
+        lock.unlock();
+        waiter.wait();
+        //被唤醒后重新竞争, 其他协程可能已经抢先拿到锁
+    }
+}
+
+void FiberMutex::unlockSlow() {
+    FiberWaiter* w = nullptr;
+    {
+        SpinLock::Lock lock(m_waitLock);
+        w = m_waiters.pop();
+    }
+    if (w) {
+        w->notify();
+    }
+}
+
+void FiberRWMutex::unlock() {
+    uint32_t s = m_state.load(std::memory_order_relaxed);
+    if (s & WRITER) {
+        if (s == WRITER && m_state.compare_exchange_strong(s, 0, std::memory_order_release)) {
+            return;
+        }
+        unlockSlow();
+        return;
+    }
+
+    LINKO_ASSERT(s & READER_MASK);
+    while (!(s & WAITING) || (s & READER_MASK) > 1) {
+        if (m_state.compare_exchange_weak(s, s - 1, std::memory_order_release)) {
+            return;
+        }
+    }
+    //最后一个读者且有等待者
+    unlockSlow();
+}
+
+void FiberRWMutex::rdlockSlow() {
+    uint32_t s = 0;
+    for (int i = 0; i < SPIN_COUNT; ++i) {
+        s = m_state.load(std::memory_order_relaxed);
+        if (!(s & (WRITER | WAITING))
+                && m_state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+            return;
+        }
+    }
+
+    SpinLock::Lock lock(m_waitLock);
+    s = m_state.load(std::memory_order_relaxed);
+    while (true) {
+        //写者优先, 已有写者等待时读者也排队
+        if (!(s & WRITER) && m_writers.empty()) {
+            if (m_state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+                return;
+            }
+            continue;
+        }
+        //用CAS设置WAITING, 保证持有者解锁时一定走慢路径
+        if ((s & WAITING) || m_state.compare_exchange_weak(s, s | WAITING, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    FiberWaiter waiter;
+    m_readers.push(&waiter);
+    lock.unlock();
+    //唤醒时解锁方已经把读锁计入m_state
+    waiter.wait();
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+void FiberRWMutex::wrlockSlow() {
+    uint32_t s = 0;
+    for (int i = 0; i < SPIN_COUNT; ++i) {
+        s = 0;
+        if (m_state.load(std::memory_order_relaxed) == 0
+                && m_state.compare_exchange_weak(s, WRITER, std::memory_order_acquire)) {
+            return;
+        }
+    }
+
+    SpinLock::Lock lock(m_waitLock);
+    s = m_state.load(std::memory_order_relaxed);
+    while (true) {
+        if (!(s & (WRITER | READER_MASK))) {
+            if (m_state.compare_exchange_weak(s, s | WRITER, std::memory_order_acquire)) {
+                return;
+            }
+            continue;
+        }
+        if ((s & WAITING) || m_state.compare_exchange_weak(s, s | WAITING, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    FiberWaiter waiter;
+    m_writers.push(&waiter);
+    lock.unlock();
+    waiter.wait();
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+void FiberRWMutex::unlockSlow() {
+    FiberWaitQueue wake;
+    {
+        SpinLock::Lock lock(m_waitLock);
+        uint32_t s = m_state.load(std::memory_order_relaxed);
+        bool to_readers = false;
+        bool to_writer = false;
+        if (s & WRITER) {
+            //写者释放时没有其他持有者, 读者优先
+            uint32_t n = 0;
+            if (!m_readers.empty()) {
+                to_readers = true;
+                n = m_readers.size() | (m_writers.empty() ? 0 : WAITING);
+            } else if (!m_writers.empty()) {
+                to_writer = true;
+                n = WRITER | (m_writers.size() > 1 ? WAITING : 0);
+            }
+            m_state.store(n, std::memory_order_release);
+        } else {
+            //读者释放, 此时只有其他读者的快路径解锁会并发修改m_state
+            while (true) {
+                uint32_t n = s - 1;
+                to_readers = to_writer = false;
+                if (!(n & READER_MASK)) {
+                    if (!m_writers.empty()) {
+                        to_writer = true;
+                        n = WRITER | (m_writers.size() > 1 || !m_readers.empty() ? WAITING : 0);
+                    } else if (!m_readers.empty()) {
+                        to_readers = true;
+                        n = m_readers.size();
+                    } else {
+                        n = 0;
+                    }
+                }
+                if (m_state.compare_exchange_weak(s, n, std::memory_order_release)) {
+                    break;
+                }
+            }
+        }
+        if (to_readers) {
+            while (FiberWaiter* w = m_readers.pop()) {
+                wake.push(w);
+            }
+        } else if (to_writer) {
+            wake.push(m_writers.pop());
+        }
+    }
+    while (FiberWaiter* w = wake.pop()) {
+        w->notify();
+    }
+}
+
+void FiberCondition::wait(FiberMutex& mutex) {
+    FiberWaiter waiter;
+    {
+        SpinLock::Lock lock(m_waitLock);
+        m_waiters.push(&waiter);
+    }
+    mutex.unlock();
+    waiter.wait();
+    mutex.lock();
+}
+
+void FiberCondition::notify() {
+    FiberWaiter* w = nullptr;
+    {
+        SpinLock::Lock lock(m_waitLock);
+        w = m_waiters.pop();
+    }
+    if (w) {
+        w->notify();
+    }
+}
+
+void FiberCondition::notifyAll() {
+    FiberWaitQueue wake;
+    {
+        SpinLock::Lock lock(m_waitLock);
+        while (FiberWaiter* w = m_waiters.pop()) {
+            wake.push(w);
+        }
+    }
+    while (FiberWaiter* w = wake.pop()) {
+        w->notify();
+    }
+}
+
+void FiberSemaphore::waitSlow() {
+    SpinLock::Lock lock(m_waitLock);
+    //notify先于入队到达
+    if (m_wakeups > 0) {
+        --m_wakeups;
+        return;
+    }
+    FiberWaiter waiter;
+    m_waiters.push(&waiter);
+    lock.unlock();
+    waiter.wait();
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+void FiberSemaphore::notifySlow() {
+    FiberWaiter* w = nullptr;
+    {
+        SpinLock::Lock lock(m_waitLock);
+        w = m_waiters.pop();
+        if (!w) {
+            ++m_wakeups;
+        }
+    }
+    if (w) {
+        w->notify();
+    }
+}
+
+}
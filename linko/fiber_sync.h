@@ -0,0 +1,291 @@
+#ifndef __LINKO_FIBER_SYNC_H__
+#define __LINKO_FIBER_SYNC_H__
+
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <stdint.h>
+
+#include "mutex.h"
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace linko {
+
+class Scheduler;
+
+/*
+ * 协程同步原语
+ * 竞争时等待者以HOLD状态挂起, 由唤醒方通过Scheduler::schedule重新调度, 不阻塞线程
+ * 无竞争时只有一次原子操作; 不在调度器协程中调用时退化为信号量阻塞线程
+ */
+
+//等待者, 位于等待方的栈上
+struct FiberWaiter : Noncopyable {
+    FiberWaiter();
+    ~FiberWaiter();
+
+    //挂起直到notify
+    void wait();
+    //唤醒等待者, 调用后不能再访问该对象
+    void notify();
+
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    //非协程环境下使用
+    Semaphore* sem = nullptr;
+    FiberWaiter* next = nullptr;
+};
+
+//侵入式FIFO等待队列, 由调用方加锁
+class FiberWaitQueue : Noncopyable {
+public:
+    void push(FiberWaiter* w);
+    FiberWaiter* pop();
+    bool empty() const { return m_head == nullptr; }
+    size_t size() const { return m_size; }
+
+private:
+    FiberWaiter* m_head = nullptr;
+    FiberWaiter* m_tail = nullptr;
+    size_t m_size = 0;
+};
+
+/*
+ * 协程互斥锁
+ * 状态0未加锁, 1加锁, 2加锁且可能有等待者; 解锁时只有状态为2才进入慢路径唤醒
+ */
+class FiberMutex : Noncopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    void lock() {
+        int expected = 0;
+        if (!m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+            lockSlow();
+        }
+    }
+
+    bool tryLock() {
+        int expected = 0;
+        return m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        if (m_state.exchange(0, std::memory_order_release) == 2) {
+            unlockSlow();
+        }
+    }
+
+private:
+    void lockSlow();
+    void unlockSlow();
+
+private:
+    std::atomic<int> m_state{0};
+    SpinLock m_waitLock;
+    FiberWaitQueue m_waiters;
+};
+
+/*
+ * 协程读写锁
+ * 低30位为读者数, WRITER表示写者持有, WAITING表示有等待者
+ * 设置WAITING后加锁一律走慢路径, 由解锁方直接把锁交给等待者; 写者释放时优先唤醒全部读者
+ */
+class FiberRWMutex : Noncopyable {
+public:
+    typedef ReadScopedLockImpl<FiberRWMutex> ReadLock;
+    typedef WriteScopedLockImpl<FiberRWMutex> WriteLock;
+
+    void rdlock() {
+        uint32_t s = m_state.load(std::memory_order_relaxed);
+        while (!(s & (WRITER | WAITING))) {
+            if (m_state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+                return;
+            }
+        }
+        rdlockSlow();
+    }
+
+    void wrlock() {
+        uint32_t expected = 0;
+        if (!m_state.compare_exchange_strong(expected, WRITER, std::memory_order_acquire)) {
+            wrlockSlow();
+        }
+    }
+
+    void unlock();
+
+private:
+    void rdlockSlow();
+    void wrlockSlow();
+    void unlockSlow();
+
+    static const uint32_t WRITER = 1u << 30;
+    static const uint32_t WAITING = 1u << 31;
+    static const uint32_t READER_MASK = WRITER - 1;
+
+private:
+    std::atomic<uint32_t> m_state{0};
+    SpinLock m_waitLock;
+    FiberWaitQueue m_readers;
+    FiberWaitQueue m_writers;
+};
+
+/*
+ * 协程条件变量, 与FiberMutex配合使用
+ */
+class FiberCondition : Noncopyable {
+public:
+    //调用前必须持有mutex, 返回时重新持有
+    void wait(FiberMutex& mutex);
+
+    template<class Predicate>
+    void wait(FiberMutex& mutex, Predicate pred) {
+        while (!pred()) {
+            wait(mutex);
+        }
+    }
+
+    void notify();
+    void notifyAll();
+
+private:
+    SpinLock m_waitLock;
+    FiberWaitQueue m_waiters;
+};
+
+/*
+ * 协程信号量
+ * m_count小于0时其绝对值为等待者数量; 等待者入队前被notify时记入m_wakeups, 避免丢失唤醒
+ */
+class FiberSemaphore : Noncopyable {
+public:
+    FiberSemaphore(int64_t count = 0)
+        :m_count(count) {
+    }
+
+    void wait() {
+        if (m_count.fetch_sub(1, std::memory_order_acquire) <= 0) {
+            waitSlow();
+        }
+    }
+
+    bool tryWait() {
+        int64_t s = m_count.load(std::memory_order_relaxed);
+        while (s > 0) {
+            if (m_count.compare_exchange_weak(s, s - 1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void notify() {
+        if (m_count.fetch_add(1, std::memory_order_release) < 0) {
+            notifySlow();
+        }
+    }
+
+private:
+    void waitSlow();
+    void notifySlow();
+
+private:
+    std::atomic<int64_t> m_count;
+    SpinLock m_waitLock;
+    FiberWaitQueue m_waiters;
+    uint64_t m_wakeups = 0;
+};
+
+/*
+ * 有界通道
+ * 缓冲区满时push挂起, 空时pop挂起; close后push失败, pop取完剩余数据后失败
+ */
+template<class T>
+class Channel : Noncopyable {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    Channel(size_t capacity = 1)
+        :m_capacity(capacity ? capacity : 1) {
+    }
+
+    bool push(const T& v) {
+        FiberMutex::Lock lock(m_mutex);
+        while (m_queue.size() >= m_capacity && !m_closed) {
+            m_notFull.wait(m_mutex);
+        }
+        if (m_closed) {
+            return false;
+        }
+        m_queue.push_back(v);
+        m_notEmpty.notify();
+        return true;
+    }
+
+    bool pop(T& v) {
+        FiberMutex::Lock lock(m_mutex);
+        while (m_queue.empty() && !m_closed) {
+            m_notEmpty.wait(m_mutex);
+        }
+        if (m_queue.empty()) {
+            return false;
+        }
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_notFull.notify();
+        return true;
+    }
+
+    bool tryPush(const T& v) {
+        FiberMutex::Lock lock(m_mutex);
+        if (m_closed || m_queue.size() >= m_capacity) {
+            return false;
+        }
+        m_queue.push_back(v);
+        m_notEmpty.notify();
+        return true;
+    }
+
+    bool tryPop(T& v) {
+        FiberMutex::Lock lock(m_mutex);
+        if (m_queue.empty()) {
+            return false;
+        }
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_notFull.notify();
+        return true;
+    }
+
+    void close() {
+        FiberMutex::Lock lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notifyAll();
+        m_notFull.notifyAll();
+    }
+
+    size_t size() {
+        FiberMutex::Lock lock(m_mutex);
+        return m_queue.size();
+    }
+
+    size_t getCapacity() const { return m_capacity; }
+    bool isClosed() {
+        FiberMutex::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+private:
+    size_t m_capacity;
+    bool m_closed = false;
+    std::deque<T> m_queue;
+    FiberMutex m_mutex;
+    FiberCondition m_notEmpty;
+    FiberCondition m_notFull;
+};
+
+}
+
+#endif
@@ -1,11 +1,18 @@
 #include "hook.h"
 #include <dlfcn.h>
+#include <stdarg.h>
+#include <atomic>
+#include <vector>
+#include <limits.h>
 
 #include "config.h"
 #include "log.h"
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "offload.h"
+#include "cancel.h"
+#include "util.h"
 
 linko::Logger::ptr g_logger = LINKO_LOG_NAME("system");
 
@@ -14,6 +21,9 @@ namespace linko {
 static linko::ConfigVar<int>::ptr g_tcp_connect_timeout = 
     linko::Config::Lookup("tcp.connect.timeout", 5000, "tcp connect timeout");
 
+static linko::ConfigVar<int>::ptr g_file_io_threads =
+    linko::Config::Lookup("hook.file_io.threads", 4, "file io offload threads, 0 to disable");
+
 static thread_local bool t_hook_enable = false;
 
 #define HOOK_FUN(XX) \
@@ -23,21 +33,34 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
+    XX(pipe) \
+    XX(pipe2) \
+    XX(eventfd) \
+    XX(open) \
+    XX(openat) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(pread) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(pwrite) \
+    XX(sendfile) \
+    XX(splice) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
-    XX(setsockopt)
+    XX(setsockopt) \
+    XX(poll) \
+    XX(select) \
+    XX(epoll_wait)
 
 void hook_init() {
     static bool is_inited = false;
@@ -72,12 +95,268 @@ void set_hook_enable(bool flag) {
     t_hook_enable = flag;
 }
 
+// 普通文件IO线程池, 首次使用时按配置创建, 之后修改线程数不生效
+static OffloadPool* get_file_io_pool() {
+    static OffloadPool* s_pool = []() -> OffloadPool* {
+        int threads = g_file_io_threads->getValue();
+        if (threads <= 0) {
+            return nullptr;
+        }
+        return new OffloadPool(threads, "file_io");
+    }();
+    return s_pool;
+}
+
 }
 
-struct timer_info {
-    int cancelled = 0;
+/*
+ * 在文件IO线程池中执行cb, 当前协程挂起, 完成后回到原线程继续执行
+ * 不在IOManager协程中或线程池未开启时返回false, 由调用方直接执行
+ */
+static bool run_in_file_pool(const std::function<void()>& cb) {
+    linko::OffloadPool* pool = linko::get_file_io_pool();
+    return pool && pool->run(cb);
+}
+
+// hook开启时为新建的句柄创建FdCtx
+static void register_fd(int fd) {
+    if (fd >= 0 && linko::t_hook_enable) {
+        linko::FdMgr::GetInstance()->get(fd, true);
+    }
+}
+
+/*
+ * 协程等待IO时的等待记录, 位于协程栈上, 超时定时器嵌入其中, 等待过程不分配内存
+ * 定时器回调只捕获IoWaiter指针, 可以放进std::function的内部缓冲区
+ */
+struct IoWaiter {
+    linko::IOManager* iom = nullptr;
+    int fd = -1;
+    uint32_t event = 0;
+    //超时后设置为ETIMEDOUT, 令牌取消后设置为ECANCELED, 先到者生效
+    std::atomic<int> cancelled{0};
+    //定时器回调执行完毕, 回调可能晚于协程恢复执行, 之前不能释放IoWaiter
+    std::atomic<bool> done{false};
+    linko::Timer timer;
+    linko::CancelWaiter cancel_waiter;
 };
 
+static void cancel_io(IoWaiter* w, int err) {
+    int expected = 0;
+    if (w->cancelled.compare_exchange_strong(expected, err)) {
+        w->iom->cancelEvent(w->fd, (linko::IOManager::Event)(w->event));
+    }
+}
+
+static void on_io_timeout(IoWaiter* w) {
+    cancel_io(w, ETIMEDOUT);
+    w->done.store(true, std::memory_order_release);
+}
+
+static void on_io_cancel(void* arg) {
+    cancel_io((IoWaiter*)arg, ECANCELED);
+}
+
+/*
+ * 挂起当前协程直到fd上的event就绪或超时
+ * 等待时间不超过当前协程的截止时间, 令牌取消时立即唤醒
+ * 返回0表示就绪, 超时返回ETIMEDOUT, 取消返回ECANCELED, addEvent失败返回-1
+ */
+static int wait_io(int fd, uint32_t event, uint64_t timeout, const char* hook_fun_name) {
+    linko::CancelToken::ptr token = linko::CancelToken::GetThis();
+    if (token) {
+        int err = token->check();
+        if (err) {
+            return err;
+        }
+        timeout = std::min(timeout, token->remaining());
+    }
+
+    IoWaiter waiter;
+    waiter.iom = linko::IOManager::GetThis();
+    waiter.fd = fd;
+    waiter.event = event;
+    waiter.cancel_waiter.cb = &on_io_cancel;
+    waiter.cancel_waiter.arg = &waiter;
+
+    bool has_timer = timeout != (uint64_t)-1;
+    //设置了超时时间
+    if (has_timer) {
+        IoWaiter* w = &waiter;
+        waiter.iom->addTimer(&waiter.timer, timeout, [w]() {
+                    on_io_timeout(w);
+                });
+    }
+
+    int rt = waiter.iom->addEvent(fd, (linko::IOManager::Event)(event));
+    //添加失败，取消定时器
+    if (rt == -1) {
+        LINKO_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
+            << fd << ", " << event << ")";
+    } else {
+        /*
+         * 添加成功后，把执行时间让出
+         * 以下两种情况会从此处返回继续执行：
+         *  1. 超时，timer的cancelEvent调用triggerEvent会唤醒
+         *  2. addEvent数据返回了
+         *  3. 令牌被取消, 回调中cancelEvent唤醒
+         */
+        if (token && !token->addWaiter(&waiter.cancel_waiter)) {
+            //注册前已经取消, 由本协程自己唤醒
+            cancel_io(&waiter, ECANCELED);
+        }
+        linko::Fiber::SetWait(hook_fun_name, fd, event);
+        linko::Fiber::YieldToHold();
+    }
+
+    if (token) {
+        token->delWaiter(&waiter.cancel_waiter);
+    }
+    if (has_timer && !waiter.timer.cancel()) {
+        //定时器已经触发, 等待回调执行完
+        while (!waiter.done.load(std::memory_order_acquire)) {
+            linko::Fiber::YieldToReady();
+        }
+    }
+    return rt == -1 ? -1 : waiter.cancelled.load();
+}
+
+/*
+ * poll的等待记录, 每个注册的事件回调和超时定时器都引用它
+ * 回调可能晚于协程恢复执行, pending归零之前不能释放
+ */
+struct PollWaiter {
+    linko::IOManager* iom = nullptr;
+    linko::Fiber::ptr fiber;
+    //只有第一个触发的回调唤醒协程
+    std::atomic<bool> woken{false};
+    //尚未执行的回调数
+    std::atomic<int> pending{0};
+    std::atomic<bool> timed_out{false};
+    linko::Timer timer;
+    linko::CancelWaiter cancel_waiter;
+};
+
+static void poll_wake(PollWaiter* w) {
+    if (!w->woken.exchange(true)) {
+        w->iom->schedule(w->fiber, -1, linko::Scheduler::HIGH);
+    }
+}
+
+static void on_poll_cancel(void* arg) {
+    poll_wake((PollWaiter*)arg);
+}
+
+/*
+ * 为fds注册事件并挂起, 任一事件就绪, 超时或令牌取消后恢复
+ * 返回1表示有事件就绪或被取消, 0表示超时(含到达截止时间), -1表示无法注册事件(如句柄已被其他协程等待)
+ * 是否因取消或截止时间返回由调用方通过CancelToken::Check判断
+ */
+static int poll_wait(linko::IOManager* iom, struct pollfd *fds, nfds_t nfds, int timeout) {
+    linko::CancelToken::ptr token = linko::CancelToken::GetThis();
+    if (token) {
+        uint64_t remaining = token->remaining();
+        if (remaining != (uint64_t)-1 && (timeout < 0 || remaining < (uint64_t)timeout)) {
+            timeout = remaining;
+        }
+    }
+
+    PollWaiter waiter;
+    waiter.iom = iom;
+    waiter.fiber = linko::Fiber::GetThis();
+    waiter.cancel_waiter.cb = &on_poll_cancel;
+    waiter.cancel_waiter.arg = &waiter;
+    PollWaiter* w = &waiter;
+
+    std::vector<std::pair<int, linko::IOManager::Event> > added;
+    bool ok = true;
+    for (nfds_t i = 0; i < nfds && ok; ++i) {
+        if (fds[i].fd < 0) {
+            continue;
+        }
+        linko::IOManager::Event events[2];
+        int cnt = 0;
+        if (fds[i].events & (POLLIN | POLLPRI | POLLRDHUP)) {
+            events[cnt++] = linko::IOManager::READ;
+        }
+        if (fds[i].events & POLLOUT) {
+            events[cnt++] = linko::IOManager::WRITE;
+        }
+        for (int j = 0; j < cnt; ++j) {
+            waiter.pending.fetch_add(1);
+            int rt = iom->tryAddEvent(fds[i].fd, events[j], [w]() {
+                        poll_wake(w);
+                        w->pending.fetch_sub(1);
+                    });
+            if (rt != 0) {
+                waiter.pending.fetch_sub(1);
+                ok = false;
+                break;
+            }
+            added.push_back(std::make_pair(fds[i].fd, events[j]));
+        }
+    }
+
+    bool has_timer = ok && timeout >= 0;
+    if (has_timer) {
+        waiter.pending.fetch_add(1);
+        iom->addTimer(&waiter.timer, timeout, [w]() {
+                    w->timed_out = true;
+                    poll_wake(w);
+                    w->pending.fetch_sub(1);
+                });
+    }
+
+    if (ok) {
+        if (token && !token->addWaiter(&waiter.cancel_waiter)) {
+            poll_wake(w);
+        }
+        if (nfds) {
+            linko::Fiber::SetWait("poll", fds[0].fd, added.empty() ? 0 : added[0].second);
+        } else {
+            linko::Fiber::SetWait("sleep");
+        }
+        linko::Fiber::YieldToHold();
+        if (token) {
+            token->delWaiter(&waiter.cancel_waiter);
+        }
+    } else if (waiter.woken.exchange(true)) {
+        //注册过程中已有事件触发并调度了本协程, 消耗掉这次唤醒
+        linko::Fiber::YieldToHold();
+    }
+
+    //未触发的事件和定时器直接删除, 已触发的等待回调执行完
+    for (auto& i : added) {
+        if (iom->delEvent(i.first, i.second)) {
+            waiter.pending.fetch_sub(1);
+        }
+    }
+    if (has_timer && waiter.timer.cancel()) {
+        waiter.pending.fetch_sub(1);
+    }
+    while (waiter.pending.load() > 0) {
+        linko::Fiber::YieldToReady();
+    }
+
+    if (!ok) {
+        return -1;
+    }
+    return waiter.timed_out ? 0 : 1;
+}
+
+/*
+ * 挂起当前协程ms毫秒, 定时器嵌入在等待记录中
+ * 被取消或到达截止时间时提前返回ECANCELED/ETIMEDOUT, 否则返回0
+ */
+static int sleep_wait(uint64_t ms) {
+    int err = linko::CancelToken::Check();
+    if (err) {
+        return err;
+    }
+    poll_wait(linko::IOManager::GetThis(), nullptr, 0, std::min(ms, (uint64_t)INT_MAX));
+    return linko::CancelToken::Check();
+}
+
 template<typename OriginFun, typename ... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, 
         uint32_t event, int timeout_so, Args&&... args) {
@@ -86,24 +365,52 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    linko::FdCtx::ptr ctx = linko::FdMgr::GetInstance()->get(fd);
-    if (!ctx) {
-        return fun(fd, std::forward<Args>(args)...);
+    //当前协程已取消或超过截止时间, 不再发起新的IO
+    int err = linko::CancelToken::Check();
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    //ctx只在ReadGuard内访问, 取出需要的状态后再执行可能让出的操作
+    bool closed = false;
+    bool direct = true;
+    bool file = false;
+    uint64_t timeout = -1;
+    {
+        linko::FdManager::ReadGuard guard;
+        linko::FdCtx* ctx = linko::FdMgr::GetInstance()->get(fd);
+        if (ctx) {
+            closed = ctx->isClosed();
+            file = ctx->isFile();
+            //不能epoll等待 或 用户设置了非阻塞
+            direct = !ctx->isPollable() || ctx->getUserNonblock();
+            timeout = ctx->getTimeout(timeout_so);
+        }
     }
 
-    if (ctx->isClosed()) {
+    if (closed) {
         //坏文件描述符
         errno = EBADF;
         return -1;
     }
 
-    //非socket 或 用户设置了非阻塞
-    if (!ctx->isSocket() || ctx->getUserNonblock()) {
+    //普通文件总是就绪, 阻塞发生在磁盘IO上, 放到线程池中执行
+    if (file) {
+        ssize_t n = -1;
+        if (run_in_file_pool([&]() {
+                    n = fun(fd, args...);
+                    err = errno;
+                })) {
+            errno = err;
+            return n;
+        }
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    uint64_t timeout = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    if (direct) {
+        return fun(fd, std::forward<Args>(args)...);
+    }
 
 retry:
     //先执行原函数，若函数返回值有效就直接返回
@@ -114,56 +421,18 @@ retry:
         n = fun(fd, std::forward<Args>(args)...);
     }
 
-    //阻塞状态
+    //阻塞状态, 只有这里才需要等待记录和定时器
     if (n == -1 && errno == EAGAIN) {
-        linko::IOManager* iom = linko::IOManager::GetThis();
-        linko::Timer::ptr timer;
-        //tinfo弱指针，可判断tinfo是否已销毁
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        //设置了超时时间
-        if (timeout != (uint64_t)-1) {
-            timer = iom->addConditionTimer(timeout, [winfo, fd, iom, event](){
-                        auto t = winfo.lock();
-                        //tinfo失效 或 设置了错误
-                        if (!t || t->cancelled) {
-                            return;
-                        }
-                        //没错误设置为超时
-                        t->cancelled = ETIMEDOUT;
-                        iom->cancelEvent(fd, (linko::IOManager::Event)(event));
-                    }, winfo);
-        }
-
-        int rt = iom->addEvent(fd, (linko::IOManager::Event)(event));
-        //添加失败，取消定时器
-        if (rt == -1) {
-            LINKO_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
-                << fd << ", " << event << ")";
-            if (timer) {
-                timer->cancel();
-            }
-        } else {
-            /*
-             * 添加成功后，把执行时间让出
-             * 以下两种情况会从此处返回继续执行：
-             *  1. 超时，timer的cancelEvent调用triggerEvent会唤醒
-             *  2. addEvent数据返回了
-             */
-            linko::Fiber::YieldToHold();
-            if (timer) {
-                timer->cancel();
-            }
-
+        int rt = wait_io(fd, event, timeout, hook_fun_name);
+        if (rt > 0) {
             //定时器超时失败
-            if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
-                return -1;
-            }
-
+            errno = rt;
+            return -1;
+        } else if (rt == 0) {
             //数据返回，重新操作
             goto retry;
         }
+        errno = EAGAIN;
     }
 
     return n;
@@ -179,26 +448,12 @@ unsigned int sleep(unsigned int seconds) {
         return sleep_f(seconds);
     }
 
-    linko::Fiber::ptr fiber = linko::Fiber::GetThis();
-    linko::IOManager* iom = linko::IOManager::GetThis();
-
-    //iom->addTimer(seconds * 1000, [iom, fiber](){
-        //iom->schedule(fiber);
-    //});
-    //iom->addTimer(seconds * 1000, std::bind(&linko::IOManager::schedule, iom, fiber));
-
-    /*
-     * bind方法不能绑定模板函数，故需要在函数调用时实力化schedule函数模板参数
-     * 此处将schedule方法的两个参数实例化为 Fiber::ptr 和 int 类型
-     *
-     * iom为函数绑定到实例化对象，fiber和-1为两个参数
-     */
-    iom->addTimer(seconds * 1000, std::bind(
-        (void(linko::Scheduler::*)
-            (linko::Fiber::ptr, int thread))&linko::IOManager::schedule,
-        iom, fiber, -1
-    ));
-    linko::Fiber::YieldToHold();
+    uint64_t end = linko::GetMonotonicMS() + seconds * 1000ull;
+    if (sleep_wait(seconds * 1000ull)) {
+        //提前返回时返回剩余秒数
+        uint64_t now = linko::GetMonotonicMS();
+        return now >= end ? 0 : (end - now + 999) / 1000;
+    }
     return 0;
 }
 
@@ -207,35 +462,32 @@ int usleep(useconds_t usec) {
         return usleep_f(usec);
     }
 
-    linko::Fiber::ptr fiber = linko::Fiber::GetThis();
-    linko::IOManager* iom = linko::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind(
-        (void(linko::Scheduler::*)
-            (linko::Fiber::ptr, int thread))&linko::IOManager::schedule,
-        iom, fiber, -1
-    ));
-
-    linko::Fiber::YieldToHold();
- 
+    int err = sleep_wait(usec / 1000);
+    if (err) {
+        errno = err;
+        return -1;
+    }
     return 0;
 }
 
 int nanosleep(const struct timespec *req, struct timespec *rem) {
     if (!linko::t_hook_enable) {
-        return nanosleep(req, rem);
+        return nanosleep_f(req, rem);
     }
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-    linko::Fiber::ptr fiber = linko::Fiber::GetThis();
-    linko::IOManager* iom = linko::IOManager::GetThis();
-    iom->addTimer(timeout_ms, std::bind(
-        (void(linko::Scheduler::*)
-            (linko::Fiber::ptr, int thread))&linko::IOManager::schedule,
-        iom, fiber, -1
-    ));
-
-    linko::Fiber::YieldToHold();
-
+    uint64_t timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+    uint64_t end = linko::GetMonotonicMS() + timeout_ms;
+    int err = sleep_wait(timeout_ms);
+    if (err) {
+        if (rem) {
+            uint64_t now = linko::GetMonotonicMS();
+            uint64_t left = now >= end ? 0 : end - now;
+            rem->tv_sec = left / 1000;
+            rem->tv_nsec = left % 1000 * 1000 * 1000;
+        }
+        errno = err;
+        return -1;
+    }
     return 0;
 }
 
@@ -252,19 +504,80 @@ int socket(int domain, int type, int protocol) {
     return fd;
 }
 
+int pipe(int pipefd[2]) {
+    int rt = pipe_f(pipefd);
+    if (rt == 0) {
+        register_fd(pipefd[0]);
+        register_fd(pipefd[1]);
+    }
+    return rt;
+}
+
+int pipe2(int pipefd[2], int flags) {
+    int rt = pipe2_f(pipefd, flags);
+    if (rt == 0) {
+        register_fd(pipefd[0]);
+        register_fd(pipefd[1]);
+    }
+    return rt;
+}
+
+int eventfd(unsigned int initval, int flags) {
+    int fd = eventfd_f(initval, flags);
+    register_fd(fd);
+    return fd;
+}
+
+int open(const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, mode_t);
+        va_end(va);
+    }
+    int fd = open_f(pathname, flags, mode);
+    register_fd(fd);
+    return fd;
+}
+
+int openat(int dirfd, const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, mode_t);
+        va_end(va);
+    }
+    int fd = openat_f(dirfd, pathname, flags, mode);
+    register_fd(fd);
+    return fd;
+}
+
 int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms) {
     if (!linko::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    linko::FdCtx::ptr ctx = linko::FdMgr::GetInstance()->get(fd);
-    if (!ctx || ctx->isClosed()) {
+    int err = linko::CancelToken::Check();
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    bool bad = true;
+    bool direct = true;
+    {
+        linko::FdManager::ReadGuard guard;
+        linko::FdCtx* ctx = linko::FdMgr::GetInstance()->get(fd);
+        if (ctx && !ctx->isClosed()) {
+            bad = false;
+            direct = !ctx->isPollable() || ctx->getUserNonblock();
+        }
+    }
+    if (bad) {
         errno = EBADF;
         return  -1;
     }
-    if (!ctx->isSocket()) {
-        return connect_f(fd, addr, addrlen);
-    }
-    if (ctx->getUserNonblock()) {
+    if (direct) {
         return connect_f(fd, addr, addrlen);
     }
 
@@ -275,37 +588,10 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
         return n;
     }
 
-    linko::IOManager* iom = linko::IOManager::GetThis();
-    linko::Timer::ptr timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    if (timeout_ms != (uint64_t)-1) {
-        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() {
-                    auto t = winfo.lock();
-                    if (!t || t->cancelled) {
-                        return;
-                    }
-                    t->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, linko::IOManager::WRITE);
-                }, winfo);
-    }
-
-    int rt = iom->addEvent(fd, linko::IOManager::WRITE);
-    if (rt == 0) {
-        linko::Fiber::YieldToHold();
-        if (timer) {
-            timer->cancel();
-        }
-        if (tinfo->cancelled) {
-            errno = tinfo->cancelled;
-            return -1;
-        }
-    } else {
-        if (timer) {
-            timer->cancel();
-        }
-        LINKO_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
+    int rt = wait_io(fd, linko::IOManager::WRITE, timeout_ms, "connect");
+    if (rt > 0) {
+        errno = rt;
+        return -1;
     }
 
     int error = 0;
@@ -333,6 +619,12 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
     return fd;
 }
 
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    int fd = do_io(s, accept4_f, "accept4", linko::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    register_fd(fd);
+    return fd;
+}
+
 ssize_t read(int fd, void *buf, size_t count) {
     return do_io(fd, read_f, "read", linko::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
@@ -353,6 +645,10 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return do_io(sockfd, recvmsg_f, "recvmsg", linko::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    return do_io(fd, pread_f, "pread", linko::IOManager::READ, SO_RCVTIMEO, buf, count, offset);
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
     return do_io(fd, write_f, "write", linko::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
@@ -373,12 +669,57 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", linko::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    return do_io(fd, pwrite_f, "pwrite", linko::IOManager::WRITE, SO_SNDTIMEO, buf, count, offset);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", linko::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    if (!linko::t_hook_enable || (flags & SPLICE_F_NONBLOCK)) {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    {
+        //任意一端由用户设置为非阻塞, 按原函数执行
+        linko::FdManager::ReadGuard guard;
+        linko::FdCtx* in = linko::FdMgr::GetInstance()->get(fd_in);
+        linko::FdCtx* out = linko::FdMgr::GetInstance()->get(fd_out);
+        if ((in && in->getUserNonblock()) || (out && out->getUserNonblock())) {
+            return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+        }
+    }
+
+    while (true) {
+        ssize_t n = splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+        if (n != -1 || (errno != EAGAIN && errno != EINTR)) {
+            return n;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        //两端都可能导致EAGAIN, 等待没有就绪的一端
+        struct pollfd pfds[2];
+        pfds[0].fd = fd_in;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = fd_out;
+        pfds[1].events = POLLOUT;
+        poll_f(pfds, 2, 0);
+        struct pollfd* wait = pfds[0].revents ? &pfds[1] : &pfds[0];
+        wait->revents = 0;
+        if (poll(wait, 1, -1) < 0) {
+            return -1;
+        }
+    }
+}
+
 int close(int fd) {
     if(!linko::t_hook_enable) {
         return close_f(fd);
     }
 
-    linko::FdCtx::ptr ctx = linko::FdMgr::GetInstance()->get(fd);
+    linko::FdCtx* ctx = linko::FdMgr::GetInstance()->get(fd);
     if(ctx) {
         auto iom = linko::IOManager::GetThis();
         if(iom) {
@@ -397,15 +738,17 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
         {
             int arg = va_arg(va, int);
             va_end(va);
-            linko::FdCtx::ptr ctx = linko::FdMgr::GetInstance()->get(fd);
-            if (!ctx || ctx->isClosed() || !ctx->isSocket()) {
-                return fcntl_f(fd, cmd, arg);
-            }
-            ctx->setUserNonblock(arg & O_NONBLOCK);
-            if (ctx->getSysNonblock()) {
-                arg |= O_NONBLOCK;
-            } else {
-                arg &= ~O_NONBLOCK;
+            {
+                linko::FdManager::ReadGuard guard;
+                linko::FdCtx* ctx = linko::FdMgr::GetInstance()->get(fd);
+                if (ctx && !ctx->isClosed() && ctx->isPollable()) {
+                    ctx->setUserNonblock(arg & O_NONBLOCK);
+                    if (ctx->getSysNonblock()) {
+                        arg |= O_NONBLOCK;
+                    } else {
+                        arg &= ~O_NONBLOCK;
+                    }
+                }
             }
             return fcntl_f(fd, cmd, arg);
         }
@@ -414,8 +757,9 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
         {
             va_end(va);
             int arg = fcntl_f(fd, cmd);
-            linko::FdCtx::ptr ctx = linko::FdMgr::GetInstance()->get(fd);
-            if (!ctx || ctx->isClosed() || !ctx->isSocket()) {
+            linko::FdManager::ReadGuard guard;
+            linko::FdCtx* ctx = linko::FdMgr::GetInstance()->get(fd);
+            if (!ctx || ctx->isClosed() || !ctx->isPollable()) {
                 return arg;
             }
             if (ctx->getUserNonblock()) {
@@ -479,11 +823,11 @@ int ioctl(int fd, unsigned long int request, ...) {
 
     if (FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        linko::FdCtx::ptr ctx = linko::FdMgr::GetInstance()->get(fd);
-        if (!ctx || ctx->isClosed() || !ctx->isSocket()) {
-           return ioctl_f(fd, request, arg);
+        linko::FdManager::ReadGuard guard;
+        linko::FdCtx* ctx = linko::FdMgr::GetInstance()->get(fd);
+        if (ctx && !ctx->isClosed() && ctx->isPollable()) {
+            ctx->setUserNonblock(user_nonblock);
         }
-        ctx->setUserNonblock(user_nonblock);
     }
     return ioctl_f(fd, request, arg);
 }
@@ -499,7 +843,8 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
 
     if (level == SOL_SOCKET) {
         if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            linko::FdCtx::ptr ctx = linko::FdMgr::GetInstance()->get(sockfd);
+            linko::FdManager::ReadGuard guard;
+            linko::FdCtx* ctx = linko::FdMgr::GetInstance()->get(sockfd);
             if (ctx) {
                 const timeval* tv = (const timeval*)optval;
                 ctx->setTimeout(optname, tv->tv_sec * 1000 + tv->tv_usec / 1000);
@@ -509,4 +854,134 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     return setsockopt_f(sockfd, level, optname, optval, optlen);
 }
 
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    linko::IOManager* iom = linko::IOManager::GetThis();
+    if (!linko::t_hook_enable || timeout == 0 || !iom
+            || linko::Fiber::GetThis().get() == linko::Scheduler::GetMainFiber()) {
+        return poll_f(fds, nfds, timeout);
+    }
+
+    uint64_t deadline = timeout > 0 ? linko::GetMonotonicMS() + timeout : -1;
+    //无法注册事件时的重试间隔, 毫秒
+    int retry_ms = 1;
+    while (true) {
+        int err = linko::CancelToken::Check();
+        if (err) {
+            errno = err;
+            return -1;
+        }
+        int n = poll_f(fds, nfds, 0);
+        if (n != 0) {
+            return n;
+        }
+        int wait_ms = -1;
+        if (timeout > 0) {
+            uint64_t now = linko::GetMonotonicMS();
+            if (now >= deadline) {
+                return 0;
+            }
+            wait_ms = deadline - now;
+        }
+        int rt = poll_wait(iom, fds, nfds, wait_ms);
+        if (rt < 0) {
+            //无法注册事件(句柄已被其他协程等待), 挂起一小段时间后重新检查, 不阻塞工作线程
+            int ms = wait_ms >= 0 ? std::min(retry_ms, wait_ms) : retry_ms;
+            sleep_wait(ms);
+            retry_ms = std::min(retry_ms * 2, 50);
+        }
+        //超时, 取消和到达截止时间都回到循环开始判断
+    }
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    if (!linko::t_hook_enable || !linko::IOManager::GetThis()
+            || (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0)) {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+
+    //转换为poll
+    std::vector<struct pollfd> pfds;
+    for (int fd = 0; fd < nfds; ++fd) {
+        short events = 0;
+        if (readfds && FD_ISSET(fd, readfds)) {
+            events |= POLLIN;
+        }
+        if (writefds && FD_ISSET(fd, writefds)) {
+            events |= POLLOUT;
+        }
+        if (exceptfds && FD_ISSET(fd, exceptfds)) {
+            events |= POLLPRI;
+        }
+        if (events) {
+            struct pollfd p;
+            p.fd = fd;
+            p.events = events;
+            p.revents = 0;
+            pfds.push_back(p);
+        }
+    }
+
+    int ms = timeout ? timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000 : -1;
+    int n = poll(pfds.data(), pfds.size(), ms);
+    if (n < 0) {
+        return n;
+    }
+
+    for (auto& i : pfds) {
+        if (i.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    if (readfds) {
+        FD_ZERO(readfds);
+    }
+    if (writefds) {
+        FD_ZERO(writefds);
+    }
+    if (exceptfds) {
+        FD_ZERO(exceptfds);
+    }
+    int count = 0;
+    for (auto& i : pfds) {
+        if (readfds && (i.events & POLLIN) && (i.revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(i.fd, readfds);
+            ++count;
+        }
+        if (writefds && (i.events & POLLOUT) && (i.revents & (POLLOUT | POLLERR))) {
+            FD_SET(i.fd, writefds);
+            ++count;
+        }
+        if (exceptfds && (i.events & POLLPRI) && (i.revents & POLLPRI)) {
+            FD_SET(i.fd, exceptfds);
+            ++count;
+        }
+    }
+    if (timeout && count == 0) {
+        timeout->tv_sec = 0;
+        timeout->tv_usec = 0;
+    }
+    return count;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if (!linko::t_hook_enable || timeout == 0 || !linko::IOManager::GetThis()) {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+    int n = epoll_wait_f(epfd, events, maxevents, 0);
+    if (n != 0) {
+        return n;
+    }
+    //epoll句柄在有事件就绪时可读
+    struct pollfd p;
+    p.fd = epfd;
+    p.events = POLLIN;
+    p.revents = 0;
+    int rt = poll(&p, 1, timeout);
+    if (rt <= 0) {
+        return rt;
+    }
+    return epoll_wait_f(epfd, events, maxevents, 0);
+}
+
 }
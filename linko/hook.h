@@ -2,7 +2,12 @@
 #define __LINKO_HOOK_H__
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <stdint.h>
@@ -12,6 +17,23 @@
 namespace linko {
     bool is_hook_enable();
     void set_hook_enable(bool flag);
+
+    /*
+     * 作用域内关闭当前线程的hook
+     * 持锁期间的IO使用, 避免协程持锁时挂起等待导致同线程其他协程死锁
+     */
+    class HookDisableGuard {
+    public:
+        HookDisableGuard()
+            :m_enable(is_hook_enable()) {
+            set_hook_enable(false);
+        }
+        ~HookDisableGuard() {
+            set_hook_enable(m_enable);
+        }
+    private:
+        bool m_enable;
+    };
 }
 
 extern "C" {
@@ -36,6 +58,25 @@ extern connect_fun connect_f;
 typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+typedef int (*accept4_fun)(int s, struct sockaddr *addr, socklen_t *addrlen, int flags);
+extern accept4_fun accept4_f;
+
+//pipe/eventfd/file
+typedef int (*pipe_fun)(int pipefd[2]);
+extern pipe_fun pipe_f;
+
+typedef int (*pipe2_fun)(int pipefd[2], int flags);
+extern pipe2_fun pipe2_f;
+
+typedef int (*eventfd_fun)(unsigned int initval, int flags);
+extern eventfd_fun eventfd_f;
+
+typedef int (*open_fun)(const char *pathname, int flags, ...);
+extern open_fun open_f;
+
+typedef int (*openat_fun)(int dirfd, const char *pathname, int flags, ...);
+extern openat_fun openat_f;
+
 //read
 typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
 extern read_fun read_f;
@@ -52,6 +93,9 @@ extern recvfrom_fun recvfrom_f;
 typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr *msg, int flags);
 extern recvmsg_fun recvmsg_f;
 
+typedef ssize_t (*pread_fun)(int fd, void *buf, size_t count, off_t offset);
+extern pread_fun pread_f;
+
 //write
 typedef ssize_t (*write_fun)(int fd, const void *buf, size_t count);
 extern write_fun write_f;
@@ -68,6 +112,15 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+typedef ssize_t (*pwrite_fun)(int fd, const void *buf, size_t count, off_t offset);
+extern pwrite_fun pwrite_f;
+
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_fun sendfile_f;
+
+typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+extern splice_fun splice_f;
+
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
@@ -84,6 +137,16 @@ extern getsockopt_fun getsockopt_f;
 typedef int (*setsockopt_fun)(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
 extern setsockopt_fun setsockopt_f;
 
+//poll
+typedef int (*poll_fun)(struct pollfd *fds, nfds_t nfds, int timeout);
+extern poll_fun poll_f;
+
+typedef int (*select_fun)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+extern select_fun select_f;
+
+typedef int (*epoll_wait_fun)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+extern epoll_wait_fun epoll_wait_f;
+
 extern int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms);
 }
 
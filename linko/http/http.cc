@@ -188,11 +188,13 @@ void HttpResponse::delHeader(const std::string& key) {
 }
 
 std::ostream& HttpResponse::dump(std::ostream& os) const {
-    os << " HTTP/"
+    os << "HTTP/"
        << ((uint32_t)(m_version >> 4))
        << "."
        << ((uint32_t)(m_version & 0x0F))
        << " "
+       << (uint32_t)m_status
+       << " "
        << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason)
        << "\r\n";
 
@@ -1,15 +1,33 @@
 #include "http_connection.h"
 #include "http_parser.h"
 #include "../log.h"
+#include "../cancel.h"
 
 #include <string>
 #include <sstream>
+#include <string.h>
 
 namespace linko {
 namespace http {
 
 static linko::Logger::ptr g_logger = LINKO_LOG_NAME("system");
 
+/*
+ * 当前协程已取消或超过截止时间时返回对应结果, 否则返回nullptr
+ * 请求中途被打断时err为失败时的errno
+ */
+static HttpResult::ptr CancelResult(int err, const std::string& msg) {
+    if (err == ECANCELED) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::CANCELLED
+                , nullptr, "cancelled: " + msg);
+    }
+    if (err == ETIMEDOUT && CancelToken::Check() == ETIMEDOUT) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
+                , nullptr, "deadline exceeded: " + msg);
+    }
+    return nullptr;
+}
+
 std::string HttpResult::toString() const {
     std::stringstream ss;
     ss << "[HttpResult result=" << result
@@ -21,7 +39,7 @@ std::string HttpResult::toString() const {
 
 HttpConnection::HttpConnection(Socket::ptr sock, bool owner)
     : SocketStream(sock, owner) {
-    m_createTime = linko::GetCurrentMS();
+    m_createTime = linko::GetCachedMonotonicMS();
 }
 
 HttpConnection::~HttpConnection() {
@@ -89,7 +107,7 @@ HttpResponse::ptr HttpConnection::recvResponse() {
             } while (!parser->isFinished());
             len -= 2;
 
-            LINKO_LOG_INFO(g_logger) << "content_len=" << client_parser.content_len;
+            LINKO_LOG_EVERY_N(g_logger, linko::LogLevel::INFO, 100) << "content_len=" << client_parser.content_len;
 
             // body长度小于缓冲区剩余数据长度
             if (client_parser.content_len <= len) {
@@ -122,10 +140,10 @@ HttpResponse::ptr HttpConnection::recvResponse() {
 
             int len = 0;
             if (length >= offset) {
-                body.append(data, offset);
+                memcpy(&body[0], data, offset);
                 len = offset;
             } else {
-                body.append(data, length);
+                memcpy(&body[0], data, length);
                 len = length;
             }
             length -= offset;
@@ -235,6 +253,11 @@ HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
 HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
                              , Uri::ptr uri
                              , uint64_t timeout_ms) {
+    // 截止时间已过或已取消时不再建立连接
+    HttpResult::ptr cancelled = CancelResult(CancelToken::Check(), uri->getHost());
+    if (cancelled) {
+        return cancelled;
+    }
     // 通过uri创建address
     Address::ptr addr = uri->createAddress();
     if (!addr) {
@@ -251,6 +274,10 @@ HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
     }
     // 发起连接请求
     if (!sock->connect(addr)) {
+        cancelled = CancelResult(errno, "connect " + addr->toString());
+        if (cancelled) {
+            return cancelled;
+        }
         return std::make_shared<HttpResult>((int)HttpResult::Error::CONNECT_FAIL
                 , nullptr, "connect fail: " + addr->toString());
     }
@@ -264,6 +291,10 @@ HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
                 , nullptr, "send request closed by peer: " + addr->toString());
     }
     if (rt < 0) {
+        cancelled = CancelResult(errno, "send request " + addr->toString());
+        if (cancelled) {
+            return cancelled;
+        }
         return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_SOCKET_ERROR
                 , nullptr, "send request socket error errno=" + std::to_string(errno)
                 + " errstr=" + std::string(std::strerror(errno)));
@@ -271,6 +302,10 @@ HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
     // 接收响应报文
     auto rsp = conn->recvResponse();
     if (!rsp) {
+        cancelled = CancelResult(errno, "recv response " + addr->toString());
+        if (cancelled) {
+            return cancelled;
+        }
         return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
                 , nullptr, "recv response timeout: " + addr->toString()
                 + " timeout_ms:" + std::to_string(timeout_ms));
@@ -293,7 +328,7 @@ HttpConnectionPool::HttpConnectionPool(const std::string& host
 }
 
 HttpConnection::ptr HttpConnectionPool::getConnection() {
-    uint64_t now_ms = linko::GetCurrentMS();
+    uint64_t now_ms = linko::GetCachedMonotonicMS();
     std::vector<HttpConnection*> invalid_conns;
     HttpConnection* ptr = nullptr;
     MutexType::Lock lock(m_mutex);
@@ -345,7 +380,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
 void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool) {
     ++ptr->m_request;
     if (!ptr->isConnected()
-            || ((ptr->m_createTime + pool->m_maxAliveTime) <= linko::GetCurrentMS())
+            || ((ptr->m_createTime + pool->m_maxAliveTime) <= linko::GetCachedMonotonicMS())
             || (ptr->m_request >= pool->m_maxRequest)) {
         delete ptr;
         --pool->m_total;
@@ -447,6 +482,10 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
 
 HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
                          , uint64_t timeout_ms) {
+    HttpResult::ptr cancelled = CancelResult(CancelToken::Check(), m_host);
+    if (cancelled) {
+        return cancelled;
+    }
     auto conn = getConnection();
     if (!conn) {
         return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_GET_CONNECTION_FAIL
@@ -464,12 +503,24 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
                 , nullptr, "send request closed by peer: " + sock->getRemoteAddress()->toString());
     }
     if (rt < 0) {
+        // 请求可能只发出一部分, 连接不能再放回连接池
+        int err = errno;
+        sock->close();
+        cancelled = CancelResult(err, "send request " + m_host);
+        if (cancelled) {
+            return cancelled;
+        }
+        errno = err;
         return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_SOCKET_ERROR
                 , nullptr, "send request socket error errno=" + std::to_string(errno)
                 + " errstr=" + std::string(std::strerror(errno)));
     }
     auto rsp = conn->recvResponse();
     if (!rsp) {
+        cancelled = CancelResult(errno, "recv response " + m_host);
+        if (cancelled) {
+            return cancelled;
+        }
         return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
                 , nullptr, "recv response timeout: " + sock->getRemoteAddress()->toString()
                 + " timeout_ms:" + std::to_string(timeout_ms));
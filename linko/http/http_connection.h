@@ -27,6 +27,8 @@ struct HttpResult {
         CREATE_SOCKET_ERROR = 7,
         POOL_GET_CONNECTION_FAIL = 8,
         POOL_INVALIDE_CONNECTION = 9,
+        // 当前协程的令牌已取消
+        CANCELLED = 10,
     };
 
     // _result: 错误码, _response: 响应构造体, _error: 错误描述
@@ -1,36 +1,127 @@
 #include "http_server.h"
+#include "http_trace.h"
 #include "../log.h"
+#include "../config.h"
 
 namespace linko {
 namespace http {
 
 static linko::Logger::ptr g_logger = LINKO_LOG_NAME("system");
 
+// 内置指标页面的路径, 为空时不注册
+static linko::ConfigVar<std::string>::ptr g_http_server_metrics_path =
+    linko::Config::Lookup("http_server.metrics_path", std::string("/metrics"),
+            "http server builtin metrics servlet path");
+
+// 采样请求记录的查看路径, 为空时不注册
+// 会暴露请求路径、请求id和各阶段耗时, 默认关闭, 只在内部管理端口上配置
+static linko::ConfigVar<std::string>::ptr g_http_server_trace_path =
+    linko::Config::Lookup("http_server.trace_path", std::string(""),
+            "http server builtin request trace servlet path");
+
+// 存活协程列表的查看路径, 为空时不注册
+// 会暴露调用栈和等待的fd, 默认关闭, 只在内部管理端口上配置
+static linko::ConfigVar<std::string>::ptr g_http_server_fiber_path =
+    linko::Config::Lookup("http_server.fiber_path", std::string(""),
+            "http server builtin fiber dump servlet path");
+
+// 统计耗时的阶段区间, 与m_phaseLatency对应
+static const struct {
+    const char* name;
+    HttpTrace::Phase from;
+    HttpTrace::Phase to;
+} s_phase_spans[] = {
+    // 连接在调度队列中等待
+    {"queue", HttpTrace::ACCEPTED, HttpTrace::STARTED},
+    {"wait_first_byte", HttpTrace::STARTED, HttpTrace::FIRST_BYTE},
+    {"recv_headers", HttpTrace::FIRST_BYTE, HttpTrace::HEADERS_PARSED},
+    {"recv_body", HttpTrace::HEADERS_PARSED, HttpTrace::DISPATCH_START},
+    {"servlet", HttpTrace::DISPATCH_START, HttpTrace::DISPATCH_END},
+    {"send", HttpTrace::DISPATCH_END, HttpTrace::RESPONSE_FLUSHED},
+};
+
 HttpServer::HttpServer(bool keepalive, linko::IOManager* worker
                                     , linko::IOManager* accept_worker)
     : TcpServer(worker, accept_worker)
     , m_isKeepalive(keepalive) {
     m_dispatch.reset(new ServletDispatch);
+    const std::string& path = g_http_server_metrics_path->getValue();
+    if (!path.empty()) {
+        m_dispatch->addServlet(path, std::make_shared<MetricsServlet>());
+    }
+    const std::string& trace_path = g_http_server_trace_path->getValue();
+    if (!trace_path.empty()) {
+        m_dispatch->addServlet(trace_path, std::make_shared<HttpTraceServlet>());
+    }
+    const std::string& fiber_path = g_http_server_fiber_path->getValue();
+    if (!fiber_path.empty()) {
+        m_dispatch->addServlet(fiber_path, std::make_shared<FiberServlet>());
+    }
+}
+
+bool HttpServer::start() {
+    MetricLabels labels = {{"server", getName()}};
+    m_requestCounter = Metrics::AddCounter("linko_http_requests_total"
+            , "http requests received", labels);
+    for (int i = 0; i < 5; ++i) {
+        MetricLabels cl = labels;
+        cl["code"] = std::to_string(i + 1) + "xx";
+        m_responseCounter[i] = Metrics::AddCounter("linko_http_responses_total"
+                , "http responses sent by status class", cl);
+    }
+    m_requestLatency = Metrics::AddHistogram("linko_http_request_duration_seconds"
+            , "time from request parsed to response sent", labels);
+    m_phaseLatency.clear();
+    for (auto& i : s_phase_spans) {
+        MetricLabels pl = labels;
+        pl["phase"] = i.name;
+        m_phaseLatency.push_back(Metrics::AddHistogram("linko_http_phase_seconds"
+                , "time spent in each phase of http request handling", pl));
+    }
+    return TcpServer::start();
 }
 
 void HttpServer::handleClient(Socket::ptr client) {
     HttpSession::ptr session(new HttpSession(client));
+    HttpTrace trace;
+    trace.ticks[HttpTrace::ACCEPTED] = GetAcceptTicks();
+    trace.mark(HttpTrace::STARTED);
     do {
         // 接收请求报文
-        auto req = session->recvRequest();    
+        auto req = session->recvRequest(&trace);
         if (!req) {
-            LINKO_LOG_WARN(g_logger) << "recv http request fail, errno="
+            LINKO_LOG_EVERY_MS(g_logger, linko::LogLevel::WARN, 1000) << "recv http request fail, errno="
                 << errno << " errstr=" << strerror(errno)
                 << " client:" << *client;
             break;
         }
+        m_requestCounter->inc();
+
+        // 请求id保存在协程局部存储中, 处理过程中的日志和派生的协程都能取到
+        std::string request_id = req->getHeader("X-Request-Id");
+        if (!request_id.empty()) {
+            SetRequestId(request_id);
+        } else {
+            ClearRequestId();
+        }
 
         // 创建响应报文
         HttpResponse::ptr rsp(new HttpResponse(req->getVersion()
                     , req->isClose() || !m_isKeepalive));
 
+        trace.mark(HttpTrace::DISPATCH_START);
         m_dispatch->handle(req, rsp, session);
+        trace.mark(HttpTrace::DISPATCH_END);
         session->sendResponse(rsp);
+        trace.mark(HttpTrace::RESPONSE_FLUSHED);
+
+        int code = (int)rsp->getStatus() / 100;
+        if (code >= 1 && code <= 5) {
+            m_responseCounter[code - 1]->inc();
+        }
+        onTrace(trace, req, rsp, request_id);
+        // 长连接上后续请求从读到数据开始计时
+        trace = HttpTrace();
 
         if (!m_isKeepalive || req->isClose()) {
             break;
@@ -39,5 +130,33 @@ void HttpServer::handleClient(Socket::ptr client) {
     session->close();
 }
 
+void HttpServer::onTrace(const HttpTrace& trace, HttpRequest::ptr req
+        , HttpResponse::ptr rsp, const std::string& request_id) {
+    for (size_t i = 0; i < m_phaseLatency.size(); ++i) {
+        int64_t us = trace.elapsedUS(s_phase_spans[i].from, s_phase_spans[i].to);
+        if (us >= 0) {
+            m_phaseLatency[i]->observe(us);
+        }
+    }
+    int64_t total = trace.elapsedUS(HttpTrace::HEADERS_PARSED, HttpTrace::RESPONSE_FLUSHED);
+    m_requestLatency->observe(total >= 0 ? total : 0);
+
+    HttpTraceRing* ring = HttpTraceMgr::GetInstance();
+    HttpTrace::Phase first = trace.ticks[HttpTrace::ACCEPTED]
+        ? HttpTrace::ACCEPTED : HttpTrace::FIRST_BYTE;
+    total = trace.elapsedUS(first, HttpTrace::RESPONSE_FLUSHED);
+    if (!ring->shouldRecord(total >= 0 ? total : 0)) {
+        return;
+    }
+    HttpTraceRing::Record record;
+    record.time_ms = GetCurrentMS();
+    record.server = getName();
+    record.method = HttpMethodToString(req->getMethod());
+    record.path = req->getPath();
+    record.request_id = request_id;
+    record.status = (int)rsp->getStatus();
+    ring->add(trace, record);
+}
+
 }
 }
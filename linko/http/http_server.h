@@ -4,6 +4,7 @@
 #include "../tcp_server.h"
 #include "http_session.h"
 #include "servlet.h"
+#include "http_trace.h"
 
 #include <memory>
 
@@ -23,13 +24,25 @@ public:
 
     ServletDispatch::ptr getServletDispatch() const { return m_dispatch; }
 
+    virtual bool start() override;
+
 protected:
     virtual void handleClient(Socket::ptr client);
 
+private:
+    // 各阶段耗时计入直方图, 按采样记录请求
+    void onTrace(const HttpTrace& trace, HttpRequest::ptr req
+            , HttpResponse::ptr rsp, const std::string& request_id);
+
 private:
     // 是否支持长连接
     bool m_isKeepalive;
     ServletDispatch::ptr m_dispatch;
+    // 请求数, 按状态码类别(1xx~5xx)统计的响应数, 请求处理耗时
+    Counter::ptr m_requestCounter;
+    Counter::ptr m_responseCounter[5];
+    Histogram::ptr m_requestLatency;
+    std::vector<Histogram::ptr> m_phaseLatency;
 
 };
 
@@ -1,5 +1,8 @@
 #include "http_session.h"
 #include "http_parser.h"
+#include "http_trace.h"
+
+#include <string.h>
 
 namespace linko {
 namespace http {
@@ -8,7 +11,7 @@ HttpSession::HttpSession(Socket::ptr sock, bool owner) \
     : SocketStream(sock, owner) {
 }
 
-HttpRequest::ptr HttpSession::recvRequest() {
+HttpRequest::ptr HttpSession::recvRequest(HttpTrace* trace) {
     HttpRequestParser::ptr parser(new HttpRequestParser);
     uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize(); 
     std::shared_ptr<char> buffer(
@@ -23,6 +26,9 @@ HttpRequest::ptr HttpSession::recvRequest() {
             close();
             return nullptr;
         }
+        if (trace) {
+            trace->markOnce(HttpTrace::FIRST_BYTE);
+        }
         // 当前已读取的数据长度
         len += offset;
         // execute会将data指针向后移动nparse个字节
@@ -42,6 +48,9 @@ HttpRequest::ptr HttpSession::recvRequest() {
             break;
         }
     }while (true);
+    if (trace) {
+        trace->mark(HttpTrace::HEADERS_PARSED);
+    }
 
     int64_t length = parser->getContentLength();
     if (length > 0) {
@@ -51,10 +60,10 @@ HttpRequest::ptr HttpSession::recvRequest() {
         int len = 0;
         // 如果body长度比缓冲区剩余的还大，将缓冲区全部加入
         if (length >= offset) {
-            body.append(data, offset);
+            memcpy(&body[0], data, offset);
             len = offset;
         } else {
-            body.append(data, length);
+            memcpy(&body[0], data, length);
             len = length;
         }
         length -= offset;
@@ -8,12 +8,15 @@ namespace linko {
 namespace http {
 
 
+struct HttpTrace;
+
 class HttpSession : public SocketStream {
 public:
     typedef std::shared_ptr<HttpSession> ptr;
 
     HttpSession(Socket::ptr sock, bool owner = true);
-    HttpRequest::ptr recvRequest();
+    // trace不为空时记录读到首段数据和请求头解析完成的时间
+    HttpRequest::ptr recvRequest(HttpTrace* trace = nullptr);
 
     // 返回值
     //  >0 发送成功
@@ -0,0 +1,135 @@
+#include "http_trace.h"
+#include "../config.h"
+
+#include <time.h>
+
+namespace linko {
+namespace http {
+
+static linko::ConfigVar<uint32_t>::ptr g_http_trace_sample =
+    linko::Config::Lookup("http_server.trace.sample", (uint32_t)0,
+            "record one of every n http requests, 0 disables sampling");
+
+static linko::ConfigVar<uint32_t>::ptr g_http_trace_slow_ms =
+    linko::Config::Lookup("http_server.trace.slow_ms", (uint32_t)0,
+            "always record http requests slower than this, 0 disables");
+
+static linko::ConfigVar<uint32_t>::ptr g_http_trace_capacity =
+    linko::Config::Lookup("http_server.trace.capacity", (uint32_t)1024,
+            "recent http request traces kept in memory");
+
+int64_t HttpTrace::elapsedUS(Phase from, Phase to) const {
+    if (!ticks[from] || !ticks[to] || ticks[to] < ticks[from]) {
+        return -1;
+    }
+    return TicksToUS(ticks[to] - ticks[from]);
+}
+
+const char* HttpTrace::PhaseToString(Phase phase) {
+    switch (phase) {
+#define XX(name, str) \
+        case name: return str;
+        XX(ACCEPTED, "accepted");
+        XX(STARTED, "started");
+        XX(FIRST_BYTE, "first_byte");
+        XX(HEADERS_PARSED, "headers_parsed");
+        XX(DISPATCH_START, "dispatch_start");
+        XX(DISPATCH_END, "dispatch_end");
+        XX(RESPONSE_FLUSHED, "response_flushed");
+#undef XX
+        default:
+            return "unknown";
+    }
+}
+
+bool HttpTraceRing::shouldRecord(uint64_t total_us) {
+    uint32_t slow_ms = g_http_trace_slow_ms->getValue();
+    if (slow_ms && total_us >= slow_ms * 1000ul) {
+        return true;
+    }
+    uint32_t sample = g_http_trace_sample->getValue();
+    return sample && m_seq.fetch_add(1, std::memory_order_relaxed) % sample == 0;
+}
+
+void HttpTraceRing::add(const HttpTrace& trace, Record& record) {
+    uint64_t base = 0;
+    for (int i = 0; i < HttpTrace::PHASE_COUNT; ++i) {
+        if (trace.ticks[i] && (!base || trace.ticks[i] < base)) {
+            base = trace.ticks[i];
+        }
+    }
+    for (int i = 0; i < HttpTrace::PHASE_COUNT; ++i) {
+        record.offset_us[i] = trace.ticks[i] ? (int64_t)TicksToUS(trace.ticks[i] - base) : -1;
+    }
+
+    size_t capacity = g_http_trace_capacity->getValue();
+    MutexType::Lock lock(m_mutex);
+    if (m_records.size() != capacity) {
+        // 容量变化时丢弃旧记录
+        m_records.clear();
+        m_records.resize(capacity);
+        m_next = 0;
+    }
+    if (capacity == 0) {
+        return;
+    }
+    std::swap(m_records[m_next], record);
+    m_next = (m_next + 1) % capacity;
+}
+
+void HttpTraceRing::dump(std::ostream& os, size_t limit) {
+    std::vector<Record> records;
+    {
+        MutexType::Lock lock(m_mutex);
+        size_t n = m_records.size();
+        for (size_t i = 1; i <= n && records.size() < limit; ++i) {
+            const Record& r = m_records[(m_next + n - i) % n];
+            if (!r.time_ms) {
+                break;
+            }
+            records.push_back(r);
+        }
+    }
+
+    for (auto& r : records) {
+        time_t t = r.time_ms / 1000;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        char buf[64];
+        size_t len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        snprintf(buf + len, sizeof(buf) - len, ".%03u", (unsigned)(r.time_ms % 1000));
+        int64_t total = r.offset_us[HttpTrace::RESPONSE_FLUSHED];
+        os << buf << " " << r.server << " " << r.method << " " << r.path
+           << " status=" << r.status;
+        if (!r.request_id.empty()) {
+            os << " request_id=" << r.request_id;
+        }
+        os << " total_us=" << total;
+        for (int i = 0; i < HttpTrace::PHASE_COUNT; ++i) {
+            if (r.offset_us[i] >= 0) {
+                os << " " << HttpTrace::PhaseToString((HttpTrace::Phase)i) << "=" << r.offset_us[i];
+            }
+        }
+        os << "\n";
+    }
+}
+
+HttpTraceServlet::HttpTraceServlet()
+    : Servlet("HttpTraceServlet") {
+}
+
+int32_t HttpTraceServlet::handle(linko::http::HttpRequest::ptr request
+        , linko::http::HttpResponse::ptr response
+        , linko::http::HttpSession::ptr session) {
+    size_t limit = request->getParamAs<size_t>("limit", -1);
+    std::stringstream ss;
+    HttpTraceMgr::GetInstance()->dump(ss, limit);
+    response->setStatus(linko::http::HttpStatus::OK);
+    response->setHeader("Server", "linko/1.0.0");
+    response->setHeader("Content-Type", "text/plain");
+    response->setBody(ss.str());
+    return 0;
+}
+
+}
+}
@@ -0,0 +1,107 @@
+#ifndef __LINKO_HTTP_TRACE_H__
+#define __LINKO_HTTP_TRACE_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <ostream>
+
+#include "../util.h"
+#include "../mutex.h"
+#include "../singleton.h"
+#include "servlet.h"
+
+namespace linko {
+namespace http {
+
+/*
+ * 单个请求各阶段的时间戳(GetCurrentTicks), 未经过的阶段为0
+ * 长连接上只有第一个请求记录ACCEPTED和STARTED
+ */
+struct HttpTrace {
+    enum Phase {
+        // 连接被accept
+        ACCEPTED = 0,
+        // 处理连接的协程开始执行
+        STARTED,
+        // 读到请求的第一段数据
+        FIRST_BYTE,
+        // 请求头解析完成
+        HEADERS_PARSED,
+        // 请求体读取完成, 交给servlet
+        DISPATCH_START,
+        DISPATCH_END,
+        // 响应写入socket
+        RESPONSE_FLUSHED,
+        PHASE_COUNT
+    };
+
+    uint64_t ticks[PHASE_COUNT] = {0};
+
+    void mark(Phase phase) { ticks[phase] = GetCurrentTicks(); }
+    void markOnce(Phase phase) {
+        if (!ticks[phase]) {
+            mark(phase);
+        }
+    }
+    // from到to的耗时(微秒), 任一阶段未记录返回-1
+    int64_t elapsedUS(Phase from, Phase to) const;
+
+    static const char* PhaseToString(Phase phase);
+};
+
+/*
+ * 采样的请求记录, 环形保存最近的http_server.trace.capacity条
+ * 每http_server.trace.sample个请求采样一次, 耗时超过http_server.trace.slow_ms的请求总是记录
+ */
+class HttpTraceRing {
+public:
+    typedef SpinLock MutexType;
+
+    struct Record {
+        uint64_t time_ms = 0;
+        std::string server;
+        std::string method;
+        std::string path;
+        std::string request_id;
+        int status = 0;
+        // 各阶段相对第一个记录阶段的偏移(微秒), 未经过为-1
+        int64_t offset_us[HttpTrace::PHASE_COUNT];
+    };
+
+    // total_us为请求总耗时, 返回是否需要记录
+    bool shouldRecord(uint64_t total_us);
+    // 由trace计算record中各阶段的偏移后加入
+    void add(const HttpTrace& trace, Record& record);
+
+    // 由新到旧输出最多limit条
+    void dump(std::ostream& os, size_t limit = -1);
+
+private:
+    MutexType m_mutex;
+    std::vector<Record> m_records;
+    // 下一条写入的位置
+    size_t m_next = 0;
+    std::atomic<uint64_t> m_seq = {0};
+};
+
+typedef Singleton<HttpTraceRing> HttpTraceMgr;
+
+/*
+ * 输出HttpTraceRing中的记录, 参数limit限制条数
+ */
+class HttpTraceServlet : public Servlet {
+public:
+    typedef std::shared_ptr<HttpTraceServlet> ptr;
+
+    HttpTraceServlet();
+    virtual int32_t handle(linko::http::HttpRequest::ptr request
+            , linko::http::HttpResponse::ptr response
+            , linko::http::HttpSession::ptr session) override;
+};
+
+}
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "servlet.h"
+#include "../metrics.h"
+#include "../fiber.h"
 #include <fnmatch.h>
 
 namespace linko {
@@ -126,5 +128,35 @@ int32_t NotFoundServlet::handle(linko::http::HttpRequest::ptr request
     response->setBody(RSP_BODY);
     return 0;
 }
+MetricsServlet::MetricsServlet()
+    : Servlet("MetricsServlet") {
+}
+
+int32_t MetricsServlet::handle(linko::http::HttpRequest::ptr request
+        , linko::http::HttpResponse::ptr response
+        , linko::http::HttpSession::ptr session) {
+    response->setStatus(linko::http::HttpStatus::OK);
+    response->setHeader("Server", "linko/1.0.0");
+    response->setHeader("Content-Type", "text/plain; version=0.0.4");
+    response->setBody(linko::Metrics::ToString());
+    return 0;
+}
+
+FiberServlet::FiberServlet()
+    : Servlet("FiberServlet") {
+}
+
+int32_t FiberServlet::handle(linko::http::HttpRequest::ptr request
+        , linko::http::HttpResponse::ptr response
+        , linko::http::HttpSession::ptr session) {
+    std::stringstream ss;
+    linko::Fiber::DumpAll(ss);
+    response->setStatus(linko::http::HttpStatus::OK);
+    response->setHeader("Server", "linko/1.0.0");
+    response->setHeader("Content-Type", "text/plain");
+    response->setBody(ss.str());
+    return 0;
+}
+
 }
 }
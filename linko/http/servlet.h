@@ -93,6 +93,32 @@ public:
             , linko::http::HttpSession::ptr session) override;
 };
 
+/*
+ * 以Prometheus文本格式输出Metrics中的全部指标
+ */
+class MetricsServlet : public Servlet {
+public:
+    typedef std::shared_ptr<MetricsServlet> ptr;
+
+    MetricsServlet();
+    virtual int32_t handle(linko::http::HttpRequest::ptr request
+            , linko::http::HttpResponse::ptr response
+            , linko::http::HttpSession::ptr session) override;
+};
+
+/*
+ * 输出所有存活协程的状态(Fiber::DumpAll)
+ */
+class FiberServlet : public Servlet {
+public:
+    typedef std::shared_ptr<FiberServlet> ptr;
+
+    FiberServlet();
+    virtual int32_t handle(linko::http::HttpRequest::ptr request
+            , linko::http::HttpResponse::ptr response
+            , linko::http::HttpSession::ptr session) override;
+};
+
 }
 }
 
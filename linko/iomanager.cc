@@ -1,11 +1,13 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "hook.h"
 
 #include <errno.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <algorithm>
 
 namespace linko {
 
@@ -35,10 +37,11 @@ void IOManager::FdContext::triggerEvent(Event event) {
     //触发该事件就将该事件从注册事件中删除
     events = (Event)(events & ~event);
     EventContext& ctx = getContext(event);
+    //等待IO的协程已经在处理请求, 优先于新任务恢复
     if (ctx.cb) {
-        ctx.scheduler->schedule(&ctx.cb);
+        ctx.scheduler->schedule(&ctx.cb, -1, Scheduler::HIGH);
     } else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, -1, Scheduler::HIGH);
     }
     ctx.scheduler = nullptr;
 }
@@ -49,7 +52,8 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
     m_epfd = epoll_create(5000);
     LINKO_ASSERT(m_epfd > 0);
 
-    int rt = pipe(m_tickleFds);
+    //tickle管道由IOManager自己管理, 不经过hook
+    int rt = pipe_f(m_tickleFds);
     LINKO_ASSERT(!rt);
 
     epoll_event event;
@@ -70,12 +74,37 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
     //初始化socket事件上下文数组
     contextResize(32);
 
+    MetricLabels labels = {{"scheduler", getName()}};
+    m_wakeupCounter = Metrics::AddCounter("linko_iomanager_wakeups_total"
+            , "epoll_wait returns in idle", labels);
+    m_timerCounter = Metrics::AddCounter("linko_timers_expired_total"
+            , "expired timer callbacks scheduled", labels);
+    m_metrics.push_back(m_wakeupCounter);
+    m_metrics.push_back(m_timerCounter);
+    static const char* s_event_names[2] = {"read", "write"};
+    for (int i = 0; i < 2; ++i) {
+        MetricLabels el = labels;
+        el["event"] = s_event_names[i];
+        m_eventCounter[i] = Metrics::AddCounter("linko_iomanager_events_total"
+                , "io events triggered", el);
+        m_metrics.push_back(m_eventCounter[i]);
+    }
+    m_metrics.push_back(Metrics::AddGauge("linko_iomanager_pending_events"
+            , "registered io events and external waits not yet triggered", labels, [this]() {
+        return (double)m_pendingEventCount;
+    }));
+    m_metrics.push_back(Metrics::AddGauge("linko_timers"
+            , "timers waiting to expire", labels, [this]() {
+        return (double)getTimerCount();
+    }));
+
     start();
 }
 
 
 IOManager::~IOManager() {
     stop();
+    Metrics::Del(m_metrics);
     close(m_epfd);
     close(m_tickleFds[0]);
     close(m_tickleFds[1]);
@@ -101,6 +130,14 @@ void IOManager::contextResize(size_t size) {
 
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+    return addEvent(fd, event, cb, true);
+}
+
+int IOManager::tryAddEvent(int fd, Event event, std::function<void()> cb) {
+    return addEvent(fd, event, cb, false);
+}
+
+int IOManager::addEvent(int fd, Event event, std::function<void()>& cb, bool strict) {
     FdContext* fd_ctx = nullptr;
     RWMutexType::ReadLock lock(m_mutex);
 
@@ -112,12 +149,15 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         lock.unlock();
         RWMutexType::WriteLock lock2(m_mutex);
         //扩充容器
-        contextResize(m_fdContexts.size() * 1.5);
+        contextResize(std::max<size_t>(m_fdContexts.size(), fd + 1) * 1.5);
         fd_ctx = m_fdContexts[fd];
     }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     //一般同一个句柄添加事件相同，可能为两个线程在操纵同一个句柄
+    if ((fd_ctx->events & event) && !strict) {
+        return 1;
+    }
     if (fd_ctx->events & event) {
         LINKO_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
             << " event=" << event
@@ -288,7 +328,7 @@ void IOManager::tickle() {
         return;
     }
     //边缘触发，有任务时，往pipe里写入一个字节数据，就会唤醒epoll_wait
-    int rt = write(m_tickleFds[1], "T", 1);
+    int rt = write_f(m_tickleFds[1], "T", 1);
     LINKO_ASSERT(rt == 1);
 } 
 
@@ -345,18 +385,22 @@ void IOManager::idle() {
              *  2. 关注的socket有数据到达
              *  3. 通过tickle唤醒
              */
-            rt = epoll_wait(m_epfd, events, 64, (int)next_timeout);
+            rt = epoll_wait_f(m_epfd, events, 64, (int)next_timeout);
             if (rt < 0 && errno == EINTR) {
                 //发生系统中断EINTR，需要重新尝试epoll_wait
             } else {
                 break;
             }
         } while (true);
+        m_wakeupCounter->inc();
+        //每轮唤醒刷新一次本线程的缓存时间
+        UpdateCachedMonotonicMS();
 
         std::vector<std::function<void()> > cbs;
         //获取超时任务，并放入任务队列
         listExpiredCb(cbs);
         if (!cbs.empty()) {
+            m_timerCounter->inc(cbs.size());
             schedule(cbs.begin(), cbs.end());
             cbs.clear();
         }
@@ -367,7 +411,7 @@ void IOManager::idle() {
             if (event.data.fd == m_tickleFds[0]) {
                 uint8_t dummy;
                 //将第一个字节无效数据取出
-                while (read(m_tickleFds[0], &dummy, 1) == 1) ;
+                while (read_f(m_tickleFds[0], &dummy, 1) == 1) ;
                 continue;
             }
 
@@ -411,11 +455,13 @@ void IOManager::idle() {
             if (real_events & READ) {
                 fd_ctx->triggerEvent(READ);
                 --m_pendingEventCount;
+                m_eventCounter[0]->inc();
             }
 
             if (real_events & WRITE) {
                 fd_ctx->triggerEvent(WRITE);
                 --m_pendingEventCount;
+                m_eventCounter[1]->inc();
             }
         }
 
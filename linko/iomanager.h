@@ -43,6 +43,8 @@ public:
 
     //0 success, -1 error
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    //与addEvent相同, 但事件已被其他协程注册时返回1, 不断言
+    int tryAddEvent(int fd, Event event, std::function<void()> cb = nullptr);
     //删除事件，不会触发事件
     bool delEvent(int fd, Event event);
 
@@ -50,9 +52,14 @@ public:
     bool cancelEvent(int fd, Event event);
     bool cancelAll(int fd);
 
+    //协程挂起等待外部线程唤醒时计入等待事件, 避免调度器提前停止
+    void addPending() { ++m_pendingEventCount; }
+    void donePending() { --m_pendingEventCount; }
+
     static IOManager* GetThis();
 
 protected:
+    int addEvent(int fd, Event event, std::function<void()>& cb, bool strict);
     void tickle() override;
     bool stopping() override;
     void idle() override;
@@ -71,6 +78,11 @@ private:
     RWMutexType m_mutex;
     //socket事件上下文容器
     std::vector<FdContext*> m_fdContexts;
+    //epoll唤醒次数, 触发的读写事件数, 到期的定时器数
+    Counter::ptr m_wakeupCounter;
+    Counter::ptr m_eventCounter[2];
+    Counter::ptr m_timerCounter;
+    std::vector<Metric::ptr> m_metrics;
 };
 
 }
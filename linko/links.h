@@ -9,5 +9,6 @@
 #include "util.h"
 #include "thread.h"
 #include "fiber.h"
+#include "metrics.h"
 
 #endif
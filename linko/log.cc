@@ -1,4 +1,5 @@
 #include "log.h"
+#include "epoch.h"
 #include <boost/mpl/eval_if.hpp>
 #include <cstdio>
 #include <iostream>
@@ -7,8 +8,21 @@
 #include <time.h>
 #include <map>
 #include <functional>
+#include <unordered_map>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <zlib.h>
+#include <algorithm>
 
 #include "config.h"
+#include "hook.h"
+#include "fiber.h"
+#include "scheduler.h"
 
 namespace linko {
 
@@ -72,10 +86,29 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
     , m_fiberId(fiber_id)
     , m_time(time)
     , m_threadName(thread_name)
+    , m_requestId(GetRequestId())
     , m_logger(logger)
     , m_level(level) {
 }
 
+// 函数内静态对象, 保证其他编译单元静态初始化期间输出日志时下标已经分配
+static FiberLocal<std::string>& RequestIdLocal() {
+    static FiberLocal<std::string> s_request_id;
+    return s_request_id;
+}
+
+void SetRequestId(const std::string& id) {
+    RequestIdLocal().set(id);
+}
+
+void ClearRequestId() {
+    RequestIdLocal().reset();
+}
+
+std::shared_ptr<const std::string> GetRequestId() {
+    return RequestIdLocal().get();
+}
+
 void LogEvent::format(const char* fmt, ...) {
     va_list al;
     va_start(al, fmt);
@@ -107,6 +140,264 @@ LogFormatter::ptr LogAppender::getFormatter() {
     return m_formatter;
 }
 
+namespace {
+
+// 复用的格式化缓冲区, 避免每条日志重新分配内存
+static thread_local std::string t_format_buffer;
+
+static void AppendUint(std::string& buf, uint64_t v) {
+    char tmp[24];
+    char* end = tmp + sizeof(tmp);
+    char* p = end;
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    buf.append(p, end - p);
+}
+
+static void AppendInt(std::string& buf, int64_t v) {
+    if (v < 0) {
+        buf.append(1, '-');
+        AppendUint(buf, -(uint64_t)v);
+    } else {
+        AppendUint(buf, v);
+    }
+}
+
+/*
+ * 每个线程缓存最近格式化过的秒级时间字符串
+ * 同一秒内的日志直接复用, 只有跨秒时才调用localtime_r + strftime
+ */
+struct TimeCacheEntry {
+    uint64_t sec = ~0ull;
+    std::string fmt;
+    char buf[64];
+    size_t len = 0;
+};
+
+static const size_t TIME_CACHE_SIZE = 4;
+static thread_local TimeCacheEntry t_time_cache[TIME_CACHE_SIZE];
+static thread_local size_t t_time_cache_next = 0;
+
+static void AppendTime(std::string& buf, const std::string& fmt, uint64_t sec) {
+    TimeCacheEntry* entry = nullptr;
+    for (size_t i = 0; i < TIME_CACHE_SIZE; ++i) {
+        TimeCacheEntry& e = t_time_cache[i];
+        if (e.fmt == fmt) {
+            if (e.sec == sec) {
+                buf.append(e.buf, e.len);
+                return;
+            }
+            entry = &e;
+            break;
+        }
+    }
+    if (!entry) {
+        entry = &t_time_cache[t_time_cache_next++ % TIME_CACHE_SIZE];
+        entry->fmt = fmt;
+    }
+
+    struct tm tm;
+    time_t t = sec;
+    localtime_r(&t, &tm);
+    entry->len = strftime(entry->buf, sizeof(entry->buf), fmt.c_str(), &tm);
+    entry->sec = sec;
+    buf.append(entry->buf, entry->len);
+}
+
+template<class T>
+static void AppendFormatted(std::string& buf, const char* spec, T v) {
+    char tmp[128];
+    int len = snprintf(tmp, sizeof(tmp), spec, v);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len < sizeof(tmp)) {
+        buf.append(tmp, len);
+        return;
+    }
+    size_t old = buf.size();
+    buf.resize(old + len + 1);
+    snprintf(&buf[old], len + 1, spec, v);
+    buf.resize(old + len);
+}
+
+static int64_t ArgToInt(const LogArg& arg) {
+    switch (arg.type) {
+        case LogArg::DOUBLE:
+            return (int64_t)arg.d;
+        case LogArg::STRING:
+            return 0;
+        default:
+            return arg.i;
+    }
+}
+
+static double ArgToDouble(const LogArg& arg) {
+    switch (arg.type) {
+        case LogArg::INT:
+            return (double)arg.i;
+        case LogArg::UINT:
+            return (double)arg.u;
+        case LogArg::DOUBLE:
+            return arg.d;
+        default:
+            return 0;
+    }
+}
+
+}
+
+std::string LogEvent::getContent() const {
+    if (!m_fmt) {
+        return m_ss.str();
+    }
+    std::string buf;
+    FormatArgs(buf, m_fmt, m_args);
+    return buf;
+}
+
+void LogEvent::appendContent(std::string& buf) const {
+    if (m_fmt) {
+        FormatArgs(buf, m_fmt, m_args);
+    } else {
+        buf.append(m_ss.str());
+    }
+}
+
+namespace {
+// 通过派生类取得stringbuf的写指针, 不复制内容
+struct StringBufPeek : public std::stringbuf {
+    static const char* Data(std::stringbuf* buf, size_t& len) {
+        char* (std::streambuf::*pbase_fn)() const = &StringBufPeek::pbase;
+        char* (std::streambuf::*pptr_fn)() const = &StringBufPeek::pptr;
+        char* begin = (buf->*pbase_fn)();
+        len = begin ? (buf->*pptr_fn)() - begin : 0;
+        return begin;
+    }
+};
+}
+
+LogArg::LogArg(const LogArgView& v)
+    : type(v.type), u(v.u) {
+    if (type == STRING) {
+        s.assign(v.s, v.len);
+    }
+}
+
+void LogEvent::captureViews(const char* fmt, const LogArgView* args, size_t argc) {
+    m_fmt = fmt;
+    m_args.reserve(argc);
+    for (size_t i = 0; i < argc; ++i) {
+        m_args.push_back(LogArg(args[i]));
+    }
+}
+
+const char* LogEvent::peekContent(size_t& len) const {
+    if (m_fmt) {
+        len = strlen(m_fmt);
+        return m_fmt;
+    }
+    return StringBufPeek::Data(m_ss.rdbuf(), len);
+}
+
+void LogEvent::FormatArgs(std::string& buf, const char* fmt, const std::vector<LogArg>& args) {
+    size_t idx = 0;
+    const char* p = fmt;
+    while (*p) {
+        if (*p != '%') {
+            const char* q = strchr(p, '%');
+            if (!q) {
+                buf.append(p);
+                break;
+            }
+            buf.append(p, q - p);
+            p = q;
+            continue;
+        }
+        if (p[1] == '%') {
+            buf.append(1, '%');
+            p += 2;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion, 长度修饰按参数实际类型重新生成
+        char spec[32];
+        size_t n = 0;
+        spec[n++] = '%';
+        const char* q = p + 1;
+        while (*q && strchr("-+ #0123456789.", *q)) {
+            if (n < sizeof(spec) - 4) {
+                spec[n++] = *q;
+            }
+            ++q;
+        }
+        while (*q && strchr("hlLqjzt", *q)) {
+            ++q;
+        }
+        char conv = *q;
+        if (!conv) {
+            buf.append(p);
+            break;
+        }
+        ++q;
+        if (idx >= args.size() || !strchr("diouxXeEfFgGaAcsp", conv)) {
+            buf.append(p, q - p);
+            p = q;
+            continue;
+        }
+
+        const LogArg& arg = args[idx++];
+        switch (conv) {
+            case 'c':
+                spec[n++] = conv;
+                spec[n] = '\0';
+                AppendFormatted(buf, spec, (int)ArgToInt(arg));
+                break;
+            case 'd':
+            case 'i':
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                AppendFormatted(buf, spec, (long long)ArgToInt(arg));
+                break;
+            case 's':
+                if (arg.type != LogArg::STRING) {
+                    std::string tmp;
+                    FormatArgs(tmp, arg.type == LogArg::DOUBLE ? "%g" : (arg.type == LogArg::INT ? "%d" : "%u")
+                               , std::vector<LogArg>(1, arg));
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    AppendFormatted(buf, spec, tmp.c_str());
+                } else if (n == 1) {
+                    buf.append(arg.s);
+                } else {
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    AppendFormatted(buf, spec, arg.s.c_str());
+                }
+                break;
+            case 'p':
+                spec[n++] = 'p';
+                spec[n] = '\0';
+                AppendFormatted(buf, spec, (void*)(uintptr_t)arg.u);
+                break;
+            default:
+                spec[n++] = conv;
+                spec[n] = '\0';
+                AppendFormatted(buf, spec, ArgToDouble(arg));
+                break;
+        }
+        p = q;
+    }
+}
+
 class MessageFormatItem : public LogFormatter::FormatItem {
 public:
     MessageFormatItem(const std::string& str = "") {}
@@ -155,6 +446,16 @@ public:
     }
 };
 
+class RequestIdFormatItem : public LogFormatter::FormatItem {
+public:
+    RequestIdFormatItem(const std::string& str = "") {}
+    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        if (event->getRequestId()) {
+            os << *event->getRequestId();
+        }
+    }
+};
+
 class ThreadNameFormatItem : public LogFormatter::FormatItem {
 public:
     ThreadNameFormatItem(const std::string& str = "") {}
@@ -171,185 +472,1768 @@ public:
             m_format = "%Y-%m-%d %H:%M:%S";
         }
     }
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
-    }
-private:
-    std::string m_format;
-};
+    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        struct tm tm;
+        time_t time = event->getTime();
+        localtime_r(&time, &tm);
+        char buf[64];
+        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
+        os << buf;
+    }
+private:
+    std::string m_format;
+};
+
+class FilenameFormatItem : public LogFormatter::FormatItem {
+public:
+    FilenameFormatItem(const std::string& str = "") {}
+    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        os << event->getFile();
+    }
+};
+
+class LineFormatItem : public LogFormatter::FormatItem {
+public:
+    LineFormatItem(const std::string& str = "") {}
+    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        os << event->getLine();
+    }
+};
+
+class NewLineFormatItem : public LogFormatter::FormatItem {
+public:
+    NewLineFormatItem(const std::string& str = "") {}
+    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        os << std::endl;
+    }
+};
+
+class StringFormatItem : public LogFormatter::FormatItem {
+public:
+    StringFormatItem(const std::string& str) 
+        : m_str(str) {}
+    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        os << m_str;
+    }
+private:
+    std::string m_str;
+};
+
+class TabFormatItem : public LogFormatter::FormatItem {
+public:
+    TabFormatItem(const std::string& str = "") {}
+    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
+        os << "\t"; 
+    }
+};
+
+
+Logger::Logger(const std::string& name)
+    : m_name(name)
+    , m_level(LogLevel::DEBUG) {
+    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+    publishAppenders(new AppenderList);
+}
+
+Logger::~Logger() {
+    //Logger析构时不可能再有log()在遍历
+    delete m_appenders.load(std::memory_order_relaxed);
+    for (auto& i : m_retired) {
+        delete i.first;
+    }
+}
+
+void Logger::publishAppenders(AppenderList* appenders) {
+    const AppenderList* old = m_appenders.exchange(appenders, std::memory_order_acq_rel);
+    if (old) {
+        m_retired.push_back(std::make_pair(old, Epoch::Retire()));
+    }
+}
+
+void Logger::reclaimAppenders(bool wait) {
+    uint64_t deadline = wait ? GetMonotonicMS() + 100 : 0;
+    while (true) {
+        std::vector<const AppenderList*> frees;
+        bool pending = false;
+        {
+            MutexType::Lock lock(m_mutex);
+            uint64_t min_epoch = Epoch::MinActive();
+            size_t n = 0;
+            for (auto& i : m_retired) {
+                if (i.second < min_epoch) {
+                    frees.push_back(i.first);
+                } else {
+                    m_retired[n++] = i;
+                }
+            }
+            m_retired.resize(n);
+            pending = n > 0;
+        }
+        //输出器析构会join写线程, 不能持有自旋锁
+        for (auto i : frees) {
+            delete i;
+        }
+        if (!pending || GetMonotonicMS() >= deadline) {
+            break;
+        }
+        //读者的临界区很短, 不使用可能让出协程的sleep, 调用方可能持有其他锁
+        sched_yield();
+    }
+}
+
+void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
+    if (level >= m_level) {
+        auto self = shared_from_this();
+        //不持有任何锁, BLOCK策略的异步输出器等待时不会阻塞其他线程
+        EpochGuard guard;
+        const AppenderList& list = appenders();
+        if (!list.empty()) {
+            for (auto& iter : list) {
+                iter->log(self, level, event);
+            }
+        } else if (m_root) {
+            m_root->log(level, event);
+        }
+        
+    }
+}
+
+void Logger::logArgs(LogLevel::Level level, const char* file, int32_t line
+        , const char* fmt, const LogArgView* args, size_t argc) {
+    if (level < m_level) {
+        return;
+    }
+    EpochGuard guard;
+    const AppenderList& list = appenders();
+    if (list.empty()) {
+        if (m_root) {
+            m_root->logArgs(level, file, line, fmt, args, argc);
+        }
+        return;
+    }
+    //只有存在文本输出器时才构造LogEvent
+    LogEvent::ptr event;
+    Logger::ptr self;
+    for (auto& i : list) {
+        if (i->m_rawArgs) {
+            static_cast<BinaryLogAppender*>(i.get())->logArgs(*this, level, file, line, 0, fmt, args, argc);
+            continue;
+        }
+        if (!event) {
+            self = shared_from_this();
+            event.reset(new LogEvent(self, level, file, line, 0, GetThreadId()
+                        , GetFiberId(), time(0), Thread::GetName()));
+            event->captureViews(fmt, args, argc);
+        }
+        i->log(self, level, event);
+    }
+}
+
+void Logger::debug(LogEvent::ptr event) {
+    log(LogLevel::DEBUG, event);
+}
+
+void Logger::info(LogEvent::ptr event) {
+    log(LogLevel::INFO, event);
+}
+
+void Logger::warn(LogEvent::ptr event) {
+    log(LogLevel::WARN, event);
+}
+
+void Logger::error(LogEvent::ptr event) {
+    log(LogLevel::ERROR, event);
+}
+
+void Logger::fatal(LogEvent::ptr event) {
+    log(LogLevel::FATAL, event);
+}
+
+void Logger::addAppender(LogAppender::ptr appender) {
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!appender->getFormatter()) {
+            MutexType::Lock ll(appender->m_mutex);
+            appender->m_formatter = m_formatter;
+        }
+        AppenderList* list = new AppenderList(appenders());
+        list->push_back(appender);
+        publishAppenders(list);
+    }
+    reclaimAppenders(false);
+}
+
+void Logger::delAppender(LogAppender::ptr appender) {
+    {
+        MutexType::Lock lock(m_mutex);
+        AppenderList* list = new AppenderList(appenders());
+        for (auto iter = list->begin(); iter != list->end(); ++iter) {
+            if (*iter == appender) {
+                list->erase(iter);
+                break;
+            }
+        }
+        publishAppenders(list);
+    }
+    reclaimAppenders(true);
+}
+
+void Logger::clearAppenders() {
+    {
+        MutexType::Lock lock(m_mutex);
+        publishAppenders(new AppenderList);
+    }
+    reclaimAppenders(true);
+}
+
+void Logger::setFormatter(LogFormatter::ptr val) {
+    MutexType::Lock lock(m_mutex);
+    m_formatter = val;
+
+    for (auto& i : appenders()) {
+        //操作友函数需要显示加锁
+        MutexType::Lock ll(i->m_mutex);
+        if (!i->m_hasFormatter) {
+            i->m_formatter = m_formatter;
+        }
+    }
+}
+
+void Logger::setFormatter(const std::string& val) {
+    //std::cout << "---" << val << std::endl;
+    linko::LogFormatter::ptr new_val(new linko::LogFormatter(val));
+    if (new_val->isError()) {
+        std::cout << "Logger setFormatter name=" << m_name
+                  << " value=" << val << " invalid formatter"
+                  << std::endl;
+        return;
+    }
+    setFormatter(new_val);
+}
+
+std::string Logger::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["root"] = m_name;
+    if (m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if (m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    
+    for (auto& i : appenders()) {
+        node["appenders"].push_back(YAML::Load(i->toYamlString()));
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+namespace {
+
+static uint64_t GetFileSize(const std::string& filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+// 压缩为path.gz, 先写临时文件再改名, 成功后删除原文件
+static bool CompressFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    std::string tmp = path + ".gz.tmp";
+    gzFile gz = gzopen(tmp.c_str(), "wb6");
+    if (!gz) {
+        ::close(fd);
+        return false;
+    }
+    bool ok = true;
+    std::vector<char> buf(64 * 1024);
+    while (true) {
+        ssize_t n = ::read(fd, &buf[0], buf.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (gzwrite(gz, &buf[0], n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    ::close(fd);
+    if (gzclose(gz) != Z_OK) {
+        ok = false;
+    }
+    if (!ok || ::rename(tmp.c_str(), (path + ".gz").c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    ::unlink(path.c_str());
+    return true;
+}
+
+/*
+ * 所有LogRotator共用的后台线程, 负责改名, 压缩和清理
+ * 进程退出时不析构, 避免与仍在写日志的静态对象产生析构顺序问题
+ */
+class LogRotateWorker {
+public:
+    static LogRotateWorker* GetInstance() {
+        static LogRotateWorker* s_worker = new LogRotateWorker;
+        return s_worker;
+    }
+
+    void rotate(LogRotator::ptr rotator) {
+        {
+            Mutex::Lock lock(m_mutex);
+            m_rotates.push_back(rotator);
+        }
+        m_sem.notify();
+    }
+
+    void notify() {
+        m_sem.notify();
+    }
+private:
+    LogRotateWorker() {
+        m_thread.reset(new Thread(std::bind(&LogRotateWorker::run, this), "log_rotate"));
+    }
+
+    struct Archive {
+        LogRotator::ptr rotator;
+        uint64_t generation;
+        std::string path;
+    };
+
+    void run() {
+        while (true) {
+            m_sem.wait();
+            std::list<LogRotator::ptr> rotates;
+            {
+                Mutex::Lock lock(m_mutex);
+                rotates.swap(m_rotates);
+            }
+            for (auto& i : rotates) {
+                uint64_t generation = i->getGeneration() + 1;
+                std::string path = i->archive();
+                if (!path.empty()) {
+                    m_archives.push_back({i, generation, path});
+                }
+            }
+            // 写线程切换到新文件之后才能压缩归档文件
+            for (auto it = m_archives.begin(); it != m_archives.end();) {
+                if (it->rotator->isReleased(it->generation)) {
+                    it->rotator->finish(it->path);
+                    it = m_archives.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+private:
+    Mutex m_mutex;
+    std::list<LogRotator::ptr> m_rotates;
+    // 只在后台线程中访问
+    std::list<Archive> m_archives;
+    Semaphore m_sem;
+    Thread::ptr m_thread;
+};
+
+}
+
+static void RotatorToYaml(YAML::Node& node, const LogRotator::ptr& rotator) {
+    if (!rotator) {
+        return;
+    }
+    YAML::Node r;
+    if (rotator->getMaxSize()) {
+        r["max_size"] = rotator->getMaxSize();
+    }
+    if (rotator->getInterval()) {
+        r["interval"] = rotator->getInterval();
+    }
+    if (rotator->getMaxFiles()) {
+        r["max_files"] = rotator->getMaxFiles();
+    }
+    r["compress"] = rotator->getCompress();
+    node["rotate"] = r;
+}
+
+LogRotator::LogRotator(const std::string& filename, uint64_t max_size
+                       , uint32_t interval, uint32_t max_files, bool compress)
+    : m_filename(filename)
+    , m_maxSize(max_size)
+    , m_interval(interval)
+    , m_maxFiles(max_files)
+    , m_compress(compress) {
+}
+
+void LogRotator::opened(uint64_t generation, uint64_t size) {
+    m_size = size;
+    m_nextTime = nextRotateTime(time(0));
+    m_opened = generation;
+    LogRotateWorker::GetInstance()->notify();
+}
+
+void LogRotator::onWrite(size_t len, uint64_t now) {
+    m_size += len;
+    if (m_pending || needReopen()) {
+        return;
+    }
+    bool by_size = m_maxSize && m_size >= m_maxSize;
+    bool by_time = now >= m_nextTime;
+    if (by_time && m_size == len) {
+        // 新周期的第一条日志写入了空文件, 不切分
+        m_nextTime = nextRotateTime(now);
+        by_time = false;
+    }
+    if (by_size || by_time) {
+        m_pending = true;
+        m_nextTime = nextRotateTime(now);
+        LogRotateWorker::GetInstance()->rotate(shared_from_this());
+    }
+}
+
+void LogRotator::close() {
+    m_closed = true;
+    LogRotateWorker::GetInstance()->notify();
+}
+
+uint64_t LogRotator::nextRotateTime(uint64_t now) const {
+    if (!m_interval) {
+        return ~0ull;
+    }
+    struct tm tm;
+    time_t t = now;
+    localtime_r(&t, &tm);
+    int64_t off = tm.tm_gmtoff;
+    return ((now + off) / m_interval + 1) * m_interval - off;
+}
+
+std::string LogRotator::archive() {
+    struct tm tm;
+    time_t now = time(0);
+    localtime_r(&now, &tm);
+    char tmp[32];
+    strftime(tmp, sizeof(tmp), ".%Y%m%d-%H%M%S", &tm);
+
+    std::string base = m_filename + tmp;
+    std::string path = base;
+    struct stat st;
+    for (int i = 1; stat(path.c_str(), &st) == 0 || stat((path + ".gz").c_str(), &st) == 0; ++i) {
+        path = base + "." + std::to_string(i);
+    }
+
+    std::string rt;
+    if (::rename(m_filename.c_str(), path.c_str()) == 0) {
+        rt = path;
+    } else if (errno != ENOENT) {
+        std::cout << "LogRotator rename " << m_filename << " to " << path
+                  << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+    }
+    // 改名失败也让写线程重新打开, 重新开始计数
+    ++m_generation;
+    m_pending = false;
+    return rt;
+}
+
+void LogRotator::finish(const std::string& path) {
+    if (m_compress) {
+        CompressFile(path);
+    }
+    if (!m_maxFiles) {
+        return;
+    }
+
+    std::string dir = ".";
+    std::string prefix = m_filename;
+    size_t pos = m_filename.rfind('/');
+    if (pos != std::string::npos) {
+        dir = pos == 0 ? "/" : m_filename.substr(0, pos);
+        prefix = m_filename.substr(pos + 1);
+    }
+    prefix += ".";
+
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    // 按(时间, 同一秒内的序号)排序, 序号缺省为0
+    std::vector<std::tuple<std::string, int, std::string> > files;
+    struct dirent* dp;
+    while ((dp = readdir(d)) != nullptr) {
+        std::string name = dp->d_name;
+        if (name.size() <= prefix.size()
+                || name.compare(0, prefix.size(), prefix) != 0
+                || !isdigit(name[prefix.size()])
+                || boost::ends_with(name, ".tmp")) {
+            continue;
+        }
+        std::string key = name.substr(prefix.size());
+        if (boost::ends_with(key, ".gz")) {
+            key.resize(key.size() - 3);
+        }
+        int seq = 0;
+        size_t dot = key.find('.');
+        if (dot != std::string::npos) {
+            seq = atoi(key.c_str() + dot + 1);
+            key.resize(dot);
+        }
+        files.push_back(std::make_tuple(key, seq, name));
+    }
+    closedir(d);
+
+    if (files.size() <= m_maxFiles) {
+        return;
+    }
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size() - m_maxFiles; ++i) {
+        ::unlink((dir + "/" + std::get<2>(files[i])).c_str());
+    }
+}
+
+uint64_t LogRotator::ParseSize(const std::string& str) {
+    char* end = nullptr;
+    uint64_t v = strtoull(str.c_str(), &end, 10);
+    switch (end ? toupper(*end) : 0) {
+        case 'G':
+            v <<= 10;
+            // fall through
+        case 'M':
+            v <<= 10;
+            // fall through
+        case 'K':
+            v <<= 10;
+        default:
+            break;
+    }
+    return v;
+}
+
+uint32_t LogRotator::ParseInterval(const std::string& str) {
+    if (boost::iequals(str, "hourly")) {
+        return 3600;
+    } else if (boost::iequals(str, "daily")) {
+        return 86400;
+    }
+    return strtoul(str.c_str(), nullptr, 10);
+}
+
+FileLogAppender::FileLogAppender(const std::string& filename, LogRotator::ptr rotator) 
+    : m_filename(filename)
+    , m_rotator(rotator) {
+    reopen();
+}
+
+FileLogAppender::~FileLogAppender() {
+    if (m_rotator) {
+        m_filestream.close();
+        m_rotator->close();
+    }
+}
+
+void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level >= m_level) {
+        std::string& buf = t_format_buffer;
+        buf.clear();
+        MutexType::Lock lock(m_mutex);
+        m_formatter->format(buf, logger, level, event);
+        if (m_rotator && m_rotator->needReopen()) {
+            openFile();
+        }
+        m_filestream.write(buf.data(), buf.size());
+        if (m_rotator) {
+            m_rotator->onWrite(buf.size(), event->getTime());
+        }
+    }
+}
+
+std::string FileLogAppender::toYamlString() {
+    YAML::Node node;
+    node["type"] = "FileLogAppender";
+    node["file"] = m_filename;
+    RotatorToYaml(node, m_rotator);
+    if (m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if (m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+bool FileLogAppender::reopen() {
+    MutexType::Lock lock(m_mutex);
+    return openFile();
+}
+
+bool FileLogAppender::openFile() {
+    if (m_filestream.is_open()) {
+        m_filestream.close();
+    }
+    uint64_t generation = m_rotator ? m_rotator->getGeneration() : 0;
+    m_filestream.open(m_filename, std::ios::app);
+    if (m_rotator) {
+        m_rotator->opened(generation, GetFileSize(m_filename));
+    }
+    return !!m_filestream;
+}
+
+namespace {
+
+/*
+ * 崩溃信号处理中使用的输出, 只有定长缓冲区和write(2)
+ * 绕过hook, 避免在信号处理函数中进入协程调度
+ */
+class CrashWriter {
+public:
+    CrashWriter(int fd)
+        : m_fd(fd) {}
+    ~CrashWriter() { flush(); }
+
+    void append(const char* str, size_t len) {
+        while (len > 0) {
+            if (m_len == sizeof(m_buf)) {
+                flush();
+            }
+            size_t n = std::min(len, sizeof(m_buf) - m_len);
+            memcpy(m_buf + m_len, str, n);
+            m_len += n;
+            str += n;
+            len -= n;
+        }
+    }
+    void append(const char* str) {
+        if (str) {
+            append(str, strlen(str));
+        }
+    }
+    void append(uint64_t v) {
+        char tmp[24];
+        size_t i = sizeof(tmp);
+        do {
+            tmp[--i] = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        append(tmp + i, sizeof(tmp) - i);
+    }
+    void flush() {
+        size_t off = 0;
+        while (off < m_len) {
+            ssize_t n = write_f(m_fd, m_buf + off, m_len - off);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            off += n;
+        }
+        m_len = 0;
+    }
+private:
+    int m_fd;
+    char m_buf[1024];
+    size_t m_len = 0;
+};
+
+}
+
+/*
+ * 单生产者单消费者无锁环形队列
+ * 生产者为写日志的业务线程, 消费者为AsyncLogAppender的后台线程
+ */
+class AsyncLogAppender::RingBuffer {
+public:
+    typedef std::shared_ptr<RingBuffer> ptr;
+
+    struct Item {
+        Logger::ptr logger;
+        LogLevel::Level level = LogLevel::UNKNOW;
+        LogEvent::ptr event;
+    };
+
+    RingBuffer(size_t size)
+        : m_items(size)
+        , m_mask(size - 1) {
+    }
+
+    bool push(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+            return false;
+        }
+        Item& item = m_items[tail & m_mask];
+        item.logger.swap(logger);
+        item.level = level;
+        item.event.swap(event);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(Item& out) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        Item& item = m_items[head & m_mask];
+        out.logger.swap(item.logger);
+        out.level = item.level;
+        out.event.swap(item.event);
+        item.logger.reset();
+        item.event.reset();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return m_tail.load(std::memory_order_acquire)
+            - m_head.load(std::memory_order_acquire);
+    }
+    size_t capacity() const { return m_mask + 1; }
+
+    /*
+     * 不出队、不分配内存地写出队列中的日志, 只在崩溃信号处理中使用
+     * 时间输出为秒级时间戳, 延迟格式化的日志只输出格式串
+     */
+    void crashDump(int fd) const {
+        CrashWriter w(fd);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        for (size_t i = m_head.load(std::memory_order_acquire); i != tail; ++i) {
+            const Item& item = m_items[i & m_mask];
+            if (!item.event) {
+                continue;
+            }
+            const LogEvent& e = *item.event;
+            size_t len = 0;
+            const char* content = e.peekContent(len);
+            w.append(e.getTime());
+            w.append("\t");
+            w.append((uint64_t)e.getThreadId());
+            w.append("\t[");
+            w.append(LogLevel::ToString(item.level));
+            w.append("]\t[");
+            w.append(item.logger ? item.logger->getName().c_str() : "");
+            w.append("]\t");
+            w.append(e.getFile());
+            w.append(":");
+            w.append((uint64_t)e.getLine());
+            w.append("\t");
+            if (content) {
+                w.append(content, len);
+            }
+            w.append("\n");
+        }
+    }
+
+    // 生产线程已退出
+    void detach() { m_detached = true; }
+    bool isDetached() const { return m_detached; }
+    // 所属输出器已销毁
+    void close() { m_closed = true; }
+    bool isClosed() const { return m_closed; }
+private:
+    std::vector<Item> m_items;
+    size_t m_mask;
+    // head/tail分处不同缓存行, 避免生产者和消费者互相伪共享
+    char m_pad0[64];
+    std::atomic<size_t> m_head = {0};
+    char m_pad1[64];
+    std::atomic<size_t> m_tail = {0};
+    char m_pad2[64];
+    std::atomic<bool> m_detached = {false};
+    std::atomic<bool> m_closed = {false};
+};
+
+namespace {
+
+// 线程退出时通知所有异步输出器回收该线程的队列
+struct LocalRings {
+    ~LocalRings() {
+        for (auto& i : rings) {
+            i.second->detach();
+        }
+    }
+    std::unordered_map<uint64_t, AsyncLogAppender::RingBuffer::ptr> rings;
+};
+
+static thread_local LocalRings t_local_rings;
+
+/*
+ * 队列满时等待后台线程腾出空间
+ * 在调度器协程中让出给同线程的其他协程, 不阻塞整个线程; 普通线程让出cpu
+ * 协程恢复后可能在其他线程, 调用方需要重新获取本线程的队列
+ */
+static void WaitForRingSpace() {
+    if (Scheduler::GetThis()) {
+        Fiber::ptr cur = Fiber::GetThis();
+        if (cur.get() != Scheduler::GetMainFiber()) {
+            cur.reset();
+            Fiber::YieldToReady();
+            return;
+        }
+    }
+    sched_yield();
+}
+
+static std::atomic<uint64_t> s_async_appender_id = {0};
+
+// 存活的异步输出器, 信号处理函数中不能加锁, 故使用固定大小的原子指针数组
+static const size_t MAX_ASYNC_APPENDERS = 64;
+static std::atomic<AsyncLogAppender*> s_async_appenders[MAX_ASYNC_APPENDERS];
+
+static size_t RoundUpPowerOfTwo(size_t v) {
+    size_t n = 2;
+    while (n < v) {
+        n <<= 1;
+    }
+    return n;
+}
+
+static void WriteFully(int fd, struct iovec* iov, int cnt) {
+    // 调用方持有输出器的锁, 不能让出协程
+    HookDisableGuard guard;
+    while (cnt > 0) {
+        ssize_t n = ::writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static const int s_crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+static const size_t CRASH_SIGNAL_COUNT = sizeof(s_crash_signals) / sizeof(s_crash_signals[0]);
+// 安装前的处理方式, 处理完成后交还给它
+static struct sigaction s_old_crash_actions[CRASH_SIGNAL_COUNT];
+static std::atomic_flag s_crashing = ATOMIC_FLAG_INIT;
+
+static void OnCrashSignal(int sig, siginfo_t* info, void* ctx) {
+    //多个线程同时崩溃时只刷出一次
+    if (!s_crashing.test_and_set()) {
+        AsyncLogAppender::CrashFlushAll();
+    }
+    for (size_t i = 0; i < CRASH_SIGNAL_COUNT; ++i) {
+        if (s_crash_signals[i] != sig) {
+            continue;
+        }
+        struct sigaction& old = s_old_crash_actions[i];
+        sigaction(sig, &old, nullptr);
+        if (old.sa_flags & SA_SIGINFO) {
+            if (old.sa_sigaction) {
+                old.sa_sigaction(sig, info, ctx);
+                return;
+            }
+        } else if (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN) {
+            old.sa_handler(sig);
+            return;
+        }
+        break;
+    }
+    //默认处理: 信号在处理函数返回后递送, 故障指令重新执行时同样会触发
+    raise(sig);
+}
+
+}
+
+const char* AsyncLogAppender::ToString(OverflowPolicy policy) {
+    switch (policy) {
+#define XX(name) \
+    case AsyncLogAppender::name: \
+        return #name;
+
+    XX(BLOCK);
+    XX(DROP);
+    XX(SAMPLE);
+#undef XX
+    default:
+        return "BLOCK";
+    }
+}
+
+AsyncLogAppender::OverflowPolicy AsyncLogAppender::FromString(const std::string& str) {
+#define XX(policy, v) \
+    if (boost::iequals(str, #v)) { \
+        return AsyncLogAppender::policy; \
+    }
+    XX(BLOCK, block);
+    XX(DROP, drop);
+    XX(SAMPLE, sample);
+#undef XX
+    return AsyncLogAppender::BLOCK;
+}
+
+AsyncLogAppender::AsyncLogAppender(const std::string& filename
+                                , size_t queue_size
+                                , OverflowPolicy policy
+                                , uint32_t sample_rate
+                                , uint32_t flush_interval_ms
+                                , LogRotator::ptr rotator)
+    : m_filename(filename)
+    , m_id(++s_async_appender_id)
+    , m_queueSize(RoundUpPowerOfTwo(queue_size))
+    , m_policy(policy)
+    , m_sampleRate(sample_rate ? sample_rate : 1)
+    , m_flushInterval(flush_interval_ms ? flush_interval_ms : 1)
+    , m_rotator(rotator) {
+    for (size_t i = 0; i < MAX_CRASH_RINGS; ++i) {
+        m_crashRings[i].store(nullptr, std::memory_order_relaxed);
+    }
+    reopen();
+    for (size_t i = 0; i < MAX_ASYNC_APPENDERS; ++i) {
+        AsyncLogAppender* expected = nullptr;
+        if (s_async_appenders[i].compare_exchange_strong(expected, this)) {
+            break;
+        }
+    }
+    InstallCrashHandler();
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "async_log"));
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    for (size_t i = 0; i < MAX_ASYNC_APPENDERS; ++i) {
+        AsyncLogAppender* expected = this;
+        if (s_async_appenders[i].compare_exchange_strong(expected, nullptr)) {
+            break;
+        }
+    }
+    m_stopping = true;
+    m_thread->join();
+    flush();
+
+    Mutex::Lock lock(m_ringMutex);
+    for (auto& i : m_rings) {
+        i->close();
+    }
+    m_rings.clear();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    if (m_rotator) {
+        m_rotator->close();
+    }
+}
+
+bool AsyncLogAppender::reopen() {
+    MutexType::Lock lock(m_mutex);
+    uint64_t generation = m_rotator ? m_rotator->getGeneration() : 0;
+    int fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "AsyncLogAppender open file=" << m_filename
+                  << " errno=" << errno << " errstr=" << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = fd;
+    if (m_rotator) {
+        m_rotator->opened(generation, GetFileSize(m_filename));
+    }
+    return true;
+}
+
+AsyncLogAppender::RingBuffer* AsyncLogAppender::getLocalRing() {
+    auto& rings = t_local_rings.rings;
+    auto it = rings.find(m_id);
+    if (it != rings.end()) {
+        return it->second.get();
+    }
+
+    //清理已销毁输出器遗留的队列
+    for (auto i = rings.begin(); i != rings.end();) {
+        if (i->second->isClosed()) {
+            i = rings.erase(i);
+        } else {
+            ++i;
+        }
+    }
+
+    RingBuffer::ptr ring(new RingBuffer(m_queueSize));
+    {
+        Mutex::Lock lock(m_ringMutex);
+        m_rings.push_back(ring);
+    }
+    //登记表满时该队列不参与崩溃刷出
+    for (size_t i = 0; i < MAX_CRASH_RINGS; ++i) {
+        RingBuffer* expected = nullptr;
+        if (m_crashRings[i].compare_exchange_strong(expected, ring.get())) {
+            break;
+        }
+    }
+    rings[m_id] = ring;
+    return ring.get();
+}
+
+void AsyncLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        return;
+    }
+    RingBuffer* ring = getLocalRing();
+    bool can_drop = m_policy == DROP
+        || (m_policy == SAMPLE && level < LogLevel::ERROR);
+
+    //超过3/4高水位后按比例采样
+    if (m_policy == SAMPLE && can_drop
+            && ring->size() > ring->capacity() / 4 * 3
+            && (m_sampleCounter.fetch_add(1, std::memory_order_relaxed) % m_sampleRate) != 0) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    while (!ring->push(logger, level, event)) {
+        if (can_drop || m_stopping) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        WaitForRingSpace();
+        ring = getLocalRing();
+    }
+}
+
+size_t AsyncLogAppender::drain() {
+    std::vector<RingBuffer::ptr> rings;
+    {
+        Mutex::Lock lock(m_ringMutex);
+        for (auto it = m_rings.begin(); it != m_rings.end();) {
+            //线程已退出且队列为空, 回收
+            if ((*it)->isDetached() && (*it)->size() == 0) {
+                //持有m_draining, 崩溃处理此时不会读取登记表
+                for (size_t i = 0; i < MAX_CRASH_RINGS; ++i) {
+                    RingBuffer* expected = it->get();
+                    if (m_crashRings[i].compare_exchange_strong(expected, nullptr)) {
+                        break;
+                    }
+                }
+                it = m_rings.erase(it);
+            } else {
+                rings.push_back(*it);
+                ++it;
+            }
+        }
+    }
+
+    static const size_t MAX_IOV = 256;
+    LogFormatter::ptr formatter = getFormatter();
+    //批次缓冲区在多次drain之间复用, 只在首次使用时分配
+    m_batch.resize(MAX_IOV);
+    iovec iovs[MAX_IOV];
+    size_t nbuf = 0;
+
+    auto write_batch = [this, &iovs, &nbuf]() {
+        if (nbuf == 0) {
+            return;
+        }
+        size_t len = 0;
+        for (size_t i = 0; i < nbuf; ++i) {
+            iovs[i].iov_base = &m_batch[i][0];
+            iovs[i].iov_len = m_batch[i].size();
+            len += m_batch[i].size();
+        }
+        if (m_rotator && m_rotator->needReopen()) {
+            reopen();
+        }
+        WriteFully(m_fd, iovs, nbuf);
+        if (m_rotator) {
+            m_rotator->onWrite(len, time(0));
+        }
+        nbuf = 0;
+    };
+
+    size_t count = 0;
+    RingBuffer::Item item;
+    for (auto& ring : rings) {
+        while (ring->pop(item)) {
+            std::string& buf = m_batch[nbuf++];
+            buf.clear();
+            formatter->format(buf, item.logger, item.level, item.event);
+            item.logger.reset();
+            item.event.reset();
+            ++count;
+            if (nbuf >= MAX_IOV) {
+                write_batch();
+            }
+        }
+    }
+
+    uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+    if (dropped != m_reportedDropped) {
+        if (nbuf >= MAX_IOV) {
+            write_batch();
+        }
+        std::stringstream ss;
+        ss << "[AsyncLogAppender] dropped " << (dropped - m_reportedDropped)
+           << " log events, total=" << dropped << std::endl;
+        m_batch[nbuf++] = ss.str();
+        m_reportedDropped = dropped;
+    }
+    write_batch();
+    return count;
+}
+
+void AsyncLogAppender::flush() {
+    //等待后台线程完成当前批次, 避免无限期阻塞(例如崩溃时后台线程已停止)
+    for (int i = 0; m_draining.test_and_set(std::memory_order_acquire); ++i) {
+        if (i > 1000) {
+            return;
+        }
+        sched_yield();
+    }
+    drain();
+    m_draining.clear(std::memory_order_release);
+}
+
+void AsyncLogAppender::run() {
+    while (!m_stopping) {
+        size_t n = 0;
+        if (!m_draining.test_and_set(std::memory_order_acquire)) {
+            n = drain();
+            m_draining.clear(std::memory_order_release);
+        }
+        if (n == 0) {
+            usleep(m_flushInterval * 1000);
+        }
+    }
+}
+
+std::string AsyncLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "FileLogAppender";
+    node["file"] = m_filename;
+    node["async"] = true;
+    node["overflow"] = ToString(m_policy);
+    node["queue_size"] = m_queueSize;
+    RotatorToYaml(node, m_rotator);
+    if (m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if (m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+void AsyncLogAppender::FlushAll() {
+    for (size_t i = 0; i < MAX_ASYNC_APPENDERS; ++i) {
+        AsyncLogAppender* appender = s_async_appenders[i].load();
+        if (appender) {
+            appender->flush();
+        }
+    }
+}
 
-class FilenameFormatItem : public LogFormatter::FormatItem {
-public:
-    FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
+void AsyncLogAppender::CrashFlushAll() {
+    for (size_t i = 0; i < MAX_ASYNC_APPENDERS; ++i) {
+        AsyncLogAppender* appender = s_async_appenders[i].load();
+        if (appender) {
+            appender->crashFlush();
+        }
     }
-};
+}
 
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
+void AsyncLogAppender::crashFlush() {
+    //后台线程正在处理, 或崩溃发生在drain内部时, 队列可能处于修改中, 放弃
+    if (m_draining.test_and_set(std::memory_order_acquire)) {
+        return;
     }
-};
+    if (m_fd >= 0) {
+        for (size_t i = 0; i < MAX_CRASH_RINGS; ++i) {
+            RingBuffer* ring = m_crashRings[i].load(std::memory_order_acquire);
+            if (ring) {
+                ring->crashDump(m_fd);
+            }
+        }
+    }
+    m_draining.clear(std::memory_order_release);
+}
 
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
+void AsyncLogAppender::InstallCrashHandler() {
+    static bool s_installed = false;
+    if (s_installed) {
+        return;
     }
+    s_installed = true;
+
+    for (size_t i = 0; i < CRASH_SIGNAL_COUNT; ++i) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = &OnCrashSignal;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&sa.sa_mask);
+        sigaction(s_crash_signals[i], &sa, &s_old_crash_actions[i]);
+    }
+}
+
+namespace {
+
+// 队列中的原始记录, 之后依次为logger名, 线程名, 请求id和参数
+struct BinaryRecord {
+    // 记录总长度, 8字节对齐
+    uint32_t size;
+    // BINARY_RECORD_SKIP表示队列尾部的填充
+    uint8_t level;
+    uint8_t pad;
+    uint16_t argc;
+    int32_t line;
+    uint32_t fiber_id;
+    uint32_t elapse;
+    uint16_t logger_len;
+    uint16_t thread_name_len;
+    uint16_t request_id_len;
+    uint64_t time;
+    const char* fmt;
+    const char* file;
 };
 
-class StringFormatItem : public LogFormatter::FormatItem {
+static const uint8_t BINARY_RECORD_SKIP = 0xff;
+// 每个线程的队列大小, 单条记录不超过其1/4, 超长的字符串参数会被截断
+static const size_t BINARY_RING_SIZE = 128 * 1024;
+static const size_t BINARY_MAX_RECORD = BINARY_RING_SIZE / 4;
+static const size_t BINARY_MAX_NAME = 1024;
+
+}
+
+/*
+ * 单生产者单消费者的字节环形队列, 记录变长且在队列中连续存放
+ * 尾部放不下时写入填充记录, 从头开始
+ */
+class BinaryLogAppender::Ring {
 public:
-    StringFormatItem(const std::string& str) 
-        : m_str(str) {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_str;
+    typedef std::shared_ptr<Ring> ptr;
+
+    Ring(size_t size)
+        : m_buf(new char[size])
+        , m_mask(size - 1)
+        , m_threadId(GetThreadId()) {
+    }
+    ~Ring() { delete[] m_buf; }
+
+    // 生产者: 预留len字节(8字节对齐)的连续空间, 空间不足返回nullptr
+    char* reserve(size_t len) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t free = m_mask + 1 - (tail - m_head.load(std::memory_order_acquire));
+        size_t contiguous = m_mask + 1 - (tail & m_mask);
+        if (len > contiguous) {
+            if (free < contiguous + len) {
+                return nullptr;
+            }
+            BinaryRecord* skip = (BinaryRecord*)(m_buf + (tail & m_mask));
+            skip->size = contiguous;
+            skip->level = BINARY_RECORD_SKIP;
+            tail += contiguous;
+        } else if (free < len) {
+            return nullptr;
+        }
+        m_reserved = tail + len;
+        return m_buf + (tail & m_mask);
+    }
+    // 生产者: 发布reserve得到的记录
+    void commit() { m_tail.store(m_reserved, std::memory_order_release); }
+
+    // 消费者: 队首记录, 队列为空返回nullptr
+    const char* front() {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        while (head != m_tail.load(std::memory_order_acquire)) {
+            const BinaryRecord* r = (const BinaryRecord*)(m_buf + (head & m_mask));
+            if (r->level != BINARY_RECORD_SKIP) {
+                return (const char*)r;
+            }
+            head += r->size;
+            m_head.store(head, std::memory_order_release);
+        }
+        return nullptr;
     }
+    void pop(const char* record) {
+        m_head.store(m_head.load(std::memory_order_relaxed)
+                + ((const BinaryRecord*)record)->size, std::memory_order_release);
+    }
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    pid_t getThreadId() const { return m_threadId; }
+    // 生产线程已退出
+    void detach() { m_detached = true; }
+    bool isDetached() const { return m_detached; }
+    // 所属输出器已销毁
+    void close() { m_closed = true; }
+    bool isClosed() const { return m_closed; }
+
+    // 消费者缓存的最近一次logger名和线程名的ID, m_segment变化后失效
+    uint64_t segment = 0;
+    std::string loggerName;
+    uint32_t loggerId = 0;
+    std::string threadName;
+    uint32_t threadNameId = 0;
 private:
-    std::string m_str;
+    char* m_buf;
+    size_t m_mask;
+    // 生产者预留到的位置
+    size_t m_reserved = 0;
+    pid_t m_threadId;
+    char m_pad0[64];
+    std::atomic<size_t> m_head = {0};
+    char m_pad1[64];
+    std::atomic<size_t> m_tail = {0};
+    char m_pad2[64];
+    std::atomic<bool> m_detached = {false};
+    std::atomic<bool> m_closed = {false};
 };
 
-class TabFormatItem : public LogFormatter::FormatItem {
-public:
-    TabFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "\t"; 
+namespace {
+
+// 线程退出时通知所有二进制输出器回收该线程的队列
+struct LocalBinaryRings {
+    ~LocalBinaryRings() {
+        for (auto& i : rings) {
+            i.second->detach();
+        }
     }
+    std::unordered_map<uint64_t, BinaryLogAppender::Ring::ptr> rings;
+    // 最近使用的队列, 避免每条日志查表
+    uint64_t lastId = 0;
+    BinaryLogAppender::Ring* last = nullptr;
 };
 
+static thread_local LocalBinaryRings t_binary_rings;
 
-Logger::Logger(const std::string& name)
-    : m_name(name)
-    , m_level(LogLevel::DEBUG) {
-    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
-}
+static std::atomic<uint64_t> s_binary_appender_id = {0};
 
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        auto self = shared_from_this();
-        MutexType::Lock lock(m_mutex);
-        if (!m_appenders.empty()) {
-            for (auto& iter : m_appenders) {
-                iter->log(self, level, event);
-            }
-        } else if (m_root) {
-            m_root->log(level, event);
-        }
-        
-    }
 }
 
-void Logger::debug(LogEvent::ptr event) {
-    log(LogLevel::DEBUG, event);
+BinaryLogAppender::BinaryLogAppender(const std::string& filename, size_t buffer_size
+                                     , LogRotator::ptr rotator)
+    : m_filename(filename)
+    , m_id(++s_binary_appender_id)
+    , m_bufferSize(buffer_size)
+    , m_buffer(buffer_size)
+    , m_rotator(rotator) {
+    m_rawArgs = true;
+    reopen();
+    m_thread.reset(new Thread(std::bind(&BinaryLogAppender::run, this), "binary_log"));
 }
 
-void Logger::info(LogEvent::ptr event) {
-    log(LogLevel::INFO, event);
+BinaryLogAppender::~BinaryLogAppender() {
+    m_stopping = true;
+    m_thread->join();
+    flush();
+
+    Mutex::Lock lock(m_ringMutex);
+    for (auto& i : m_rings) {
+        i->close();
+    }
+    m_rings.clear();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    if (m_rotator) {
+        m_rotator->close();
+    }
 }
 
-void Logger::warn(LogEvent::ptr event) {
-    log(LogLevel::WARN, event);
+bool BinaryLogAppender::reopen() {
+    Mutex::Lock lock(m_drainMutex);
+    flushBuffer();
+    return openFile();
 }
 
-void Logger::error(LogEvent::ptr event) {
-    log(LogLevel::ERROR, event);
+bool BinaryLogAppender::openFile() {
+    uint64_t generation = m_rotator ? m_rotator->getGeneration() : 0;
+    int fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "BinaryLogAppender open file=" << m_filename
+                  << " errno=" << errno << " errstr=" << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = fd;
+    // 新打开的文件从新的一段开始, 字符串表需要重新写入
+    m_hasHeader = false;
+    if (m_rotator) {
+        m_rotator->opened(generation, GetFileSize(m_filename));
+    }
+    return true;
 }
 
-void Logger::fatal(LogEvent::ptr event) {
-    log(LogLevel::FATAL, event);
+void BinaryLogAppender::flush() {
+    Mutex::Lock lock(m_drainMutex);
+    drain();
 }
 
-void Logger::addAppender(LogAppender::ptr appender) {
-    MutexType::Lock lock(m_mutex);
-    if (!appender->getFormatter()) {
-        MutexType::Lock ll(appender->m_mutex);
-        appender->m_formatter = m_formatter;
+void BinaryLogAppender::run() {
+    while (!m_stopping) {
+        size_t n = 0;
+        {
+            Mutex::Lock lock(m_drainMutex);
+            n = drain();
+        }
+        if (n == 0) {
+            usleep(10 * 1000);
+        }
     }
-    m_appenders.push_back(appender);
 }
 
-void Logger::delAppender(LogAppender::ptr appender) {
-    for (auto iter = m_appenders.begin(); iter != m_appenders.end(); ++iter) {
-        if (*iter == appender) {
-            m_appenders.erase(iter);
-            break;
+void BinaryLogAppender::flushBuffer() {
+    if (m_buffer.getSize() == 0) {
+        return;
+    }
+    if (m_fd >= 0) {
+        std::vector<iovec> iovs;
+        m_buffer.setPosition(0);
+        m_buffer.getReadBuffers(iovs);
+        WriteFully(m_fd, &iovs[0], iovs.size());
+        if (m_rotator) {
+            m_rotator->onWrite(m_buffer.getSize(), time(0));
         }
     }
+    m_buffer.clear();
 }
 
-void Logger::clearAppenders() {
-    m_appenders.clear();
+void BinaryLogAppender::writeHeader(uint64_t now) {
+    m_literals.clear();
+    m_strings.clear();
+    m_nextId = 1;
+    ++m_segment;
+    m_buffer.writeFuint8(HEADER);
+    m_buffer.writeFuint32(MAGIC);
+    m_buffer.writeFuint8(VERSION);
+    m_buffer.writeStringVint(m_formatter ? m_formatter->getPattern() : "");
+    m_buffer.writeUint64(now);
+    m_lastTime = now;
+    m_hasHeader = true;
 }
 
-void Logger::setFormatter(LogFormatter::ptr val) {
-    MutexType::Lock lock(m_mutex);
-    m_formatter = val;
+uint32_t BinaryLogAppender::internLiteral(const char* str) {
+    if (!str) {
+        return 0;
+    }
+    auto it = m_literals.find(str);
+    if (it != m_literals.end()) {
+        return it->second;
+    }
+    uint32_t id = m_nextId++;
+    m_buffer.writeFuint8(STRING);
+    m_buffer.writeUint32(id);
+    m_buffer.writeStringVint(str);
+    m_literals[str] = id;
+    return id;
+}
 
-    for (auto& i : m_appenders) {
-        //操作友函数需要显示加锁
-        MutexType::Lock ll(i->m_mutex);
-        if (!i->m_hasFormatter) {
-            i->m_formatter = m_formatter;
+uint32_t BinaryLogAppender::internString(const char* str, size_t len) {
+    std::string key(str, len);
+    auto it = m_strings.find(key);
+    if (it != m_strings.end()) {
+        return it->second;
+    }
+    uint32_t id = m_nextId++;
+    m_buffer.writeFuint8(STRING);
+    m_buffer.writeUint32(id);
+    m_buffer.writeStringVint(key);
+    m_strings[key] = id;
+    return id;
+}
+
+BinaryLogAppender::Ring* BinaryLogAppender::getLocalRing() {
+    LocalBinaryRings& local = t_binary_rings;
+    if (local.lastId == m_id) {
+        return local.last;
+    }
+    auto& rings = local.rings;
+    auto it = rings.find(m_id);
+    if (it == rings.end()) {
+        //清理已销毁输出器遗留的队列
+        for (auto i = rings.begin(); i != rings.end();) {
+            if (i->second->isClosed()) {
+                i = rings.erase(i);
+            } else {
+                ++i;
+            }
+        }
+        Ring::ptr ring(new Ring(BINARY_RING_SIZE));
+        {
+            Mutex::Lock lock(m_ringMutex);
+            m_rings.push_back(ring);
         }
+        it = rings.insert(std::make_pair(m_id, ring)).first;
     }
+    local.lastId = m_id;
+    local.last = it->second.get();
+    return local.last;
 }
 
-void Logger::setFormatter(const std::string& val) {
-    //std::cout << "---" << val << std::endl;
-    linko::LogFormatter::ptr new_val(new linko::LogFormatter(val));
-    if (new_val->isError()) {
-        std::cout << "Logger setFormatter name=" << m_name
-                  << " value=" << val << " invalid formatter"
-                  << std::endl;
+void BinaryLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
         return;
     }
-    setFormatter(new_val);
+    const char* fmt = event->getFmt();
+    if (fmt) {
+        const std::vector<LogArg>& args = event->getArgs();
+        std::vector<LogArgView> views(args.begin(), args.end());
+        logArgs(*logger, level, event->getFile(), event->getLine(), event->getElapse()
+                , fmt, views.data(), views.size());
+    } else {
+        // 流式日志没有格式串, 整条内容作为一个字符串参数
+        std::string content = event->getContent();
+        LogArgView view(content);
+        logArgs(*logger, level, event->getFile(), event->getLine(), event->getElapse()
+                , nullptr, &view, 1);
+    }
 }
 
-std::string Logger::toYamlString() {
-    MutexType::Lock lock(m_mutex);
-    YAML::Node node;
-    node["root"] = m_name;
-    if (m_level != LogLevel::UNKNOW) {
-        node["level"] = LogLevel::ToString(m_level);
+void BinaryLogAppender::logArgs(const Logger& logger, LogLevel::Level level, const char* file
+                                , int32_t line, uint32_t elapse, const char* fmt
+                                , const LogArgView* args, size_t argc) {
+    if (level < m_level) {
+        return;
     }
-    if (m_formatter) {
-        node["formatter"] = m_formatter->getPattern();
+    const std::string& logger_name = logger.getName();
+    const std::string& thread_name = Thread::GetName();
+    std::shared_ptr<const std::string> request_id = GetRequestId();
+    size_t logger_len = std::min(logger_name.size(), BINARY_MAX_NAME);
+    size_t thread_name_len = std::min(thread_name.size(), BINARY_MAX_NAME);
+    size_t request_id_len = request_id ? std::min(request_id->size(), BINARY_MAX_NAME) : 0;
+
+    size_t len = sizeof(BinaryRecord) + logger_len + thread_name_len + request_id_len;
+    size_t strings = 0;
+    size_t string_bytes = 0;
+    for (size_t i = 0; i < argc; ++i) {
+        if (args[i].type == LogArg::STRING) {
+            ++strings;
+            string_bytes += args[i].len;
+            len += 1 + sizeof(uint32_t);
+        } else {
+            len += 1 + sizeof(uint64_t);
+        }
     }
-    
-    for (auto& i : m_appenders) {
-        node["appenders"].push_back(YAML::Load(i->toYamlString()));
+    //超长时字符串参数平均截断
+    size_t string_limit = (size_t)-1;
+    if (len + string_bytes > BINARY_MAX_RECORD) {
+        if (len >= BINARY_MAX_RECORD) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        string_limit = (BINARY_MAX_RECORD - len) / strings;
+        for (size_t i = 0; i < argc; ++i) {
+            if (args[i].type == LogArg::STRING) {
+                len += std::min(args[i].len, string_limit);
+            }
+        }
+    } else {
+        len += string_bytes;
+    }
+    len = (len + 7) & ~(size_t)7;
+
+    Ring* ring = getLocalRing();
+    char* buf = nullptr;
+    while (!(buf = ring->reserve(len))) {
+        if (m_stopping) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        //不持有任何锁, 等待后台线程腾出空间
+        WaitForRingSpace();
+        ring = getLocalRing();
+    }
+
+    BinaryRecord* r = (BinaryRecord*)buf;
+    r->size = len;
+    r->level = level;
+    r->argc = argc;
+    r->line = line;
+    r->fiber_id = GetFiberId();
+    r->elapse = elapse;
+    r->logger_len = logger_len;
+    r->thread_name_len = thread_name_len;
+    r->request_id_len = request_id_len;
+    r->time = time(0);
+    r->fmt = fmt;
+    r->file = file;
+    char* p = buf + sizeof(BinaryRecord);
+    memcpy(p, logger_name.data(), logger_len);
+    p += logger_len;
+    memcpy(p, thread_name.data(), thread_name_len);
+    p += thread_name_len;
+    if (request_id_len) {
+        memcpy(p, request_id->data(), request_id_len);
+        p += request_id_len;
+    }
+    for (size_t i = 0; i < argc; ++i) {
+        *p++ = args[i].type;
+        if (args[i].type == LogArg::STRING) {
+            uint32_t n = std::min(args[i].len, string_limit);
+            memcpy(p, &n, sizeof(n));
+            p += sizeof(n);
+            memcpy(p, args[i].s, n);
+            p += n;
+        } else {
+            memcpy(p, &args[i].u, sizeof(uint64_t));
+            p += sizeof(uint64_t);
+        }
+    }
+    ring->commit();
+
+    if (level >= LogLevel::ERROR) {
+        flush();
     }
-    std::stringstream ss;
-    ss << node;
-    return ss.str();
 }
 
-FileLogAppender::FileLogAppender(const std::string& filename) 
-    : m_filename(filename){
-    reopen();
+size_t BinaryLogAppender::drain() {
+    std::vector<Ring::ptr> rings;
+    {
+        Mutex::Lock lock(m_ringMutex);
+        for (auto it = m_rings.begin(); it != m_rings.end();) {
+            //线程已退出且队列为空, 回收
+            if ((*it)->isDetached() && (*it)->empty()) {
+                it = m_rings.erase(it);
+            } else {
+                rings.push_back(*it);
+                ++it;
+            }
+        }
+    }
+    if (m_rotator && m_rotator->needReopen()) {
+        // 缓冲区中的记录依赖旧文件的字符串表, 先写入旧文件再切换
+        flushBuffer();
+        openFile();
+    }
+
+    size_t count = 0;
+    for (auto& ring : rings) {
+        const char* record = nullptr;
+        while ((record = ring->front())) {
+            encode(*ring, record);
+            ring->pop(record);
+            ++count;
+            if (m_buffer.getSize() >= m_bufferSize) {
+                flushBuffer();
+            }
+        }
+    }
+    flushBuffer();
+    return count;
 }
 
-void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        MutexType::Lock lock(m_mutex);
-        m_filestream << m_formatter->format(logger, level, event);
+void BinaryLogAppender::encode(Ring& ring, const char* record) {
+    // 流式日志没有格式串, 整条内容作为一个字符串参数
+    static const char* s_content_fmt = "%s";
+
+    const BinaryRecord* r = (const BinaryRecord*)record;
+    if (!m_hasHeader) {
+        writeHeader(r->time);
+    }
+    const char* p = record + sizeof(BinaryRecord);
+    const char* logger_name = p;
+    p += r->logger_len;
+    const char* thread_name = p;
+    p += r->thread_name_len;
+    const char* request_id = p;
+    p += r->request_id_len;
+
+    uint32_t fmt_id = internLiteral(r->fmt ? r->fmt : s_content_fmt);
+    uint32_t file_id = internLiteral(r->file);
+    if (ring.segment != m_segment) {
+        ring.segment = m_segment;
+        ring.loggerId = 0;
+        ring.threadNameId = 0;
+    }
+    if (!ring.loggerId || ring.loggerName.size() != r->logger_len
+            || memcmp(ring.loggerName.data(), logger_name, r->logger_len)) {
+        ring.loggerName.assign(logger_name, r->logger_len);
+        ring.loggerId = internString(logger_name, r->logger_len);
+    }
+    if (!ring.threadNameId || ring.threadName.size() != r->thread_name_len
+            || memcmp(ring.threadName.data(), thread_name, r->thread_name_len)) {
+        ring.threadName.assign(thread_name, r->thread_name_len);
+        ring.threadNameId = internString(thread_name, r->thread_name_len);
+    }
+
+    m_buffer.writeFuint8(EVENT);
+    m_buffer.writeUint32(fmt_id);
+    m_buffer.writeUint32(file_id);
+    m_buffer.writeInt32(r->line);
+    m_buffer.writeFuint8(r->level);
+    m_buffer.writeInt64((int64_t)(r->time - m_lastTime));
+    m_buffer.writeUint32(ring.getThreadId());
+    m_buffer.writeUint32(r->fiber_id);
+    m_buffer.writeUint32(r->elapse);
+    m_buffer.writeUint32(ring.loggerId);
+    m_buffer.writeUint32(ring.threadNameId);
+    //请求id每次都不同, 不放入字符串表
+    m_buffer.writeUint64(r->request_id_len);
+    m_buffer.write(request_id, r->request_id_len);
+    m_lastTime = r->time;
+
+    m_buffer.writeUint32(r->argc);
+    for (uint16_t i = 0; i < r->argc; ++i) {
+        uint8_t type = *p++;
+        m_buffer.writeFuint8(type);
+        if (type == LogArg::STRING) {
+            uint32_t n = 0;
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            m_buffer.writeUint64(n);
+            m_buffer.write(p, n);
+            p += n;
+            continue;
+        }
+        uint64_t v = 0;
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        switch (type) {
+            case LogArg::INT:
+                m_buffer.writeInt64((int64_t)v);
+                break;
+            case LogArg::UINT:
+                m_buffer.writeUint64(v);
+                break;
+            case LogArg::DOUBLE: {
+                double d;
+                memcpy(&d, &v, sizeof(d));
+                m_buffer.writeDouble(d);
+                break;
+            }
+        }
     }
 }
 
-std::string FileLogAppender::toYamlString() {
+std::string BinaryLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
     YAML::Node node;
-    node["type"] = "FileLogAppender";
+    node["type"] = "BinaryLogAppender";
     node["file"] = m_filename;
+    RotatorToYaml(node, m_rotator);
     if (m_level != LogLevel::UNKNOW) {
         node["level"] = LogLevel::ToString(m_level);
     }
@@ -361,18 +2245,12 @@ std::string FileLogAppender::toYamlString() {
     return ss.str();
 }
 
-bool FileLogAppender::reopen() {
-    MutexType::Lock lock(m_mutex);
-    if (m_filestream) {
-        m_filestream.close();
-    }
-    m_filestream.open(m_filename, std::ios::app);
-    return !!m_filestream;
-}
-
 void StdoutLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
     if (level >= m_level) {
-        m_formatter->format(std::cout, logger, level, event);
+        std::string& buf = t_format_buffer;
+        buf.clear();
+        m_formatter->format(buf, logger, level, event);
+        std::cout.write(buf.data(), buf.size());
     }
 }
 
@@ -397,11 +2275,55 @@ LogFormatter::LogFormatter(const std::string& pattern)
 }
 
 std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for (auto& i : m_items) {
-        i->format(ss, logger, level, event);
+    std::string buf;
+    format(buf, logger, level, event);
+    return buf;
+}
+
+void LogFormatter::format(std::string& buf, const std::shared_ptr<Logger>& logger
+                        , LogLevel::Level level, const LogEvent::ptr& event) {
+    for (auto& op : m_ops) {
+        switch (op.type) {
+            case FormatOp::STRING:
+                buf.append(op.arg);
+                break;
+            case FormatOp::MESSAGE:
+                event->appendContent(buf);
+                break;
+            case FormatOp::LEVEL:
+                buf.append(LogLevel::ToString(level));
+                break;
+            case FormatOp::ELAPSE:
+                AppendUint(buf, event->getElapse());
+                break;
+            case FormatOp::NAME:
+                buf.append(event->getLogger()->getName());
+                break;
+            case FormatOp::THREAD_ID:
+                AppendUint(buf, event->getThreadId());
+                break;
+            case FormatOp::FIBER_ID:
+                AppendUint(buf, event->getFiberId());
+                break;
+            case FormatOp::THREAD_NAME:
+                buf.append(event->getThreadName());
+                break;
+            case FormatOp::REQUEST_ID:
+                if (event->getRequestId()) {
+                    buf.append(*event->getRequestId());
+                }
+                break;
+            case FormatOp::DATETIME:
+                AppendTime(buf, op.arg, event->getTime());
+                break;
+            case FormatOp::FILENAME:
+                buf.append(event->getFile());
+                break;
+            case FormatOp::LINE:
+                AppendInt(buf, event->getLine());
+                break;
+        }
     }
-    return ss.str();
 }
 
 std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
@@ -495,19 +2417,47 @@ void LogFormatter::init() {
         XX(T, TabFormatItem),
         XX(F, FiberIdFormatItem),
         XX(N, ThreadNameFormatItem),
+        XX(R, RequestIdFormatItem),
 #undef XX
     };
 
+    static std::map<std::string, FormatOp::Type> s_format_ops = {
+        {"m", FormatOp::MESSAGE},
+        {"p", FormatOp::LEVEL},
+        {"r", FormatOp::ELAPSE},
+        {"c", FormatOp::NAME},
+        {"t", FormatOp::THREAD_ID},
+        {"d", FormatOp::DATETIME},
+        {"f", FormatOp::FILENAME},
+        {"l", FormatOp::LINE},
+        {"F", FormatOp::FIBER_ID},
+        {"N", FormatOp::THREAD_NAME},
+        {"R", FormatOp::REQUEST_ID},
+    };
+
     for (auto& iter : vec) {
         if (std::get<2>(iter) == 0) {
             m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(iter))));
+            addOp(FormatOp::STRING, std::get<0>(iter));
         } else {
             auto it = s_format_items.find(std::get<0>(iter));
             if (it == s_format_items.end()) {
                 m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(iter) + ">>")));
+                addOp(FormatOp::STRING, "<<error_format %" + std::get<0>(iter) + ">>");
                 m_error = true;
             } else {
                 m_items.push_back(it->second(std::get<1>(iter)));
+                //换行和制表符在编译时直接转为常量文本
+                if (std::get<0>(iter) == "n") {
+                    addOp(FormatOp::STRING, "\n");
+                } else if (std::get<0>(iter) == "T") {
+                    addOp(FormatOp::STRING, "\t");
+                } else if (std::get<0>(iter) == "d") {
+                    addOp(FormatOp::DATETIME, std::get<1>(iter).empty()
+                            ? "%Y-%m-%d %H:%M:%S" : std::get<1>(iter));
+                } else {
+                    addOp(s_format_ops[std::get<0>(iter)], "");
+                }
             }
         }
         //std::cout << "(" << std::get<0>(iter) << ") - (" << std::get<1>(iter) << ") - (" << std::get<2>(iter) << ")" << std::endl;
@@ -515,6 +2465,15 @@ void LogFormatter::init() {
     //std::cout << m_items.size() << std::endl;
 }
 
+void LogFormatter::addOp(FormatOp::Type type, const std::string& arg) {
+    //合并相邻的常量文本
+    if (type == FormatOp::STRING && !m_ops.empty()
+            && m_ops.back().type == FormatOp::STRING) {
+        m_ops.back().arg.append(arg);
+        return;
+    }
+    m_ops.push_back(FormatOp(type, arg));
+}
 
 LoggerManager::LoggerManager() {
     m_root.reset(new Logger);
@@ -550,19 +2509,69 @@ std::string LoggerManager::toYamlString() {
 }
 
 struct LogAppnderDefine {
-    int type = 0; //1: File, 2: Stdout
+    int type = 0; //1: File, 2: Stdout, 3: Binary
     LogLevel::Level level = LogLevel::UNKNOW;
     std::string formatter;
     std::string file;
+    //FileLogAppender是否使用异步模式
+    bool async = false;
+    AsyncLogAppender::OverflowPolicy overflow = AsyncLogAppender::BLOCK;
+    uint32_t queueSize = 4096;
+    //文件切分, rotateSize和rotateInterval均为0时不切分
+    uint64_t rotateSize = 0;
+    uint32_t rotateInterval = 0;
+    uint32_t rotateMaxFiles = 0;
+    bool rotateCompress = true;
 
     bool operator==(const LogAppnderDefine& oth) const {
         return type == oth.type
             && level == oth.level
             && formatter == oth.formatter
-            && file == oth.file;
+            && file == oth.file
+            && async == oth.async
+            && overflow == oth.overflow
+            && queueSize == oth.queueSize
+            && rotateSize == oth.rotateSize
+            && rotateInterval == oth.rotateInterval
+            && rotateMaxFiles == oth.rotateMaxFiles
+            && rotateCompress == oth.rotateCompress;
+    }
+
+    LogRotator::ptr createRotator() const {
+        if (!rotateSize && !rotateInterval) {
+            return nullptr;
+        }
+        return LogRotator::ptr(new LogRotator(file, rotateSize
+                    , rotateInterval, rotateMaxFiles, rotateCompress));
     }
 };
 
+/*
+ * rotate:
+ *   max_size: 100M      # 按大小切分, 支持K/M/G
+ *   interval: daily     # 按时间切分, hourly/daily/秒数
+ *   max_files: 7        # 保留的归档数
+ *   compress: true      # gzip压缩归档
+ */
+static void ParseRotate(const YAML::Node& a, LogAppnderDefine& lad) {
+    if (!a["rotate"].IsDefined()) {
+        return;
+    }
+    auto r = a["rotate"];
+    if (r["max_size"].IsDefined()) {
+        lad.rotateSize = LogRotator::ParseSize(r["max_size"].as<std::string>());
+    }
+    if (r["interval"].IsDefined()) {
+        lad.rotateInterval = LogRotator::ParseInterval(r["interval"].as<std::string>());
+    }
+    if (r["max_files"].IsDefined()) {
+        lad.rotateMaxFiles = r["max_files"].as<uint32_t>();
+    }
+    if (r["compress"].IsDefined()) {
+        lad.rotateCompress = r["compress"].as<bool>();
+    }
+}
+
 struct LogDefine {
     std::string name;
     LogLevel::Level level = LogLevel::UNKNOW;
@@ -615,6 +2624,27 @@ public:
                     if (a["formatter"].IsDefined()) {
                         lad.formatter = a["formatter"].as<std::string>();
                     }
+                    if (a["async"].IsDefined()) {
+                        lad.async = a["async"].as<bool>();
+                    }
+                    if (a["overflow"].IsDefined()) {
+                        lad.overflow = AsyncLogAppender::FromString(a["overflow"].as<std::string>());
+                    }
+                    if (a["queue_size"].IsDefined()) {
+                        lad.queueSize = a["queue_size"].as<uint32_t>();
+                    }
+                    ParseRotate(a, lad);
+                } else if (type == "BinaryLogAppender") {
+                    lad.type = 3;
+                    if (!a["file"].IsDefined()) {
+                        std::cout << "log config error: binaryappender's file is null, " << a << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    ParseRotate(a, lad);
+                    if (a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
                 } else if (type == "StdoutLogAppender") {
                     lad.type = 2;
                     if (a["formatter"].IsDefined()) {
@@ -649,8 +2679,24 @@ public:
             if (a.type == 1) {
                 na["type"] = "FileLogAppender";
                 na["file"] = a.file;
+                if (a.async) {
+                    na["async"] = true;
+                    na["overflow"] = AsyncLogAppender::ToString(a.overflow);
+                    na["queue_size"] = a.queueSize;
+                }
             } else if (a.type == 2) {
                 na["typd"] = "StdoutLogAppender";
+            } else if (a.type == 3) {
+                na["type"] = "BinaryLogAppender";
+                na["file"] = a.file;
+            }
+            if (a.rotateSize || a.rotateInterval) {
+                YAML::Node r;
+                r["max_size"] = a.rotateSize;
+                r["interval"] = a.rotateInterval;
+                r["max_files"] = a.rotateMaxFiles;
+                r["compress"] = a.rotateCompress;
+                na["rotate"] = r;
             }
             if (!a.formatter.empty()) {
                 na["formatter"] = a.formatter;
@@ -700,10 +2746,15 @@ struct LogIniter {
                 logger->clearAppenders();
                 for (auto& a : i.appenderDefines) {
                     linko::LogAppender::ptr ap;
-                    if (a.type == 1) {
-                        ap.reset(new FileLogAppender(a.file));
+                    if (a.type == 1 && a.async) {
+                        ap.reset(new AsyncLogAppender(a.file, a.queueSize, a.overflow
+                                    , 16, 10, a.createRotator()));
+                    } else if (a.type == 1) {
+                        ap.reset(new FileLogAppender(a.file, a.createRotator()));
                     } else if (a.type == 2) {
                         ap.reset(new StdoutLogAppender);
+                    } else if (a.type == 3) {
+                        ap.reset(new BinaryLogAppender(a.file, 64 * 1024, a.createRotator()));
                     }
                     ap->setLevel(a.level);
                     if (!a.formatter.empty()) {
@@ -2,6 +2,8 @@
 #define __LINKO_LOG_H__
 
 #include <cstdarg>
+#include <string.h>
+#include <atomic>
 #include <map>
 #include <string>
 #include <memory>
@@ -9,7 +11,10 @@
 #include <sstream>
 #include <vector>
 #include <fstream>
+#include <type_traits>
+#include <unordered_map>
 #include "util.h"
+#include "bytearray.h"
 #include "singleton.h"
 #include "thread.h"
 
@@ -37,6 +42,40 @@
 #define LINKO_LOG_FMT_ERROR(logger, fmt, ...) LINKO_LOG_FMT_LEVEL(logger, linko::LogLevel::ERROR, fmt, __VA_ARGS__)
 #define LINKO_LOG_FMT_FATAL(logger, fmt, ...) LINKO_LOG_FMT_LEVEL(logger, linko::LogLevel::FATAL, fmt, __VA_ARGS__)
 
+// 延迟格式化: 只记录格式串和参数, 由输出器决定何时格式化(二进制输出器直接落盘原始参数)
+// fmt必须是字符串常量, 二进制输出器按地址缓存格式串ID
+#define LINKO_LOG_BIN_LEVEL(logger, level, fmt, ...) \
+    if (logger->getLevel() <= level) \
+        logger->logDeferred(level, __FILE__, __LINE__, "" fmt, ##__VA_ARGS__)
+
+#define LINKO_LOG_BIN_DEBUG(logger, fmt, ...) LINKO_LOG_BIN_LEVEL(logger, linko::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LINKO_LOG_BIN_INFO(logger, fmt, ...) LINKO_LOG_BIN_LEVEL(logger, linko::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LINKO_LOG_BIN_WARN(logger, fmt, ...) LINKO_LOG_BIN_LEVEL(logger, linko::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define LINKO_LOG_BIN_ERROR(logger, fmt, ...) LINKO_LOG_BIN_LEVEL(logger, linko::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LINKO_LOG_BIN_FATAL(logger, fmt, ...) LINKO_LOG_BIN_LEVEL(logger, linko::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+// 限流日志, 每个调用点持有一个静态限流器, 参数必须是常量
+// 被跳过时不构造LogEvent, 放行时在内容前输出期间被抑制的条数
+#define LINKO_LOG_LIMITED(logger, level, limiter_type, ...) \
+    if (uint64_t __linko_suppressed = 0) {} else \
+    if (logger->getLevel() <= level \
+            && []() -> limiter_type& { static limiter_type s_limiter(__VA_ARGS__); return s_limiter; }() \
+                .allow(__linko_suppressed)) \
+        linko::LogEventWrap(linko::LogEvent::ptr(new linko::LogEvent(logger, level, \
+                        __FILE__, __LINE__, 0, linko::GetThreadId(), linko::GetFiberId(), \
+                        time(0), linko::Thread::GetName()))).getSS() \
+            << linko::LogSuppressed(__linko_suppressed)
+
+// 每n次输出1次
+#define LINKO_LOG_EVERY_N(logger, level, n) \
+    LINKO_LOG_LIMITED(logger, level, linko::LogEveryN, n)
+// 每ms毫秒最多输出1次
+#define LINKO_LOG_EVERY_MS(logger, level, ms) \
+    LINKO_LOG_LIMITED(logger, level, linko::LogEveryMS, ms)
+// 令牌桶, 每秒rate条, 最多突发burst条
+#define LINKO_LOG_RATE_LIMITED(logger, level, rate, burst) \
+    LINKO_LOG_LIMITED(logger, level, linko::LogTokenBucket, rate, burst)
+
 #define LINKO_LOG_ROOT() linko::LoggerMgr::GetInstance()->getRoot()
 #define LINKO_LOG_NAME(name) linko::LoggerMgr::GetInstance()->getLogger(name)
 
@@ -61,6 +100,102 @@ public:
 };
 
 
+/*
+ * 延迟格式化的日志参数
+ * 整数统一按64位保存, 格式化时再按格式串中的转换符输出
+ */
+struct LogArg {
+    enum Type {
+        INT = 1,
+        UINT = 2,
+        DOUBLE = 3,
+        STRING = 4
+    };
+
+    template<class T>
+    LogArg(T v, typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value)
+                                        || std::is_enum<T>::value>::type* = 0)
+        : type(INT), i((int64_t)v) {}
+    template<class T>
+    LogArg(T v, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type* = 0)
+        : type(UINT), u((uint64_t)v) {}
+    template<class T>
+    LogArg(T v, typename std::enable_if<std::is_floating_point<T>::value>::type* = 0)
+        : type(DOUBLE), d((double)v) {}
+    template<class T>
+    LogArg(const T* v)
+        : type(UINT), u((uint64_t)(uintptr_t)v) {}
+    LogArg(const char* v)
+        : type(STRING), u(0), s(v ? v : "(null)") {}
+    LogArg(char* v)
+        : type(STRING), u(0), s(v ? v : "(null)") {}
+    LogArg(const std::string& v)
+        : type(STRING), u(0), s(v) {}
+
+    LogArg(const struct LogArgView& v);
+
+    Type type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+    std::string s;
+};
+
+/*
+ * 不拥有字符串的参数视图, 与LogArg的类型规则相同
+ * 延迟格式化日志在调用线程只构造视图, 不分配内存
+ */
+struct LogArgView {
+    LogArgView()
+        : type(LogArg::UINT), u(0) {}
+    template<class T>
+    LogArgView(T v, typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value)
+                                        || std::is_enum<T>::value>::type* = 0)
+        : type(LogArg::INT), i((int64_t)v) {}
+    template<class T>
+    LogArgView(T v, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type* = 0)
+        : type(LogArg::UINT), u((uint64_t)v) {}
+    template<class T>
+    LogArgView(T v, typename std::enable_if<std::is_floating_point<T>::value>::type* = 0)
+        : type(LogArg::DOUBLE), d((double)v) {}
+    template<class T>
+    LogArgView(const T* v)
+        : type(LogArg::UINT), u((uint64_t)(uintptr_t)v) {}
+    LogArgView(const char* v)
+        : type(LogArg::STRING), u(0), s(v ? v : "(null)"), len(strlen(s)) {}
+    LogArgView(char* v)
+        : LogArgView((const char*)v) {}
+    LogArgView(const std::string& v)
+        : type(LogArg::STRING), u(0), s(v.data()), len(v.size()) {}
+    LogArgView(const LogArg& v)
+        : type(v.type), u(v.u) {
+        if (type == LogArg::STRING) {
+            s = v.s.data();
+            len = v.s.size();
+        }
+    }
+
+    LogArg::Type type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+    const char* s = nullptr;
+    size_t len = 0;
+};
+
+
+/*
+ * 请求id, 保存在协程局部存储中, 由当前协程派生的协程继承
+ * LogEvent创建时记录, 日志格式%R输出
+ */
+void SetRequestId(const std::string& id);
+void ClearRequestId();
+std::shared_ptr<const std::string> GetRequestId();
+
 class LogEvent{
 public:
     typedef std::shared_ptr<LogEvent> ptr;
@@ -77,13 +212,38 @@ public:
     uint32_t getFiberId() const { return m_fiberId; }
     uint64_t getTime() const { return m_time; }
     const std::string& getThreadName() const { return m_threadName; }
-    std::string getContent() const { return m_ss.str(); }
+    // 创建时所在协程的请求id, 没有为nullptr
+    const std::shared_ptr<const std::string>& getRequestId() const { return m_requestId; }
+    void setRequestId(std::shared_ptr<const std::string> v) { m_requestId = std::move(v); }
+    std::string getContent() const;
+    // 将日志内容追加到buf末尾
+    void appendContent(std::string& buf) const;
+    // 不分配内存地取得已写入的内容, 延迟格式化的日志返回格式串; 供崩溃信号处理使用
+    const char* peekContent(size_t& len) const;
     std::shared_ptr<Logger> getLogger() const { return m_logger; }
     LogLevel::Level getLevel() const { return m_level; }
     std::stringstream& getSS() { return m_ss; }
 
     void format(const char* fmt, ...);
     void format(const char* fmt, va_list al);
+
+    // 记录格式串和参数, 不立即格式化
+    template<class... Args>
+    void capture(const char* fmt, const Args&... args) {
+        m_fmt = fmt;
+        m_args.reserve(sizeof...(args));
+        int dummy[] = {0, (m_args.push_back(LogArg(args)), 0)...};
+        (void)dummy;
+    }
+
+    void captureViews(const char* fmt, const LogArgView* args, size_t argc);
+
+    // 延迟格式化的格式串, 流式/printf式日志为nullptr
+    const char* getFmt() const { return m_fmt; }
+    const std::vector<LogArg>& getArgs() const { return m_args; }
+
+    // 按printf格式串将args格式化追加到buf, 整数转换符会忽略原有的长度修饰
+    static void FormatArgs(std::string& buf, const char* fmt, const std::vector<LogArg>& args);
 private:
     //file name
     const char* m_file{nullptr};
@@ -99,15 +259,118 @@ private:
     uint64_t m_time{0};
     //thread name
     const std::string m_threadName;
+    //request id
+    std::shared_ptr<const std::string> m_requestId;
     //logger content stream
     std::stringstream m_ss;
     //Logger
     std::shared_ptr<Logger> m_logger;
     //log level
     LogLevel::Level m_level;
+    //deferred format string
+    const char* m_fmt{nullptr};
+    //deferred arguments
+    std::vector<LogArg> m_args;
 };
 
 
+/*
+ * 日志限流器
+ * 返回true时suppressed为上次放行后被抑制的条数
+ * allow返回false的开销: LogEveryN只有一次relaxed fetch_add;
+ * LogEveryMS和LogTokenBucket还要读一次单调时钟, 再做一次relaxed load和一次relaxed fetch_add
+ */
+class LogEveryN {
+public:
+    LogEveryN(uint64_t n)
+        : m_n(n ? n : 1) {}
+
+    bool allow(uint64_t& suppressed) {
+        uint64_t c = m_count.fetch_add(1, std::memory_order_relaxed);
+        if (c % m_n) {
+            return false;
+        }
+        suppressed = c ? m_n - 1 : 0;
+        return true;
+    }
+private:
+    uint64_t m_n;
+    std::atomic<uint64_t> m_count = {0};
+};
+
+class LogEveryMS {
+public:
+    LogEveryMS(uint64_t ms)
+        : m_interval(ms) {}
+
+    bool allow(uint64_t& suppressed) {
+        // 单调时钟, 系统时间回拨不会导致长时间全部被抑制
+        uint64_t now = GetMonotonicMS();
+        uint64_t next = m_next.load(std::memory_order_relaxed);
+        if (now < next || !m_next.compare_exchange_strong(next, now + m_interval
+                                , std::memory_order_relaxed)) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+private:
+    uint64_t m_interval;
+    std::atomic<uint64_t> m_next = {0};
+    std::atomic<uint64_t> m_suppressed = {0};
+};
+
+// GCRA形式的令牌桶, 只需维护一个理论到达时间
+class LogTokenBucket {
+public:
+    LogTokenBucket(double rate, uint32_t burst)
+        : m_interval(IntervalUS(rate))
+        , m_tolerance(m_interval * (burst ? burst - 1 : 0)) {}
+
+    bool allow(uint64_t& suppressed) {
+        uint64_t now = GetMonotonicUS();
+        uint64_t tat = m_tat.load(std::memory_order_relaxed);
+        do {
+            if (tat > now + m_tolerance) {
+                m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!m_tat.compare_exchange_weak(tat, (tat > now ? tat : now) + m_interval
+                        , std::memory_order_relaxed));
+        suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+private:
+    // 每条日志的间隔, 微秒; rate超过1000000时按1us计, 避免间隔为0导致不再限流
+    static uint64_t IntervalUS(double rate) {
+        if (rate <= 0) {
+            return 1000000;
+        }
+        uint64_t v = 1000000 / rate;
+        return v ? v : 1;
+    }
+
+    uint64_t m_interval;
+    uint64_t m_tolerance;
+    std::atomic<uint64_t> m_tat = {0};
+    std::atomic<uint64_t> m_suppressed = {0};
+};
+
+struct LogSuppressed {
+    LogSuppressed(uint64_t c)
+        : count(c) {}
+    uint64_t count;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const LogSuppressed& s) {
+    if (s.count) {
+        os << "[suppressed " << s.count << " messages] ";
+    }
+    return os;
+}
+
+
 class LogEventWrap {
 public:
     LogEventWrap(LogEvent::ptr e);
@@ -127,6 +390,9 @@ public:
     std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
 
     std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+
+    // 按编译后的指令序列追加到buf末尾, 不经过ostream和虚函数
+    void format(std::string& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event);
 public:
     class FormatItem {
     public:
@@ -135,16 +401,45 @@ public:
         virtual void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
     };
 
+    // 编译后的格式化指令, 相邻的常量文本会被合并为一条STRING
+    struct FormatOp {
+        enum Type {
+            STRING,
+            MESSAGE,
+            LEVEL,
+            ELAPSE,
+            NAME,
+            THREAD_ID,
+            FIBER_ID,
+            THREAD_NAME,
+            REQUEST_ID,
+            DATETIME,
+            FILENAME,
+            LINE
+        };
+
+        FormatOp(Type t, const std::string& a = "")
+            : type(t), arg(a) {}
+
+        Type type;
+        // STRING的文本或DATETIME的strftime格式
+        std::string arg;
+    };
+
     void init();
 
     bool isError() const { return m_error; }
 
     const std::string getPattern() const { return m_pattern; }
+private:
+    void addOp(FormatOp::Type type, const std::string& arg);
 private:
     //log format
     std::string m_pattern;
     //parsed log format
     std::vector<FormatItem::ptr> m_items;
+    //compiled log format
+    std::vector<FormatOp> m_ops;
     bool m_error = false;
 };
 
@@ -168,6 +463,8 @@ public:
 protected:
     LogLevel::Level m_level = LogLevel::DEBUG;
     bool m_hasFormatter = false;
+    // 直接接收延迟格式化的参数(BinaryLogAppender), Logger据此跳过LogEvent的构造
+    bool m_rawArgs = false;
     MutexType m_mutex;
     LogFormatter::ptr m_formatter;
 };
@@ -178,8 +475,10 @@ friend class LoggerManager;
 public:
     typedef std::shared_ptr<Logger> ptr;
     typedef SpinLock MutexType;
+    typedef std::list<LogAppender::ptr> AppenderList;
 
     Logger(const std::string& name = "root");
+    ~Logger();
 
     void log(LogLevel::Level level, LogEvent::ptr event);
     void debug(LogEvent::ptr event);
@@ -187,6 +486,19 @@ public:
     void warn(LogEvent::ptr event);
     void error(LogEvent::ptr event);
     void fatal(LogEvent::ptr event);
+
+    /*
+     * 延迟格式化日志, 二进制输出器在调用线程只拷贝参数
+     * 其他输出器才构造LogEvent, 由LINKO_LOG_BIN_*调用
+     */
+    template<class... Args>
+    void logDeferred(LogLevel::Level level, const char* file, int32_t line
+            , const char* fmt, const Args&... args) {
+        LogArgView views[sizeof...(args) + 1] = {LogArgView(args)...};
+        logArgs(level, file, line, fmt, views, sizeof...(args));
+    }
+    void logArgs(LogLevel::Level level, const char* file, int32_t line
+            , const char* fmt, const LogArgView* args, size_t argc);
     
     void addAppender(LogAppender::ptr appender);
     void delAppender(LogAppender::ptr appender);
@@ -202,11 +514,29 @@ public:
 
     std::string toYamlString();
 
+private:
+    // 发布新的输出器列表并退役旧列表, 调用方需持有m_mutex
+    void publishAppenders(AppenderList* appenders);
+    /*
+     * 释放已经没有Logger::log在遍历的旧列表, 只被旧列表引用的输出器随之析构(停止写线程并flush)
+     * wait为true时最多等待100ms让正在输出的读者退出, 仍未退出的留到下次发布时再回收
+     */
+    void reclaimAppenders(bool wait);
+    const AppenderList& appenders() const {
+        return *m_appenders.load(std::memory_order_acquire);
+    }
+
 private:
     std::string m_name;
     LogLevel::Level m_level;
     MutexType m_mutex;
-    std::list<LogAppender::ptr> m_appenders;
+    /*
+     * 写时复制的输出器列表, log()在EpochGuard内做一次acquire读取, 不加锁
+     * 旧列表可能仍被其他线程遍历, 基于epoch延迟释放
+     */
+    std::atomic<const AppenderList*> m_appenders{nullptr};
+    // 已退役待释放的列表及退役时的epoch
+    std::vector<std::pair<const AppenderList*, uint64_t> > m_retired;
     LogFormatter::ptr m_formatter;
     Logger::ptr m_root;
 };
@@ -219,17 +549,260 @@ public:
     std::string toYamlString() override;
 };
 
+/*
+ * 日志文件切分
+ * 写日志的线程只做大小和时间判断, 改名和压缩都由后台线程完成:
+ * 后台线程先把当前文件改名为归档文件(写线程的fd仍指向它, 日志不会丢失)并增加代数,
+ * 写线程下次写入时发现代数变化便重新打开同名新文件, 之后后台线程再压缩归档文件并清理旧归档
+ * 归档文件名为 filename.YYYYmmdd-HHMMSS[.N][.gz]
+ */
+class LogRotator : public std::enable_shared_from_this<LogRotator> {
+public:
+    typedef std::shared_ptr<LogRotator> ptr;
+
+    // max_size: 文件超过该字节数时切分, 0表示不按大小切分
+    // interval: 按本地时间对齐的切分周期(秒), 如3600按小时, 86400按天, 0表示不按时间切分
+    // max_files: 保留的归档文件数, 0表示不清理
+    // compress: 归档文件是否gzip压缩
+    LogRotator(const std::string& filename, uint64_t max_size
+               , uint32_t interval = 0, uint32_t max_files = 0, bool compress = true);
+
+    // 写线程在打开文件前取当前代数, 打开后连同文件大小传给opened
+    uint64_t getGeneration() const { return m_generation; }
+    void opened(uint64_t generation, uint64_t size);
+    // 文件已被后台线程改名, 写线程需要重新打开
+    bool needReopen() const { return m_generation != m_opened; }
+    // 写入len字节后调用, 达到切分条件时投递给后台线程
+    void onWrite(size_t len, uint64_t now);
+    // 输出器关闭文件后调用, 允许后台线程压缩最后的归档文件
+    void close();
+
+    // 以下由后台线程调用
+    // 将当前文件改名为归档文件, 返回归档文件名, 失败返回空串
+    std::string archive();
+    // 写线程已不再写入generation代的文件
+    bool isReleased(uint64_t generation) const { return m_closed || m_opened >= generation; }
+    // 压缩归档文件并清理超出max_files的旧归档
+    void finish(const std::string& path);
+
+    const std::string& getFilename() const { return m_filename; }
+    uint64_t getMaxSize() const { return m_maxSize; }
+    uint32_t getInterval() const { return m_interval; }
+    uint32_t getMaxFiles() const { return m_maxFiles; }
+    bool getCompress() const { return m_compress; }
+
+    // 解析"100M", "1G"等大小, 不带单位为字节
+    static uint64_t ParseSize(const std::string& str);
+    // 解析"hourly", "daily"或秒数
+    static uint32_t ParseInterval(const std::string& str);
+private:
+    uint64_t nextRotateTime(uint64_t now) const;
+private:
+    std::string m_filename;
+    uint64_t m_maxSize;
+    uint32_t m_interval;
+    uint32_t m_maxFiles;
+    bool m_compress;
+    // 以下两项只由写线程访问(调用方持有输出器的锁)
+    uint64_t m_size = 0;
+    uint64_t m_nextTime = ~0ull;
+    // 已投递切分请求, 后台线程完成改名后清除
+    std::atomic<bool> m_pending = {false};
+    // 后台线程每次改名后加一
+    std::atomic<uint64_t> m_generation = {0};
+    // 写线程当前打开的文件代数
+    std::atomic<uint64_t> m_opened = {0};
+    std::atomic<bool> m_closed = {false};
+};
+
+
 class FileLogAppender : public LogAppender {
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
 
-    FileLogAppender(const std::string& filename);
+    FileLogAppender(const std::string& filename, LogRotator::ptr rotator = nullptr);
+    ~FileLogAppender();
     void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
     bool reopen();
     std::string toYamlString() override;
+private:
+    // 调用方需持有m_mutex
+    bool openFile();
 private:
     std::string m_filename;
     std::ofstream m_filestream;
+    LogRotator::ptr m_rotator;
+};
+
+/*
+ * 异步文件日志输出器
+ * 业务线程只把LogEvent放入本线程的无锁环形队列, 由后台线程统一格式化并writev批量落盘
+ */
+class AsyncLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+    // 队列写满时的处理策略
+    enum OverflowPolicy {
+        // 阻塞等待后台线程腾出空间
+        BLOCK = 0,
+        // 直接丢弃
+        DROP = 1,
+        // 超过高水位后按比例采样, ERROR及以上级别总是阻塞写入
+        SAMPLE = 2
+    };
+
+    static const char* ToString(OverflowPolicy policy);
+    static OverflowPolicy FromString(const std::string& str);
+
+    // queue_size: 每个线程环形队列的槽位数, 向上取整为2的幂
+    // sample_rate: SAMPLE策略下每sample_rate条日志保留1条
+    AsyncLogAppender(const std::string& filename
+                    , size_t queue_size = 4096
+                    , OverflowPolicy policy = BLOCK
+                    , uint32_t sample_rate = 16
+                    , uint32_t flush_interval_ms = 10
+                    , LogRotator::ptr rotator = nullptr);
+    ~AsyncLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+
+    // 将所有线程队列中的日志立即写入文件(调用线程同步执行)
+    void flush();
+    bool reopen();
+
+    uint64_t getDropped() const { return m_dropped; }
+    OverflowPolicy getPolicy() const { return m_policy; }
+
+    // 刷新所有存活的异步输出器, 供退出时使用
+    static void FlushAll();
+    // 只用write(2)写出所有输出器队列中的日志, 可在信号处理函数中调用
+    static void CrashFlushAll();
+    /*
+     * 安装SIGSEGV/SIGABRT等信号处理, 崩溃前尽力刷出队列中的日志
+     * 之后交还给安装前的处理函数, 没有则按默认方式终止
+     */
+    static void InstallCrashHandler();
+
+    class RingBuffer;
+private:
+    RingBuffer* getLocalRing();
+    void run();
+    // 取出所有队列中的日志并批量写入, 返回处理条数
+    size_t drain();
+    void crashFlush();
+
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    uint64_t m_id;
+    size_t m_queueSize;
+    OverflowPolicy m_policy;
+    uint32_t m_sampleRate;
+    uint32_t m_flushInterval;
+    // 保护m_rings
+    Mutex m_ringMutex;
+    std::vector<std::shared_ptr<RingBuffer> > m_rings;
+    // 崩溃处理不加锁读取的队列登记表, 增删都不分配内存
+    static const size_t MAX_CRASH_RINGS = 256;
+    std::atomic<RingBuffer*> m_crashRings[MAX_CRASH_RINGS];
+    // 批量写入时复用的格式化缓冲区
+    std::vector<std::string> m_batch;
+    // 同一时刻只允许一个消费者(后台线程或崩溃处理)
+    std::atomic_flag m_draining = ATOMIC_FLAG_INIT;
+    std::atomic<uint64_t> m_dropped = {0};
+    std::atomic<uint64_t> m_sampleCounter = {0};
+    uint64_t m_reportedDropped = 0;
+    std::atomic<bool> m_stopping = {false};
+    Thread::ptr m_thread;
+    LogRotator::ptr m_rotator;
+};
+
+
+/*
+ * 二进制日志输出器
+ * 格式串, 文件名, logger名和线程名只在首次出现时写入字符串表, 之后每条日志只记录ID,
+ * 参数按varint编码原样落盘, 文本格式化推迟到用linko_logcat读取时进行
+ * 调用线程只把参数原样拷贝进本线程的环形队列, 编码和写文件都由后台线程完成
+ *
+ * 文件由若干记录组成, 每条记录以1字节类型开头:
+ *   HEADER: magic(F32) version(F8) pattern(Vint串) base_time(U64), 之后的ID和时间都相对本段
+ *   STRING: id(U32) value(Vint串)
+ *   EVENT:  fmt_id file_id line(I32) level(F8) time_delta(I64) thread_id fiber_id elapse
+ *           logger_id thread_name_id request_id(Vint串) argc(U32), 每个参数为 type(F8) + value
+ * 其中U32/U64/I32/I64均为varint编码
+ */
+class BinaryLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<BinaryLogAppender> ptr;
+
+    enum RecordType {
+        HEADER = 0,
+        STRING = 1,
+        EVENT = 2
+    };
+
+    // "LKB1"
+    static const uint32_t MAGIC = 0x4c4b4231;
+    static const uint8_t VERSION = 2;
+
+    /*
+     * buffer_size: 编码缓冲区超过该大小时写入文件, 后台线程每轮处理完也会写入
+     * ERROR及以上级别在调用线程同步写入
+     */
+    BinaryLogAppender(const std::string& filename, size_t buffer_size = 64 * 1024
+                      , LogRotator::ptr rotator = nullptr);
+    ~BinaryLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    // 调用线程的写入路径, 不分配内存也不加锁; 队列满时等待后台线程腾出空间
+    void logArgs(const Logger& logger, LogLevel::Level level, const char* file, int32_t line
+                 , uint32_t elapse, const char* fmt, const LogArgView* args, size_t argc);
+    std::string toYamlString() override;
+
+    bool reopen();
+    // 将所有线程队列中的日志立即编码写入文件(调用线程同步执行)
+    void flush();
+
+    uint64_t getDropped() const { return m_dropped; }
+
+    class Ring;
+private:
+    Ring* getLocalRing();
+    void run();
+    // 以下函数调用方需持有m_drainMutex
+    size_t drain();
+    void encode(Ring& ring, const char* record);
+    uint32_t internLiteral(const char* str);
+    uint32_t internString(const char* str, size_t len);
+    void writeHeader(uint64_t now);
+    void flushBuffer();
+    bool openFile();
+private:
+    std::string m_filename;
+    uint64_t m_id;
+    int m_fd = -1;
+    size_t m_bufferSize;
+    ByteArray m_buffer;
+    // 同一时刻只允许一个消费者(后台线程或flush)
+    Mutex m_drainMutex;
+    // 保护m_rings
+    Mutex m_ringMutex;
+    std::vector<std::shared_ptr<Ring> > m_rings;
+    // 字符串常量(格式串, 文件名)按地址缓存
+    std::unordered_map<const char*, uint32_t> m_literals;
+    // logger名, 线程名按内容缓存; 各队列另外缓存最近一次的ID
+    std::unordered_map<std::string, uint32_t> m_strings;
+    uint32_t m_nextId = 1;
+    // 每写一次HEADER加1, 使队列缓存的ID失效
+    uint64_t m_segment = 0;
+    bool m_hasHeader = false;
+    uint64_t m_lastTime = 0;
+    std::atomic<uint64_t> m_dropped = {0};
+    std::atomic<bool> m_stopping = {false};
+    Thread::ptr m_thread;
+    LogRotator::ptr m_rotator;
 };
 
 
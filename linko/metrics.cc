@@ -0,0 +1,282 @@
+#include "metrics.h"
+#include "log.h"
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace linko {
+
+static Logger::ptr g_logger = LINKO_LOG_NAME("system");
+
+static void EscapeLabelValue(std::ostream& os, const std::string& v) {
+    for (char c : v) {
+        switch (c) {
+            case '\\': os << "\\\\"; break;
+            case '"': os << "\\\""; break;
+            case '\n': os << "\\n"; break;
+            default: os << c; break;
+        }
+    }
+}
+
+Metric::Metric(const std::string& name, const std::string& help
+        , const MetricLabels& labels, Type type)
+    :m_name(name)
+    ,m_help(help)
+    ,m_labels(labels)
+    ,m_type(type) {
+}
+
+const char* Metric::TypeToString(Type type) {
+    switch (type) {
+        case COUNTER: return "counter";
+        case GAUGE: return "gauge";
+        case HISTOGRAM: return "histogram";
+    }
+    return "untyped";
+}
+
+std::string Metric::labelsToString(const std::string& extra) const {
+    if (m_labels.empty() && extra.empty()) {
+        return "";
+    }
+    std::stringstream ss;
+    ss << "{";
+    bool first = true;
+    for (auto& i : m_labels) {
+        if (!first) {
+            ss << ",";
+        }
+        first = false;
+        ss << i.first << "=\"";
+        EscapeLabelValue(ss, i.second);
+        ss << "\"";
+    }
+    if (!extra.empty()) {
+        ss << (first ? "" : ",") << extra;
+    }
+    ss << "}";
+    return ss.str();
+}
+
+Counter::Counter(const std::string& name, const std::string& help
+        , const MetricLabels& labels)
+    :Metric(name, help, labels, COUNTER) {
+}
+
+size_t Counter::ShardIndex() {
+    static std::atomic<size_t> s_next {0};
+    static thread_local size_t t_index = s_next++ % SHARDS;
+    return t_index;
+}
+
+uint64_t Counter::value() const {
+    uint64_t v = 0;
+    for (size_t i = 0; i < SHARDS; ++i) {
+        v += m_shards[i].value.load(std::memory_order_relaxed);
+    }
+    return v;
+}
+
+void Counter::write(std::ostream& os) const {
+    os << m_name << labelsToString() << " " << value() << "\n";
+}
+
+Gauge::Gauge(const std::string& name, const std::string& help
+        , const MetricLabels& labels, Callback cb)
+    :Metric(name, help, labels, GAUGE)
+    ,m_cb(cb) {
+}
+
+double Gauge::value() const {
+    return m_cb ? m_cb() : m_value.load(std::memory_order_relaxed);
+}
+
+void Gauge::write(std::ostream& os) const {
+    os << m_name << labelsToString() << " " << value() << "\n";
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help
+        , const MetricLabels& labels)
+    :Metric(name, help, labels, HISTOGRAM) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+int Histogram::BucketIndex(uint64_t us) {
+    if (us < (uint64_t)SUB_COUNT) {
+        return us;
+    }
+    int msb = 63 - __builtin_clzll(us);
+    if (msb >= MAX_BITS) {
+        return BUCKETS - 1;
+    }
+    //第(msb - SUB_BITS + 1)组, 组内按msb之后的SUB_BITS位分桶
+    return (msb - SUB_BITS + 1) * SUB_COUNT
+        + ((us >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+uint64_t Histogram::BucketUpper(int idx) {
+    if (idx < SUB_COUNT) {
+        return idx + 1;
+    }
+    int group = idx / SUB_COUNT;
+    int sub = idx % SUB_COUNT;
+    return (uint64_t)(SUB_COUNT + sub + 1) << (group - 1);
+}
+
+void Histogram::observe(uint64_t us) {
+    m_buckets[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(us, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const {
+    uint64_t n = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        n += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = std::min<uint64_t>(total * p, total - 1);
+    uint64_t n = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        n += counts[i];
+        if (n > target) {
+            return BucketUpper(i);
+        }
+    }
+    return BucketUpper(BUCKETS - 1);
+}
+
+void Histogram::write(std::ostream& os) const {
+    //先取一次快照, 保证各行之间一致
+    uint64_t counts[BUCKETS];
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+    }
+    uint64_t n = 0;
+    int idx = 0;
+    for (int k = 0; k <= EXPORT_BITS; ++k) {
+        //上界不超过2^k的桶
+        int limit = k < SUB_BITS ? (1 << k) : (k - SUB_BITS + 1) * SUB_COUNT;
+        for (; idx < limit; ++idx) {
+            n += counts[idx];
+        }
+        std::stringstream le;
+        le.precision(9);
+        le << "le=\"" << (double)(1ull << k) / 1000000 << "\"";
+        os << m_name << "_bucket" << labelsToString(le.str()) << " " << n << "\n";
+    }
+    for (; idx < BUCKETS; ++idx) {
+        n += counts[idx];
+    }
+    std::string labels = labelsToString();
+    os << m_name << "_bucket" << labelsToString("le=\"+Inf\"") << " " << n << "\n";
+    os << m_name << "_sum" << labels << " " << (double)sum() / 1000000 << "\n";
+    os << m_name << "_count" << labels << " " << n << "\n";
+}
+
+Metric::ptr Metrics::Add(Metric::ptr metric, bool replace) {
+    RWMutexType::WriteLock lock(GetMutex());
+    auto it = GetDatas().find(metric->getName());
+    if (it == GetDatas().end()) {
+        Family& f = GetDatas()[metric->getName()];
+        f.help = metric->getHelp();
+        f.type = metric->getType();
+        f.metrics[metric->labelsToString()] = metric;
+        return metric;
+    }
+    Family& f = it->second;
+    if (f.type != metric->getType()) {
+        //类型冲突时返回未注册的对象, 不影响调用方使用
+        LINKO_LOG_ERROR(g_logger) << "metric name=" << metric->getName() << " exists but type "
+            << Metric::TypeToString(f.type) << " not " << Metric::TypeToString(metric->getType());
+        return metric;
+    }
+    Metric::ptr& v = f.metrics[metric->labelsToString()];
+    if (!v || replace) {
+        v = metric;
+    }
+    return v;
+}
+
+Counter::ptr Metrics::AddCounter(const std::string& name, const std::string& help
+        , const MetricLabels& labels) {
+    return std::static_pointer_cast<Counter>(
+            Add(std::make_shared<Counter>(name, help, labels), false));
+}
+
+Gauge::ptr Metrics::AddGauge(const std::string& name, const std::string& help
+        , const MetricLabels& labels, Gauge::Callback cb) {
+    bool replace = !!cb;
+    return std::static_pointer_cast<Gauge>(
+            Add(std::make_shared<Gauge>(name, help, labels, cb), replace));
+}
+
+Histogram::ptr Metrics::AddHistogram(const std::string& name, const std::string& help
+        , const MetricLabels& labels) {
+    return std::static_pointer_cast<Histogram>(
+            Add(std::make_shared<Histogram>(name, help, labels), false));
+}
+
+void Metrics::Del(Metric::ptr metric) {
+    if (!metric) {
+        return;
+    }
+    RWMutexType::WriteLock lock(GetMutex());
+    auto it = GetDatas().find(metric->getName());
+    if (it == GetDatas().end()) {
+        return;
+    }
+    auto& metrics = it->second.metrics;
+    auto mit = metrics.find(metric->labelsToString());
+    if (mit != metrics.end() && mit->second == metric) {
+        metrics.erase(mit);
+    }
+    if (metrics.empty()) {
+        GetDatas().erase(it);
+    }
+}
+
+void Metrics::Del(const std::vector<Metric::ptr>& metrics) {
+    for (auto& i : metrics) {
+        Del(i);
+    }
+}
+
+void Metrics::Dump(std::ostream& os) {
+    //回调gauge在读锁内执行, Del返回后不会再被调用
+    RWMutexType::ReadLock lock(GetMutex());
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision(9);
+    for (auto& i : GetDatas()) {
+        os << "# HELP " << i.first << " " << i.second.help << "\n";
+        os << "# TYPE " << i.first << " " << Metric::TypeToString(i.second.type) << "\n";
+        for (auto& m : i.second.metrics) {
+            m.second->write(os);
+        }
+    }
+    os.precision(precision);
+    os.flags(flags);
+}
+
+std::string Metrics::ToString() {
+    std::stringstream ss;
+    Dump(ss);
+    return ss.str();
+}
+
+}
@@ -0,0 +1,193 @@
+#ifndef __LINKO_METRICS_H__
+#define __LINKO_METRICS_H__
+
+#include <memory>
+#include <string>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <stdint.h>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace linko {
+
+/*
+ * 运行时指标
+ * 计数器按线程分片累加, 直方图按对数-线性分桶, 写入路径只有relaxed原子操作
+ * 所有指标注册在Metrics中, 以Prometheus文本格式导出
+ */
+
+typedef std::map<std::string, std::string> MetricLabels;
+
+class Metric : Noncopyable {
+public:
+    typedef std::shared_ptr<Metric> ptr;
+
+    enum Type {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM,
+    };
+
+    Metric(const std::string& name, const std::string& help
+            , const MetricLabels& labels, Type type);
+    virtual ~Metric() {}
+
+    const std::string& getName() const { return m_name; }
+    const std::string& getHelp() const { return m_help; }
+    const MetricLabels& getLabels() const { return m_labels; }
+    Type getType() const { return m_type; }
+
+    //输出Prometheus样本行
+    virtual void write(std::ostream& os) const = 0;
+
+    //{k="v",...}, extra为追加的标签(不含括号)
+    std::string labelsToString(const std::string& extra = "") const;
+
+    static const char* TypeToString(Type type);
+
+protected:
+    std::string m_name;
+    std::string m_help;
+    MetricLabels m_labels;
+    Type m_type;
+};
+
+//单调递增计数器
+class Counter : public Metric {
+public:
+    typedef std::shared_ptr<Counter> ptr;
+
+    Counter(const std::string& name, const std::string& help
+            , const MetricLabels& labels = MetricLabels());
+
+    void inc(uint64_t v = 1) {
+        m_shards[ShardIndex()].value.fetch_add(v, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+
+    void write(std::ostream& os) const override;
+
+    //当前线程使用的分片
+    static size_t ShardIndex();
+
+private:
+    static const size_t SHARDS = 16;
+    //每个分片独占一个缓存行, 避免多线程累加时伪共享
+    struct Shard {
+        std::atomic<uint64_t> value{0};
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+    Shard m_shards[SHARDS];
+};
+
+//瞬时值, 由调用方设置或在导出时通过回调读取
+class Gauge : public Metric {
+public:
+    typedef std::shared_ptr<Gauge> ptr;
+    typedef std::function<double()> Callback;
+
+    Gauge(const std::string& name, const std::string& help
+            , const MetricLabels& labels = MetricLabels(), Callback cb = nullptr);
+
+    void set(int64_t v) { m_value.store(v, std::memory_order_relaxed); }
+    void inc(int64_t v = 1) { m_value.fetch_add(v, std::memory_order_relaxed); }
+    void dec(int64_t v = 1) { m_value.fetch_sub(v, std::memory_order_relaxed); }
+    double value() const;
+
+    void write(std::ostream& os) const override;
+
+private:
+    std::atomic<int64_t> m_value{0};
+    Callback m_cb;
+};
+
+/*
+ * 延迟直方图, 单位微秒, 导出时换算为秒
+ * 每个2的幂区间再等分为8个桶, 相对误差不超过12.5%, 最大约2^41微秒
+ * 导出的le边界为2^k微秒(k=0~25)
+ */
+class Histogram : public Metric {
+public:
+    typedef std::shared_ptr<Histogram> ptr;
+
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_BITS = 41;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+    static const int EXPORT_BITS = 25;
+
+    Histogram(const std::string& name, const std::string& help
+            , const MetricLabels& labels = MetricLabels());
+
+    void observe(uint64_t us);
+
+    uint64_t count() const;
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    //返回第p(0~1)分位所在桶的上界, 微秒
+    uint64_t percentile(double p) const;
+
+    void write(std::ostream& os) const override;
+
+    static int BucketIndex(uint64_t us);
+    //桶idx的上界(不含)
+    static uint64_t BucketUpper(int idx);
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_sum{0};
+};
+
+/*
+ * 指标注册表
+ * 同名同标签的计数器/直方图/普通gauge重复注册时返回已有对象
+ * 回调gauge重复注册时替换旧的, 回调引用的对象销毁前需调用Del
+ */
+class Metrics {
+public:
+    typedef RWMutex RWMutexType;
+
+    static Counter::ptr AddCounter(const std::string& name, const std::string& help
+            , const MetricLabels& labels = MetricLabels());
+    static Gauge::ptr AddGauge(const std::string& name, const std::string& help
+            , const MetricLabels& labels = MetricLabels(), Gauge::Callback cb = nullptr);
+    static Histogram::ptr AddHistogram(const std::string& name, const std::string& help
+            , const MetricLabels& labels = MetricLabels());
+
+    //注销指标, 仅当注册的仍是该对象时删除; 返回后不会再调用其回调
+    static void Del(Metric::ptr metric);
+    static void Del(const std::vector<Metric::ptr>& metrics);
+
+    //按Prometheus文本格式(0.0.4)导出全部指标
+    static void Dump(std::ostream& os);
+    static std::string ToString();
+
+private:
+    static Metric::ptr Add(Metric::ptr metric, bool replace);
+
+    //同一指标名下的所有标签组合
+    struct Family {
+        std::string help;
+        Metric::Type type;
+        std::map<std::string, Metric::ptr> metrics;
+    };
+    typedef std::map<std::string, Family> FamilyMap;
+
+    static FamilyMap& GetDatas() {
+        static FamilyMap s_datas;
+        return s_datas;
+    }
+
+    static RWMutexType& GetMutex() {
+        static RWMutexType s_mutex;
+        return s_mutex;
+    }
+};
+
+}
+
+#endif
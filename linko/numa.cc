@@ -0,0 +1,166 @@
+#include "numa.h"
+#include "log.h"
+
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace linko {
+
+static Logger::ptr g_logger = LINKO_LOG_NAME("system");
+
+// 支持的最大节点数, 用于mbind的节点掩码
+static const int MAX_NODES = 1024;
+
+bool ParseCpuList(const std::string& str, std::vector<int>& cpus) {
+    cpus.clear();
+    const char* p = str.c_str();
+    while (*p) {
+        if (*p == ',' || isspace(*p)) {
+            ++p;
+            continue;
+        }
+        char* end = nullptr;
+        long begin = strtol(p, &end, 10);
+        if (end == p || begin < 0) {
+            return false;
+        }
+        long last = begin;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < begin) {
+                return false;
+            }
+            p = end;
+        }
+        for (long i = begin; i <= last; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return !cpus.empty();
+}
+
+bool ParseAffinity(const std::string& spec, std::vector<int>& cpus) {
+    if (spec.compare(0, 5, "node:") == 0) {
+        cpus = GetNumaNodeCpus(atoi(spec.c_str() + 5));
+        return !cpus.empty();
+    }
+    return ParseCpuList(spec, cpus);
+}
+
+namespace {
+
+// cpu -> 节点, 进程内只读取一次
+struct NumaTopology {
+    std::vector<std::vector<int> > nodes;
+    std::vector<int> cpu_node;
+
+    NumaTopology() {
+        DIR* dir = opendir("/sys/devices/system/node");
+        if (!dir) {
+            return;
+        }
+        while (struct dirent* ent = readdir(dir)) {
+            int node = -1;
+            if (sscanf(ent->d_name, "node%d", &node) != 1 || node < 0 || node >= MAX_NODES) {
+                continue;
+            }
+            std::ifstream ifs(std::string("/sys/devices/system/node/") + ent->d_name + "/cpulist");
+            std::string line;
+            std::getline(ifs, line);
+            std::vector<int> cpus;
+            ParseCpuList(line, cpus);
+            if ((int)nodes.size() <= node) {
+                nodes.resize(node + 1);
+            }
+            nodes[node] = cpus;
+            for (int cpu : cpus) {
+                if ((int)cpu_node.size() <= cpu) {
+                    cpu_node.resize(cpu + 1, -1);
+                }
+                cpu_node[cpu] = node;
+            }
+        }
+        closedir(dir);
+    }
+};
+
+NumaTopology& GetTopology() {
+    static NumaTopology s_topology;
+    return s_topology;
+}
+
+}
+
+int GetNumaNodeCount() {
+    return GetTopology().nodes.size();
+}
+
+int GetCpuNumaNode(int cpu) {
+    NumaTopology& t = GetTopology();
+    if (cpu < 0 || cpu >= (int)t.cpu_node.size()) {
+        return -1;
+    }
+    return t.cpu_node[cpu];
+}
+
+std::vector<int> GetNumaNodeCpus(int node) {
+    NumaTopology& t = GetTopology();
+    if (node < 0 || node >= (int)t.nodes.size()) {
+        return std::vector<int>();
+    }
+    return t.nodes[node];
+}
+
+int GetCurrentNumaNode() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr)) {
+        return -1;
+    }
+    return node;
+}
+
+bool SetThreadAffinity(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rt) {
+        LINKO_LOG_ERROR(g_logger) << "pthread_setaffinity_np cpu=" << cpu
+            << " rt=" << rt << " " << strerror(rt);
+        return false;
+    }
+    return true;
+}
+
+void* NumaLocalAlloc(size_t size) {
+    static const long s_page = sysconf(_SC_PAGESIZE);
+    void* p = nullptr;
+    if (posix_memalign(&p, s_page, size)) {
+        return nullptr;
+    }
+    //单节点时默认策略已经是本地分配
+    int node = GetCurrentNumaNode();
+    if (GetNumaNodeCount() <= 1 || node < 0 || node >= MAX_NODES) {
+        return p;
+    }
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+    //内核只使用maxnode - 1位; 复用的内存已经落在其他节点上时迁移过来
+    if (syscall(SYS_mbind, p, size, MPOL_PREFERRED, mask, MAX_NODES + 1, MPOL_MF_MOVE)) {
+        LINKO_LOG_DEBUG(g_logger) << "mbind node=" << node << " errno=" << errno
+            << " " << strerror(errno);
+    }
+    return p;
+}
+
+}
@@ -0,0 +1,36 @@
+#ifndef __LINKO_NUMA_H__
+#define __LINKO_NUMA_H__
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+namespace linko {
+
+/*
+ * CPU与NUMA拓扑
+ * 拓扑从/sys/devices/system/node读取, 内存策略直接调用mbind, 不依赖libnuma
+ * 拓扑不可用时节点返回-1, 相关操作退化为普通行为
+ */
+
+// 解析"0-3,8,10-11"格式的cpu列表
+bool ParseCpuList(const std::string& str, std::vector<int>& cpus);
+
+// 解析亲和性配置, 支持cpu列表或"node:N"表示节点N的全部cpu
+bool ParseAffinity(const std::string& spec, std::vector<int>& cpus);
+
+int GetNumaNodeCount();
+// cpu所在节点, 未知返回-1
+int GetCpuNumaNode(int cpu);
+std::vector<int> GetNumaNodeCpus(int node);
+int GetCurrentNumaNode();
+
+// 将当前线程绑定到cpu
+bool SetThreadAffinity(int cpu);
+
+// 分配页对齐内存并优先放在当前线程所在节点, 用free释放
+void* NumaLocalAlloc(size_t size);
+
+}
+
+#endif
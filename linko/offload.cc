@@ -0,0 +1,137 @@
+#include "offload.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace linko {
+
+static Logger::ptr g_logger = LINKO_LOG_NAME("system");
+
+static ConfigVar<int>::ptr g_offload_threads =
+    Config::Lookup("offload.threads", 4, "offload pool threads");
+
+static ConfigVar<uint64_t>::ptr g_offload_slow_wait =
+    Config::Lookup("offload.slow_wait", (uint64_t)100, "offload queue wait warning threshold ms");
+
+template<class T>
+static void UpdateMax(std::atomic<T>& v, T n) {
+    T cur = v.load(std::memory_order_relaxed);
+    while (n > cur && !v.compare_exchange_weak(cur, n, std::memory_order_relaxed)) {
+    }
+}
+
+OffloadPool::OffloadPool(size_t threads, const std::string& name)
+    :m_name(name)
+    ,m_threads(threads) {
+    LINKO_ASSERT(threads > 0);
+    //IOManager空闲时阻塞在epoll上, 不会像Scheduler一样空转
+    m_iom = new IOManager(threads, false, name);
+
+    MetricLabels labels = {{"pool", m_name}};
+    m_queueWait = Metrics::AddHistogram("linko_offload_queue_wait_seconds"
+            , "offload task wait from submit to start", labels);
+    m_runTime = Metrics::AddHistogram("linko_offload_run_seconds"
+            , "offload task run time", labels);
+    m_metrics.push_back(m_queueWait);
+    m_metrics.push_back(m_runTime);
+    m_metrics.push_back(Metrics::AddGauge("linko_offload_threads"
+            , "offload pool threads", labels, [this]() {
+        return (double)m_threads;
+    }));
+    m_metrics.push_back(Metrics::AddGauge("linko_offload_queue_depth"
+            , "offload tasks submitted but not started", labels, [this]() {
+        return (double)m_queued;
+    }));
+    m_metrics.push_back(Metrics::AddGauge("linko_offload_queue_depth_peak"
+            , "peak offload queue depth", labels, [this]() {
+        return (double)m_peakQueued;
+    }));
+    m_metrics.push_back(Metrics::AddGauge("linko_offload_running"
+            , "offload tasks running", labels, [this]() {
+        return (double)m_running;
+    }));
+}
+
+OffloadPool::~OffloadPool() {
+    Metrics::Del(m_metrics);
+    delete m_iom;
+}
+
+bool OffloadPool::run(const std::function<void()>& cb) {
+    IOManager* iom = IOManager::GetThis();
+    if (!iom || iom == m_iom
+            || Fiber::GetThis().get() == Scheduler::GetMainFiber()) {
+        return false;
+    }
+
+    Fiber::ptr fiber = Fiber::GetThis();
+    int thread = GetThreadId();
+    std::exception_ptr error;
+    uint64_t submit = GetMonotonicUS();
+
+    UpdateMax<size_t>(m_peakQueued, ++m_queued);
+    //挂起期间计入原调度器的等待事件, 避免其提前停止
+    iom->addPending();
+    m_iom->schedule([this, &cb, &error, iom, fiber, thread, submit]() {
+        uint64_t start = GetMonotonicUS();
+        --m_queued;
+        ++m_running;
+        uint64_t wait = start - submit;
+        m_queueWait->observe(wait);
+        UpdateMax<uint64_t>(m_maxWaitUs, wait);
+        if (wait > g_offload_slow_wait->getValue() * 1000) {
+            LINKO_LOG_WARN(g_logger) << "offload pool " << m_name
+                << " task waited " << wait / 1000 << "ms, queued=" << m_queued;
+        }
+
+        try {
+            cb();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        m_runTime->observe(GetMonotonicUS() - start);
+        --m_running;
+        iom->schedule(fiber, thread, Scheduler::HIGH);
+        iom->donePending();
+    });
+    Fiber::SetWait("offload");
+    Fiber::YieldToHold();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return true;
+}
+
+OffloadPool::Stats OffloadPool::getStats() const {
+    Stats s;
+    s.threads = m_threads;
+    s.queued = m_queued;
+    s.peak_queued = m_peakQueued;
+    s.running = m_running;
+    s.completed = m_runTime->count();
+    s.total_wait_us = m_queueWait->sum();
+    s.max_wait_us = m_maxWaitUs;
+    s.total_run_us = m_runTime->sum();
+    return s;
+}
+
+OffloadPool* GetOffloadPool() {
+    //不释放, 避免进程退出时与仍在使用它的线程竞争
+    static OffloadPool* s_pool = new OffloadPool(
+            std::max(1, g_offload_threads->getValue()), "offload");
+    return s_pool;
+}
+
+void offload(const std::function<void()>& fn) {
+    if (!IOManager::GetThis() || !GetOffloadPool()->run(fn)) {
+        fn();
+    }
+}
+
+}
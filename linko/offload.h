@@ -0,0 +1,75 @@
+#ifndef __LINKO_OFFLOAD_H__
+#define __LINKO_OFFLOAD_H__
+
+#include <memory>
+#include <functional>
+#include <string>
+#include <atomic>
+#include <vector>
+
+#include "iomanager.h"
+#include "metrics.h"
+#include "noncopyable.h"
+
+namespace linko {
+
+/*
+ * 阻塞任务线程池
+ * 计算密集或无法避免的阻塞调用放到独立线程中执行, 调用协程挂起,
+ * 完成后回到原IOManager线程继续执行, 不占用IO工作线程
+ */
+class OffloadPool : Noncopyable {
+public:
+    typedef std::shared_ptr<OffloadPool> ptr;
+
+    struct Stats {
+        size_t threads = 0;
+        //已提交尚未开始执行的任务数
+        size_t queued = 0;
+        size_t peak_queued = 0;
+        //正在执行的任务数
+        size_t running = 0;
+        uint64_t completed = 0;
+        //任务从提交到开始执行的等待时间
+        uint64_t total_wait_us = 0;
+        uint64_t max_wait_us = 0;
+        uint64_t total_run_us = 0;
+    };
+
+    OffloadPool(size_t threads, const std::string& name = "offload");
+    ~OffloadPool();
+
+    /*
+     * 在线程池中执行cb, 当前协程挂起直到cb执行完毕, cb抛出的异常在当前协程重新抛出
+     * 不在IOManager协程中, 或当前线程就属于本线程池时返回false, cb不会被执行
+     */
+    bool run(const std::function<void()>& cb);
+
+    Stats getStats() const;
+    const std::string& getName() const { return m_name; }
+    size_t getThreads() const { return m_threads; }
+
+private:
+    std::string m_name;
+    size_t m_threads;
+    IOManager* m_iom;
+    std::atomic<size_t> m_queued{0};
+    std::atomic<size_t> m_peakQueued{0};
+    std::atomic<size_t> m_running{0};
+    std::atomic<uint64_t> m_maxWaitUs{0};
+    //任务从提交到开始执行的等待时间
+    Histogram::ptr m_queueWait;
+    //任务执行耗时, 次数即完成的任务数
+    Histogram::ptr m_runTime;
+    std::vector<Metric::ptr> m_metrics;
+};
+
+//默认阻塞任务线程池, 线程数由offload.threads配置, 首次使用时创建
+OffloadPool* GetOffloadPool();
+
+//在默认线程池中执行fn并等待完成, 不在协程中时直接在当前线程执行
+void offload(const std::function<void()>& fn);
+
+}
+
+#endif
@@ -2,10 +2,23 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include "numa.h"
+
+#include <algorithm>
 
 namespace linko {
 static linko::Logger::ptr g_logger = LINKO_LOG_NAME("system");
 
+//调度器名称 -> cpu列表("0-3,8")或"node:N", 工作线程依次绑定到其中一个cpu
+static ConfigVar<std::map<std::string, std::string> >::ptr g_scheduler_affinity =
+    Config::Lookup("scheduler.affinity", std::map<std::string, std::string>()
+            , "scheduler worker cpu affinity");
+
+static ConfigVar<uint64_t>::ptr g_scheduler_max_queue_wait =
+    Config::Lookup("scheduler.max_queue_wait", (uint64_t)50
+            , "lower priority task queue wait limit ms before it runs ahead");
+
 //协程调度器
 static thread_local Scheduler* t_scheduler = nullptr;
 //线程主协程
@@ -44,10 +57,40 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    static const char* s_priority_names[PRIORITY_COUNT] = {"high", "normal", "low"};
+    MetricLabels labels = {{"scheduler", m_name}};
+    m_taskCounter = Metrics::AddCounter("linko_scheduler_tasks_total"
+            , "tasks taken from the scheduler queue", labels);
+    m_metrics.push_back(m_taskCounter);
+    for (int p = HIGH; p < PRIORITY_COUNT; ++p) {
+        MetricLabels pl = labels;
+        pl["priority"] = s_priority_names[p];
+        m_queueWait[p] = Metrics::AddHistogram("linko_scheduler_queue_wait_seconds"
+                , "time tasks spent in the scheduler queue", pl);
+        m_metrics.push_back(m_queueWait[p]);
+        m_queueStarved[p] = Metrics::AddCounter("linko_scheduler_queue_starved_total"
+                , "tasks run early because they waited longer than max_queue_wait", pl);
+        m_metrics.push_back(m_queueStarved[p]);
+        m_metrics.push_back(Metrics::AddGauge("linko_scheduler_queue_depth"
+                , "tasks waiting in the scheduler queue", pl, [this, p]() {
+            MutexType::Lock lock(m_mutex);
+            return (double)m_fibers[p].size();
+        }));
+    }
+    m_metrics.push_back(Metrics::AddGauge("linko_scheduler_threads_active"
+            , "scheduler threads running a task", labels, [this]() {
+        return (double)m_activeThreadCount;
+    }));
+    m_metrics.push_back(Metrics::AddGauge("linko_scheduler_threads_idle"
+            , "scheduler threads in idle", labels, [this]() {
+        return (double)m_idleThreadCount;
+    }));
 }
 
 Scheduler::~Scheduler() {
     LINKO_ASSERT(m_stopping);
+    Metrics::Del(m_metrics);
     if (GetThis() == this) {
         t_scheduler = nullptr;
     }
@@ -70,11 +113,22 @@ void Scheduler::start() {
     m_stopping = false;
     LINKO_ASSERT(m_threads.empty());
 
+    std::vector<int> cpus;
+    auto affinity = g_scheduler_affinity->getValue();
+    auto it = affinity.find(m_name);
+    if (it != affinity.end() && !ParseAffinity(it->second, cpus)) {
+        LINKO_LOG_ERROR(g_logger) << "scheduler " << m_name
+            << " invalid affinity: " << it->second;
+    }
+
+    m_threadNodes.assign(m_threadIds.size(), -1);
     m_threads.resize(m_threadCount);
     for (size_t i = 0; i < m_threadCount; ++i) {
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
         m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this)
-                    , m_name + "_" + std::to_string(i)));
+                    , m_name + "_" + std::to_string(i), cpu));
         m_threadIds.push_back(m_threads[i]->getId());
+        m_threadNodes.push_back(GetCpuNumaNode(m_threads[i]->getCpu()));
     }
 
     lock.unlock();
@@ -150,6 +204,88 @@ void Scheduler::stop() {
     }
 }
 
+int Scheduler::getThreadOnNode(int node) {
+    if (node < 0) {
+        return -1;
+    }
+    size_t n = m_threadNodes.size();
+    size_t start = m_nextNodeThread++;
+    for (size_t i = 0; i < n; ++i) {
+        size_t idx = (start + i) % n;
+        if (m_threadNodes[idx] == node) {
+            return m_threadIds[idx];
+        }
+    }
+    return -1;
+}
+
+bool Scheduler::canRunNoLock(const FiberAndThread& ft, bool& tickle_me) {
+    //任务指定的线程非当前线程则跳过
+    if (ft.thread != -1 && ft.thread != linko::GetThreadId()) {
+        tickle_me = true;
+        return false;
+    }
+    LINKO_ASSERT(ft.fiber || ft.cb);
+    //如果任务正在执行则跳过
+    return !ft.fiber || ft.fiber->getState() != Fiber::EXEC;
+}
+
+bool Scheduler::takeNoLock(FiberAndThread& ft, bool& tickle_me, uint64_t& wait_us, bool& starved) {
+    if (m_taskCount == 0) {
+        return false;
+    }
+    uint64_t now = GetMonotonicUS();
+    //顺带刷新本线程的缓存时间, 取出的任务在本线程执行
+    UpdateCachedMonotonicMS(now / 1000);
+    uint64_t max_wait = g_scheduler_max_queue_wait->getValue() * 1000;
+
+    //低优先级队列头部等待超时则先执行其中等待最久的
+    std::list<FiberAndThread>* queue = nullptr;
+    auto it = m_fibers[0].end();
+    for (int p = NORMAL; p < PRIORITY_COUNT; ++p) {
+        auto& q = m_fibers[p];
+        if (!q.empty() && now - q.front().enqueueUs > max_wait
+                && (!queue || q.front().enqueueUs < queue->front().enqueueUs)
+                && canRunNoLock(q.front(), tickle_me)) {
+            queue = &q;
+        }
+    }
+    starved = queue != nullptr;
+    if (queue) {
+        it = queue->begin();
+    }
+
+    for (int p = HIGH; p < PRIORITY_COUNT && !queue; ++p) {
+        auto& q = m_fibers[p];
+        for (it = q.begin(); it != q.end(); ++it) {
+            if (canRunNoLock(*it, tickle_me)) {
+                queue = &q;
+                break;
+            }
+        }
+    }
+    if (!queue) {
+        return false;
+    }
+
+    //取出任务并从任务队列中删除
+    ft = *it;
+    queue->erase(it);
+    --m_taskCount;
+
+    wait_us = now > ft.enqueueUs ? now - ft.enqueueUs : 0;
+    return true;
+}
+
+Scheduler::QueueStats Scheduler::getQueueStats(Priority priority) {
+    QueueStats st;
+    st.histogram = m_queueWait[priority];
+    st.count = st.histogram->count();
+    st.total_us = st.histogram->sum();
+    st.starved = m_queueStarved[priority]->value();
+    return st;
+}
+
 void Scheduler::setThis() {
     t_scheduler = this;
 }
@@ -172,31 +308,22 @@ void Scheduler::run() {
         ft.reset();
         bool tickle_me = false;
         bool is_active = false;
+        uint64_t wait_us = 0;
+        bool starved = false;
         {
             //获取任务
             MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while (it != m_fibers.end()) {
-                //任务指定的线程非当前线程则跳过
-                if (it->thread != -1 && it->thread != linko::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                LINKO_ASSERT(it->fiber || it->cb);
-                //如果任务正在执行则跳过
-                if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
-
-                //取出任务并从任务队列中删除，将当前线程标记为正在执行任务
-                ft = *it;
-                m_fibers.erase(it);
+            if (takeNoLock(ft, tickle_me, wait_us, starved)) {
                 ++m_activeThreadCount;
                 is_active = true;
-                break;
+            }
+        }
+        //指标在解锁后记录, 不延长调度锁的持有时间
+        if (is_active) {
+            m_taskCounter->inc();
+            m_queueWait[ft.priority]->observe(wait_us);
+            if (starved) {
+                m_queueStarved[ft.priority]->inc();
             }
         }
 
@@ -213,11 +340,11 @@ void Scheduler::run() {
 
             //如果协程状态被设置为READY，则需要重新加入任务队列中等待处理
             if (ft.fiber->getState() == Fiber::READY) {
-                schedule(ft.fiber);
+                schedule(ft.fiber, -1, ft.priority);
             //如果是初始化或暂停状态，设置状态为HOLD
             } else if (ft.fiber->getState() != Fiber::TERM
                     && ft.fiber->getState() != Fiber::EXCEPT) {
-                ft.fiber->m_state = Fiber::HOLD;
+                ft.fiber->m_state.store(Fiber::HOLD, std::memory_order_release);
             }
             //任务完成需要重置
             ft.reset();
@@ -230,13 +357,15 @@ void Scheduler::run() {
             } else {
                 cb_fiber.reset(new Fiber(ft.cb));
             }
+            cb_fiber->setLocals(std::move(ft.locals));
+            Priority priority = ft.priority;
             ft.reset();
             //执行任务
             cb_fiber->swapIn();
             --m_activeThreadCount;
 
             if (cb_fiber->getState() == Fiber::READY) {
-                schedule(cb_fiber);
+                schedule(cb_fiber, -1, priority);
                 cb_fiber.reset();
             //状态为异常或终止，则重置
             } else if (cb_fiber->getState() == Fiber::EXCEPT
@@ -244,7 +373,7 @@ void Scheduler::run() {
                 cb_fiber->reset(nullptr);
             } else {
                 //设置状态为HOLD，后面会通过ft.fiber被拉起
-                cb_fiber->m_state = Fiber::HOLD;
+                cb_fiber->m_state.store(Fiber::HOLD, std::memory_order_release);
                 cb_fiber.reset();
             }
 
@@ -269,7 +398,7 @@ void Scheduler::run() {
             --m_idleThreadCount;
             if (idle_fiber->getState() != Fiber::TERM
              && idle_fiber->getState() != Fiber::EXCEPT) {
-                idle_fiber->m_state = Fiber::HOLD;
+                idle_fiber->m_state.store(Fiber::HOLD, std::memory_order_release);
             }
         }
     }
@@ -284,7 +413,7 @@ bool Scheduler::stopping() {
     MutexType::Lock lock(m_mutex);
     return m_autoStop 
         && m_stopping
-        && m_fibers.empty() 
+        && m_taskCount == 0
         && m_activeThreadCount == 0;
 }
 
@@ -7,6 +7,8 @@
 #include "mutex.h"
 #include "fiber.h"
 #include "thread.h"
+#include "util.h"
+#include "metrics.h"
 
 namespace linko {
 class Scheduler {
@@ -25,17 +27,52 @@ public:
     void start();
     void stop();
 
+    /*
+     * 返回一个绑定在numa节点node上的工作线程id, 多个时轮询, 没有返回-1
+     * 需要通过scheduler.affinity配置绑定cpu
+     */
+    int getThreadOnNode(int node);
+
+    /*
+     * 任务优先级
+     * 调度时优先取高优先级队列, 低优先级任务排队超过scheduler.max_queue_wait时提前执行, 避免饿死
+     */
+    enum Priority {
+        //IO事件等恢复执行的协程
+        HIGH = 0,
+        //新任务
+        NORMAL = 1,
+        //后台任务
+        LOW = 2,
+    };
+    static const int PRIORITY_COUNT = 3;
+
+    //排队耗时统计, 取自注册到Metrics的直方图和计数器
+    struct QueueStats {
+        uint64_t count = 0;
+        uint64_t total_us = 0;
+        //因等待超时而提前执行的次数
+        uint64_t starved = 0;
+        Histogram::ptr histogram;
+
+        //返回第p(0~1)分位所在桶的上界, 微秒
+        uint64_t percentile(double p) const { return histogram ? histogram->percentile(p) : 0; }
+    };
+
+    QueueStats getQueueStats(Priority priority);
+
     /*
      * 调度协程
      * fc:协程或函数
      * thread:协程执行的线程id，-1表示任意线程
+     * priority:优先级
      */
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
+    void schedule(FiberOrCb fc, int thread = -1, Priority priority = NORMAL) {
         bool need_tickle = false;
         {
             MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
+            need_tickle = scheduleNoLock(fc, thread, priority);
         }
         if (need_tickle) {
             tickle();
@@ -43,12 +80,12 @@ public:
     }
 
     template<class InputIterator>
-    void schedule(InputIterator begin, InputIterator end) {
+    void schedule(InputIterator begin, InputIterator end, Priority priority = NORMAL) {
         bool need_tickle = false;
         {
             MutexType::Lock lock(m_mutex);
             while (begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
+                need_tickle = scheduleNoLock(&*begin, -1, priority) || need_tickle;
                 ++begin;
             }
         }
@@ -68,11 +105,18 @@ protected:
 private:
     //将任务加入到队列中，若任务队列中有任务，则tickle()唤醒
     template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_fibers.empty();
+    bool scheduleNoLock(FiberOrCb fc, int thread, Priority priority) {
+        bool need_tickle = m_taskCount == 0;
         FiberAndThread ft(fc, thread);
         if (ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
+            //新任务继承当前协程的局部存储
+            if (ft.cb) {
+                ft.locals = Fiber::GetLocals();
+            }
+            ft.priority = priority;
+            ft.enqueueUs = GetMonotonicUS();
+            m_fibers[priority].push_back(ft);
+            ++m_taskCount;
         }
         return need_tickle;
     }
@@ -82,6 +126,11 @@ private:
         Fiber::ptr fiber;
         std::function<void()> cb;
         int thread;
+        Priority priority = NORMAL;
+        //入队时间, 微秒
+        uint64_t enqueueUs = 0;
+        //回调任务执行时使用的协程局部存储
+        FiberLocalStorage::ptr locals;
 
         //指定协程在哪个线程上运行
         FiberAndThread(Fiber::ptr f, int thr)
@@ -113,15 +162,33 @@ private:
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            priority = NORMAL;
+            enqueueUs = 0;
+            locals.reset();
         }
     };
 
+    /*
+     * 从队列中取出当前线程可执行的任务, 没有返回false
+     * wait_us为任务的排队耗时, starved表示因等待超时提前执行, 由调用方在解锁后记录
+     */
+    bool takeNoLock(FiberAndThread& ft, bool& tickle_me, uint64_t& wait_us, bool& starved);
+    bool canRunNoLock(const FiberAndThread& ft, bool& tickle_me);
+
 private:
     MutexType m_mutex;
     //线程池
     std::vector<Thread::ptr> m_threads;
-    //待执行的协程队列
-    std::list<FiberAndThread> m_fibers;
+    //待执行的协程队列, 按优先级划分
+    std::list<FiberAndThread> m_fibers[PRIORITY_COUNT];
+    //所有队列中的任务数
+    size_t m_taskCount = 0;
+    //执行的任务数、排队耗时和等待超时提前执行的次数
+    Counter::ptr m_taskCounter;
+    Histogram::ptr m_queueWait[PRIORITY_COUNT];
+    Counter::ptr m_queueStarved[PRIORITY_COUNT];
+    //注册到Metrics的指标, 析构时注销
+    std::vector<Metric::ptr> m_metrics;
     //use_caller为true时有效，调度协程
     Fiber::ptr m_rootFiber;
     std::string m_name;
@@ -129,6 +196,9 @@ private:
 protected:
     //协程下的线程id数量
     std::vector<int> m_threadIds;
+    //与m_threadIds对应的线程所在numa节点, 未绑定为-1
+    std::vector<int> m_threadNodes;
+    std::atomic<size_t> m_nextNodeThread = {0};
     //线程数量
     size_t m_threadCount = 0;
     //工作线程数量
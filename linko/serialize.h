@@ -0,0 +1,549 @@
+#ifndef __LINKO_SERIALIZE_H__
+#define __LINKO_SERIALIZE_H__
+
+#include <stdint.h>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bytearray.h"
+
+/*
+ * 基于ByteArray的带tag结构体序列化, 采用protobuf式的tag/wire type布局, 但与protobuf不兼容:
+ *   每个字段为 key(varint, tag << 3 | 类型) + 值
+ *   有符号整数/枚举总是zigzag varint(相当于protobuf的sint), 无符号整数/bool为varint
+ *   float/double为定长, 按ByteArray的字节序写入(默认大端, protobuf为小端)
+ *   string/嵌套结构体为 长度(varint) + 内容
+ *   整数和浮点数的vector打包为一个长度字段, 其他vector每个元素一个字段
+ *   map每个元素为一个嵌套结构 {1: key, 2: value}
+ *
+ * 用法:
+ *   struct Person {
+ *       int32_t id;
+ *       std::string name;
+ *       std::vector<Address> addrs;
+ *       LINKO_SERIALIZE(
+ *           LINKO_FIELD(1, id)
+ *           LINKO_FIELD(2, name)
+ *           LINKO_FIELD(3, addrs)
+ *       )
+ *   };
+ *   linko::Serializer::Encode(ba, person);
+ *   linko::Serializer::Decode(ba, person);
+ *
+ * 编码分两遍: 先计算总大小并按先序记录每个嵌套结构的长度, 再顺序写入, 嵌套长度不再重复计算
+ * 长度记录在线程本地的vector中复用, 除ByteArray扩容外编码过程不分配内存
+ */
+#define LINKO_SERIALIZE(...) \
+    template<class V> \
+    void linkoVisit(V& v) { __VA_ARGS__ } \
+    template<class V> \
+    void linkoVisit(V& v) const { __VA_ARGS__ }
+
+#define LINKO_FIELD(tag, name) \
+    static_assert((tag) > 0 && (tag) < (1 << 29), "invalid field tag"); \
+    v(tag, name);
+
+namespace linko {
+
+namespace serialize {
+
+enum WireType {
+    VARINT = 0,
+    FIXED64 = 1,
+    LENGTH = 2,
+    FIXED32 = 5
+};
+
+inline size_t VarintSize(uint64_t v) {
+    return (64 - __builtin_clzll(v | 1) + 6) / 7;
+}
+
+inline uint64_t Zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline uint32_t MakeKey(uint32_t tag, int wire) {
+    return (tag << 3) | wire;
+}
+
+inline size_t KeySize(uint32_t tag) {
+    return VarintSize(tag << 3);
+}
+
+/*
+ * 编码时按先序记录的嵌套长度
+ */
+class SizeCache {
+public:
+    size_t reserve() {
+        m_sizes.push_back(0);
+        return m_sizes.size() - 1;
+    }
+    void set(size_t idx, size_t size) { m_sizes[idx] = size; }
+    size_t next() { return m_sizes[m_next++]; }
+    void reset() {
+        m_sizes.clear();
+        m_next = 0;
+    }
+
+    static SizeCache& GetThreadLocal() {
+        static thread_local SizeCache s_cache;
+        return s_cache;
+    }
+private:
+    std::vector<size_t> m_sizes;
+    size_t m_next = 0;
+};
+
+// 读取LENGTH类型的长度, 超出剩余数据时抛出std::out_of_range
+inline size_t ReadLength(ByteArray& ba) {
+    uint64_t len = ba.readUint64();
+    if (len > ba.getReadSize()) {
+        throw std::out_of_range("length out of range");
+    }
+    return len;
+}
+
+inline void SkipField(ByteArray& ba, int wire) {
+    size_t len = 0;
+    switch (wire) {
+        case VARINT:
+            ba.readUint64();
+            return;
+        case FIXED64:
+            len = 8;
+            break;
+        case FIXED32:
+            len = 4;
+            break;
+        case LENGTH:
+            len = ReadLength(ba);
+            break;
+        default:
+            throw std::logic_error("invalid wire type " + std::to_string(wire));
+    }
+    // setPosition超过m_size会扩大数据大小, 先检查剩余长度
+    if (len > ba.getReadSize()) {
+        throw std::out_of_range("skip out of range");
+    }
+    ba.setPosition(ba.getPosition() + len);
+}
+
+inline void CheckWire(int wire, int expect) {
+    if (wire != expect) {
+        throw std::logic_error("wire type mismatch " + std::to_string(wire)
+                + " expect " + std::to_string(expect));
+    }
+}
+
+struct NullVisitor {
+    template<class F>
+    void operator()(uint32_t, F&) {}
+};
+
+// T是否通过LINKO_SERIALIZE声明了字段
+template<class T>
+class IsMessage {
+    template<class U>
+    static char test(decltype(std::declval<U&>().linkoVisit(std::declval<NullVisitor&>()))*);
+    template<class U>
+    static int test(...);
+public:
+    static const bool value = sizeof(test<T>(nullptr)) == sizeof(char);
+};
+
+/*
+ * 单个值的编码, size和write包含LENGTH类型的长度前缀, 不包含key
+ */
+template<class T, class Enable = void>
+class Codec;
+
+// 有符号整数和枚举
+template<class T>
+class Codec<T, typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value)
+        || std::is_enum<T>::value>::type> {
+public:
+    static const int wire = VARINT;
+    static size_t size(const T& v, SizeCache&) { return VarintSize(Zigzag((int64_t)v)); }
+    static void write(ByteArray& ba, const T& v, SizeCache&) { ba.writeInt64((int64_t)v); }
+    static void read(ByteArray& ba, T& v) { v = (T)ba.readInt64(); }
+};
+
+// 无符号整数和bool
+template<class T>
+class Codec<T, typename std::enable_if<std::is_integral<T>::value
+        && std::is_unsigned<T>::value>::type> {
+public:
+    static const int wire = VARINT;
+    static size_t size(const T& v, SizeCache&) { return VarintSize(v); }
+    static void write(ByteArray& ba, const T& v, SizeCache&) { ba.writeUint64(v); }
+    static void read(ByteArray& ba, T& v) { v = (T)ba.readUint64(); }
+};
+
+template<>
+class Codec<float> {
+public:
+    static const int wire = FIXED32;
+    static size_t size(const float&, SizeCache&) { return 4; }
+    static void write(ByteArray& ba, const float& v, SizeCache&) { ba.writeFloat(v); }
+    static void read(ByteArray& ba, float& v) { v = ba.readFloat(); }
+};
+
+template<>
+class Codec<double> {
+public:
+    static const int wire = FIXED64;
+    static size_t size(const double&, SizeCache&) { return 8; }
+    static void write(ByteArray& ba, const double& v, SizeCache&) { ba.writeDouble(v); }
+    static void read(ByteArray& ba, double& v) { v = ba.readDouble(); }
+};
+
+template<>
+class Codec<std::string> {
+public:
+    static const int wire = LENGTH;
+    static size_t size(const std::string& v, SizeCache&) {
+        return VarintSize(v.size()) + v.size();
+    }
+    static void write(ByteArray& ba, const std::string& v, SizeCache&) {
+        ba.writeUint64(v.size());
+        ba.write(v.c_str(), v.size());
+    }
+    static void read(ByteArray& ba, std::string& v) {
+        v.resize(ReadLength(ba));
+        if (!v.empty()) {
+            ba.read(&v[0], v.size());
+        }
+    }
+};
+
+template<class T>
+size_t BodySize(const T& msg, SizeCache& cache);
+template<class T>
+void WriteBody(ByteArray& ba, const T& msg, SizeCache& cache);
+template<class T>
+void ReadBody(ByteArray& ba, T& msg, size_t end);
+
+// 嵌套结构体
+template<class T>
+class Codec<T, typename std::enable_if<IsMessage<T>::value>::type> {
+public:
+    static const int wire = LENGTH;
+    static size_t size(const T& v, SizeCache& cache) {
+        size_t idx = cache.reserve();
+        size_t len = BodySize(v, cache);
+        cache.set(idx, len);
+        return VarintSize(len) + len;
+    }
+    static void write(ByteArray& ba, const T& v, SizeCache& cache) {
+        ba.writeUint64(cache.next());
+        WriteBody(ba, v, cache);
+    }
+    static void read(ByteArray& ba, T& v) {
+        size_t len = ReadLength(ba);
+        ReadBody(ba, v, ba.getPosition() + len);
+    }
+};
+
+/*
+ * 字段的编码, 包含key; 重复字段(vector/map)在这一层展开
+ */
+template<class T>
+class Field {
+public:
+    static size_t size(uint32_t tag, const T& v, SizeCache& cache) {
+        return KeySize(tag) + Codec<T>::size(v, cache);
+    }
+    static void write(ByteArray& ba, uint32_t tag, const T& v, SizeCache& cache) {
+        ba.writeUint32(MakeKey(tag, Codec<T>::wire));
+        Codec<T>::write(ba, v, cache);
+    }
+    static void read(ByteArray& ba, int wire, T& v) {
+        CheckWire(wire, Codec<T>::wire);
+        Codec<T>::read(ba, v);
+    }
+};
+
+// 打包写入, 整数类型使用ByteArray的批量编码
+template<class T>
+void WritePacked(ByteArray& ba, const std::vector<T>& v, SizeCache& cache) {
+    for (const auto& i : v) {
+        Codec<T>::write(ba, i, cache);
+    }
+}
+
+inline void WritePacked(ByteArray& ba, const std::vector<int32_t>& v, SizeCache&) {
+    ba.writeInt32Array(v.data(), v.size());
+}
+
+inline void WritePacked(ByteArray& ba, const std::vector<uint32_t>& v, SizeCache&) {
+    ba.writeUint32Array(v.data(), v.size());
+}
+
+inline void WritePacked(ByteArray& ba, const std::vector<int64_t>& v, SizeCache&) {
+    ba.writeInt64Array(v.data(), v.size());
+}
+
+inline void WritePacked(ByteArray& ba, const std::vector<uint64_t>& v, SizeCache&) {
+    ba.writeUint64Array(v.data(), v.size());
+}
+
+template<class T>
+class Field<std::vector<T> > {
+public:
+    static const bool packed = Codec<T>::wire != LENGTH;
+
+    static size_t size(uint32_t tag, const std::vector<T>& v, SizeCache& cache) {
+        if (v.empty()) {
+            return 0;
+        }
+        if (packed) {
+            size_t idx = cache.reserve();
+            size_t len = 0;
+            for (const auto& i : v) {
+                len += Codec<T>::size(i, cache);
+            }
+            cache.set(idx, len);
+            return KeySize(tag) + VarintSize(len) + len;
+        }
+        size_t len = KeySize(tag) * v.size();
+        for (const auto& i : v) {
+            len += Codec<T>::size(i, cache);
+        }
+        return len;
+    }
+
+    static void write(ByteArray& ba, uint32_t tag, const std::vector<T>& v, SizeCache& cache) {
+        if (v.empty()) {
+            return;
+        }
+        if (packed) {
+            ba.writeUint32(MakeKey(tag, LENGTH));
+            ba.writeUint64(cache.next());
+            WritePacked(ba, v, cache);
+            return;
+        }
+        uint32_t key = MakeKey(tag, LENGTH);
+        for (const auto& i : v) {
+            ba.writeUint32(key);
+            Codec<T>::write(ba, i, cache);
+        }
+    }
+
+    static void read(ByteArray& ba, int wire, std::vector<T>& v) {
+        if (packed && wire == LENGTH) {
+            size_t end = ReadLength(ba) + ba.getPosition();
+            while (ba.getPosition() < end) {
+                T tmp;
+                Codec<T>::read(ba, tmp);
+                v.push_back(tmp);
+            }
+            if (ba.getPosition() != end) {
+                throw std::out_of_range("packed field length mismatch");
+            }
+            return;
+        }
+        // 未打包的单个元素
+        CheckWire(wire, Codec<T>::wire);
+        T tmp;
+        Codec<T>::read(ba, tmp);
+        v.push_back(std::move(tmp));
+    }
+};
+
+template<class M>
+class MapField {
+public:
+    typedef typename M::key_type K;
+    typedef typename M::mapped_type V;
+
+    static size_t size(uint32_t tag, const M& v, SizeCache& cache) {
+        size_t len = 0;
+        for (const auto& i : v) {
+            size_t idx = cache.reserve();
+            size_t n = KeySize(1) + Codec<K>::size(i.first, cache)
+                + KeySize(2) + Codec<V>::size(i.second, cache);
+            cache.set(idx, n);
+            len += KeySize(tag) + VarintSize(n) + n;
+        }
+        return len;
+    }
+
+    static void write(ByteArray& ba, uint32_t tag, const M& v, SizeCache& cache) {
+        uint32_t key = MakeKey(tag, LENGTH);
+        for (const auto& i : v) {
+            ba.writeUint32(key);
+            ba.writeUint64(cache.next());
+            ba.writeUint32(MakeKey(1, Codec<K>::wire));
+            Codec<K>::write(ba, i.first, cache);
+            ba.writeUint32(MakeKey(2, Codec<V>::wire));
+            Codec<V>::write(ba, i.second, cache);
+        }
+    }
+
+    static void read(ByteArray& ba, int wire, M& v) {
+        CheckWire(wire, LENGTH);
+        size_t end = ReadLength(ba) + ba.getPosition();
+        K k = K();
+        V val = V();
+        while (ba.getPosition() < end) {
+            uint32_t key = ba.readUint32();
+            if ((key >> 3) == 1) {
+                CheckWire(key & 7, Codec<K>::wire);
+                Codec<K>::read(ba, k);
+            } else if ((key >> 3) == 2) {
+                CheckWire(key & 7, Codec<V>::wire);
+                Codec<V>::read(ba, val);
+            } else {
+                SkipField(ba, key & 7);
+            }
+        }
+        if (ba.getPosition() != end) {
+            throw std::out_of_range("map entry length mismatch");
+        }
+        v[std::move(k)] = std::move(val);
+    }
+};
+
+template<class K, class V>
+class Field<std::map<K, V> > : public MapField<std::map<K, V> > {
+};
+
+template<class K, class V>
+class Field<std::unordered_map<K, V> > : public MapField<std::unordered_map<K, V> > {
+};
+
+class SizeVisitor {
+public:
+    SizeVisitor(SizeCache& cache)
+        :m_cache(cache) {
+    }
+    template<class F>
+    void operator()(uint32_t tag, const F& f) {
+        m_size += Field<F>::size(tag, f, m_cache);
+    }
+    size_t getSize() const { return m_size; }
+private:
+    SizeCache& m_cache;
+    size_t m_size = 0;
+};
+
+class WriteVisitor {
+public:
+    WriteVisitor(ByteArray& ba, SizeCache& cache)
+        :m_ba(ba)
+        ,m_cache(cache) {
+    }
+    template<class F>
+    void operator()(uint32_t tag, const F& f) {
+        Field<F>::write(m_ba, tag, f, m_cache);
+    }
+private:
+    ByteArray& m_ba;
+    SizeCache& m_cache;
+};
+
+class ReadVisitor {
+public:
+    ReadVisitor(ByteArray& ba, uint32_t tag, int wire)
+        :m_ba(ba)
+        ,m_tag(tag)
+        ,m_wire(wire) {
+    }
+    template<class F>
+    void operator()(uint32_t tag, F& f) {
+        if (!m_found && tag == m_tag) {
+            Field<F>::read(m_ba, m_wire, f);
+            m_found = true;
+        }
+    }
+    bool isFound() const { return m_found; }
+private:
+    ByteArray& m_ba;
+    uint32_t m_tag;
+    int m_wire;
+    bool m_found = false;
+};
+
+template<class T>
+size_t BodySize(const T& msg, SizeCache& cache) {
+    SizeVisitor v(cache);
+    msg.linkoVisit(v);
+    return v.getSize();
+}
+
+template<class T>
+void WriteBody(ByteArray& ba, const T& msg, SizeCache& cache) {
+    WriteVisitor v(ba, cache);
+    msg.linkoVisit(v);
+}
+
+template<class T>
+void ReadBody(ByteArray& ba, T& msg, size_t end) {
+    while (ba.getPosition() < end) {
+        uint32_t key = ba.readUint32();
+        ReadVisitor v(ba, key >> 3, key & 7);
+        msg.linkoVisit(v);
+        if (!v.isFound()) {
+            // 未知字段跳过, 兼容新增字段
+            SkipField(ba, key & 7);
+        }
+    }
+    if (ba.getPosition() != end) {
+        throw std::out_of_range("message length mismatch");
+    }
+}
+
+}
+
+class Serializer {
+public:
+    // 编码后的字节数
+    template<class T>
+    static size_t ByteSize(const T& msg) {
+        serialize::SizeCache& cache = serialize::SizeCache::GetThreadLocal();
+        cache.reset();
+        return serialize::BodySize(msg, cache);
+    }
+
+    // 从ba当前位置写入msg, 返回写入的字节数
+    template<class T>
+    static size_t Encode(ByteArray& ba, const T& msg) {
+        serialize::SizeCache& cache = serialize::SizeCache::GetThreadLocal();
+        cache.reset();
+        size_t len = serialize::BodySize(msg, cache);
+        ba.reserve(len);
+        serialize::WriteBody(ba, msg, cache);
+        return len;
+    }
+
+    // 从ba当前位置读取len字节解码到msg, 数据不完整或格式错误时返回false
+    // 字段合并到msg中, vector/map追加元素
+    template<class T>
+    static bool Decode(ByteArray& ba, T& msg, size_t len) {
+        if (len > ba.getReadSize()) {
+            return false;
+        }
+        try {
+            serialize::ReadBody(ba, msg, ba.getPosition() + len);
+        } catch (std::exception& e) {
+            return false;
+        }
+        return true;
+    }
+
+    // 读取ba中剩余的全部数据
+    template<class T>
+    static bool Decode(ByteArray& ba, T& msg) {
+        return Decode(ba, msg, ba.getReadSize());
+    }
+};
+
+}
+
+#endif
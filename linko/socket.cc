@@ -61,7 +61,8 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdManager::ReadGuard guard;
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -74,7 +75,8 @@ bool Socket::setSendTimeout(int64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-     FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdManager::ReadGuard guard;
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -122,8 +124,13 @@ Socket::ptr Socket::accept() {
 }
 
 bool Socket::init(int sock) {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
-    if (ctx && ctx->isSocket() && !ctx->isClosed()) {
+    bool ok = false;
+    {
+        FdManager::ReadGuard guard;
+        FdCtx* ctx = FdMgr::GetInstance()->get(sock);
+        ok = ctx && ctx->isSocket() && !ctx->isClosed();
+    }
+    if (ok) {
         m_sock = sock;
         m_isConnected = true;
         initSock();
@@ -1,6 +1,7 @@
 #include "tcp_server.h"
 #include "config.h"
 #include "log.h"
+#include "numa.h"
 
 namespace linko {
 
@@ -8,8 +9,23 @@ static linko::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     linko::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
             "tcp server read timeout");
 
+//按连接收包所在cpu的numa节点选择工作线程, 需要网卡中断绑定在其本地节点并配置scheduler.affinity
+static linko::ConfigVar<bool>::ptr g_tcp_server_numa_steer =
+    linko::Config::Lookup("tcp_server.numa_steer", false,
+            "dispatch accepted connection to worker on the numa node receiving it");
+
 static linko::Logger::ptr g_logger = LINKO_LOG_NAME("system");
 
+static FiberLocal<uint64_t>& AcceptTicks() {
+    static FiberLocal<uint64_t> s_ticks;
+    return s_ticks;
+}
+
+uint64_t TcpServer::GetAcceptTicks() {
+    std::shared_ptr<const uint64_t> p = AcceptTicks().get();
+    return p ? *p : 0;
+}
+
 TcpServer::TcpServer(linko::IOManager* worker 
             , linko::IOManager* accept_worker)
     : m_worker(worker)
@@ -72,13 +88,22 @@ void TcpServer::startAccept(Socket::ptr sock) {
     while (!m_isStop) {
         Socket::ptr client = sock->accept();
         if (client) {
+            uint64_t accept_ticks = GetCurrentTicks();
             client->setRecvTimeout(m_recvTimeout);
+            int thread = -1;
+            int cpu = -1;
+            if (g_tcp_server_numa_steer->getValue()
+                    && client->getOption(SOL_SOCKET, SO_INCOMING_CPU, cpu)) {
+                thread = m_worker->getThreadOnNode(GetCpuNumaNode(cpu));
+            }
+            m_acceptCounter->inc();
             // handleClient结束前tcpserver不能结束, 
             // 使用shared_from_this创建智能指针维持生命
-            m_worker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
+            m_worker->schedule(std::bind(&TcpServer::onClient,
+                        shared_from_this(), client, accept_ticks), thread);
         } else {
-            LINKO_LOG_ERROR(g_logger) << "accept errno=" << errno
+            m_acceptErrorCounter->inc();
+            LINKO_LOG_RATE_LIMITED(g_logger, linko::LogLevel::ERROR, 10, 20) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
         }
     }
@@ -90,6 +115,14 @@ bool TcpServer::start() {
     }
     m_isStop = false;
 
+    MetricLabels labels = {{"server", m_name}};
+    m_acceptCounter = Metrics::AddCounter("linko_tcp_server_accepted_total"
+            , "connections accepted", labels);
+    m_acceptErrorCounter = Metrics::AddCounter("linko_tcp_server_accept_errors_total"
+            , "accept failures", labels);
+    m_connGauge = Metrics::AddGauge("linko_tcp_server_connections"
+            , "connections being handled", labels);
+
     for (auto& sock : m_socks) {
         m_accpetWorker->schedule(std::bind(&TcpServer::startAccept,
                     shared_from_this(), sock));
@@ -110,6 +143,14 @@ void TcpServer::stop() {
     });
 }
 
+void TcpServer::onClient(Socket::ptr client, uint64_t accept_ticks) {
+    AcceptTicks().set(accept_ticks);
+    m_connGauge->inc();
+    handleClient(client);
+    m_connGauge->dec();
+    AcceptTicks().reset();
+}
+
 void TcpServer::handleClient(Socket::ptr client) {
     LINKO_LOG_INFO(g_logger) << "handleClient: " << *client;
 }
@@ -8,6 +8,7 @@
 #include "iomanager.h"
 #include "socket.h"
 #include "address.h"
+#include "metrics.h"
 
 namespace linko {
 
@@ -35,12 +36,19 @@ public:
 
     bool isStop() const { return m_isStop; }
 
+    // 当前协程处理的连接被accept时的GetCurrentTicks, 不在handleClient中返回0
+    static uint64_t GetAcceptTicks();
+
 protected:
     // 处理新连接的Socket类
     virtual void handleClient(Socket::ptr client);
     // 开始接受连接
     virtual void startAccept(Socket::ptr sock);
 
+private:
+    // 统计当前连接数并调用handleClient
+    void onClient(Socket::ptr client, uint64_t accept_ticks);
+
 private:
     // 监听socket数组
     std::vector<Socket::ptr> m_socks;
@@ -54,6 +62,10 @@ private:
     std::string m_name;
     // 服务是否停止
     bool m_isStop;
+    // 已接受的连接数, accept失败次数, 当前连接数, 在start时按服务器名称注册
+    Counter::ptr m_acceptCounter;
+    Counter::ptr m_acceptErrorCounter;
+    Gauge::ptr m_connGauge;
 
 };
 
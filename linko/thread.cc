@@ -1,5 +1,6 @@
 #include "thread.h"
 #include "log.h"
+#include "numa.h"
 
 namespace linko {
 
@@ -24,9 +25,10 @@ void Thread::SetName(const std::string& name) {
     t_thread_name = name;
 }
 
-Thread::Thread(std::function<void()> cb, const std::string& name) 
+Thread::Thread(std::function<void()> cb, const std::string& name, int cpu) 
     : m_cb(cb) 
-    , m_name(name) {
+    , m_name(name)
+    , m_cpu(cpu) {
     if (name.empty()) {
         m_name = "UNKNOW";
     }
@@ -65,6 +67,10 @@ void* Thread::run(void* arg) {
     t_thread_name = thread->getName();
     thread->m_id = linko::GetThreadId();
     pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
+    //先绑定cpu, 之后线程首次访问的内存(线程局部缓冲区, 协程栈)按首次访问原则落在本地节点
+    if (thread->m_cpu >= 0 && !SetThreadAffinity(thread->m_cpu)) {
+        thread->m_cpu = -1;
+    }
     
     std::function<void()> cb;
     cb.swap(thread->m_cb);
@@ -8,11 +8,13 @@ namespace linko {
 class Thread {
 public:
     typedef std::shared_ptr<Thread> ptr;
-    Thread(std::function<void()> cb, const std::string& name);
+    // cpu >= 0时线程在执行cb前绑定到该cpu
+    Thread(std::function<void()> cb, const std::string& name, int cpu = -1);
     ~Thread();
 
     pid_t getId() const { return m_id; }
     std::string getName() const { return m_name; }
+    int getCpu() const { return m_cpu; }
 
     void join();
 
@@ -31,6 +33,7 @@ private:
     pthread_t m_thread = 0;
     std::function<void()> m_cb;
     std::string m_name;
+    int m_cpu = -1;
 
     Semaphore m_semaphore;
 };
@@ -3,52 +3,28 @@
 
 namespace linko {
 
-bool Timer::Comparator::operator()(const Timer::ptr &lhs, 
-                                    const Timer::ptr &rhs) const {
-    //比较定时器的智能指针的大小(按执行时间排序)
-    if (!lhs && !rhs) {
-        return false;
-    }
-
-    if (!lhs) {
-        return true;
-    }
-
-    if (!rhs) {
-        return false;
-    }
-
-    if (lhs->m_next < rhs->m_next) {
-        return true;
-    }
-
-    if (rhs->m_next < lhs->m_next) {
-        return false;
-    }
-
-    return lhs.get() < rhs.get();
-}
-
-
 Timer::Timer(uint64_t ms, std::function<void()> cb,
             bool recurring, TimerManager* manager) 
     : m_recurring(recurring)
     , m_ms(ms)
     , m_cb(cb)
     , m_manager(manager) {
-    m_next = linko::GetCurrentMS() + m_ms;
-}
-
-Timer::Timer(uint64_t next) 
-    : m_next(next){
+    m_next = linko::GetMonotonicMS() + m_ms;
 }
 
 bool Timer::cancel() {
+    if (!m_manager) {
+        return false;
+    }
+    //最后一个引用可能是m_self, 在释放锁之后再析构
+    Timer::ptr self;
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if (m_cb) {
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        if (m_index != (size_t)-1) {
+            m_manager->remove(this);
+        }
+        self.swap(m_self);
         return true;
     }
     return false;
@@ -56,16 +32,11 @@ bool Timer::cancel() {
 
 bool Timer::refresh() {
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
-        return false;
-    }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    if (!m_cb || m_index == (size_t)-1) {
         return false;
     }
-    m_manager->m_timers.erase(it);
-    m_next = linko::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_next = linko::GetMonotonicMS() + m_ms;
+    m_manager->siftDown(m_index);
     return true;
 }
 
@@ -77,14 +48,13 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     if (!m_cb) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    if (m_index == (size_t)-1) {
         return false;
     }
-    m_manager->m_timers.erase(it);
+    m_manager->remove(this);
     uint64_t start = 0;
     if (from_now) {
-        start = linko::GetCurrentMS();
+        start = linko::GetMonotonicMS();
     } else {
         //设置为当时创建时的起始时间
         start = m_next - m_ms;
@@ -92,29 +62,47 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     //更新时间
     m_ms = ms;
     m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
+    m_manager->addTimer(this, lock);
     return true;    
 }
 
 TimerManager::TimerManager() {
-    m_previousTime = linko::GetCurrentMS();
 }
 
 TimerManager::~TimerManager() {
+    std::vector<Timer::ptr> timers;
+    for (auto i : m_timers) {
+        i->m_index = -1;
+        if (i->m_self) {
+            timers.push_back(std::move(i->m_self));
+        }
+    }
+    m_timers.clear();
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, 
                                 bool recurring) {
     Timer::ptr timer(new Timer(ms, cb, recurring, this));
     RWMutexType::WriteLock lock(m_mutex);
-    addTimer(timer, lock);
+    timer->m_self = timer;
+    addTimer(timer.get(), lock);
     return timer;
 }
 
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    auto it = m_timers.insert(val).first;
+void TimerManager::addTimer(Timer* timer, uint64_t ms, std::function<void()> cb) {
+    timer->m_recurring = false;
+    timer->m_ms = ms;
+    timer->m_next = linko::GetMonotonicMS() + ms;
+    timer->m_cb.swap(cb);
+    timer->m_manager = this;
+    RWMutexType::WriteLock lock(m_mutex);
+    addTimer(timer, lock);
+}
+
+void TimerManager::addTimer(Timer* val, RWMutexType::WriteLock& lock) {
+    push(val);
     //如果该定时器是超时时间最短 && 没有设置触发onTimerInsertedAtFront
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
+    bool at_front = (val->m_index == 0) && !m_tickled;
     if (at_front) {
         m_tickled = true;
     }
@@ -147,8 +135,8 @@ uint64_t TimerManager::getNextTimer() {
         return ~0ull;
     }
 
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = linko::GetCurrentMS();
+    const Timer* next = m_timers.front();
+    uint64_t now_ms = linko::GetMonotonicMS();
     if (now_ms >= next->m_next) {
         return 0;
     } else {
@@ -157,7 +145,8 @@ uint64_t TimerManager::getNextTimer() {
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
-    uint64_t now_ms = linko::GetCurrentMS();
+    uint64_t now_ms = linko::GetMonotonicMS();
+    //m_self在释放锁之后再析构
     std::vector<Timer::ptr> expired;
     {
         RWMutexType::ReadLock lock(m_mutex);
@@ -170,47 +159,82 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
         return;
     }
 
-    bool rollover = detectClockRollover(now_ms);
-    //服务器时间正常 && 第一个计时器未超时
-    if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+    //第一个计时器未超时
+    if (m_timers.front()->m_next > now_ms) {
         return;
     }
 
-    Timer::ptr now_timer(new Timer(now_ms));
-    //若服务器时间改动，则所有Timer都视为过期
-    //否则返回第一个>= now_ms的迭代器，在此迭代器之前的定时器全部超时
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    //筛选出执行时间与当前时间相同的定时器
-    while (it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    //取出超时的部分
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-
-    //获取所有超时的任务
-    cbs.reserve(expired.size());
-    for (auto& timer : expired) {
+    //取出所有执行时间<= now_ms的定时器
+    std::vector<Timer*> recurring;
+    while (!m_timers.empty() && m_timers.front()->m_next <= now_ms) {
+        Timer* timer = m_timers.front();
+        remove(timer);
         cbs.push_back(timer->m_cb);
         //如果是循环定时器，则设置新的执行时间，重新加入定时器集合中
         if (timer->m_recurring) {
             timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            recurring.push_back(timer);
         } else {
             timer->m_cb = nullptr;
+            if (timer->m_self) {
+                expired.push_back(std::move(timer->m_self));
+            }
         }
     }
+    for (auto timer : recurring) {
+        push(timer);
+    }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    //如果当前时间比上次执行时间还小 && 小于一个小时的时间，相当于时间倒流了
-    if (now_ms < m_previousTime &&
-        now_ms < (m_previousTime - 60 * 60 * 1000)) {
-        rollover = true;
+void TimerManager::push(Timer* val) {
+    m_timers.push_back(val);
+    val->m_index = m_timers.size() - 1;
+    siftUp(val->m_index);
+}
+
+void TimerManager::remove(Timer* val) {
+    size_t idx = val->m_index;
+    Timer* last = m_timers.back();
+    m_timers.pop_back();
+    val->m_index = -1;
+    if (last != val) {
+        place(last, idx);
+        siftUp(idx);
+        siftDown(last->m_index);
     }
-    m_previousTime = now_ms;
-    return rollover;
+}
+
+void TimerManager::siftUp(size_t idx) {
+    Timer* val = m_timers[idx];
+    while (idx > 0) {
+        size_t parent = (idx - 1) / 2;
+        if (m_timers[parent]->m_next <= val->m_next) {
+            break;
+        }
+        place(m_timers[parent], idx);
+        idx = parent;
+    }
+    place(val, idx);
+}
+
+void TimerManager::siftDown(size_t idx) {
+    Timer* val = m_timers[idx];
+    size_t size = m_timers.size();
+    while (true) {
+        size_t child = idx * 2 + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && m_timers[child + 1]->m_next < m_timers[child]->m_next) {
+            ++child;
+        }
+        if (val->m_next <= m_timers[child]->m_next) {
+            break;
+        }
+        place(m_timers[child], idx);
+        idx = child;
+    }
+    place(val, idx);
 }
 
 bool TimerManager::hasTimer() {
@@ -218,4 +242,9 @@ bool TimerManager::hasTimer() {
     return !m_timers.empty();
 }
 
+size_t TimerManager::getTimerCount() {
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_timers.size();
+}
+
 }
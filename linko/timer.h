@@ -2,36 +2,38 @@
 #define __LINKO_TIMER_H__
 
 #include <memory>
-#include <set>
 #include <vector>
+#include <functional>
 #include "thread.h"
 
 namespace linko {
 
 class TimerManager;
-class Timer : public std::enable_shared_from_this<Timer> {
+class Timer {
 friend class TimerManager;
 public:
     typedef std::shared_ptr<Timer> ptr;
 
+    /*
+     * 嵌入在其他对象中的定时器, 通过TimerManager::addTimer(Timer*, ...)加入, 不单独分配内存
+     * 持有者需保证在定时器触发或cancel成功之前不销毁
+     */
+    Timer() {}
+
     bool cancel();
     bool refresh();
     bool reset(uint64_t ms, bool from_now);
 private:
     Timer(uint64_t ms, std::function<void()> cb
         , bool recurring, TimerManager* manager);
-
-    Timer(uint64_t ms);
 private:
     bool m_recurring = false;   //是否循环定时器
     uint64_t m_ms = 0;          //执行周期
-    uint64_t m_next = 0;        //精确的执行时间
+    uint64_t m_next = 0;        //精确的执行时间(GetMonotonicMS)
     std::function<void()> m_cb;
     TimerManager* m_manager = nullptr;
-private:
-    struct Comparator {
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-    };
+    size_t m_index = -1;        //在堆中的位置, 不在堆中时为-1
+    Timer::ptr m_self;          //在堆中时持有自身, 嵌入的定时器为空
 };
 
 class TimerManager {
@@ -49,21 +51,33 @@ public:
             uint64_t ms, std::function<void()> cb, 
             std::weak_ptr<void> weak_cond, bool recurring = false);
 
+    //加入嵌入的定时器, 除堆扩容外不分配内存
+    void addTimer(Timer* timer, uint64_t ms, std::function<void()> cb);
+
     //到最近一个定时器执行的时间间隔(毫秒)
     uint64_t getNextTimer();
     //获取需要执行的定时器的回调函数列表
     void listExpiredCb(std::vector<std::function<void()> >& cbs);
     bool hasTimer();
+    size_t getTimerCount();
 protected:
     virtual void onTimerInsertedAtFront() = 0;
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
+    void addTimer(Timer* val, RWMutexType::WriteLock& lock);
 private:
-    bool detectClockRollover(uint64_t now_ms);
+    //最小堆操作, 调用时需持有写锁
+    void push(Timer* val);
+    void remove(Timer* val);
+    void siftUp(size_t idx);
+    void siftDown(size_t idx);
+    void place(Timer* val, size_t idx) {
+        m_timers[idx] = val;
+        val->m_index = idx;
+    }
 private:
     RWMutexType m_mutex;
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
+    //按执行时间排列的最小堆
+    std::vector<Timer*> m_timers;
     bool m_tickled = false;
-    uint64_t m_previousTime = 0;
 };
 
 }
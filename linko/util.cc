@@ -1,6 +1,12 @@
 #include "util.h"
 #include <execinfo.h>
 #include <sys/time.h>
+#include <time.h>
+#include <atomic>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 
 #include "log.h"
 #include "fiber.h"
@@ -46,6 +52,30 @@ std::string BacktraceToString(int size, int skip, const std::string& prefix) {
     return ss.str();
 }
 
+int BacktraceRaw(void** array, int size, int skip) {
+    void** tmp = (void**)malloc(sizeof(void*) * (size + skip));
+    int s = ::backtrace(tmp, size + skip);
+    int n = 0;
+    for (int i = skip; i < s; ++i) {
+        array[n++] = tmp[i];
+    }
+    free(tmp);
+    return n;
+}
+
+std::string BacktraceSymbolsToString(void* const* array, int size, const std::string& prefix) {
+    std::stringstream ss;
+    char** strings = backtrace_symbols(array, size);
+    if (strings == NULL) {
+        return ss.str();
+    }
+    for (int i = 0; i < size; ++i) {
+        ss << prefix << strings[i] << std::endl;
+    }
+    free(strings);
+    return ss.str();
+}
+
 uint64_t GetCurrentMS() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
@@ -57,4 +87,193 @@ uint64_t GetCurrentUS() {
     return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+static uint64_t GetMonotonicNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000ul + ts.tv_nsec;
+}
+
+//cpuid 0x80000007 edx bit8: invariant tsc, 频率恒定且各核同步, 否则退化为CLOCK_MONOTONIC
+static bool UseTSC() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool s_use_tsc = []() {
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+            return false;
+        }
+        __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        return (edx & (1u << 8)) != 0;
+    }();
+    return s_use_tsc;
+#else
+    return false;
+#endif
+}
+
+uint64_t GetCurrentTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (UseTSC()) {
+        return __builtin_ia32_rdtsc();
+    }
+#endif
+    return GetMonotonicNS();
+}
+
+namespace {
+
+/*
+ * tick与CLOCK_MONOTONIC的对应关系, 单调时间 = ns + (当前tick - ticks) * slope
+ * 首次使用后至少间隔10ms才完成校准, 之前直接读CLOCK_MONOTONIC, 不在调用方忙等
+ * 之后每隔约1s重新对照CLOCK_MONOTONIC建立锚点, 新锚点从旧直线的预测值开始保证单调,
+ * 偏差通过调整slope在下一个周期内消除, 误差不会累积
+ * 只有一个线程更新锚点(updating), 读端通过seq重试
+ */
+struct ClockAnchor {
+    std::atomic<uint32_t> seq{0};
+    std::atomic<uint64_t> ticks{0};
+    std::atomic<uint64_t> ns{0};
+    // 锚点处实际读到的CLOCK_MONOTONIC, 用于估算下一段的频率
+    std::atomic<uint64_t> clock_ns{0};
+    // 含偏差修正的换算斜率, 0表示尚未校准
+    std::atomic<double> slope{0};
+    // 实测的每tick纳秒数, 用于换算时间间隔
+    std::atomic<double> ns_per_tick{0};
+    std::atomic<bool> updating{false};
+};
+
+static ClockAnchor s_anchor;
+
+static const uint64_t CALIBRATE_NS = 10 * 1000 * 1000;
+static const uint64_t RESYNC_NS = 1000 * 1000 * 1000;
+
+static void LoadAnchor(uint64_t& ticks, uint64_t& ns, double& slope) {
+    uint32_t seq = 0;
+    do {
+        seq = s_anchor.seq.load(std::memory_order_acquire);
+        ticks = s_anchor.ticks.load(std::memory_order_relaxed);
+        ns = s_anchor.ns.load(std::memory_order_relaxed);
+        slope = s_anchor.slope.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != s_anchor.seq.load(std::memory_order_relaxed));
+}
+
+static void StoreAnchor(uint64_t ticks, uint64_t ns, uint64_t clock_ns
+                        , double slope, double ns_per_tick) {
+    uint32_t seq = s_anchor.seq.load(std::memory_order_relaxed);
+    s_anchor.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s_anchor.ticks.store(ticks, std::memory_order_relaxed);
+    s_anchor.ns.store(ns, std::memory_order_relaxed);
+    s_anchor.clock_ns.store(clock_ns, std::memory_order_relaxed);
+    s_anchor.slope.store(slope, std::memory_order_relaxed);
+    s_anchor.ns_per_tick.store(ns_per_tick, std::memory_order_relaxed);
+    s_anchor.seq.store(seq + 2, std::memory_order_release);
+}
+
+//对照CLOCK_MONOTONIC重建锚点, 其他线程正在更新时直接返回, 继续使用旧锚点
+static void Resync() {
+    if (s_anchor.updating.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+    uint64_t clock_ns = GetMonotonicNS();
+    uint64_t ticks = GetCurrentTicks();
+    uint64_t last_ticks = s_anchor.ticks.load(std::memory_order_relaxed);
+    uint64_t last_ns = s_anchor.ns.load(std::memory_order_relaxed);
+    uint64_t last_clock_ns = s_anchor.clock_ns.load(std::memory_order_relaxed);
+    double last_slope = s_anchor.slope.load(std::memory_order_relaxed);
+
+    if (last_clock_ns == 0) {
+        //只记录校准起点
+        StoreAnchor(ticks, clock_ns, clock_ns, 0, 0);
+    } else if (clock_ns - last_clock_ns >= CALIBRATE_NS && ticks > last_ticks) {
+        double ns_per_tick = (double)(clock_ns - last_clock_ns) / (ticks - last_ticks);
+        if (last_slope == 0) {
+            StoreAnchor(ticks, clock_ns, clock_ns, ns_per_tick, ns_per_tick);
+        } else {
+            uint64_t predicted = last_ns + (uint64_t)((ticks - last_ticks) * last_slope);
+            if (predicted + RESYNC_NS / 2 < clock_ns) {
+                //落后太多(如系统挂起)直接跳到实际时间
+                StoreAnchor(ticks, clock_ns, clock_ns, ns_per_tick, ns_per_tick);
+            } else {
+                //从预测值开始, 在下一个周期内追上实际时间, 超前时最多放慢一半
+                double offset = (double)predicted - (double)clock_ns;
+                double slope = ns_per_tick * std::max(0.5, 1 - offset / RESYNC_NS);
+                StoreAnchor(ticks, predicted, clock_ns, slope, ns_per_tick);
+            }
+        }
+    }
+    s_anchor.updating.store(false, std::memory_order_release);
+}
+
+}
+
+uint64_t TicksToUS(uint64_t ticks) {
+    if (!UseTSC()) {
+        return ticks / 1000;
+    }
+    double ns_per_tick = s_anchor.ns_per_tick.load(std::memory_order_relaxed);
+    if (ns_per_tick == 0) {
+        Resync();
+        ns_per_tick = s_anchor.ns_per_tick.load(std::memory_order_relaxed);
+    }
+    if (ns_per_tick == 0) {
+        //校准完成前用距起点的实测值粗略估算
+        uint64_t start_ticks = 0;
+        uint64_t start_ns = 0;
+        double slope = 0;
+        LoadAnchor(start_ticks, start_ns, slope);
+        uint64_t now_ticks = GetCurrentTicks();
+        uint64_t now_ns = GetMonotonicNS();
+        if (start_ns == 0 || now_ticks <= start_ticks || now_ns <= start_ns) {
+            return 0;
+        }
+        ns_per_tick = (double)(now_ns - start_ns) / (now_ticks - start_ticks);
+    }
+    return ticks * ns_per_tick / 1000;
+}
+
+uint64_t GetMonotonicUS() {
+    if (!UseTSC()) {
+        return GetMonotonicNS() / 1000;
+    }
+    uint64_t now = GetCurrentTicks();
+    uint64_t ticks = 0;
+    uint64_t ns = 0;
+    double slope = 0;
+    LoadAnchor(ticks, ns, slope);
+    if (slope == 0) {
+        Resync();
+        return GetMonotonicNS() / 1000;
+    }
+    //锚点可能由其他线程在本线程读tick之后建立
+    double delta = now > ticks ? (now - ticks) * slope : 0;
+    if (delta >= RESYNC_NS) {
+        Resync();
+        LoadAnchor(ticks, ns, slope);
+        delta = now > ticks ? (now - ticks) * slope : 0;
+    }
+    return (ns + (uint64_t)delta) / 1000;
+}
+
+uint64_t GetMonotonicMS() {
+    return GetMonotonicUS() / 1000;
+}
+
+static thread_local uint64_t t_cached_ms = 0;
+
+uint64_t GetCachedMonotonicMS() {
+    if (t_cached_ms) {
+        return t_cached_ms;
+    }
+    //没有刷新过的线程读粗粒度时钟, 精度为一个内核tick, 满足秒级超时判断
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+uint64_t UpdateCachedMonotonicMS(uint64_t now_ms) {
+    t_cached_ms = now_ms;
+    return now_ms;
+}
+
 }
@@ -18,9 +18,35 @@ uint32_t GetFiberId();
 
 void Backtrace(std::vector<std::string>& bt, int size = 64, int skip = 1);
 std::string BacktraceToString(int size = 64, int skip = 1, const std::string& prefix = "");
+//只记录返回地址, 不做符号化, 返回帧数; 用于需要先保存调用栈再输出的场景
+int BacktraceRaw(void** array, int size, int skip = 1);
+std::string BacktraceSymbolsToString(void* const* array, int size, const std::string& prefix = "");
 
+//墙上时间, 会随系统时间调整跳变, 只用于日志和对外展示
 uint64_t GetCurrentMS();
 uint64_t GetCurrentUS();
+
+/*
+ * 读取cpu时间戳计数器, 开销远小于gettimeofday, 只用于计算时间间隔
+ * cpu不支持invariant tsc或非x86平台退化为CLOCK_MONOTONIC纳秒
+ */
+uint64_t GetCurrentTicks();
+//tick数换算为微秒, 频率由对照CLOCK_MONOTONIC的实测得到
+uint64_t TicksToUS(uint64_t ticks);
+
+/*
+ * 单调时钟, 不受系统时间调整影响, 定时器和超时判断统一使用
+ * 由tick数换算, 每隔约1s对照CLOCK_MONOTONIC修正一次, 与其同起点, 各线程读到的值可以直接比较
+ */
+uint64_t GetMonotonicMS();
+uint64_t GetMonotonicUS();
+/*
+ * 当前线程缓存的单调时间(毫秒), 只用于秒级的超时判断
+ * 调度线程每取出一个任务、IOManager每轮idle时刷新, 没有刷新过的线程直接读时钟
+ */
+uint64_t GetCachedMonotonicMS();
+//刷新并返回当前线程的缓存
+uint64_t UpdateCachedMonotonicMS(uint64_t now_ms = GetMonotonicMS());
 }
 
 #endif
@@ -16,6 +16,34 @@ int main (int argc, char** argv) {
     LINKO_LOG_DEBUG(logger) << "test macro";
     LINKO_LOG_FMT_DEBUG(logger, "test format debug %s", "dddd");
 
+    linko::AsyncLogAppender::ptr async_appender(new linko::AsyncLogAppender("./async_log.txt"
+                , 1024, linko::AsyncLogAppender::DROP));
+    logger->addAppender(async_appender);
+    for (int i = 0; i < 10000; ++i) {
+        LINKO_LOG_INFO(logger) << "test async " << i;
+    }
+    async_appender->flush();
+    std::cout << "async dropped=" << async_appender->getDropped() << std::endl;
+    logger->delAppender(async_appender);
+
+    // 二进制日志, 用 bin/linko_logcat ./log.bin 查看
+    linko::BinaryLogAppender::ptr bin_appender(new linko::BinaryLogAppender("./log.bin"));
+    logger->addAppender(bin_appender);
+    LINKO_LOG_BIN_INFO(logger, "test binary int=%d uint=%u double=%.3f str=%s hex=%#x"
+            , -42, 42u, 3.14159, "hello", 255);
+    LINKO_LOG_BIN_WARN(logger, "test binary no args");
+    LINKO_LOG_INFO(logger) << "test binary stream";
+    bin_appender->flush();
+    logger->delAppender(bin_appender);
+
+    // 限流日志, 被抑制的条数会在下一条输出的日志前注明
+    for (int i = 0; i < 1000; ++i) {
+        LINKO_LOG_EVERY_N(logger, linko::LogLevel::INFO, 300) << "every 300 i=" << i;
+        LINKO_LOG_EVERY_MS(logger, linko::LogLevel::INFO, 20) << "every 20ms i=" << i;
+        LINKO_LOG_RATE_LIMITED(logger, linko::LogLevel::INFO, 50, 3) << "rate 50/s i=" << i;
+        usleep(100);
+    }
+
     auto l = linko::LoggerMgr::GetInstance()->getLogger("xxx");
     l->addAppender(linko::LogAppender::ptr(new linko::StdoutLogAppender));
     LINKO_LOG_DEBUG(l) << "ttt";
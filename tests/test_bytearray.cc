@@ -1,5 +1,6 @@
 #include "../linko/bytearray.h"
 #include "../linko/links.h"
+#include <limits>
 
 static linko::Logger::ptr g_logger = LINKO_LOG_ROOT();
 
@@ -86,7 +87,229 @@ void test() {
 #undef XX
 }
 
+// 随机定位读写, 块大小不是写入单位的整数倍, 覆盖跨块读写
+void test_seek() {
+    const size_t count = 256 * 1024;
+    linko::ByteArray::ptr ba(new linko::ByteArray(1000));
+    for (size_t i = 0; i < count; ++i) {
+        ba->writeFuint32(i);
+    }
+    uint64_t start = linko::GetCurrentUS();
+    for (size_t i = 0; i < count; ++i) {
+        size_t idx = std::rand() % count;
+        ba->setPosition(idx * 4);
+        LINKO_ASSERT(ba->readFuint32() == idx);
+    }
+    uint64_t used = linko::GetCurrentUS() - start;
+
+    std::vector<iovec> iovs;
+    ba->setPosition(4 * 1000);
+    LINKO_ASSERT(ba->getReadBuffers(iovs, 3000) == 3000);
+    LINKO_ASSERT(iovs.size() == 3 && iovs[0].iov_len == 1000);
+    LINKO_LOG_INFO(g_logger) << "random seek+read count=" << count
+        << " size=" << ba->getSize() << " used=" << used << "us";
+}
+
+// 批量接口与逐个接口的结果必须逐字节一致, 并比较两者吞吐
+void test_bulk() {
+#define XX(type, write_fun, read_fun, write_arr, read_arr, gen) { \
+    const size_t count = 1000000; \
+    std::vector<type> vec(count); \
+    for (size_t i = 0; i < count; ++i) { \
+        vec[i] = (type)(gen); \
+    } \
+    vec[0] = 0; \
+    vec[1] = std::numeric_limits<type>::max(); \
+    vec[2] = std::numeric_limits<type>::min(); \
+    linko::ByteArray::ptr ba(new linko::ByteArray(4096)); \
+    uint64_t t0 = linko::GetCurrentUS(); \
+    for (auto& i : vec) { \
+        ba->write_fun(i); \
+    } \
+    uint64_t t1 = linko::GetCurrentUS(); \
+    linko::ByteArray::ptr bulk(new linko::ByteArray(4096)); \
+    bulk->write_arr(&vec[0], count); \
+    uint64_t t2 = linko::GetCurrentUS(); \
+    ba->setPosition(0); \
+    bulk->setPosition(0); \
+    LINKO_ASSERT(ba->toString() == bulk->toString()); \
+    uint64_t t3 = linko::GetCurrentUS(); \
+    for (size_t i = 0; i < count; ++i) { \
+        LINKO_ASSERT(ba->read_fun() == vec[i]); \
+    } \
+    uint64_t t4 = linko::GetCurrentUS(); \
+    std::vector<type> out(count); \
+    bulk->read_arr(&out[0], count); \
+    uint64_t t5 = linko::GetCurrentUS(); \
+    LINKO_ASSERT(out == vec); \
+    LINKO_ASSERT(bulk->getReadSize() == 0); \
+    LINKO_LOG_INFO(g_logger) << #write_arr "/" #read_arr " count=" << count \
+        << " size=" << bulk->getSize() \
+        << " write: single=" << (t1 - t0) << "us bulk=" << (t2 - t1) << "us" \
+        << " read: single=" << (t4 - t3) << "us bulk=" << (t5 - t4) << "us"; \
+}
+
+    XX(uint32_t, writeUint32, readUint32, writeUint32Array, readUint32Array
+        , (uint32_t)std::rand() >> (std::rand() % 32));
+    XX(int32_t, writeInt32, readInt32, writeInt32Array, readInt32Array
+        , (int32_t)(std::rand() - RAND_MAX / 2) >> (std::rand() % 32));
+    XX(uint64_t, writeUint64, readUint64, writeUint64Array, readUint64Array
+        , (((uint64_t)std::rand() << 33) ^ ((uint64_t)std::rand() << 2)) >> (std::rand() % 64));
+    XX(int64_t, writeInt64, readInt64, writeInt64Array, readInt64Array
+        , (int64_t)(((uint64_t)std::rand() << 33) ^ std::rand()) >> (std::rand() % 64));
+    XX(uint32_t, writeFuint32, readFuint32, writeFuint32Array, readFuint32Array
+        , std::rand());
+    XX(int64_t, writeFint64, readFint64, writeFint64Array, readFint64Array
+        , ((int64_t)std::rand() << 32) | std::rand());
+#undef XX
+
+    // 覆盖写不能破坏之后的数据
+    linko::ByteArray::ptr ba(new linko::ByteArray(64));
+    std::vector<uint64_t> vals(100, ~0ull);
+    ba->writeUint64Array(&vals[0], vals.size());
+    size_t size = ba->getSize();
+    ba->setPosition(0);
+    uint64_t small[3] = {1, 2, 3};
+    ba->writeUint64Array(small, 3);
+    ba->setPosition(0);
+    uint64_t check[3];
+    ba->readUint64Array(check, 3);
+    LINKO_ASSERT(check[0] == 1 && check[1] == 2 && check[2] == 3);
+    ba->setPosition(30);
+    LINKO_ASSERT(ba->readUint64() == ~0ull);
+    LINKO_ASSERT(ba->getSize() == size);
+}
+
+void test_slice() {
+    linko::ByteArray::ptr src(new linko::ByteArray(16));
+    std::string body;
+    for (int i = 0; i < 100; ++i) {
+        body.append(1, 'a' + i % 26);
+    }
+    src->writeStringWithoutLength(body);
+
+    bool released = false;
+    static const char s_ext[] = "-external-";
+    {
+        linko::ByteArray cord(16);
+        cord.writeStringWithoutLength("header:");
+        cord.appendSlice(*src, 50, 10);
+        cord.appendExternal(s_ext, sizeof(s_ext) - 1, [&released]() {
+            released = true;
+        });
+        cord.writeStringWithoutLength(":trailer");
+        LINKO_ASSERT(cord.isCord());
+
+        cord.setPosition(0);
+        std::string expect = "header:" + body.substr(10, 50) + s_ext + ":trailer";
+        LINKO_ASSERT(cord.toString() == expect);
+
+        // 切片部分的iovec直接指向src的块
+        std::vector<iovec> src_iovs;
+        src->getReadBuffers(src_iovs, 50, 10);
+        std::vector<iovec> iovs;
+        cord.getReadBuffers(iovs, 50, 7);
+        LINKO_ASSERT(iovs.size() == src_iovs.size());
+        for (size_t i = 0; i < iovs.size(); ++i) {
+            LINKO_ASSERT(iovs[i].iov_base == src_iovs[i].iov_base);
+        }
+        iovs.clear();
+        cord.getReadBuffers(iovs, sizeof(s_ext) - 1, 57);
+        LINKO_ASSERT(iovs.size() == 1 && iovs[0].iov_base == s_ext);
+
+        // 写时复制, 修改src不影响cord
+        src->setPosition(20);
+        src->writeStringWithoutLength("XXXX");
+        cord.setPosition(0);
+        LINKO_ASSERT(cord.toString() == expect);
+
+        // 覆盖cord中的共享部分也不影响src
+        cord.setPosition(7);
+        cord.writeStringWithoutLength("YYYY");
+        char check[4];
+        src->read(check, 4, 10);
+        LINKO_ASSERT(std::string(check, 4) == body.substr(10, 4));
+        LINKO_ASSERT(!released);
+    }
+    LINKO_ASSERT(released);
+    LINKO_LOG_INFO(LINKO_LOG_ROOT()) << "test_slice ok";
+}
+
+void test_mmap() {
+    const std::string name = "/tmp/test_bytearray_mmap.dat";
+    linko::ByteArray::ptr src(new linko::ByteArray(1024));
+    for (uint32_t i = 0; i < 100000; ++i) {
+        src->writeFuint32(i);
+    }
+    src->setPosition(0);
+    LINKO_ASSERT(src->writeToFile(name));
+
+    {
+        linko::ByteArray ro(name, linko::ByteArray::READ_ONLY);
+        LINKO_ASSERT(ro.getMapMode() == linko::ByteArray::READ_ONLY);
+        LINKO_ASSERT(ro.getSize() == src->getSize());
+        ro.advise(linko::ByteArray::ADVICE_SEQUENTIAL);
+        ro.advise(linko::ByteArray::ADVICE_WILLNEED, 4000, 10000);
+        std::vector<iovec> iovs;
+        ro.getReadBuffers(iovs);
+        LINKO_ASSERT(iovs.size() == 1);
+        for (uint32_t i = 0; i < 100000; ++i) {
+            LINKO_ASSERT(ro.readFuint32() == i);
+        }
+
+        // 只读映射写入时复制, 文件不变, 可以追加到映射之后
+        ro.setPosition(0);
+        ro.writeFuint32(0xffffffff);
+        // 只复制写入所在的一块, 其余部分仍引用映射
+        iovs.clear();
+        ro.setPosition(0);
+        ro.getReadBuffers(iovs);
+        LINKO_ASSERT(iovs.size() == 2);
+        LINKO_ASSERT(iovs[0].iov_len == 4096);
+        ro.setPosition(200000);
+        ro.writeFuint32(0xfffffffe);
+        ro.setPosition(200000);
+        LINKO_ASSERT(ro.readFuint32() == 0xfffffffe);
+        LINKO_ASSERT(ro.readFuint32() == 50001);
+        ro.setPosition(199996);
+        LINKO_ASSERT(ro.readFuint32() == 49999);
+        ro.setPosition(ro.getSize());
+        ro.writeFuint32(100000);
+        LINKO_ASSERT(ro.getSize() == src->getSize() + 4);
+    }
+
+    {
+        linko::ByteArray rw(name, linko::ByteArray::READ_WRITE);
+        LINKO_ASSERT(rw.getMapMode() == linko::ByteArray::READ_WRITE);
+        LINKO_ASSERT(rw.readFuint32() == 0);
+        rw.setPosition(0);
+        rw.writeFuint32(0xffffffff);
+        LINKO_ASSERT(rw.sync());
+        rw.setPosition(rw.getSize());
+        bool failed = false;
+        try {
+            rw.writeFuint8(0);
+        } catch (std::out_of_range& e) {
+            failed = true;
+        }
+        LINKO_ASSERT(failed);
+    }
+
+    linko::ByteArray check;
+    LINKO_ASSERT(check.readFromFile(name));
+    check.setPosition(0);
+    LINKO_ASSERT(check.getSize() == src->getSize());
+    LINKO_ASSERT(check.readFuint32() == 0xffffffff);
+    LINKO_ASSERT(check.readFuint32() == 1);
+    unlink(name.c_str());
+    LINKO_LOG_INFO(LINKO_LOG_ROOT()) << "test_mmap ok";
+}
+
 int main(int argc, char** argv) {
     test();
+    test_seek();
+    test_bulk();
+    test_slice();
+    test_mmap();
     return 0;
 }
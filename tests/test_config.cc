@@ -1,5 +1,7 @@
 #include "../linko/config.h"
 #include "../linko/log.h"
+#include "../linko/util.h"
+#include "../linko/macro.h"
 #include <yaml-cpp/yaml.h>
 
 #include <iostream>
@@ -201,10 +203,59 @@ void test_log() {
     LINKO_LOG_INFO(system_log) << "hello system" << std::endl;
 }
 
+// 多线程读取与修改配置, 对比拷贝读取和快照读取的开销
+void test_snapshot() {
+    static const int THREADS = 4;
+    static const int LOOPS = 1000000;
+    std::vector<int> big(100, 1);
+    g_int_vec_value_config->setValue(big);
+
+    std::atomic<bool> stop{false};
+    std::vector<linko::Thread::ptr> thrs;
+    for (int i = 0; i < THREADS; ++i) {
+        thrs.push_back(linko::Thread::ptr(new linko::Thread([&stop]() {
+            uint64_t start = linko::GetCurrentUS();
+            int64_t sum = 0;
+            for (int j = 0; j < LOOPS; ++j) {
+                sum += g_int_vec_value_config->getValue().size();
+            }
+            uint64_t copy_us = linko::GetCurrentUS() - start;
+
+            start = linko::GetCurrentUS();
+            for (int j = 0; j < LOOPS; ++j) {
+                auto v = g_int_vec_value_config->getSnapshot();
+                // 快照不会被并发修改, 所有元素必须一致
+                LINKO_ASSERT(v->front() == v->back());
+                sum += v->size();
+            }
+            uint64_t snapshot_us = linko::GetCurrentUS() - start;
+
+            start = linko::GetCurrentUS();
+            for (int j = 0; j < LOOPS; ++j) {
+                sum += g_int_value_config->getValue();
+            }
+            uint64_t scalar_us = linko::GetCurrentUS() - start;
+
+            LINKO_LOG_INFO(LINKO_LOG_ROOT()) << "vector copy=" << copy_us * 1000.0 / LOOPS
+                << "ns snapshot=" << snapshot_us * 1000.0 / LOOPS
+                << "ns int=" << scalar_us * 1000.0 / LOOPS << "ns sum=" << sum;
+        }, "reader_" + std::to_string(i))));
+    }
+
+    for (int i = 2; i < 50; ++i) {
+        g_int_vec_value_config->setValue(std::vector<int>(100, i));
+        usleep(1000);
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+}
+
 int main(int argc, char** argv) {
     //test_yaml();
     //test_config();
     //test_class();
+    test_snapshot();
     test_log();
 
     linko::Config::Visit([](linko::ConfigVarBase::ptr var) {
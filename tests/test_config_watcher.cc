@@ -0,0 +1,60 @@
+#include "../linko/config_watcher.h"
+#include "../linko/links.h"
+#include <fstream>
+
+/*
+ * 改写被监听的配置文件, 检查合法配置整体生效, 非法配置整体不生效
+ * 用法: test_config_watcher [文件路径]
+ */
+
+static linko::Logger::ptr g_logger = LINKO_LOG_ROOT();
+
+static linko::ConfigVar<int>::ptr g_port =
+    linko::Config::Lookup("watch_test.port", 8080, "port");
+static linko::ConfigVar<int>::ptr g_timeout =
+    linko::Config::Lookup("watch_test.timeout", 1000, "timeout ms");
+
+static void write_file(const std::string& path, int port, int timeout) {
+    std::ofstream ofs(path, std::ios::trunc);
+    ofs << "watch_test:\n  port: " << port << "\n  timeout: " << timeout << "\n";
+}
+
+static void run(const std::string& path) {
+    g_timeout->setValidator([](const int& v) {
+        return v > 0;
+    });
+    //监听者触发时同一文件中的其他配置已经提交
+    g_port->addListener([](const int& old_value, const int& new_value) {
+        LINKO_LOG_INFO(g_logger) << "port " << old_value << " -> " << new_value
+            << " timeout=" << g_timeout->getValue();
+    });
+
+    write_file(path, 8080, 1000);
+    linko::ConfigWatcher::ptr watcher(new linko::ConfigWatcher);
+    watcher->start();
+    watcher->addFile(path);
+
+    write_file(path, 9090, 3000);
+    usleep(500 * 1000);
+    LINKO_LOG_INFO(g_logger) << "valid reload port=" << g_port->getValue()
+        << " timeout=" << g_timeout->getValue();
+
+    write_file(path, 7070, -1);
+    usleep(500 * 1000);
+    LINKO_LOG_INFO(g_logger) << "invalid reload port=" << g_port->getValue()
+        << " timeout=" << g_timeout->getValue();
+
+    linko::ConfigWatcher::Stats s = watcher->getStats();
+    LINKO_LOG_INFO(g_logger) << "reloads=" << s.reloads << " failures=" << s.failures
+        << " last_latency=" << s.last_latency_us << "us max_latency=" << s.max_latency_us
+        << "us last_load=" << s.last_load_us << "us";
+    watcher->stop();
+    unlink(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    std::string path = argc > 1 ? argv[1] : "/tmp/test_config_watcher.yml";
+    linko::IOManager iom(1);
+    iom.schedule(std::bind(run, path));
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include "../linko/fiber_sync.h"
+#include "../linko/iomanager.h"
+#include "../linko/links.h"
+
+/*
+ * 协程同步原语正确性检查, 以及与线程锁的竞争性能对比
+ * 用法: test_fiber_sync [循环次数]
+ */
+
+static linko::Logger::ptr g_logger = LINKO_LOG_ROOT();
+
+static const int THREADS = 4;
+static const int FIBERS = 64;
+
+// yield_inside为true时持锁期间让出协程, 线程锁在这种情况下会死锁, 只对协程锁测试
+template<class MutexType>
+static void bench_mutex(const char* name, int loops, bool yield_inside) {
+    MutexType mutex;
+    int64_t counter = 0;
+    uint64_t start = linko::GetCurrentUS();
+    {
+        linko::IOManager iom(THREADS, false, "bench");
+        for (int i = 0; i < FIBERS; ++i) {
+            iom.schedule([&mutex, &counter, loops, yield_inside]() {
+                for (int j = 0; j < loops; ++j) {
+                    typename MutexType::Lock lock(mutex);
+                    ++counter;
+                    if (yield_inside && j % 64 == 0) {
+                        linko::Fiber::YieldToReady();
+                    }
+                }
+            });
+        }
+    }
+    uint64_t used = linko::GetCurrentUS() - start;
+    LINKO_ASSERT(counter == (int64_t)FIBERS * loops);
+    LINKO_LOG_INFO(g_logger) << name << (yield_inside ? " yield" : "") << " ops=" << counter
+        << " ns/op=" << used * 1000.0 / counter;
+}
+
+// 90%读10%写
+template<class RWMutexType>
+static void bench_rwmutex(const char* name, int loops) {
+    RWMutexType mutex;
+    int64_t counter = 0;
+    std::atomic<int64_t> reads{0};
+    uint64_t start = linko::GetCurrentUS();
+    {
+        linko::IOManager iom(THREADS, false, "bench");
+        for (int i = 0; i < FIBERS; ++i) {
+            iom.schedule([&mutex, &counter, &reads, loops]() {
+                int64_t sum = 0;
+                for (int j = 0; j < loops; ++j) {
+                    if (j % 10 == 0) {
+                        typename RWMutexType::WriteLock lock(mutex);
+                        ++counter;
+                    } else {
+                        typename RWMutexType::ReadLock lock(mutex);
+                        sum += counter;
+                    }
+                }
+                reads += sum > 0;
+            });
+        }
+    }
+    uint64_t used = linko::GetCurrentUS() - start;
+    LINKO_ASSERT(counter == (int64_t)FIBERS * ((loops + 9) / 10));
+    LINKO_LOG_INFO(g_logger) << name << " ops=" << (int64_t)FIBERS * loops
+        << " ns/op=" << used * 1000.0 / ((int64_t)FIBERS * loops);
+}
+
+// 两个协程通过信号量交替执行
+static void bench_fiber_semaphore(int loops) {
+    linko::FiberSemaphore ping;
+    linko::FiberSemaphore pong;
+    uint64_t start = linko::GetCurrentUS();
+    {
+        linko::IOManager iom(2, false, "bench");
+        iom.schedule([&ping, &pong, loops]() {
+            for (int i = 0; i < loops; ++i) {
+                ping.notify();
+                pong.wait();
+            }
+        });
+        iom.schedule([&ping, &pong, loops]() {
+            for (int i = 0; i < loops; ++i) {
+                ping.wait();
+                pong.notify();
+            }
+        });
+    }
+    uint64_t used = linko::GetCurrentUS() - start;
+    LINKO_LOG_INFO(g_logger) << "FiberSemaphore ping-pong loops=" << loops
+        << " ns/round=" << used * 1000.0 / loops;
+}
+
+static void bench_thread_semaphore(int loops) {
+    linko::Semaphore ping;
+    linko::Semaphore pong;
+    uint64_t start = linko::GetCurrentUS();
+    {
+        linko::Thread t1([&ping, &pong, loops]() {
+            for (int i = 0; i < loops; ++i) {
+                ping.notify();
+                pong.wait();
+            }
+        }, "ping");
+        linko::Thread t2([&ping, &pong, loops]() {
+            for (int i = 0; i < loops; ++i) {
+                ping.wait();
+                pong.notify();
+            }
+        }, "pong");
+        t1.join();
+        t2.join();
+    }
+    uint64_t used = linko::GetCurrentUS() - start;
+    LINKO_LOG_INFO(g_logger) << "Semaphore ping-pong loops=" << loops
+        << " ns/round=" << used * 1000.0 / loops;
+}
+
+// 多生产者多消费者, 最后一个生产者关闭通道
+static void test_channel(int loops) {
+    linko::Channel<int64_t> chan(16);
+    std::atomic<int> producers{THREADS};
+    std::atomic<int64_t> sum{0};
+    std::atomic<int64_t> count{0};
+    uint64_t start = linko::GetCurrentUS();
+    {
+        linko::IOManager iom(THREADS, false, "bench");
+        for (int i = 0; i < THREADS; ++i) {
+            iom.schedule([&chan, &producers, loops]() {
+                for (int j = 1; j <= loops; ++j) {
+                    LINKO_ASSERT(chan.push(j));
+                }
+                if (--producers == 0) {
+                    chan.close();
+                }
+            });
+            iom.schedule([&chan, &sum, &count]() {
+                int64_t v = 0;
+                while (chan.pop(v)) {
+                    sum += v;
+                    ++count;
+                }
+            });
+        }
+    }
+    uint64_t used = linko::GetCurrentUS() - start;
+    LINKO_ASSERT(count == (int64_t)THREADS * loops);
+    LINKO_ASSERT(sum == (int64_t)THREADS * loops * (loops + 1) / 2);
+    LINKO_LOG_INFO(g_logger) << "Channel items=" << count << " ns/item=" << used * 1000.0 / count;
+}
+
+int main(int argc, char** argv) {
+    int loops = argc > 1 ? atoi(argv[1]) : 10000;
+    g_logger->setLevel(linko::LogLevel::INFO);
+    LINKO_LOG_NAME("system")->setLevel(linko::LogLevel::WARN);
+
+    bench_mutex<linko::Mutex>("Mutex", loops, false);
+    bench_mutex<linko::SpinLock>("SpinLock", loops, false);
+    bench_mutex<linko::FiberMutex>("FiberMutex", loops, false);
+    bench_mutex<linko::FiberMutex>("FiberMutex", loops, true);
+
+    bench_rwmutex<linko::RWMutex>("RWMutex", loops);
+    bench_rwmutex<linko::FiberRWMutex>("FiberRWMutex", loops);
+
+    bench_thread_semaphore(loops * 10);
+    bench_fiber_semaphore(loops * 10);
+
+    test_channel(loops * 10);
+    return 0;
+}
@@ -1,6 +1,10 @@
 #include "../linko/hook.h"
 #include "../linko/log.h"
 #include "../linko/iomanager.h"
+#include "../linko/fd_manager.h"
+#include "../linko/cancel.h"
+#include "../linko/util.h"
+#include "../linko/macro.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -64,10 +68,155 @@ void test_sock() {
     LINKO_LOG_INFO(g_logger) << buff;
 }
 
+// 创建由hook管理的socketpair, 并设置接收超时以走定时器路径
+static bool make_pair(int fds[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        LINKO_LOG_ERROR(g_logger) << "socketpair errno=" << errno;
+        return false;
+    }
+    timeval tv{5, 0};
+    for (int i = 0; i < 2; ++i) {
+        linko::FdMgr::GetInstance()->get(fds[i], true);
+        setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return true;
+}
+
+/*
+ * hook后recv的耗时
+ * ready: 数据已到达, recv直接返回
+ * block: 两个协程乒乓收发, 每次recv都要挂起等待对方
+ */
+void test_recv_bench(int count) {
+    int fds[2];
+    if (!make_pair(fds)) {
+        return;
+    }
+
+    char buf[4096] = {0};
+    uint64_t used = 0;
+    for (int i = 0; i < count; i += sizeof(buf)) {
+        int n = std::min<int>(sizeof(buf), count - i);
+        send(fds[1], buf, n, 0);
+        uint64_t start = linko::GetCurrentUS();
+        for (int j = 0; j < n; ++j) {
+            recv(fds[0], buf, 1, 0);
+        }
+        used += linko::GetCurrentUS() - start;
+    }
+    LINKO_LOG_INFO(g_logger) << "recv ready count=" << count
+        << " ns/op=" << used * 1000.0 / count;
+
+    uint64_t start = linko::GetCurrentUS();
+    linko::IOManager::GetThis()->schedule([fds, count]() {
+        char c = 0;
+        for (int i = 0; i < count; ++i) {
+            recv(fds[0], &c, 1, 0);
+            send(fds[0], &c, 1, 0);
+        }
+    });
+    char c = 0;
+    for (int i = 0; i < count; ++i) {
+        send(fds[1], &c, 1, 0);
+        recv(fds[1], &c, 1, 0);
+    }
+    used = linko::GetCurrentUS() - start;
+    // 每轮两个协程各阻塞一次recv
+    LINKO_LOG_INFO(g_logger) << "recv block count=" << count
+        << " ns/op=" << used * 1000.0 / count / 2;
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 管道/eventfd/poll与文件读写都不应阻塞工作线程
+void test_pipe_poll() {
+    int fds[2];
+    LINKO_ASSERT(pipe(fds) == 0);
+    int efd = eventfd(0, 0);
+    LINKO_ASSERT(efd >= 0);
+
+    linko::IOManager::GetThis()->schedule([fds, efd]() {
+        sleep(1);
+        write(fds[1], "ping", 4);
+        uint64_t v = 1;
+        write(efd, &v, sizeof(v));
+    });
+
+    char buf[16];
+    ssize_t n = read(fds[0], buf, sizeof(buf));
+    LINKO_LOG_INFO(g_logger) << "pipe read n=" << n;
+
+    struct pollfd p;
+    p.fd = efd;
+    p.events = POLLIN;
+    p.revents = 0;
+    int rt = poll(&p, 1, 3000);
+    LINKO_LOG_INFO(g_logger) << "poll eventfd rt=" << rt << " revents=" << p.revents;
+
+    p.fd = fds[0];
+    uint64_t start = linko::GetCurrentMS();
+    rt = poll(&p, 1, 100);
+    LINKO_LOG_INFO(g_logger) << "poll timeout rt=" << rt << " used=" << linko::GetCurrentMS() - start << "ms";
+
+    int fd = open("/proc/self/status", O_RDONLY);
+    n = read(fd, buf, sizeof(buf));
+    LINKO_LOG_INFO(g_logger) << "file read n=" << n;
+    close(fd);
+
+    close(fds[0]);
+    close(fds[1]);
+    close(efd);
+}
+
+// 截止时间对当前协程和其派生的协程都生效, 取消会唤醒正在等待的操作
+void test_deadline() {
+    int fds[2];
+    int child_fds[2];
+    LINKO_ASSERT(pipe(fds) == 0);
+    LINKO_ASSERT(pipe(child_fds) == 0);
+    char buf[16];
+
+    linko::CancelScope scope(200);
+    linko::IOManager::GetThis()->schedule([child_fds]() {
+        char c;
+        uint64_t start = linko::GetCurrentMS();
+        ssize_t n = read(child_fds[0], &c, 1);
+        LINKO_LOG_INFO(g_logger) << "child read n=" << n << " errno=" << strerror(errno)
+            << " used=" << linko::GetCurrentMS() - start << "ms";
+        close(child_fds[0]);
+        close(child_fds[1]);
+    });
+
+    {
+        linko::CancelScope inner;
+        linko::CancelToken::ptr token = inner.getToken();
+        linko::IOManager::GetThis()->schedule([token]() {
+            usleep(50 * 1000);
+            token->cancel();
+        });
+        uint64_t start = linko::GetCurrentMS();
+        ssize_t n = read(fds[0], buf, sizeof(buf));
+        LINKO_LOG_INFO(g_logger) << "cancel read n=" << n << " errno=" << strerror(errno)
+            << " used=" << linko::GetCurrentMS() - start << "ms";
+    }
+
+    uint64_t start = linko::GetCurrentMS();
+    int rt = usleep(1000 * 1000);
+    LINKO_LOG_INFO(g_logger) << "deadline usleep rt=" << rt << " errno=" << strerror(errno)
+        << " used=" << linko::GetCurrentMS() - start << "ms";
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
 int main(int argc, char** argv) {
     //test_sleep();
     //test_sock();
-    linko::IOManager iom;
-    iom.schedule(test_sock);
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    linko::IOManager iom(1);
+    iom.schedule(test_pipe_poll);
+    iom.schedule(test_deadline);
+    iom.schedule(std::bind(test_recv_bench, count));
     return 0;
 }
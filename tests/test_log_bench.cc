@@ -0,0 +1,89 @@
+#include "../linko/links.h"
+#include <iostream>
+#include <unistd.h>
+
+/*
+ * 日志吞吐基准测试, 统计每个线程每秒输出的日志条数
+ * 用法: test_log_bench [线程数] [每线程日志条数] > /dev/null
+ * 结果输出到stderr, stdout留给StdoutLogAppender
+ */
+
+// 只格式化不输出, 用于衡量日志框架本身的开销
+class NullLogAppender : public linko::LogAppender {
+public:
+    void log(linko::Logger::ptr logger, linko::LogLevel::Level level
+            , linko::LogEvent::ptr event) override {
+        if (level >= m_level) {
+            m_buf.clear();
+            m_formatter->format(m_buf, logger, level, event);
+        }
+    }
+
+    std::string toYamlString() override { return "type: NullLogAppender"; }
+private:
+    static thread_local std::string m_buf;
+};
+
+thread_local std::string NullLogAppender::m_buf;
+
+// deferred: 使用LINKO_LOG_BIN_*只记录参数, 不在调用线程格式化
+void bench(const std::string& name, linko::LogAppender::ptr appender
+        , int threads, int count, bool deferred = false) {
+    linko::Logger::ptr logger(new linko::Logger("bench_" + name));
+    logger->addAppender(appender);
+
+    linko::Mutex mutex;
+    std::vector<double> rates;
+    std::vector<linko::Thread::ptr> thrs;
+    uint64_t begin = linko::GetCurrentUS();
+    for (int i = 0; i < threads; ++i) {
+        thrs.push_back(linko::Thread::ptr(new linko::Thread([&]() {
+            uint64_t start = linko::GetCurrentUS();
+            for (int j = 0; j < count; ++j) {
+                if (deferred) {
+                    LINKO_LOG_BIN_INFO(logger, "bench log message seq=%d value=%g name=%s"
+                            , j, 3.14159, name);
+                } else {
+                    LINKO_LOG_INFO(logger) << "bench log message seq=" << j
+                        << " value=" << 3.14159 << " name=" << name;
+                }
+            }
+            uint64_t used = linko::GetCurrentUS() - start;
+            linko::Mutex::Lock lock(mutex);
+            rates.push_back(count * 1000000.0 / (used ? used : 1));
+        }, name + "_" + std::to_string(i))));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = linko::GetCurrentUS() - begin;
+
+    double sum = 0;
+    for (auto& i : rates) {
+        sum += i;
+    }
+    std::cerr << name << ": threads=" << threads
+              << " events/thread=" << count
+              << " avg events/sec/thread=" << (uint64_t)(sum / rates.size())
+              << " total events/sec=" << (uint64_t)(threads * (double)count * 1000000.0 / (used ? used : 1))
+              << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int count = argc > 2 ? atoi(argv[2]) : 100000;
+
+    bench("null", linko::LogAppender::ptr(new NullLogAppender), threads, count);
+    bench("stdout", linko::LogAppender::ptr(new linko::StdoutLogAppender), threads, count);
+    bench("file", linko::LogAppender::ptr(new linko::FileLogAppender("./log_bench.txt")), threads, count);
+    {
+        linko::AsyncLogAppender::ptr async(new linko::AsyncLogAppender("./log_bench_async.txt"));
+        bench("async_file", async, threads, count);
+        async->flush();
+    }
+    bench("binary_file", linko::LogAppender::ptr(new linko::BinaryLogAppender("./log_bench.bin")), threads, count, true);
+    unlink("./log_bench.txt");
+    unlink("./log_bench_async.txt");
+    unlink("./log_bench.bin");
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "../linko/links.h"
+#include "../linko/iomanager.h"
+#include "../linko/http/http_server.h"
+#include "../linko/http/http_connection.h"
+#include <signal.h>
+
+/*
+ * 多线程累加计数器与直方图的耗时, 以及/metrics, /admin/traces, /admin/fibers页面的输出
+ * 用法: test_metrics [每个线程的次数]
+ */
+
+static linko::Logger::ptr g_logger = LINKO_LOG_ROOT();
+
+void test_bench(int count) {
+    linko::Counter::ptr counter = linko::Metrics::AddCounter("test_counter_total", "test counter");
+    linko::Histogram::ptr hist = linko::Metrics::AddHistogram("test_latency_seconds", "test histogram");
+
+    std::vector<linko::Thread::ptr> thrs;
+    uint64_t start = linko::GetCurrentUS();
+    for (int i = 0; i < 4; ++i) {
+        thrs.push_back(std::make_shared<linko::Thread>([counter, hist, count]() {
+            for (int j = 0; j < count; ++j) {
+                counter->inc();
+                hist->observe(j % 10000);
+            }
+        }, "metrics_" + std::to_string(i)));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = linko::GetCurrentUS() - start;
+    LINKO_LOG_INFO(g_logger) << "counter=" << counter->value() << " hist count=" << hist->count()
+        << " p50=" << hist->percentile(0.5) << "us p99=" << hist->percentile(0.99) << "us"
+        << " ns/op=" << used * 1000.0 / count / 4 / 2;
+}
+
+void test_servlet() {
+    // 管理页面默认不注册, 需要在创建HttpServer前配置路径
+    linko::Config::Lookup<std::string>("http_server.trace_path")->setValue("/admin/traces");
+    linko::Config::Lookup<std::string>("http_server.fiber_path")->setValue("/admin/fibers");
+    linko::http::HttpServer::ptr server(new linko::http::HttpServer);
+    linko::Address::ptr addr = linko::Address::LookupAnyIPAddress("127.0.0.1:8021");
+    if (!server->bind(addr)) {
+        return;
+    }
+    server->start();
+    linko::Config::Lookup<uint32_t>("http_server.trace.sample")->setValue(1);
+    linko::Config::Lookup<bool>("fiber.backtrace_on_hold")->setValue(true);
+
+    // 挂起在管道上的协程, 在/admin/fibers中可以看到等待的fd和调用栈
+    int fds[2];
+    pipe(fds);
+    linko::IOManager::GetThis()->schedule([fds]() {
+        char c;
+        read(fds[0], &c, 1);
+    });
+
+    const char* paths[] = {"/metrics", "/not_found", "/admin/traces", "/admin/fibers"};
+    for (auto path : paths) {
+        // 等上一个请求的记录写入
+        usleep(10 * 1000);
+        auto r = linko::http::HttpConnection::DoGet(std::string("http://127.0.0.1:8021") + path, 1000
+                , {{"X-Request-Id", path}});
+        if (r->response) {
+            std::cout << r->response->getBody() << std::endl;
+        } else {
+            LINKO_LOG_ERROR(g_logger) << "get " << path << " fail: " << r->toString();
+        }
+    }
+    // 信号触发时协程列表输出到system日志
+    linko::Config::Lookup<int>("fiber.dump_signal")->setValue(SIGUSR2);
+    raise(SIGUSR2);
+    usleep(10 * 1000);
+
+    write(fds[1], "x", 1);
+    server->stop();
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    test_bench(count);
+    linko::IOManager iom(1, true, "main");
+    iom.schedule(test_servlet);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "../linko/offload.h"
+#include "../linko/links.h"
+#include <zlib.h>
+
+/*
+ * 单个IO线程上同时运行心跳协程和压缩任务, 对比直接执行与offload时心跳的延迟
+ * 用法: test_offload [任务数]
+ */
+
+static linko::Logger::ptr g_logger = LINKO_LOG_ROOT();
+
+static std::string s_data;
+
+static void compress_once() {
+    uLongf len = compressBound(s_data.size());
+    std::string out(len, '\0');
+    compress2((Bytef*)&out[0], &len, (const Bytef*)s_data.data(), s_data.size(), 9);
+}
+
+static void run(int tasks, bool use_offload) {
+    bool stop = false;
+    uint64_t max_delay = 0;
+    linko::IOManager::GetThis()->schedule([&stop, &max_delay]() {
+        while (!stop) {
+            uint64_t start = linko::GetCurrentMS();
+            usleep(10 * 1000);
+            max_delay = std::max(max_delay, linko::GetCurrentMS() - start - 10);
+        }
+    });
+
+    uint64_t start = linko::GetCurrentMS();
+    std::atomic<int> done{0};
+    for (int i = 0; i < tasks; ++i) {
+        linko::IOManager::GetThis()->schedule([use_offload, &done]() {
+            if (use_offload) {
+                linko::offload(compress_once);
+            } else {
+                compress_once();
+            }
+            ++done;
+        });
+    }
+    while (done < tasks) {
+        usleep(1000);
+    }
+    stop = true;
+    usleep(20 * 1000);
+    LINKO_LOG_INFO(g_logger) << (use_offload ? "offload" : "inline") << " tasks=" << tasks
+        << " used=" << linko::GetCurrentMS() - start << "ms heartbeat max_delay=" << max_delay << "ms";
+}
+
+int main(int argc, char** argv) {
+    int tasks = argc > 1 ? atoi(argv[1]) : 32;
+    for (int i = 0; i < (1 << 20); ++i) {
+        s_data.push_back("linko offload "[i % 14] + (i >> 12) % 7);
+    }
+
+    linko::IOManager iom(1);
+    iom.schedule([tasks]() {
+        run(tasks, false);
+        run(tasks, true);
+
+        // 异常在调用协程中重新抛出
+        try {
+            linko::offload([]() { throw std::runtime_error("offload error"); });
+        } catch (std::exception& e) {
+            LINKO_LOG_INFO(g_logger) << "caught: " << e.what();
+        }
+
+        linko::OffloadPool::Stats s = linko::GetOffloadPool()->getStats();
+        LINKO_LOG_INFO(g_logger) << "threads=" << s.threads << " completed=" << s.completed
+            << " peak_queued=" << s.peak_queued << " avg_wait=" << s.total_wait_us / s.completed
+            << "us max_wait=" << s.max_wait_us << "us avg_run=" << s.total_run_us / s.completed << "us";
+    });
+    return 0;
+}
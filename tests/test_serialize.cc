@@ -0,0 +1,228 @@
+#include "../linko/serialize.h"
+#include "../linko/links.h"
+
+/*
+ * 序列化正确性检查, 以及与手写ByteArray编解码的性能对比
+ * 用法: test_serialize [次数]
+ */
+
+static linko::Logger::ptr g_logger = LINKO_LOG_ROOT();
+
+enum PhoneType {
+    MOBILE = 0,
+    HOME = 1,
+    WORK = 2
+};
+
+struct Phone {
+    std::string number;
+    PhoneType type = MOBILE;
+
+    LINKO_SERIALIZE(
+        LINKO_FIELD(1, number)
+        LINKO_FIELD(2, type)
+    )
+};
+
+struct Person {
+    int32_t id = 0;
+    std::string name;
+    std::string email;
+    uint64_t uid = 0;
+    double score = 0;
+    bool vip = false;
+    std::vector<Phone> phones;
+    std::vector<int32_t> tags;
+    std::map<std::string, int64_t> counters;
+
+    LINKO_SERIALIZE(
+        LINKO_FIELD(1, id)
+        LINKO_FIELD(2, name)
+        LINKO_FIELD(3, email)
+        LINKO_FIELD(4, uid)
+        LINKO_FIELD(5, score)
+        LINKO_FIELD(6, vip)
+        LINKO_FIELD(7, phones)
+        LINKO_FIELD(8, tags)
+        LINKO_FIELD(9, counters)
+    )
+};
+
+// 新版本增加了字段, 旧版本解码时应跳过
+struct PersonV2 {
+    int32_t id = 0;
+    std::string name;
+    std::vector<std::string> aliases;
+    float weight = 0;
+
+    LINKO_SERIALIZE(
+        LINKO_FIELD(1, id)
+        LINKO_FIELD(2, name)
+        LINKO_FIELD(20, aliases)
+        LINKO_FIELD(21, weight)
+    )
+};
+
+bool operator==(const Phone& a, const Phone& b) {
+    return a.number == b.number && a.type == b.type;
+}
+
+bool operator==(const Person& a, const Person& b) {
+    return a.id == b.id && a.name == b.name && a.email == b.email && a.uid == b.uid
+        && a.score == b.score && a.vip == b.vip && a.phones == b.phones
+        && a.tags == b.tags && a.counters == b.counters;
+}
+
+// 手写编解码, 字段顺序两边需要保持一致
+void hand_encode(linko::ByteArray& ba, const Person& p) {
+    ba.writeInt32(p.id);
+    ba.writeStringVint(p.name);
+    ba.writeStringVint(p.email);
+    ba.writeUint64(p.uid);
+    ba.writeDouble(p.score);
+    ba.writeFuint8(p.vip);
+    ba.writeUint32(p.phones.size());
+    for (auto& i : p.phones) {
+        ba.writeStringVint(i.number);
+        ba.writeInt32(i.type);
+    }
+    ba.writeUint32(p.tags.size());
+    for (auto& i : p.tags) {
+        ba.writeInt32(i);
+    }
+    ba.writeUint32(p.counters.size());
+    for (auto& i : p.counters) {
+        ba.writeStringVint(i.first);
+        ba.writeInt64(i.second);
+    }
+}
+
+void hand_decode(linko::ByteArray& ba, Person& p) {
+    p.id = ba.readInt32();
+    p.name = ba.readStringFVint();
+    p.email = ba.readStringFVint();
+    p.uid = ba.readUint64();
+    p.score = ba.readDouble();
+    p.vip = ba.readFuint8();
+    p.phones.resize(ba.readUint32());
+    for (auto& i : p.phones) {
+        i.number = ba.readStringFVint();
+        i.type = (PhoneType)ba.readInt32();
+    }
+    p.tags.resize(ba.readUint32());
+    for (auto& i : p.tags) {
+        i = ba.readInt32();
+    }
+    uint32_t count = ba.readUint32();
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string k = ba.readStringFVint();
+        p.counters[k] = ba.readInt64();
+    }
+}
+
+Person make_person() {
+    Person p;
+    p.id = -12345;
+    p.name = "linko";
+    p.email = "linko@example.com";
+    p.uid = 1ull << 40;
+    p.score = 98.5;
+    p.vip = true;
+    for (int i = 0; i < 3; ++i) {
+        Phone phone;
+        phone.number = "1380000000" + std::to_string(i);
+        phone.type = (PhoneType)(i % 3);
+        p.phones.push_back(phone);
+    }
+    for (int i = 0; i < 20; ++i) {
+        p.tags.push_back(i * 1000 - 5000);
+    }
+    p.counters["login"] = 100;
+    p.counters["logout"] = -3;
+    p.counters["view"] = 1ll << 35;
+    return p;
+}
+
+void test_roundtrip() {
+    Person p = make_person();
+    linko::ByteArray ba;
+    size_t len = linko::Serializer::Encode(ba, p);
+    LINKO_ASSERT(len == ba.getSize());
+    LINKO_ASSERT(len == linko::Serializer::ByteSize(p));
+
+    ba.setPosition(0);
+    Person q;
+    LINKO_ASSERT(linko::Serializer::Decode(ba, q));
+    LINKO_ASSERT(p == q);
+
+    // 旧结构体跳过未知字段
+    PersonV2 v2;
+    v2.id = 7;
+    v2.name = "v2";
+    v2.aliases = {"a", "b"};
+    v2.weight = 60.5;
+    ba.clear();
+    linko::Serializer::Encode(ba, v2);
+    ba.setPosition(0);
+    Person old;
+    LINKO_ASSERT(linko::Serializer::Decode(ba, old));
+    LINKO_ASSERT(old.id == 7 && old.name == "v2");
+
+    // 截断的数据解码失败
+    ba.clear();
+    linko::Serializer::Encode(ba, p);
+    ba.setPosition(0);
+    Person truncated;
+    LINKO_ASSERT(!linko::Serializer::Decode(ba, truncated, len - 3));
+    LINKO_LOG_INFO(g_logger) << "test_roundtrip ok size=" << len;
+}
+
+void bench(int count) {
+    Person p = make_person();
+    linko::ByteArray ba;
+    Person q;
+
+    uint64_t start = linko::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        ba.clear();
+        hand_encode(ba, p);
+    }
+    uint64_t hand_enc = linko::GetCurrentUS() - start;
+    size_t hand_size = ba.getSize();
+
+    start = linko::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        ba.setPosition(0);
+        q = Person();
+        hand_decode(ba, q);
+    }
+    uint64_t hand_dec = linko::GetCurrentUS() - start;
+    LINKO_ASSERT(p == q);
+
+    start = linko::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        ba.clear();
+        linko::Serializer::Encode(ba, p);
+    }
+    uint64_t ser_enc = linko::GetCurrentUS() - start;
+    size_t ser_size = ba.getSize();
+
+    start = linko::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        ba.setPosition(0);
+        q = Person();
+        linko::Serializer::Decode(ba, q);
+    }
+    uint64_t ser_dec = linko::GetCurrentUS() - start;
+    LINKO_ASSERT(p == q);
+
+    LINKO_LOG_INFO(g_logger) << "count=" << count
+        << " hand: size=" << hand_size << " encode=" << hand_enc << "us decode=" << hand_dec << "us"
+        << " serializer: size=" << ser_size << " encode=" << ser_enc << "us decode=" << ser_dec << "us";
+}
+
+int main(int argc, char** argv) {
+    test_roundtrip();
+    bench(argc > 1 ? atoi(argv[1]) : 100000);
+    return 0;
+}
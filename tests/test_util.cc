@@ -8,7 +8,37 @@ void test_assert() {
     LINKO_ASSERT2(0 == 1, "test assert2 xxx");
 }
 
+// 单调时钟与墙上时间的间隔应一致, 并对比读取开销
+void test_clock() {
+    uint64_t wall = linko::GetCurrentUS();
+    uint64_t mono = linko::GetMonotonicUS();
+    usleep(100 * 1000);
+    LINKO_LOG_INFO(g_logger) << "sleep 100ms wall=" << linko::GetCurrentUS() - wall
+        << "us monotonic=" << linko::GetMonotonicUS() - mono << "us";
+
+    const int count = 1000000;
+    uint64_t v = 0;
+    uint64_t start = linko::GetMonotonicUS();
+    for (int i = 0; i < count; ++i) {
+        v += linko::GetCurrentUS();
+    }
+    uint64_t t1 = linko::GetMonotonicUS();
+    for (int i = 0; i < count; ++i) {
+        v += linko::GetMonotonicUS();
+    }
+    uint64_t t2 = linko::GetMonotonicUS();
+    linko::UpdateCachedMonotonicMS();
+    for (int i = 0; i < count; ++i) {
+        v += linko::GetCachedMonotonicMS();
+    }
+    uint64_t t3 = linko::GetMonotonicUS();
+    LINKO_LOG_INFO(g_logger) << "ns/op gettimeofday=" << (t1 - start) * 1000.0 / count
+        << " monotonic=" << (t2 - t1) * 1000.0 / count
+        << " cached=" << (t3 - t2) * 1000.0 / count << " (" << v % 10 << ")";
+}
+
 int main(int argc, char** argv) {
+    test_clock();
     test_assert();
     return 0;
 }
@@ -0,0 +1,157 @@
+/*
+ * 将BinaryLogAppender输出的二进制日志解码为文本
+ * 用法: linko_logcat [-p pattern] file...
+ * 默认使用写入时记录在文件头中的pattern, -p可指定新的输出格式
+ */
+#include "linko/log.h"
+#include "linko/bytearray.h"
+
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <unistd.h>
+
+static void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [-p pattern] file..." << std::endl;
+}
+
+static const std::string& getString(const std::map<uint32_t, std::string>& strings, uint32_t id) {
+    static const std::string s_empty;
+    auto it = strings.find(id);
+    return it == strings.end() ? s_empty : it->second;
+}
+
+static linko::LogArg readArg(linko::ByteArray& ba) {
+    uint8_t type = ba.readFuint8();
+    switch (type) {
+        case linko::LogArg::INT:
+            return linko::LogArg(ba.readInt64());
+        case linko::LogArg::UINT:
+            return linko::LogArg(ba.readUint64());
+        case linko::LogArg::DOUBLE:
+            return linko::LogArg(ba.readDouble());
+        case linko::LogArg::STRING:
+            return linko::LogArg(ba.readStringFVint());
+        default:
+            throw std::logic_error("invalid arg type " + std::to_string(type));
+    }
+}
+
+static bool decode(const std::string& file, const std::string& pattern) {
+    linko::ByteArray ba;
+    if (!ba.readFromFile(file)) {
+        return false;
+    }
+    ba.setPosition(0);
+
+    linko::LogFormatter::ptr formatter;
+    std::map<uint32_t, std::string> strings;
+    std::map<std::string, linko::Logger::ptr> loggers;
+    uint64_t last_time = 0;
+    std::string buf;
+    std::vector<linko::LogArg> args;
+
+    try {
+        while (ba.getReadSize() > 0) {
+            uint8_t type = ba.readFuint8();
+            if (type == linko::BinaryLogAppender::HEADER) {
+                uint32_t magic = ba.readFuint32();
+                uint8_t version = ba.readFuint8();
+                if (magic != linko::BinaryLogAppender::MAGIC
+                        || version != linko::BinaryLogAppender::VERSION) {
+                    std::cerr << file << ": bad header magic=" << std::hex << magic
+                              << std::dec << " version=" << (int)version << std::endl;
+                    return false;
+                }
+                std::string p = ba.readStringFVint();
+                last_time = ba.readUint64();
+                strings.clear();
+                formatter.reset(new linko::LogFormatter(pattern.empty() ? p : pattern));
+                if (formatter->isError()) {
+                    std::cerr << file << ": invalid pattern " << formatter->getPattern() << std::endl;
+                    return false;
+                }
+            } else if (type == linko::BinaryLogAppender::STRING) {
+                uint32_t id = ba.readUint32();
+                strings[id] = ba.readStringFVint();
+            } else if (type == linko::BinaryLogAppender::EVENT) {
+                if (!formatter) {
+                    std::cerr << file << ": event before header" << std::endl;
+                    return false;
+                }
+                uint32_t fmt_id = ba.readUint32();
+                uint32_t file_id = ba.readUint32();
+                int32_t line = ba.readInt32();
+                linko::LogLevel::Level level = (linko::LogLevel::Level)ba.readFuint8();
+                last_time += ba.readInt64();
+                uint32_t thread_id = ba.readUint32();
+                uint32_t fiber_id = ba.readUint32();
+                uint32_t elapse = ba.readUint32();
+                const std::string& logger_name = getString(strings, ba.readUint32());
+                const std::string& thread_name = getString(strings, ba.readUint32());
+                std::string request_id = ba.readStringFVint();
+                uint32_t argc = ba.readUint32();
+                args.clear();
+                for (uint32_t i = 0; i < argc; ++i) {
+                    args.push_back(readArg(ba));
+                }
+
+                linko::Logger::ptr& logger = loggers[logger_name];
+                if (!logger) {
+                    logger.reset(new linko::Logger(logger_name));
+                }
+                linko::LogEvent::ptr event(new linko::LogEvent(logger, level
+                            , getString(strings, file_id).c_str(), line, elapse
+                            , thread_id, fiber_id, last_time, thread_name));
+                if (!request_id.empty()) {
+                    event->setRequestId(std::make_shared<const std::string>(std::move(request_id)));
+                }
+                buf.clear();
+                linko::LogEvent::FormatArgs(buf, getString(strings, fmt_id).c_str(), args);
+                event->getSS() << buf;
+
+                buf.clear();
+                formatter->format(buf, logger, level, event);
+                std::cout.write(buf.data(), buf.size());
+            } else {
+                std::cerr << file << ": invalid record type " << (int)type
+                          << " at offset " << ba.getPosition() - 1 << std::endl;
+                return false;
+            }
+        }
+    } catch (std::out_of_range& e) {
+        // 进程崩溃时最后一条记录可能只写了一半
+        std::cerr << file << ": truncated record at end of file" << std::endl;
+    } catch (std::logic_error& e) {
+        std::cerr << file << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string pattern;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                pattern = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int rt = 0;
+    for (int i = optind; i < argc; ++i) {
+        if (!decode(argv[i], pattern)) {
+            rt = 1;
+        }
+    }
+    return rt;
+}